@@ -0,0 +1,39 @@
+cls
+
+del VkBenchmarks.exe VkBenchmarksBlocking.exe LogBlockingUploads.txt LogBatchedUploads.txt *.spv
+
+glslangValidator.exe -V -H -o Shader.vert.spv Shader.vert
+
+glslangValidator.exe -V -H -o Shader.frag.spv Shader.frag
+
+glslangValidator.exe -V -H -o Shader.tesc.spv Shader.tesc
+
+glslangValidator.exe -V -H -o Shader.tese.spv Shader.tese
+
+glslangValidator.exe -V -H -DCLIPMAP_FILL_HEIGHT -o ShaderHeight.comp.spv Shader.comp
+
+glslangValidator.exe -V -H -DCLIPMAP_FILL_HEIGHT16 -o ShaderHeight16.comp.spv Shader.comp
+
+glslangValidator.exe -V -H -o ShaderColor.comp.spv Shader.comp
+
+cl /I"C:\VulkanSDK\Anjaneya\Include" /c /Zi /EHsc /O2 ClipmapBenchmarks.cpp /Fo"ClipmapBenchmarks.obj"
+
+cl /I"C:\VulkanSDK\Anjaneya\Include" /c /Zi /EHsc /O2 /DCLIPMAP_BLOCKING_UPLOADS=1 ClipmapBenchmarks.cpp /Fo"ClipmapBenchmarksBlocking.obj"
+
+rc.exe Vk.rc
+
+link ClipmapBenchmarks.obj Vk.res /LIBPATH:"C:\VulkanSDK\Anjaneya\Lib" vulkan-1.lib gdi32.lib user32.lib kernel32.lib /OUT:VkBenchmarks.exe /DEBUG
+
+link ClipmapBenchmarksBlocking.obj Vk.res /LIBPATH:"C:\VulkanSDK\Anjaneya\Lib" vulkan-1.lib gdi32.lib user32.lib kernel32.lib /OUT:VkBenchmarksBlocking.exe /DEBUG
+
+del ClipmapBenchmarks.obj ClipmapBenchmarksBlocking.obj Vk.res
+
+rem Both runs log the per-frame upload stall; compare the "upload stall" lines.
+
+VkBenchmarksBlocking.exe
+
+move /Y Log.txt LogBlockingUploads.txt
+
+VkBenchmarks.exe
+
+move /Y Log.txt LogBatchedUploads.txt
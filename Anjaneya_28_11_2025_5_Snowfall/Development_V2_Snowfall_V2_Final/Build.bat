@@ -10,6 +10,12 @@ glslangValidator.exe -V -H -o Shader.tesc.spv Shader.tesc
 
 glslangValidator.exe -V -H -o Shader.tese.spv Shader.tese
 
+glslangValidator.exe -V -H -DCLIPMAP_FILL_HEIGHT -o ShaderHeight.comp.spv Shader.comp
+
+glslangValidator.exe -V -H -DCLIPMAP_FILL_HEIGHT16 -o ShaderHeight16.comp.spv Shader.comp
+
+glslangValidator.exe -V -H -o ShaderColor.comp.spv Shader.comp
+
 cl /I"C:\VulkanSDK\Anjaneya\Include" /c /Zi /EHsc Vk.cpp /Fo"Vk.obj"
 
 rc.exe Vk.rc
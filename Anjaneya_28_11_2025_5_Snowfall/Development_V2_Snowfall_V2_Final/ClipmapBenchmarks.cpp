@@ -0,0 +1,1096 @@
+// Clipmap streaming micro-benchmarks and per-frame timing logs. This file is
+// its own translation unit: it builds the whole renderer with
+// CLIPMAP_BENCHMARKS set, so the benchmarks reach the renderer's internal
+// functions, and Benchmark.bat links it into VkBenchmarks.exe. Vk.exe is built
+// from VK.cpp alone and carries none of this.
+//
+// The load-time benchmarks log to Log.txt once the attribute sources are in
+// memory; the frame statistics are logged every gClipmapFrameStatsInterval
+// frames while the renderer runs.
+
+#define CLIPMAP_BENCHMARKS 1
+#include "VK.cpp"
+
+// Pages in two bands of five mip 0 tile rows of a mapped terrain, one tile at a
+// time on this thread and then through the tile reader, and logs tiles per
+// second and the latency of each tile from the start of its band. Every band is
+// requested at once, like the level jobs of one camera step. It runs before any
+// other benchmark loads tiles, so this process has not touched either band yet;
+// the page cache is still only cold if the file is not on the standby list
+// (after a reboot, or for a file larger than RAM).
+static void RunTileReaderBenchmark(void)
+{
+        if(gClipmapTerrainFile.view == NULL)
+        {
+                return;
+        }
+
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+        const double ticksPerMicrosecond = (double)frequency.QuadPart / 1.0e6;
+
+        const uint32_t bandRows = 5u;
+        const uint32_t tileCountX = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].mipImages[0].width / gClipmapTileSize;
+        const uint32_t tileCountY = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].mipImages[0].height / gClipmapTileSize;
+        if(tileCountY < bandRows * 4u)
+        {
+                return;
+        }
+
+        for(uint32_t useReader = 0; useReader < 2u; useReader++)
+        {
+                uint32_t firstRow = tileCountY / 2u + useReader * (tileCountY / 4u);
+                if(useReader != 0u)
+                {
+                        InitializeClipmapTileReader();
+                        if(!IsClipmapTileReaderRunning())
+                        {
+                                ShutdownClipmapTileReader();
+                                break;
+                        }
+                }
+
+                uint64_t histogram[gClipmapTileReadLatencyBuckets];
+                memset((void*)histogram, 0, sizeof(histogram));
+                uint64_t tileCount = 0;
+                volatile LONG remaining = 0;
+                ClipmapVector<ClipmapTileRead> reads;
+
+                QueryPerformanceCounter(&start);
+                // One batch per 5x5 window along the band, as a level job would ask.
+                for(uint32_t windowX = 0; windowX < tileCountX; windowX += bandRows)
+                {
+                        ClipmapTileKeyVector window;
+                        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                        {
+                                for(uint32_t row = 0; row < bandRows; row++)
+                                {
+                                        for(uint32_t column = 0; column < bandRows && windowX + column < tileCountX; column++)
+                                        {
+                                                ClipmapTileKey key = { (ClipmapAttributeType)attributeIndex, 0u, windowX + column, firstRow + row };
+                                                window.push_back(key);
+                                        }
+                                }
+                        }
+                        tileCount += window.size();
+
+                        if(useReader != 0u)
+                        {
+                                BuildClipmapTileReads(window, &remaining, reads);
+                                continue;
+                        }
+
+                        for(const ClipmapTileKey& key : window)
+                        {
+                                const ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
+                                ReadClipmapTileRange(GetMappedTilePayload(source, 0u, key.tileX, key.tileY), GetTileStorageBytes(source));
+
+                                LARGE_INTEGER now;
+                                QueryPerformanceCounter(&now);
+                                RecordClipmapTileReadLatency(histogram, (double)(now.QuadPart - start.QuadPart) / ticksPerMicrosecond, 1u);
+                        }
+                }
+
+                uint64_t readCount = tileCount;
+                if(useReader != 0u)
+                {
+                        for(ClipmapTileRead& read : reads)
+                        {
+                                read.submitTicks = start.QuadPart;
+                        }
+                        readCount = reads.size();
+                        InterlockedExchange(&remaining, (LONG)reads.size());
+                        QueueClipmapTileReads(reads, false);
+                        while(InterlockedCompareExchange(&remaining, 0, 0) != 0)
+                        {
+                                Sleep(0);
+                        }
+                        memcpy(histogram, gClipmapTileReader.latencyHistogram, sizeof(histogram));
+                        ShutdownClipmapTileReader();
+                }
+                QueryPerformanceCounter(&end);
+
+                double seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+                fprintf(gFILE, "RunTileReaderBenchmark(): %s: %llu tiles in %llu reads, %.0f tiles/s, latency p50 <= %.0f us, p99 <= %.0f us\n",
+                        (useReader != 0u) ? "tile reader" : "inline",
+                        (unsigned long long)tileCount,
+                        (unsigned long long)readCount,
+                        (seconds > 0.0) ? (double)tileCount / seconds : 0.0,
+                        GetClipmapTileReadLatencyPercentile(histogram, 0.5),
+                        GetClipmapTileReadLatencyPercentile(histogram, 0.99));
+        }
+}
+
+// Reference implementation of the slot scan the hash index replaced; only kept
+// so the benchmark below can compare against it.
+static ClipmapTileCacheEntry* FindTileCacheEntryLinear(ClipmapAttributeSource& source, uint64_t key)
+{
+        for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
+        {
+                if(source.tileCache[i].occupied && source.tileCache[i].key == key)
+                {
+                        return &source.tileCache[i];
+                }
+        }
+        return NULL;
+}
+
+static void RunTileCacheBenchmark(void)
+{
+        ClipmapAttributeSource* scratch = (ClipmapAttributeSource*)calloc(1, sizeof(ClipmapAttributeSource));
+        if(scratch == NULL)
+        {
+                ClipmapAbortOnAllocationFailure();
+                return;
+        }
+
+        ClearClipmapTileCache(*scratch);
+
+        ClipmapVector<uint64_t> keys;
+        keys.reserve(gClipmapMaxResidentTiles * 2u);
+        for(uint32_t i = 0; i < (uint32_t)(gClipmapMaxResidentTiles * 2u); i++)
+        {
+                ClipmapTileKey key;
+                key.attribute = CLIPMAP_ATTRIBUTE_HEIGHT;
+                key.mipLevel = 0u;
+                key.tileX = (i * 7u) & 63u;
+                key.tileY = i >> 3;
+                keys.push_back(PackTileKey(key));
+        }
+
+        // Fill the cache with the first half of the keys; the second half are misses.
+        for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
+        {
+                AllocateTileCacheEntry(*scratch, keys[i]);
+        }
+
+        const uint32_t lookupCount = 200000u;
+        uint32_t lcg = 12345u;
+        size_t linearHits = 0;
+        size_t hashedHits = 0;
+
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+
+        QueryPerformanceCounter(&start);
+        for(uint32_t i = 0; i < lookupCount; i++)
+        {
+                lcg = lcg * 1664525u + 1013904223u;
+                if(FindTileCacheEntryLinear(*scratch, keys[(lcg >> 8) % keys.size()]) != NULL)
+                {
+                        linearHits++;
+                }
+        }
+        QueryPerformanceCounter(&end);
+        double linearSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+        lcg = 12345u;
+        QueryPerformanceCounter(&start);
+        for(uint32_t i = 0; i < lookupCount; i++)
+        {
+                lcg = lcg * 1664525u + 1013904223u;
+                if(FindTileCacheEntry(*scratch, keys[(lcg >> 8) % keys.size()]) != NULL)
+                {
+                        hashedHits++;
+                }
+        }
+        QueryPerformanceCounter(&end);
+        double hashedSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+        // Touch random resident tiles to time LRU upkeep.
+        lcg = 12345u;
+        QueryPerformanceCounter(&start);
+        for(uint32_t i = 0; i < lookupCount; i++)
+        {
+                lcg = lcg * 1664525u + 1013904223u;
+                ClipmapTileCacheEntry* entry = &scratch->tileCache[(lcg >> 8) % gClipmapMaxResidentTiles];
+                TouchTileEntry(*scratch, entry);
+        }
+        QueryPerformanceCounter(&end);
+        double touchSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+        // Evict and re-insert every resident tile to time the remove/allocate path.
+        QueryPerformanceCounter(&start);
+        for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
+        {
+                RemoveTileCacheEntry(*scratch, keys[i]);
+                AllocateTileCacheEntry(*scratch, keys[i + gClipmapMaxResidentTiles]);
+        }
+        QueryPerformanceCounter(&end);
+        double churnSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+        fprintf(gFILE, "RunTileCacheBenchmark(): %u lookups over %zu tiles: linear %.1f ns/lookup (%zu hits), hashed %.1f ns/lookup (%zu hits), LRU touch %.1f ns, evict+insert %.1f ns/tile\n",
+                lookupCount,
+                gClipmapMaxResidentTiles,
+                linearSeconds * 1.0e9 / (double)lookupCount,
+                linearHits,
+                hashedSeconds * 1.0e9 / (double)lookupCount,
+                hashedHits,
+                touchSeconds * 1.0e9 / (double)lookupCount,
+                churnSeconds * 1.0e9 / (double)gClipmapMaxResidentTiles);
+
+        ClearClipmapTileCache(*scratch);
+        free(scratch);
+}
+
+// Copies every base-mip tile of each attribute, offset by half a tile so rows
+// straddle the wrap seam, and logs throughput for the previous per-texel copy
+// and the row-span copy.
+static void RunTileLoadBenchmark(void)
+{
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                const ImageData& image = source.mipImages[0];
+                if(image.pixels == NULL)
+                {
+                        continue;
+                }
+
+                uint32_t tileSize = source.tileSize;
+                uint32_t bytesPerTexel = source.bytesPerTexel;
+                uint32_t tileCountX = image.width / tileSize;
+                uint32_t tileCountY = image.height / tileSize;
+                size_t tileBytes = (size_t)tileSize * (size_t)tileSize * (size_t)bytesPerTexel;
+                uint8_t* scratch = (uint8_t*)malloc(tileBytes);
+                if(scratch == NULL)
+                {
+                        ClipmapAbortOnAllocationFailure();
+                        return;
+                }
+
+                const uint32_t passes = 4u;
+                uint32_t halfTile = tileSize / 2u;
+
+                QueryPerformanceCounter(&start);
+                for(uint32_t pass = 0; pass < passes; pass++)
+                {
+                        for(uint32_t tileY = 0; tileY < tileCountY; tileY++)
+                        {
+                                for(uint32_t tileX = 0; tileX < tileCountX; tileX++)
+                                {
+                                        for(uint32_t localY = 0; localY < tileSize; localY++)
+                                        {
+                                                uint32_t srcY = WrapCoordForTile((int)(tileY * tileSize + localY + halfTile), image.height);
+                                                for(uint32_t localX = 0; localX < tileSize; localX++)
+                                                {
+                                                        uint32_t srcX = WrapCoordForTile((int)(tileX * tileSize + localX + halfTile), image.width);
+                                                        size_t dstIndex = ((size_t)localY * (size_t)tileSize + (size_t)localX) * (size_t)bytesPerTexel;
+                                                        size_t srcIndex = ((size_t)srcY * (size_t)image.width + (size_t)srcX) * (size_t)bytesPerTexel;
+                                                        memcpy(scratch + dstIndex, image.pixels + srcIndex, bytesPerTexel);
+                                                }
+                                        }
+                                }
+                        }
+                }
+                QueryPerformanceCounter(&end);
+                double perTexelSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+                QueryPerformanceCounter(&start);
+                for(uint32_t pass = 0; pass < passes; pass++)
+                {
+                        for(uint32_t tileY = 0; tileY < tileCountY; tileY++)
+                        {
+                                for(uint32_t tileX = 0; tileX < tileCountX; tileX++)
+                                {
+                                        CopyTileFromImage(image, bytesPerTexel, tileSize, (int)(tileX * tileSize + halfTile), (int)(tileY * tileSize + halfTile), scratch);
+                                }
+                        }
+                }
+                QueryPerformanceCounter(&end);
+                double spanSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+                double megabytes = (double)tileBytes * (double)tileCountX * (double)tileCountY * (double)passes / (1024.0 * 1024.0);
+                fprintf(gFILE, "RunTileLoadBenchmark(): %s per-texel %.1f MB/s, row spans %.1f MB/s\n",
+                        gClipmapAttributeSpecs[attributeIndex].debugName,
+                        megabytes / perTexelSeconds,
+                        megabytes / spanSeconds);
+
+                free(scratch);
+        }
+}
+
+// Compresses and decodes every base-mip tile of each attribute, checks the round
+// trip is lossless and logs the ratio, throughput and how many tiles the default
+// budget holds raw and compressed.
+static void RunTileCompressionBenchmark(void)
+{
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                const ImageData& image = source.mipImages[0];
+                if(image.pixels == NULL || source.tileSize > gClipmapTileSize)
+                {
+                        continue;
+                }
+
+                uint32_t tileSize = source.tileSize;
+                uint32_t tileCountX = image.width / tileSize;
+                uint32_t tileCountY = image.height / tileSize;
+                size_t tileBytes = GetTileRawBytes(source);
+                uint32_t channelCount, channelBits;
+                GetClipmapTileChannelLayout(source, &channelCount, &channelBits);
+
+                uint8_t* texels = (uint8_t*)malloc(tileBytes);
+                uint8_t* decoded = (uint8_t*)malloc(tileBytes);
+                uint8_t* stream = (uint8_t*)malloc(gClipmapTileMaxStreamBytes);
+                if(texels == NULL || decoded == NULL || stream == NULL)
+                {
+                        ClipmapAbortOnAllocationFailure();
+                        return;
+                }
+
+                int64_t encodeTicks = 0;
+                int64_t decodeTicks = 0;
+                uint64_t streamBytesTotal = 0;
+                uint64_t chunkBytesTotal = 0;
+                uint32_t rawTiles = 0u;
+                uint32_t mismatches = 0u;
+                for(uint32_t tileY = 0; tileY < tileCountY; tileY++)
+                {
+                        for(uint32_t tileX = 0; tileX < tileCountX; tileX++)
+                        {
+                                CopyTileFromImage(image, source.bytesPerTexel, tileSize, (int)(tileX * tileSize), (int)(tileY * tileSize), texels);
+
+                                QueryPerformanceCounter(&start);
+                                size_t streamBytes = EncodeClipmapTile(texels, tileSize, channelCount, channelBits, stream, gClipmapTileMaxStreamBytes);
+                                QueryPerformanceCounter(&end);
+                                encodeTicks += end.QuadPart - start.QuadPart;
+
+                                QueryPerformanceCounter(&start);
+                                bool decodedOk = DecodeClipmapTile(stream, streamBytes, tileSize, channelCount, channelBits, decoded);
+                                QueryPerformanceCounter(&end);
+                                decodeTicks += end.QuadPart - start.QuadPart;
+
+                                if(!decodedOk || memcmp(texels, decoded, tileBytes) != 0)
+                                {
+                                        mismatches++;
+                                }
+                                rawTiles += (stream[0] == CLIPMAP_TILE_CODEC_RAW) ? 1u : 0u;
+                                streamBytesTotal += streamBytes;
+                                chunkBytesTotal += ((streamBytes + gClipmapTileChunkBytes - 1u) / gClipmapTileChunkBytes) * gClipmapTileChunkBytes;
+                        }
+                }
+
+                uint32_t tileCount = tileCountX * tileCountY;
+                double megabytes = (double)tileBytes * (double)tileCount / (1024.0 * 1024.0);
+                double chunkBytesPerTile = (double)chunkBytesTotal / (double)tileCount;
+                fprintf(gFILE, "RunTileCompressionBenchmark(): %s %u tiles %.2f:1 (%u stored raw), encode %.1f MB/s, decode %.1f MB/s, %u mismatches\n",
+                        gClipmapAttributeSpecs[attributeIndex].debugName,
+                        tileCount,
+                        (double)tileBytes * (double)tileCount / (double)streamBytesTotal,
+                        rawTiles,
+                        megabytes * (double)frequency.QuadPart / (double)CLIPMAP_MAX(encodeTicks, (int64_t)1),
+                        megabytes * (double)frequency.QuadPart / (double)CLIPMAP_MAX(decodeTicks, (int64_t)1),
+                        mismatches);
+                fprintf(gFILE, "RunTileCompressionBenchmark(): %s %.0f MB holds %zu tiles raw, %.0f compressed\n",
+                        gClipmapAttributeSpecs[attributeIndex].debugName,
+                        (double)gClipmapDefaultTileCacheBudgetBytes / (1024.0 * 1024.0),
+                        gClipmapDefaultTileCacheBudgetBytes / tileBytes,
+                        (double)gClipmapDefaultTileCacheBudgetBytes / chunkBytesPerTile);
+
+                free(stream);
+                free(decoded);
+                free(texels);
+        }
+}
+
+struct ClipmapTileHashEntry
+{
+        uint64_t hash;
+        uint32_t tile;
+};
+
+static int CompareClipmapTileHashes(const void* a, const void* b)
+{
+        uint64_t hashA = ((const ClipmapTileHashEntry*)a)->hash;
+        uint64_t hashB = ((const ClipmapTileHashEntry*)b)->hash;
+        return (hashA < hashB) ? -1 : ((hashA > hashB) ? 1 : 0);
+}
+
+// Cuts a few sample heightfields into tiles and logs how many are uniform or
+// duplicates, the effective compression that gives and how many tiles the
+// default budget then reaches: the procedural terrain, the same with a flat sea,
+// terraced with a flat sea, and a terrain that repeats every four tiles.
+static void RunTileDedupBenchmark(void)
+{
+        const uint32_t size = 1024u;
+        const uint32_t tileSize = gClipmapTileSize;
+        const uint32_t tileCountX = size / tileSize;
+        const uint32_t tileCount = tileCountX * tileCountX;
+        const size_t tileTexels = (size_t)tileSize * (size_t)tileSize;
+        const size_t tileBytes = tileTexels * sizeof(float);
+        const float seaLevel = 0.75f;
+        const char* fieldNames[] = { "rolling", "coastal", "terraced", "repeating" };
+
+        float* tiles = (float*)malloc((size_t)tileCount * tileBytes);
+        ClipmapTileHashEntry* hashes = (ClipmapTileHashEntry*)malloc((size_t)tileCount * sizeof(ClipmapTileHashEntry));
+        if(tiles == NULL || hashes == NULL)
+        {
+                ClipmapAbortOnAllocationFailure();
+                return;
+        }
+
+        for(uint32_t fieldIndex = 0; fieldIndex < sizeof(fieldNames) / sizeof(fieldNames[0]); fieldIndex++)
+        {
+                for(uint32_t y = 0; y < size; y++)
+                {
+                        for(uint32_t x = 0; x < size; x++)
+                        {
+                                float heightValue = (fieldIndex == 3u) ? ProceduralTerrainHeight(x % (tileSize * 4u), y % (tileSize * 4u)) : ProceduralTerrainHeight(x, y);
+                                if(fieldIndex == 1u)
+                                {
+                                        heightValue = CLIPMAP_MAX(heightValue, seaLevel);
+                                }
+                                else if(fieldIndex == 2u)
+                                {
+                                        heightValue = CLIPMAP_MAX(floorf(heightValue * 4.0f) / 4.0f, seaLevel);
+                                }
+                                uint32_t tile = (y / tileSize) * tileCountX + x / tileSize;
+                                tiles[(size_t)tile * tileTexels + (size_t)(y % tileSize) * tileSize + x % tileSize] = heightValue;
+                        }
+                }
+
+                uint32_t uniformTiles = 0u;
+                uint32_t hashedTiles = 0u;
+                for(uint32_t tile = 0; tile < tileCount; tile++)
+                {
+                        const uint8_t* texels = (const uint8_t*)(tiles + (size_t)tile * tileTexels);
+                        if(IsUniformTile(texels, tileTexels, sizeof(float)))
+                        {
+                                uniformTiles++;
+                                continue;
+                        }
+                        hashes[hashedTiles].hash = HashClipmapTileBytes(texels, tileBytes, 0xCBF29CE484222325ull);
+                        hashes[hashedTiles].tile = tile;
+                        hashedTiles++;
+                }
+                qsort(hashes, hashedTiles, sizeof(ClipmapTileHashEntry), CompareClipmapTileHashes);
+
+                // A tile is a duplicate when an earlier tile with the same hash holds the same bytes.
+                uint32_t duplicateTiles = 0u;
+                for(uint32_t i = 0; i < hashedTiles; i++)
+                {
+                        for(uint32_t j = i; j > 0u && hashes[j - 1u].hash == hashes[i].hash; j--)
+                        {
+                                if(memcmp(tiles + (size_t)hashes[i].tile * tileTexels, tiles + (size_t)hashes[j - 1u].tile * tileTexels, tileBytes) == 0)
+                                {
+                                        duplicateTiles++;
+                                        break;
+                                }
+                        }
+                }
+
+                uint32_t storedTiles = hashedTiles - duplicateTiles;
+                double storedBytes = (double)storedTiles * (double)tileBytes + (double)uniformTiles * sizeof(float);
+                double ratio = (double)tileCount * (double)tileBytes / CLIPMAP_MAX(storedBytes, 1.0);
+                fprintf(gFILE, "RunTileDedupBenchmark(): %s %u tiles, %u uniform, %u duplicates, %.2f:1, %.0f MB reaches %zu tiles raw, %.0f deduplicated (slot limit %zu)\n",
+                        fieldNames[fieldIndex],
+                        tileCount,
+                        uniformTiles,
+                        duplicateTiles,
+                        ratio,
+                        (double)gClipmapDefaultTileCacheBudgetBytes / (1024.0 * 1024.0),
+                        gClipmapDefaultTileCacheBudgetBytes / tileBytes,
+                        (double)(gClipmapDefaultTileCacheBudgetBytes / tileBytes) * ratio,
+                        gClipmapMaxResidentTiles);
+        }
+
+        free(hashes);
+        free(tiles);
+}
+
+// Quantizes the procedural heightfield to 16-bit unorm and logs the largest
+// height error in world units, at the base mip and after one box filter step.
+// Then cuts every tile out of the float and the 16-bit image and compresses it,
+// the per-tile work of a cache miss, and logs the bytes and tiles per second of
+// the copy alone (tiles kept raw) and of the copy and compression.
+static void RunHeightQuantizationBenchmark(void)
+{
+        const uint32_t size = 1024u;
+        const uint32_t tileSize = gClipmapTileSize;
+        const uint32_t tileCountX = size / tileSize;
+        const size_t texelCount = (size_t)size * (size_t)size;
+
+        float* heights = (float*)malloc(texelCount * sizeof(float));
+        uint16_t* quantized = (uint16_t*)malloc(texelCount * sizeof(uint16_t));
+        uint8_t* texels = (uint8_t*)malloc(gClipmapTileMaxRawBytes);
+        uint8_t* stream = (uint8_t*)malloc(gClipmapTileMaxStreamBytes);
+        if(heights == NULL || quantized == NULL || texels == NULL || stream == NULL)
+        {
+                ClipmapAbortOnAllocationFailure();
+                return;
+        }
+
+        float low = ProceduralTerrainHeight(0u, 0u);
+        float high = low;
+        for(uint32_t y = 0; y < size; y++)
+        {
+                for(uint32_t x = 0; x < size; x++)
+                {
+                        float heightValue = ProceduralTerrainHeight(x, y);
+                        heights[(size_t)y * size + x] = heightValue;
+                        low = CLIPMAP_MIN(low, heightValue);
+                        high = CLIPMAP_MAX(high, heightValue);
+                }
+        }
+
+        const float scale = high - low;
+        const float step = scale / gClipmapHeight16Max;
+        float maxError = 0.0f;
+        for(size_t texel = 0; texel < texelCount; texel++)
+        {
+                quantized[texel] = QuantizeClipmapHeight(heights[texel], scale, low);
+                maxError = CLIPMAP_MAX(maxError, fabsf((float)quantized[texel] * step + low - heights[texel]));
+        }
+
+        float maxMipError = 0.0f;
+        for(uint32_t y = 0; y < size; y += 2u)
+        {
+                for(uint32_t x = 0; x < size; x += 2u)
+                {
+                        size_t t00 = (size_t)y * size + x;
+                        size_t t01 = t00 + size;
+                        float average = 0.25f * (heights[t00] + heights[t00 + 1u] + heights[t01] + heights[t01 + 1u]);
+                        uint32_t unormAverage = ((uint32_t)quantized[t00] + quantized[t00 + 1u] + quantized[t01] + quantized[t01 + 1u] + 2u) / 4u;
+                        maxMipError = CLIPMAP_MAX(maxMipError, fabsf((float)unormAverage * step + low - average));
+                }
+        }
+
+        fprintf(gFILE, "RunHeightQuantizationBenchmark(): range [%.4f, %.4f], step %.5f world units, max error %.5f (mip 0), %.5f (mip 1)\n",
+                low * gTerrainHeightScale,
+                high * gTerrainHeightScale,
+                step * gTerrainHeightScale,
+                maxError * gTerrainHeightScale,
+                maxMipError * gTerrainHeightScale);
+
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+
+        const char* formatNames[] = { "R32_SFLOAT", "R16_UNORM" };
+        const uint32_t tileCount = tileCountX * tileCountX;
+        const uint32_t passes = 8u;
+        double copyTilesPerSecond[2];
+        double tilesPerSecond[2];
+        double storedBytes[2];
+        for(uint32_t formatIndex = 0; formatIndex < 2u; formatIndex++)
+        {
+                uint32_t bytesPerTexel = (formatIndex == 0u) ? (uint32_t)sizeof(float) : (uint32_t)sizeof(uint16_t);
+                ImageData image;
+                image.width = size;
+                image.height = size;
+                image.size = (VkDeviceSize)(texelCount * bytesPerTexel);
+                image.pixels = (formatIndex == 0u) ? (uint8_t*)heights : (uint8_t*)quantized;
+
+                int64_t copyTicks = 0;
+                int64_t encodeTicks = 0;
+                uint64_t streamBytesTotal = 0u;
+                for(uint32_t pass = 0; pass < passes * tileCount; pass++)
+                {
+                        uint32_t tile = pass % tileCount;
+                        QueryPerformanceCounter(&start);
+                        CopyTileFromImage(image, bytesPerTexel, tileSize, (int)((tile % tileCountX) * tileSize), (int)((tile / tileCountX) * tileSize), texels);
+                        QueryPerformanceCounter(&end);
+                        copyTicks += end.QuadPart - start.QuadPart;
+
+                        QueryPerformanceCounter(&start);
+                        streamBytesTotal += EncodeClipmapTile(texels, tileSize, 1u, bytesPerTexel * 8u, stream, gClipmapTileMaxStreamBytes);
+                        QueryPerformanceCounter(&end);
+                        encodeTicks += end.QuadPart - start.QuadPart;
+                }
+
+                copyTilesPerSecond[formatIndex] = (double)(passes * tileCount) * (double)frequency.QuadPart / (double)CLIPMAP_MAX(copyTicks, (int64_t)1);
+                tilesPerSecond[formatIndex] = (double)(passes * tileCount) * (double)frequency.QuadPart / (double)CLIPMAP_MAX(copyTicks + encodeTicks, (int64_t)1);
+                storedBytes[formatIndex] = (double)streamBytesTotal / (double)passes;
+                fprintf(gFILE, "RunHeightQuantizationBenchmark(): %s %u tiles, %.1f KB raw, %.1f KB compressed per tile, %.0f tiles/s copied, %.0f copied and compressed\n",
+                        formatNames[formatIndex],
+                        tileCount,
+                        (double)tileSize * (double)tileSize * (double)bytesPerTexel / 1024.0,
+                        storedBytes[formatIndex] / (double)tileCount / 1024.0,
+                        copyTilesPerSecond[formatIndex],
+                        tilesPerSecond[formatIndex]);
+        }
+
+        fprintf(gFILE, "RunHeightQuantizationBenchmark(): R16_UNORM gives %.2fx the tiles/s copied, %.2fx copied and compressed, %.2f:1 smaller raw and %.2f:1 smaller compressed\n",
+                copyTilesPerSecond[1] / copyTilesPerSecond[0],
+                tilesPerSecond[1] / tilesPerSecond[0],
+                (double)sizeof(float) / (double)sizeof(uint16_t),
+                storedBytes[0] / CLIPMAP_MAX(storedBytes[1], 1.0));
+
+        free(stream);
+        free(texels);
+        free(quantized);
+        free(heights);
+}
+
+// Previous enumeration: walks every covered tile coordinate and dedups the
+// wrapped keys with a linear search. Tiles are addressed in the same source mip
+// as CollectVisibleTilesForLevel() so the two sets can be compared. Kept only
+// for RunVisibleTileBenchmark().
+static void CollectVisibleTilesForLevelReference(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileKeyVector (&outTiles)[CLIPMAP_ATTRIBUTE_COUNT])
+{
+	for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+	{
+		outTiles[attributeIndex].clear();
+	}
+
+        // The level's image holds gClipmapTextureSize samples, one past the last grid vertex.
+        int sampleSpacing = 1 << levelIndex;
+        int coverageSamples = (int)gClipmapTextureSize * sampleSpacing;
+        int startX = originSamples.x;
+        int startY = originSamples.y;
+        int endX = startX + coverageSamples;
+        int endY = startY + coverageSamples;
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                if(source.width == 0 || source.height == 0)
+                {
+                        continue;
+                }
+
+                uint32_t mipLevel = GetClipmapSourceMipForLevel(source, levelIndex);
+                const ImageData& image = source.mipImages[mipLevel];
+                uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
+                uint32_t tileCountX = (image.width + tileSize - 1u) / tileSize;
+                uint32_t tileCountY = (image.height + tileSize - 1u) / tileSize;
+                float mipTileSize = (float)((1 << mipLevel) * (int)tileSize);
+
+                int minTileX = (int)floorf((float)startX / mipTileSize);
+                int maxTileX = (int)floorf((float)(endX - 1) / mipTileSize);
+                int minTileY = (int)floorf((float)startY / mipTileSize);
+                int maxTileY = (int)floorf((float)(endY - 1) / mipTileSize);
+
+		ClipmapVector<uint64_t> seen;
+                for(int tileY = minTileY; tileY <= maxTileY; tileY++)
+                {
+                        for(int tileX = minTileX; tileX <= maxTileX; tileX++)
+                        {
+                                ClipmapTileKey key;
+                                key.attribute = (ClipmapAttributeType)attributeIndex;
+                                key.mipLevel = mipLevel;
+                                key.tileX = WrapCoordForTile(tileX, tileCountX);
+                                key.tileY = WrapCoordForTile(tileY, tileCountY);
+
+				uint64_t packed = PackTileKey(key);
+				bool alreadySeen = false;
+				for(const uint64_t value : seen)
+				{
+					if(value == packed)
+					{
+						alreadySeen = true;
+						break;
+					}
+				}
+
+				if(!alreadySeen)
+				{
+					seen.push_back(packed);
+					outTiles[attributeIndex].push_back(key);
+				}
+                        }
+                }
+        }
+}
+
+static int CompareClipmapPackedTileKeys(const void* a, const void* b)
+{
+        uint64_t keyA = *(const uint64_t*)a;
+        uint64_t keyB = *(const uint64_t*)b;
+        return (keyA < keyB) ? -1 : ((keyA > keyB) ? 1 : 0);
+}
+
+// True when both enumerations produced the same tiles, in any order.
+static bool AreClipmapTileSetsEqual(const ClipmapTileKeyVector& a, const ClipmapTileKeyVector& b)
+{
+        if(a.size() != b.size())
+        {
+                return false;
+        }
+
+        ClipmapVector<uint64_t> keysA;
+        ClipmapVector<uint64_t> keysB;
+        if(!keysA.reserve(a.size()) || !keysB.reserve(b.size()))
+        {
+                ClipmapAbortOnAllocationFailure();
+        }
+        for(size_t index = 0; index < a.size(); index++)
+        {
+                keysA.push_back(PackTileKey(a[index]));
+                keysB.push_back(PackTileKey(b[index]));
+        }
+        if(a.size() == 0u)
+        {
+                return true;
+        }
+
+        qsort(&keysA[0], keysA.size(), sizeof(uint64_t), CompareClipmapPackedTileKeys);
+        qsort(&keysB[0], keysB.size(), sizeof(uint64_t), CompareClipmapPackedTileKeys);
+        return memcmp(&keysA[0], &keysB[0], keysA.size() * sizeof(uint64_t)) == 0;
+}
+
+static void RunVisibleTileBenchmark(void)
+{
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+
+        glm::ivec2 cameraSample = glm::ivec2(37, -91);
+        uint32_t mismatchedLevels = 0u;
+        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+        {
+                glm::ivec2 origin = ComputeClipmapOriginForLevel(levelIndex, cameraSample);
+                ClipmapTileKeyVector referenceTiles[CLIPMAP_ATTRIBUTE_COUNT];
+                ClipmapTileKeyVector tiles[CLIPMAP_ATTRIBUTE_COUNT];
+
+                QueryPerformanceCounter(&start);
+                CollectVisibleTilesForLevelReference(levelIndex, origin, referenceTiles);
+                QueryPerformanceCounter(&end);
+                double referenceSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+                QueryPerformanceCounter(&start);
+                CollectVisibleTilesForLevel(levelIndex, origin, tiles);
+                QueryPerformanceCounter(&end);
+                double closedFormSeconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+
+                size_t referenceCount = 0;
+                size_t count = 0;
+                bool matched = true;
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        referenceCount += referenceTiles[attributeIndex].size();
+                        count += tiles[attributeIndex].size();
+                        matched = matched && AreClipmapTileSetsEqual(referenceTiles[attributeIndex], tiles[attributeIndex]);
+                }
+                mismatchedLevels += matched ? 0u : 1u;
+
+                fprintf(gFILE, "RunVisibleTileBenchmark(): level %u: reference %.3f ms, closed form %.3f ms, %zu tiles%s\n",
+                        levelIndex,
+                        referenceSeconds * 1000.0,
+                        closedFormSeconds * 1000.0,
+                        count,
+                        matched ? "" : " (MISMATCH)");
+                if(!matched)
+                {
+                        fprintf(gFILE, "RunVisibleTileBenchmark(): level %u: reference has %zu tiles, closed form %zu\n", levelIndex, referenceCount, count);
+                }
+        }
+
+        fprintf(gFILE, "RunVisibleTileBenchmark(): %u of %u levels enumerate a different tile set\n", mismatchedLevels, gClipmapLevelCount);
+}
+
+// Times the CPU side of initial population (procedural generation, mip pyramids
+// and residency of every level's tiles) with 1, 2, 4 and 8 threads. Leaves the
+// tile caches empty and restarts the pool with its default worker count.
+static void RunTaskPoolScalingBenchmark(void)
+{
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER generated;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+
+        ClipmapAttributeSource* scratch = (ClipmapAttributeSource*)calloc(CLIPMAP_ATTRIBUTE_COUNT, sizeof(ClipmapAttributeSource));
+        if(scratch == NULL)
+        {
+                ClipmapAbortOnAllocationFailure();
+                return;
+        }
+
+        const uint32_t sourceSize = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].width;
+        const uint32_t threadCounts[] = { 1u, 2u, 4u, 8u };
+        double singleThreadMs = 0.0;
+        for(uint32_t threadCount : threadCounts)
+        {
+                ShutdownClipmapTaskPool();
+                InitializeClipmapTaskPool(threadCount - 1u);
+
+                QueryPerformanceCounter(&start);
+                ImageData images[CLIPMAP_ATTRIBUTE_COUNT];
+                memset((void*)images, 0, sizeof(images));
+                GenerateProceduralTerrainImages(sourceSize, &images[CLIPMAP_ATTRIBUTE_HEIGHT], &images[CLIPMAP_ATTRIBUTE_DIFFUSE], &images[CLIPMAP_ATTRIBUTE_NORMAL]);
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        scratch[attributeIndex].tileSize = gClipmapTileSize;
+                        scratch[attributeIndex].mipImages[0] = images[attributeIndex];
+                        scratch[attributeIndex].mipCount = 1;
+                }
+                RunClipmapTasks(BuildClipmapSourceMipsTask, scratch, CLIPMAP_ATTRIBUTE_COUNT);
+                QueryPerformanceCounter(&generated);
+
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        ClearClipmapTileCache(gClipmapAttributeSources[attributeIndex]);
+                }
+                PopulateAllClipmapLevelTiles(glm::ivec2(0));
+                QueryPerformanceCounter(&end);
+
+                double generateMs = (double)(generated.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+                double tilesMs = (double)(end.QuadPart - generated.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+                double totalMs = generateMs + tilesMs;
+                if(threadCount == 1u)
+                {
+                        singleThreadMs = totalMs;
+                }
+
+                fprintf(gFILE, "RunTaskPoolScalingBenchmark(): %u threads: generate+mips %.2f ms, tiles %.2f ms (%llu), total %.2f ms, speedup %.2fx\n",
+                        threadCount,
+                        generateMs,
+                        tilesMs,
+                        (unsigned long long)gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].tilesLoaded,
+                        totalMs,
+                        singleThreadMs / totalMs);
+
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        DestroyClipmapSourceMips(scratch[attributeIndex]);
+                }
+        }
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClearClipmapTileCache(gClipmapAttributeSources[attributeIndex]);
+        }
+        free(scratch);
+
+        ShutdownClipmapTaskPool();
+        InitializeClipmapTaskPool(GetDefaultClipmapTaskWorkerCount());
+}
+
+// Replays a fixed flight (gCameraMoveSpeed at 60 Hz, turning 60 degrees every
+// three seconds) with and without prefetch and logs the demand misses. Jobs run
+// synchronously here, so prefetches always finish before the next demand job.
+static void RunPrefetchFlightBenchmark(void)
+{
+        const uint32_t frameCount = 1200u;
+        const float frameSeconds = 1.0f / 60.0f;
+        const uint32_t framesPerLeg = 180u;
+
+        for(uint32_t withPrefetch = 0; withPrefetch < 2u; withPrefetch++)
+        {
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        ClearClipmapTileCache(gClipmapAttributeSources[attributeIndex]);
+                }
+                memset((void*)&gClipmapPrefetch, 0, sizeof(ClipmapPrefetchState));
+                gClipmapStreamingContext.prefetchJobs.clear();
+                gClipmapStreamingContext.prefetchCancellations = 0;
+
+                glm::vec2 position = glm::vec2(0.0f);
+                float heading = 0.0f;
+                gClipmapCameraSample = glm::ivec2(0);
+                PopulateAllClipmapLevelTiles(gClipmapCameraSample);
+                glm::ivec2 levelOrigins[gClipmapLevelCount];
+                for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+                {
+                        levelOrigins[levelIndex] = ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample);
+                }
+                uint64_t initialLoads = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].demandMisses;
+
+                for(uint32_t frame = 0; frame < frameCount; frame++)
+                {
+                        if(frame != 0 && (frame % framesPerLeg) == 0)
+                        {
+                                heading += glm::radians(60.0f);
+                        }
+
+                        glm::vec3 velocity = glm::vec3(sinf(heading), 0.0f, -cosf(heading)) * gCameraMoveSpeed;
+                        position += glm::vec2(velocity.x, velocity.z) * frameSeconds;
+                        glm::vec2 cameraSample = position / gClipmapBaseWorldSpacing;
+                        glm::ivec2 desiredCameraSample = glm::ivec2((int)floorf(cameraSample.x), (int)floorf(cameraSample.y));
+
+                        if(withPrefetch != 0u)
+                        {
+                                ScheduleClipmapPrefetch(cameraSample, velocity);
+                                while(!gClipmapStreamingContext.prefetchJobs.empty())
+                                {
+                                        ClipmapStreamingJob job = gClipmapStreamingContext.prefetchJobs.front();
+                                        gClipmapStreamingContext.prefetchJobs.pop();
+                                        RunClipmapPrefetchJob(job);
+                                }
+                        }
+
+                        glm::ivec2 sampleDelta = desiredCameraSample - gClipmapCameraSample;
+                        if(glm::all(glm::lessThan(glm::abs(sampleDelta), glm::ivec2(gClipmapSampleUpdateThreshold))))
+                        {
+                                continue;
+                        }
+
+                        gClipmapCameraSample = desiredCameraSample;
+                        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+                        {
+                                ClipmapStreamingJob job;
+                                job.levelIndex = levelIndex;
+                                job.desiredOrigin = ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample);
+                                job.prefetchGeneration = 0;
+                                job.tilesRead = false;
+                                if(job.desiredOrigin == levelOrigins[levelIndex])
+                                {
+                                        continue;
+                                }
+
+                                levelOrigins[levelIndex] = job.desiredOrigin;
+                                ClipmapLevelUpdate update;
+                                RunClipmapStreamingJob(job, update);
+                        }
+                }
+
+                const ClipmapAttributeSource& heightSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT];
+                fprintf(gFILE, "RunPrefetchFlightBenchmark(): prefetch %s: %llu demand misses over %u frames, prefetched %llu, hits %llu (%.1f%%), %llu cancellations\n",
+                        (withPrefetch != 0u) ? "on" : "off",
+                        (unsigned long long)(heightSource.demandMisses - initialLoads),
+                        frameCount,
+                        (unsigned long long)heightSource.prefetchLoads,
+                        (unsigned long long)heightSource.prefetchHits,
+                        (heightSource.prefetchLoads != 0) ? (100.0 * (double)heightSource.prefetchHits / (double)heightSource.prefetchLoads) : 0.0,
+                        (unsigned long long)gClipmapStreamingContext.prefetchCancellations);
+        }
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClearClipmapTileCache(gClipmapAttributeSources[attributeIndex]);
+        }
+        memset((void*)&gClipmapPrefetch, 0, sizeof(ClipmapPrefetchState));
+        gClipmapCameraSample = glm::ivec2(0);
+}
+
+// Logs frame-to-frame time, the render-thread cost of UpdateClipmapLevels(),
+// the time the CPU spent waiting for clipmap uploads, the texels applied per
+// frame against gClipmapFrameUpdateTexelBudget and the coarsest finest drawn
+// level every gClipmapFrameStatsInterval frames, so streaming spikes and the
+// draw fallback are visible on the real renderer.
+const uint32_t gClipmapFrameStatsInterval = 600u;
+
+static int CompareClipmapFrameTimes(const void* left, const void* right)
+{
+        double a = *(const double*)left;
+        double b = *(const double*)right;
+        return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+// Sorts the samples in place.
+static double ComputeClipmapFrameTimePercentile(double* samples, uint32_t count, double percentile)
+{
+        if(count == 0)
+        {
+                return 0.0;
+        }
+
+        qsort(samples, count, sizeof(double), CompareClipmapFrameTimes);
+        uint32_t index = (uint32_t)ceil(percentile * (double)count);
+        return samples[CLIPMAP_MIN(CLIPMAP_MAX(index, 1u), count) - 1u];
+}
+
+static void RecordClipmapFrameStats(const LARGE_INTEGER& streamingStart)
+{
+        static LARGE_INTEGER frequency = {0};
+        static LONGLONG previousFrameCounter = 0;
+        static uint32_t frameCount = 0;
+        static uint32_t frameSampleCount = 0;
+        static double worstFrameMs = 0.0;
+        static double totalFrameMs = 0.0;
+        static double worstStreamingMs = 0.0;
+        static double totalStreamingMs = 0.0;
+        static double frameSamples[gClipmapFrameStatsInterval];
+        static double streamingSamples[gClipmapFrameStatsInterval];
+        static double worstUploadStallMs = 0.0;
+        static double totalUploadStallMs = 0.0;
+        static double uploadStallSamples[gClipmapFrameStatsInterval];
+        static double texelSamples[gClipmapFrameStatsInterval];
+        static uint64_t previousTexelsUpdated = 0;
+        static uint64_t previousBudgetLimitedFrames = 0;
+        static uint64_t worstFrameTexels = 0;
+        static uint64_t totalFrameTexels = 0;
+        static uint32_t coarsestDrawLevel = 0;
+
+        if(frequency.QuadPart == 0)
+        {
+                QueryPerformanceFrequency(&frequency);
+        }
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        double streamingMs = (double)(now.QuadPart - streamingStart.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+        worstStreamingMs = CLIPMAP_MAX(worstStreamingMs, streamingMs);
+        totalStreamingMs += streamingMs;
+        streamingSamples[frameCount] = streamingMs;
+
+        double uploadStallMs = gClipmapUploadStats.frameStallMs;
+        gClipmapUploadStats.frameStallMs = 0.0;
+        worstUploadStallMs = CLIPMAP_MAX(worstUploadStallMs, uploadStallMs);
+        totalUploadStallMs += uploadStallMs;
+        uploadStallSamples[frameCount] = uploadStallMs;
+
+        uint64_t frameTexels = gClipmapStreamingContext.texelsUpdated - previousTexelsUpdated;
+        previousTexelsUpdated = gClipmapStreamingContext.texelsUpdated;
+        worstFrameTexels = CLIPMAP_MAX(worstFrameTexels, frameTexels);
+        totalFrameTexels += frameTexels;
+        texelSamples[frameCount] = (double)frameTexels;
+        coarsestDrawLevel = CLIPMAP_MAX(coarsestDrawLevel, gClipmapFinestDrawLevel);
+
+        if(previousFrameCounter != 0)
+        {
+                double frameMs = (double)(now.QuadPart - previousFrameCounter) * 1000.0 / (double)frequency.QuadPart;
+                worstFrameMs = CLIPMAP_MAX(worstFrameMs, frameMs);
+                totalFrameMs += frameMs;
+                frameSamples[frameSampleCount++] = frameMs;
+        }
+        previousFrameCounter = now.QuadPart;
+
+        frameCount++;
+        if(frameCount == gClipmapFrameStatsInterval)
+        {
+                fprintf(gFILE, "display(): %u frames (%s streaming, %s uploads): frame avg %.3f ms p99 %.3f ms worst %.3f ms, UpdateClipmapLevels avg %.3f ms p99 %.3f ms worst %.3f ms, upload stall avg %.3f ms p99 %.3f ms worst %.3f ms\n",
+                        frameCount,
+                        (gClipmapStreamingContext.workerThread != NULL) ? "worker" : "inline",
+                        CLIPMAP_BLOCKING_UPLOADS ? "blocking" : "batched",
+                        totalFrameMs / (double)CLIPMAP_MAX(frameSampleCount, 1u),
+                        ComputeClipmapFrameTimePercentile(frameSamples, frameSampleCount, 0.99),
+                        worstFrameMs,
+                        totalStreamingMs / (double)frameCount,
+                        ComputeClipmapFrameTimePercentile(streamingSamples, frameCount, 0.99),
+                        worstStreamingMs,
+                        totalUploadStallMs / (double)frameCount,
+                        ComputeClipmapFrameTimePercentile(uploadStallSamples, frameCount, 0.99),
+                        worstUploadStallMs);
+                fprintf(gFILE, "display(): texels applied per frame avg %.0f p99 %.0f worst %llu (budget %llu, %llu frames budget-limited), coarsest finest drawn level %u\n",
+                        (double)totalFrameTexels / (double)frameCount,
+                        ComputeClipmapFrameTimePercentile(texelSamples, frameCount, 0.99),
+                        (unsigned long long)worstFrameTexels,
+                        (unsigned long long)gClipmapFrameUpdateTexelBudget,
+                        (unsigned long long)(gClipmapStreamingContext.budgetLimitedFrames - previousBudgetLimitedFrames),
+                        coarsestDrawLevel);
+                previousBudgetLimitedFrames = gClipmapStreamingContext.budgetLimitedFrames;
+
+                frameCount = 0;
+                frameSampleCount = 0;
+                worstFrameMs = 0.0;
+                totalFrameMs = 0.0;
+                worstStreamingMs = 0.0;
+                totalStreamingMs = 0.0;
+                worstUploadStallMs = 0.0;
+                totalUploadStallMs = 0.0;
+                worstFrameTexels = 0;
+                totalFrameTexels = 0;
+                coarsestDrawLevel = 0;
+        }
+}
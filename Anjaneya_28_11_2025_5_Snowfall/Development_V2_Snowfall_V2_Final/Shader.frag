@@ -34,8 +34,8 @@ layout(binding = 0) uniform ClipmapUniforms
     ClipmapLevelUniform levels[CLIPMAP_LEVEL_COUNT];
 } uClipmap;
 
-layout(binding = 2) uniform sampler2D diffuseClipmaps[CLIPMAP_LEVEL_COUNT];
-layout(binding = 3) uniform sampler2D normalClipmaps[CLIPMAP_LEVEL_COUNT];
+layout(binding = 2) uniform sampler2DArray diffuseClipmaps; // layer = level
+layout(binding = 3) uniform sampler2DArray normalClipmaps; // layer = level
 
 const vec3 lightDirection = normalize(vec3(0.35, 1.0, 0.25));
 const vec3 ambientColor  = vec3(0.26);
@@ -270,12 +270,12 @@ void main()
     }
 
     // Clipmap sampling (macro features from your existing textures).
-    vec3 albedo0 = texture(diffuseClipmaps[vLevelIndex],       vClipmapUV).rgb;
-    vec3 albedo1 = texture(diffuseClipmaps[vParentLevelIndex], vParentClipmapUV).rgb;
+    vec3 albedo0 = texture(diffuseClipmaps, vec3(vClipmapUV, float(vLevelIndex))).rgb;
+    vec3 albedo1 = texture(diffuseClipmaps, vec3(vParentClipmapUV, float(vParentLevelIndex))).rgb;
     vec3 albedo  = mix(albedo0, albedo1, vMorphFactor);
 
-    vec3 normal0 = texture(normalClipmaps[vLevelIndex],       vClipmapUV).rgb * 2.0 - 1.0;
-    vec3 normal1 = texture(normalClipmaps[vParentLevelIndex], vParentClipmapUV).rgb * 2.0 - 1.0;
+    vec3 normal0 = texture(normalClipmaps, vec3(vClipmapUV, float(vLevelIndex))).rgb * 2.0 - 1.0;
+    vec3 normal1 = texture(normalClipmaps, vec3(vParentClipmapUV, float(vParentLevelIndex))).rgb * 2.0 - 1.0;
     vec3 normalSample = normalize(mix(normal0, normal1, vMorphFactor));
     vec3 macroNormal  = normalize(vNormal + normalSample * 0.35);
 
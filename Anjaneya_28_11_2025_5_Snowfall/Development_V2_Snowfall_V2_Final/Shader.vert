@@ -11,7 +11,7 @@ layout(location = 1) out vec2 vEdgeDir;
 
 struct ClipmapLevelUniform
 {
-    vec4 worldOriginAndSpacing; // xyz = (originX, originZ, sampleSpacingWorld)
+    vec4 worldOriginAndSpacing; // xyzw = (originX, originZ, sampleSpacingWorld, heightBias)
     vec4 textureInfo; // x = invTextureSize, y = heightScale, z = morphStart, w = morphEnd
     vec4 torusParams; // xy = texel offsets
 };
@@ -30,7 +30,7 @@ layout(binding = 0) uniform ClipmapUniforms
     ClipmapLevelUniform levels[CLIPMAP_LEVEL_COUNT];
 } uClipmap;
 
-layout(binding = 1) uniform sampler2D heightClipmaps[CLIPMAP_LEVEL_COUNT];
+layout(binding = 1) uniform sampler2DArray heightClipmaps; // layer = level
 
 layout(push_constant) uniform PushConstants
 {
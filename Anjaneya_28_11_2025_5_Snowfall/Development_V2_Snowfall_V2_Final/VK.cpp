@@ -6,13 +6,29 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <intrin.h>
 
 #include "VK.h"
 #define LOG_FILE (char*)"Log.txt"
 
 #define CLIPMAP_MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define CLIPMAP_MAX(a, b) (((a) > (b)) ? (a) : (b))
+// Set by ClipmapBenchmarks.cpp (Benchmark.bat), which builds the renderer with
+// the clipmap streaming micro-benchmarks and per-frame timing logs included.
+#ifndef CLIPMAP_BENCHMARKS
+#define CLIPMAP_BENCHMARKS 0
+#endif
+// Set to 0 to run clipmap streaming jobs inline on the render thread instead
+// of the background worker (useful for frame-time comparisons).
+#define CLIPMAP_STREAMING_THREAD 1
+// Set to 1 to submit and wait for every clipmap level upload on its own, the
+// way uploads ran before they were batched per frame (for stall comparisons;
+// Benchmark.bat builds both).
+#ifndef CLIPMAP_BLOCKING_UPLOADS
+#define CLIPMAP_BLOCKING_UPLOADS 0
+#endif
 
 extern FILE* gFILE;
 
@@ -447,6 +463,12 @@ Device Queque
 */
 VkQueue vkQueue =  VK_NULL_HANDLE; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkQueue.html
 
+/*
+Clipmap streaming queue: an async-compute queue when the device has one, otherwise vkQueue itself.
+*/
+uint32_t gClipmapStreamQueueFamilyIndex = UINT32_MAX;
+VkQueue gClipmapStreamQueue = VK_NULL_HANDLE;
+
 /*
 Color Format and Color Space
 */
@@ -612,6 +634,15 @@ void DestroyImageData(ImageData* imageData);
 
 const float gTerrainWorldExtent = 4096.0f;
 const float gTerrainHeightScale = 180.0f;
+// With -height16 heights are stored as 16-bit unorm everywhere (source mips,
+// tiles, terrain files and the clipmap images) and decoded as
+// unorm * gClipmapHeightScale + gClipmapHeightBias before gTerrainHeightScale.
+// Scale and bias are chosen per terrain to span its height range.
+bool gClipmapHeight16 = false;
+float gClipmapHeightScale = 1.0f;
+float gClipmapHeightBias = 0.0f;
+// Set when the device was created with shaderStorageImageExtendedFormats.
+bool gClipmapStorageImageExtendedFormats = false;
 
 // Keep this in sync with CLIPMAP_LEVEL_COUNT in the shaders.
 static const uint32_t gClipmapLevelCount = 9u;
@@ -626,14 +657,34 @@ static const uint32_t gClipmapTextureSize = gClipmapGridSize + 1u;
 static const float gClipmapMorphBandThickness = 2.0f;
 static const float gClipmapSkirtDepth = 12.0f;
 static const uint32_t gClipmapBlockSize = 32u;
+// Keep this in sync with CLIPMAP_TILE_SIZE in Shader.comp.
 static const uint32_t gClipmapTileSize = 64u;
-// The clipmap system loads a tile per attribute for every visible region across
-// all clipmap levels. The previous 256 entry cache was too small for the
-// initial population pass, which led to allocation failures that surfaced as
-// VK_ERROR_OUT_OF_HOST_MEMORY during CreateVertexBuffer(). Bump the cache size
-// to comfortably cover the working set and avoid premature failures while
-// keeping memory usage reasonable.
-static const size_t gClipmapMaxResidentTiles = 512u;
+// Slot table capacity per attribute. How many tiles are actually resident is
+// decided by the shared byte budget below, and one busy attribute may hold more
+// than its share of it while the others are idle.
+static const size_t gClipmapMaxResidentTiles = 2048u;
+// Resident tile payloads of all attributes together (the former 512 tiles per
+// attribute). Overridden at startup with -tilecachemb=<megabytes>.
+static const size_t gClipmapDefaultTileCacheBudgetBytes = 24u * 1024u * 1024u;
+size_t gClipmapTileCacheBudgetBytes = gClipmapDefaultTileCacheBudgetBytes;
+// With -compresstiles, arena tiles are stored losslessly compressed in chains of
+// small blocks and decoded whenever their texels are read. Mapped tiles are
+// always read in place.
+bool gClipmapTileCompression = false;
+static const size_t gClipmapTileChunkBytes = 1024u;
+// Size of the on-disk second tier evicted tiles spill to; zero keeps it off.
+// Set with -tilespillmb=<megabytes>.
+size_t gClipmapTileSpillBudgetBytes = 0;
+// A compressed tile stream starts with its codec.
+static const size_t gClipmapTileStreamHeaderBytes = 1u;
+// Largest tile: four bytes per texel.
+static const size_t gClipmapTileMaxRawBytes = (size_t)gClipmapTileSize * (size_t)gClipmapTileSize * 4u;
+static const size_t gClipmapTileMaxStreamBytes = gClipmapTileMaxRawBytes + gClipmapTileStreamHeaderBytes;
+
+// Each attribute source keeps a box-filtered mip pyramid so coarse clipmap levels
+// read tiles at (or near) their own sample spacing. Mips stop once they would be
+// smaller than a tile.
+static const uint32_t gClipmapMaxSourceMips = 8u;
 
 VertexData gClipmapVertexBuffer;
 VertexData gClipmapIndexBuffer;
@@ -660,17 +711,71 @@ struct ClipmapAttributeSpec
 	const char* debugName;
 };
 
-const ClipmapAttributeSpec gClipmapAttributeSpecs[CLIPMAP_ATTRIBUTE_COUNT] =
+// The height entry follows the height source; see SetClipmapHeightFormat().
+ClipmapAttributeSpec gClipmapAttributeSpecs[CLIPMAP_ATTRIBUTE_COUNT] =
 {
         { VK_FORMAT_R32_SFLOAT, sizeof(float), "HeightClipmap" },
         { VK_FORMAT_R8G8B8A8_UNORM, 4u, "DiffuseClipmap" },
         { VK_FORMAT_R8G8B8A8_UNORM, 4u, "NormalClipmap" }
 };
 
+static const float gClipmapHeight16Max = 65535.0f;
+
+// Switches the height attribute between float and 16-bit unorm texels. Must not
+// change once the clipmap images exist.
+static void SetClipmapHeightFormat(bool height16)
+{
+        gClipmapHeight16 = height16;
+        gClipmapAttributeSpecs[CLIPMAP_ATTRIBUTE_HEIGHT].format = height16 ? VK_FORMAT_R16_UNORM : VK_FORMAT_R32_SFLOAT;
+        gClipmapAttributeSpecs[CLIPMAP_ATTRIBUTE_HEIGHT].bytesPerTexel = height16 ? (uint32_t)sizeof(uint16_t) : (uint32_t)sizeof(float);
+}
+
+// The clipmap images are sampled with linear filtering and written by the fill
+// shader as storage images, none of which R16_UNORM has to support.
+static bool IsClipmapHeight16Supported(void)
+{
+        if(!gClipmapStorageImageExtendedFormats)
+        {
+                return false;
+        }
+
+        VkFormatProperties vkFormatProperties;
+        memset((void*)&vkFormatProperties, 0, sizeof(vkFormatProperties));
+        vkGetPhysicalDeviceFormatProperties(vkPhysicalDevice_selected, VK_FORMAT_R16_UNORM, &vkFormatProperties);
+
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+                VK_FORMAT_FEATURE_TRANSFER_DST_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT;
+        return (vkFormatProperties.optimalTilingFeatures & required) == required;
+}
+
+static inline uint16_t QuantizeClipmapHeight(float height, float scale, float bias)
+{
+        float unorm = (scale > 0.0f) ? (height - bias) / scale : 0.0f;
+        return (uint16_t)glm::clamp(unorm * gClipmapHeight16Max + 0.5f, 0.0f, gClipmapHeight16Max);
+}
+
+// Height of one texel in the current height format, before gTerrainHeightScale.
+static inline float DecodeClipmapHeight(const uint8_t* texel)
+{
+        if(gClipmapHeight16)
+        {
+                uint16_t value;
+                memcpy(&value, texel, sizeof(value));
+                return (float)value * (gClipmapHeightScale / gClipmapHeight16Max) + gClipmapHeightBias;
+        }
+
+        float value;
+        memcpy(&value, texel, sizeof(value));
+        return value;
+}
+
+// A tile is identified by its attribute, source mip and tile coordinates within
+// that mip; it does not depend on the clipmap level, so it is shared by every
+// level that reads the same mip over the same footprint.
 struct ClipmapTileKey
 {
         ClipmapAttributeType attribute;
-        uint32_t level;
+        uint32_t mipLevel;
         uint32_t tileX;
         uint32_t tileY;
 };
@@ -678,1942 +783,7274 @@ struct ClipmapTileKey
 struct ClipmapTileResident
 {
         ClipmapTileKey key;
-        ClipmapVector<uint8_t> data;
+        uint8_t* data; // First block of the chain owned by the tile arena, or mapped pages.
+        uint32_t storageBytes; // Budget charged for data.
+        uint32_t encodedBytes; // Length of the compressed stream in data; 0 when data holds raw texels.
+        uint64_t contentHash; // Of the stored bytes, set when an arena tile is loaded.
+        uint32_t payload; // Shared payload in gClipmapTilePayloads + 1; 0 when the tile owns data.
+        bool uniform; // Every texel equals uniformTexel and data is NULL.
+        uint8_t uniformTexel[4];
         uint64_t lastUsedFrame;
 };
 
-struct ClipmapTileCacheEntry
-{
-        bool occupied;
-        uint64_t key;
-        ClipmapTileResident tile;
+// Fixed-size slab for tile payloads. A single arena shared by every attribute is
+// allocated when the sources are loaded and its size is the tile cache budget;
+// blocks are recycled through a free stack so streaming never touches the heap.
+// A tile holds a chain of blocks: its raw texels, or the chunks of its
+// compressed stream. Blocks are the size of the smallest raw tile, so only the
+// wider attributes' raw tiles span more than one.
+struct ClipmapTileArena
+{
+        uint8_t* memory;
+        size_t blockSize;
+        uint32_t blockCount;
+        ClipmapVector<uint32_t> freeBlocks;
+        ClipmapVector<uint32_t> nextBlocks; // Chain links, block index + 1; 0 ends a chain.
+        uint32_t usedBlocks;
+        uint32_t highWaterBlocks;
+        uint64_t failedAllocations;
 };
 
-struct ClipmapAttributeSource
+static void DestroyClipmapTileArena(ClipmapTileArena& arena)
+{
+        free(arena.memory);
+        arena.memory = NULL;
+        arena.blockSize = 0;
+        arena.blockCount = 0;
+        arena.freeBlocks.release();
+        arena.nextBlocks.release();
+        arena.usedBlocks = 0;
+        arena.highWaterBlocks = 0;
+        arena.failedAllocations = 0;
+}
+
+static bool CreateClipmapTileArena(ClipmapTileArena& arena, size_t blockSize, uint32_t blockCount)
 {
-        uint32_t width;
-        uint32_t height;
-        uint32_t bytesPerTexel;
-        bool isFloat;
-        uint32_t tileSize;
-        size_t maxResidentTiles;
-        ImageData imageData;
-        ClipmapTileCacheEntry tileCache[gClipmapMaxResidentTiles];
-        size_t tileCacheCount;
-        ClipmapVector<uint64_t> lruOrder;
-        bool cacheLimitReported;
-};
+        DestroyClipmapTileArena(arena);
 
-static void RemoveTileCacheEntry(ClipmapAttributeSource& source, uint64_t key);
+        arena.memory = (uint8_t*)malloc(blockSize * (size_t)blockCount);
+        if(arena.memory == NULL)
+        {
+                fprintf(gFILE, "CreateClipmapTileArena(): failed to allocate %u blocks of %zu bytes\n", blockCount, blockSize);
+                return false;
+        }
 
-static ClipmapTileCacheEntry* FindTileCacheEntry(ClipmapAttributeSource& source, uint64_t key)
+        arena.blockSize = blockSize;
+        arena.blockCount = blockCount;
+        arena.freeBlocks.reserve(blockCount);
+        arena.nextBlocks.resize(blockCount);
+        // Push in reverse so blocks are handed out from the start of the arena.
+        for(uint32_t block = blockCount; block > 0; block--)
+        {
+                arena.freeBlocks.push_back(block - 1u);
+        }
+        return true;
+}
+
+static inline uint32_t GetClipmapTileBlockIndex(const ClipmapTileArena& arena, const uint8_t* blockData)
 {
-	for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
-	{
-		if(source.tileCache[i].occupied && source.tileCache[i].key == key)
-		{
-			return &source.tileCache[i];
-		}
-	}
-        return NULL;
+        size_t block = (size_t)(blockData - arena.memory) / arena.blockSize;
+        assert(block < arena.blockCount);
+        return (uint32_t)block;
 }
 
-static ClipmapTileCacheEntry* AllocateTileCacheEntry(ClipmapAttributeSource& source, uint64_t key)
+// Next block of the chain, or NULL after its last block.
+static inline uint8_t* GetNextClipmapTileBlock(const ClipmapTileArena& arena, const uint8_t* blockData)
+{
+        uint32_t link = arena.nextBlocks[GetClipmapTileBlockIndex(arena, blockData)];
+        return (link != 0u) ? (arena.memory + (size_t)(link - 1u) * arena.blockSize) : NULL;
+}
+
+// Takes blockCount blocks linked into one chain; all of them or none.
+static uint8_t* AllocateClipmapTileBlocks(ClipmapTileArena& arena, uint32_t blockCount)
 {
-        if (source.maxResidentTiles != 0 && source.tileCacheCount >= source.maxResidentTiles)
+        if(blockCount == 0u || arena.freeBlocks.size() < blockCount)
         {
-                // For single-tile requests (e.g., CPU sampling via EnsureTileResident),
-                // evict the least-recently-used tile to make room instead of failing.
-                if (!source.lruOrder.empty())
-                {
-                        uint64_t candidate = source.lruOrder.back();
-                        source.lruOrder.pop_back();
-                        RemoveTileCacheEntry(source, candidate);
-                }
-                else
-                {
-                        if (!source.cacheLimitReported)
-                        {
-                                source.cacheLimitReported = true;
-                                FILE* logFile = (gFILE != NULL) ? gFILE : stderr;
-                                fprintf(logFile,
-                                        "AllocateTileCacheEntry(): cache limit (%zu) reached for key %llu (no LRU candidate)\n",
-                                        source.maxResidentTiles,
-                                        (unsigned long long)key);
-                        }
-                        return NULL;
-                }
+                arena.failedAllocations++;
+                return NULL;
         }
 
-        for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
+        uint32_t link = 0u;
+        for(uint32_t i = 0; i < blockCount; i++)
         {
-                if(source.tileCache[i].occupied == false)
-                {
-                        source.tileCache[i].occupied = true;
-                        source.tileCache[i].key = key;
-                        source.tileCache[i].tile.data.release();
-                        source.tileCache[i].tile.lastUsedFrame = 0;
-                        source.tileCacheCount++;
-                        return &source.tileCache[i];
-                }
+                uint32_t block = arena.freeBlocks.back();
+                arena.freeBlocks.pop_back();
+                arena.nextBlocks[block] = link;
+                link = block + 1u;
         }
-        return NULL;
+        arena.usedBlocks += blockCount;
+        arena.highWaterBlocks = CLIPMAP_MAX(arena.highWaterBlocks, arena.usedBlocks);
+        return arena.memory + (size_t)(link - 1u) * arena.blockSize;
 }
 
-static void RemoveTileCacheEntry(ClipmapAttributeSource& source, uint64_t key)
+// Frees every block of the chain after its first keepCount blocks and returns
+// how many were freed; keepCount 0 frees the whole chain.
+static uint32_t FreeClipmapTileBlocks(ClipmapTileArena& arena, uint8_t* blockData, uint32_t keepCount)
 {
-	ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, key);
-	if(entry != NULL && entry->occupied)
-	{
-		entry->tile.data.release();
-		entry->occupied = false;
-		entry->key = 0;
-		entry->tile.lastUsedFrame = 0;
-		if(source.tileCacheCount > 0)
-		{
-			source.tileCacheCount--;
-		}
-	}
-}
+        if(blockData == NULL || arena.memory == NULL)
+        {
+                return 0u;
+        }
 
-static void ClearClipmapTileCache(ClipmapAttributeSource& source)
-{
-	for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
+        uint32_t block = GetClipmapTileBlockIndex(arena, blockData);
+        for(uint32_t kept = 1u; kept < keepCount; kept++)
         {
-                if(source.tileCache[i].occupied)
+                if(arena.nextBlocks[block] == 0u)
                 {
-                        source.tileCache[i].tile.data.release();
-                        source.tileCache[i].occupied = false;
+                        return 0u;
                 }
-                source.tileCache[i].key = 0;
-                source.tileCache[i].tile.lastUsedFrame = 0;
+                block = arena.nextBlocks[block] - 1u;
         }
-        source.tileCacheCount = 0;
-        source.cacheLimitReported = false;
-        source.lruOrder.clear();
+
+        uint32_t freed = 0u;
+        uint32_t link = block + 1u;
+        if(keepCount != 0u)
+        {
+                link = arena.nextBlocks[block];
+                arena.nextBlocks[block] = 0u;
+        }
+        while(link != 0u)
+        {
+                uint32_t next = arena.nextBlocks[link - 1u];
+                arena.nextBlocks[link - 1u] = 0u;
+                arena.freeBlocks.push_back(link - 1u);
+                link = next;
+                freed++;
+        }
+        arena.usedBlocks -= freed;
+        return freed;
 }
 
-struct ClipmapAttributeResource
-{
-        VkImage vkImage;
-        VkDeviceMemory vkDeviceMemory;
-        VkImageView vkImageView;
-        VkSampler vkSampler;
-        bool initialized;
-};
+ClipmapTileArena gClipmapTileArena;
+// What the resident tiles of all attributes may hold: the budget, raised to what
+// one level update pins if it is smaller. Set when the sources are loaded.
+size_t gClipmapTileCacheCapacityBytes = 0;
 
-enum ClipmapPatchType
-{
-        CLIPMAP_PATCH_RING_BLOCK = 0,
-        CLIPMAP_PATCH_TRIM = 1,
-        CLIPMAP_PATCH_FILLER = 2,
-        CLIPMAP_PATCH_FIXUP_NORTH = 3,
-        CLIPMAP_PATCH_FIXUP_EAST = 4,
-        CLIPMAP_PATCH_FIXUP_SOUTH = 5,
-        CLIPMAP_PATCH_FIXUP_WEST = 6,
-        CLIPMAP_PATCH_SKIRT_OUTER = 7,
-        CLIPMAP_PATCH_SKIRT_INNER = 8
-};
+// On-disk tiled terrain. A header page is followed by one tile index per
+// attribute mip and then the tile payloads. Each payload starts on a page
+// boundary so a memory-mapped tile can be read in place. Index entries are
+// byte offsets of payloads within the file. Heights are float, or 16-bit unorm
+// decoded with the header's height scale and bias (version 2).
+static const uint32_t gClipmapTerrainFileMagic = 0x46544C43u; // "CLTF"
+static const uint32_t gClipmapTerrainFileVersion = 2u;
+static const uint32_t gClipmapTerrainFilePageSize = 4096u;
 
-struct ClipmapMeshSection
+struct ClipmapTerrainFileMip
 {
-	ClipmapPatchType patchType;
-	uint32_t firstIndex;
-	uint32_t indexCount;
-	glm::uvec2 blockCoord;
+        uint32_t width;
+        uint32_t height;
+        uint32_t tileCountX;
+        uint32_t tileCountY;
+        uint64_t indexOffset;
 };
 
-struct ClipmapLevelResource
+struct ClipmapTerrainFileAttribute
 {
-	ClipmapAttributeResource attributes[CLIPMAP_ATTRIBUTE_COUNT];
-	glm::ivec2 originInSamples;
-	glm::vec2 worldOrigin;
-	glm::ivec2 textureOffset;
-	bool initialized;
-	volatile LONG jobPending;
+        uint32_t bytesPerTexel;
+        uint32_t isFloat;
+        uint32_t mipCount;
+        uint32_t reserved;
+        ClipmapTerrainFileMip mips[gClipmapMaxSourceMips];
 };
 
-struct ClipmapPushConstants
+struct ClipmapTerrainFileHeader
 {
-	uint32_t levelIndex;
-	uint32_t patchType;
-	uint32_t padding0;
-	uint32_t padding1;
+        uint32_t magic;
+        uint32_t version;
+        uint32_t tileSize;
+        uint32_t attributeCount;
+        uint64_t fileSize;
+        ClipmapTerrainFileAttribute attributes[CLIPMAP_ATTRIBUTE_COUNT];
+        float heightScale;
+        float heightBias;
 };
 
-ClipmapVector<ClipmapMeshSection> gClipmapMeshSections;
-ClipmapLevelResource gClipmapLevels[gClipmapLevelCount];
-ClipmapAttributeSource gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_COUNT];
-CRITICAL_SECTION gClipmapLevelMutexes[gClipmapLevelCount];
-VkPipeline gClipmapComputePipelines[CLIPMAP_ATTRIBUTE_COUNT] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
-VkPipelineLayout gClipmapComputePipelineLayout = VK_NULL_HANDLE;
-uint64_t gClipmapTileFrameCounter = 0;
-
-struct ClipmapStreamingJob
-{
-        uint32_t levelIndex;
-        glm::ivec2 desiredOrigin;
-};
+static_assert(sizeof(ClipmapTerrainFileHeader) <= gClipmapTerrainFilePageSize,
+        "ClipmapTerrainFileHeader must fit in the header page");
 
-struct ClipmapUpdateRegion
+struct ClipmapTerrainFile
 {
-	uint32_t x;
-	uint32_t y;
-	uint32_t width;
-	uint32_t height;
+        HANDLE file;
+        HANDLE mapping;
+        const uint8_t* view;
+        uint64_t size;
 };
 
-using ClipmapTileKeyVector = ClipmapVector<ClipmapTileKey>;
-using ClipmapUpdateRegionVector = ClipmapVector<ClipmapUpdateRegion>;
-
-static void ShutdownClipmapStreaming(void);
-static VkResult PopulateClipmapLevelCpuData(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapUpdateRegionVector& outRegions);
-static VkResult UploadClipmapLevelToGpu(uint32_t levelIndex, const ClipmapUpdateRegionVector& regions);
-static inline uint32_t WrapCoordForTile(int value, uint32_t modulus);
-static uint64_t PackTileKey(const ClipmapTileKey& key);
-static VkResult EnsureTileResident(const ClipmapTileKey& key, ClipmapTileResident** outTile);
-static VkResult EnsureTileSetResident(const ClipmapTileKeyVector& keys);
-static void EnforceTileBudgets(ClipmapTileKeyVector (&requiredTiles)[CLIPMAP_ATTRIBUTE_COUNT]);
-static void CollectVisibleTilesForLevel(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileKeyVector (&outTiles)[CLIPMAP_ATTRIBUTE_COUNT]);
+ClipmapTerrainFile gClipmapTerrainFile;
+char gClipmapTerrainFilePath[MAX_PATH] = "";
+char gClipmapTerrainWritePath[MAX_PATH] = "";
+uint32_t gClipmapTerrainWriteSize = 1024u;
 
-struct ClipmapStreamingContext
+// Returns the text that follows `name` on the command line, or NULL. The name
+// has to start an argument and end at '=', whitespace or the end of the line,
+// so it does not match inside a longer option or a path.
+static const char* FindClipmapCommandLineOption(const char* commandLine, const char* name)
 {
-        HANDLE workerThread;
-        CRITICAL_SECTION mutex;
-        ClipmapQueue<ClipmapStreamingJob> pendingJobs;
-        bool stopRequested;
-};
-
-ClipmapStreamingContext gClipmapStreamingContext;
+        size_t nameLength = strlen(name);
+        bool nameHasValue = (nameLength != 0u) && (name[nameLength - 1u] == '=');
+        for(const char* option = strstr(commandLine, name); option != NULL; option = strstr(option + 1, name))
+        {
+                if(option != commandLine && !isspace((unsigned char)option[-1]))
+                {
+                        continue;
+                }
 
-static inline bool IsClipmapJobPending(ClipmapLevelResource* resource)
-{
-	return InterlockedCompareExchange(&resource->jobPending, 0, 0) != 0;
+                char next = option[nameLength];
+                if(nameHasValue || next == '\0' || next == '=' || isspace((unsigned char)next))
+                {
+                        return option + nameLength;
+                }
+        }
+        return NULL;
 }
 
-static inline void SetClipmapJobPending(ClipmapLevelResource* resource, bool isPending)
+// Copies an option value up to the next space, or between quotes if it starts with one.
+static void CopyClipmapCommandLineValue(const char* value, char* outValue, size_t outSize)
 {
-	InterlockedExchange(&resource->jobPending, isPending ? 1 : 0);
-}
-
-float gClipmapBaseWorldSpacing = 1.0f;
-const int gClipmapSampleUpdateThreshold = 2;
-glm::ivec2 gClipmapCameraSample = glm::ivec2(0);
-bool gClipmapSynchronizationInitialized = false;
+        char terminator = ' ';
+        if(*value == '"')
+        {
+                terminator = '"';
+                value++;
+        }
 
-//31-Ortho: Uniform Buffer (Uniform related declarations)
-//31.1
-struct ClipmapLevelUniform
-{
-        glm::vec4 worldOriginAndSpacing; // xyz = (originX, originZ, sampleSpacingWorld)
-        glm::vec4 textureInfo; // x = invTextureSize, y = heightScale, z = morphStart, w = morphEnd
-        glm::vec4 torusParams; // xy = texel offsets, z = gridSize, w = max tessellation factor
-};
+        size_t length = 0;
+        while(value[length] != '\0' && value[length] != terminator && length + 1u < outSize)
+        {
+                outValue[length] = value[length];
+                length++;
+        }
+        outValue[length] = '\0';
+}
 
-struct ClipmapCameraUniform
+static bool ParseClipmapCommandLineNumber(const char* value, const char* name, unsigned long* outNumber)
 {
-	glm::mat4 viewMatrix;
-	glm::mat4 projectionMatrix;
-	glm::mat4 viewProjectionMatrix;
-	glm::vec4 cameraWorldPosition;
-};
+        char* end = NULL;
+        unsigned long number = strtoul(value, &end, 10);
+        if(end == value || number == 0)
+        {
+                fprintf(gFILE, "ParseClipmapCommandLine(): ignoring invalid %s value\n", name);
+                return false;
+        }
 
-struct ClipmapUniformData
-{
-	ClipmapCameraUniform camera;
-	ClipmapLevelUniform levels[gClipmapLevelCount];
-};
+        *outNumber = number;
+        return true;
+}
 
-//31.1
-struct UniformData
-{
-	VkBuffer vkBuffer; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkBuffer.html
-	VkDeviceMemory vkDeviceMemory; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkDeviceMemory.html
-};
+// Reads the clipmap options. Must run before the clipmap sources are loaded.
+//   -tilecachemb=<megabytes>  tile cache budget, so machines with less RAM can shrink it
+//   -terrain=<path>           stream the terrain from a file written by -writeterrain
+//   -writeterrain=<path>      write the procedural terrain to a file and exit
+//   -terrainsize=<texels>     edge length of the terrain written by -writeterrain
+//   -compresstiles            keep resident tiles compressed
+//   -tilespillmb=<megabytes>  spill evicted tiles to a temporary file of this size
+//   -height16                 store heights as 16-bit unorm instead of float
+static void ParseClipmapCommandLine(const char* commandLine)
+{
+        if(commandLine == NULL)
+        {
+                return;
+        }
 
-//31.1
-struct UniformData uniformData;
+        unsigned long number = 0;
+        const char* value = FindClipmapCommandLineOption(commandLine, "-tilecachemb=");
+        if(value != NULL && ParseClipmapCommandLineNumber(value, "-tilecachemb", &number))
+        {
+                gClipmapTileCacheBudgetBytes = (size_t)number * 1024u * 1024u;
+                fprintf(gFILE, "ParseClipmapCommandLine(): tile cache budget set to %lu MB\n", number);
+        }
 
-glm::vec3 gCameraPosition = glm::vec3(0.0f, 600.0f, 800.0f);
-glm::quat gCameraOrientation = glm::quat(glm::vec3(0.0f));
-const float gCameraMoveSpeed = 1200.0f;
-const float gCameraRotationSpeed = glm::radians(120.0f);
-glm::vec3 gCameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
-float gCameraDistance = 1000.0f;
-float gCameraYawRadians = glm::radians(-35.0f);
-float gCameraPitchRadians = glm::radians(-25.0f);
-bool gIsMouseDragging = false;
-POINT gLastMousePosition = {0};
-const float gMouseRotationSensitivity = 0.005f;
-const float gMouseZoomSpeed = 0.5f;
+        value = FindClipmapCommandLineOption(commandLine, "-tilespillmb=");
+        if(value != NULL && ParseClipmapCommandLineNumber(value, "-tilespillmb", &number))
+        {
+                gClipmapTileSpillBudgetBytes = (size_t)number * 1024u * 1024u;
+                fprintf(gFILE, "ParseClipmapCommandLine(): evicted tiles spill to a %lu MB file\n", number);
+        }
 
-float NormalizeAngleRadians(float angle)
-{
-        const float twoPi = glm::two_pi<float>();
+        if(FindClipmapCommandLineOption(commandLine, "-compresstiles") != NULL)
+        {
+                gClipmapTileCompression = true;
+                fprintf(gFILE, "ParseClipmapCommandLine(): resident tiles are compressed\n");
+        }
 
-        angle = fmod(angle, twoPi);
+        if(FindClipmapCommandLineOption(commandLine, "-height16") != NULL)
+        {
+                SetClipmapHeightFormat(true);
+                fprintf(gFILE, "ParseClipmapCommandLine(): heights are stored as 16-bit unorm\n");
+        }
 
-        if (angle > glm::pi<float>())
+        value = FindClipmapCommandLineOption(commandLine, "-terrainsize=");
+        if(value != NULL && ParseClipmapCommandLineNumber(value, "-terrainsize", &number))
         {
-                angle -= twoPi;
+                gClipmapTerrainWriteSize = (uint32_t)number;
         }
-        else if (angle < -glm::pi<float>())
+
+        value = FindClipmapCommandLineOption(commandLine, "-writeterrain=");
+        if(value != NULL)
         {
-                angle += twoPi;
+                CopyClipmapCommandLineValue(value, gClipmapTerrainWritePath, sizeof(gClipmapTerrainWritePath));
         }
 
-        return angle;
+        value = FindClipmapCommandLineOption(commandLine, "-terrain=");
+        if(value != NULL)
+        {
+                CopyClipmapCommandLineValue(value, gClipmapTerrainFilePath, sizeof(gClipmapTerrainFilePath));
+        }
 }
 
-void UpdateCameraOrbitTransform()
-{
-        gCameraYawRadians = NormalizeAngleRadians(gCameraYawRadians);
-        gCameraPitchRadians = NormalizeAngleRadians(gCameraPitchRadians);
+// Tile slots are indexed through a chained hash table keyed on the packed tile
+// key and threaded on an intrusive LRU list. Bucket heads, chain links, LRU links
+// and the free-slot list store "slot + 1" so a zero-initialized source is already
+// a valid empty cache.
+static const uint32_t gClipmapTileHashBucketCount = 2048u;
+static const uint32_t gClipmapTileSlotNone = 0u;
 
-        // Prevent the orbit radius from collapsing to zero while still allowing zoom-in adjustments.
-        gCameraDistance = glm::max(gCameraDistance, 0.1f);
+struct ClipmapTileCacheEntry
+{
+        bool occupied;
+        uint64_t key;
+        uint32_t next; // Hash chain link while occupied, free-list link otherwise.
+        uint32_t lruPrev; // Towards the most recently used end.
+        uint32_t lruNext; // Towards the least recently used end.
+        uint64_t pinGeneration;
+        bool prefetched; // Loaded by a prefetch job and not requested by a demand job since.
+        bool loaded; // The tile's payload has been filled.
+        ClipmapTileResident tile;
+};
 
-        glm::quat yawQuat = glm::angleAxis(gCameraYawRadians, glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::vec3 rightAxis = yawQuat * glm::vec3(1.0f, 0.0f, 0.0f);
-        glm::quat pitchQuat = glm::angleAxis(gCameraPitchRadians, glm::normalize(rightAxis));
+struct ClipmapAttributeSource
+{
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytesPerTexel;
+        bool isFloat;
+        uint32_t tileSize;
+        ImageData mipImages[gClipmapMaxSourceMips]; // Only sizes are set when mapped.
+        uint32_t mipCount;
+        // Set when the source is read from the mapped terrain file: tile (x, y) of
+        // mip m starts mappedTileIndex[m][y * tileCountX + x] bytes into mappedView.
+        const uint8_t* mappedView;
+        const uint64_t* mappedTileIndex[gClipmapMaxSourceMips];
+        ClipmapTileCacheEntry tileCache[gClipmapMaxResidentTiles];
+        uint32_t tileHashBuckets[gClipmapTileHashBucketCount];
+        uint32_t freeSlotHead;
+        uint32_t slotHighWater;
+        size_t tileCacheCount;
+        uint64_t tilesLoaded;
+        uint64_t demandMisses;
+        uint64_t prefetchLoads;
+        uint64_t prefetchHits;
+        uint64_t prefetchWasted;
+        uint64_t demandHits; // Demand requests found in memory.
+        uint64_t uniformTiles; // Loaded tiles kept as a single texel.
+        uint64_t duplicateTiles; // Loaded tiles that share an identical tile's payload.
+        volatile LONG64 spillHits; // Misses read back from the spill file; counted on the loading threads.
+        size_t residentBytes; // Arena blocks or mapped pages held by this attribute's tiles.
+        size_t residentBytesHighWater;
+        double reloadCostMicroseconds; // Running average of one tile load.
+        uint64_t tilesEncoded;
+        uint64_t encodedBytes; // Compressed stream bytes of all tilesEncoded.
+        volatile LONG64 tilesDecoded; // Decodes run on any streaming thread.
+        volatile LONG64 decodeTicks;
+        uint32_t lruHead;
+        uint32_t lruTail;
+        // Tiles touched since the current job began carry this generation and are
+        // never chosen for eviction until the next job starts.
+        uint64_t pinGeneration;
+        bool cacheLimitReported;
+};
 
-        gCameraOrientation = glm::normalize(pitchQuat * yawQuat);
+static_assert((gClipmapTileHashBucketCount & (gClipmapTileHashBucketCount - 1u)) == 0u,
+        "gClipmapTileHashBucketCount must be a power of two");
+static_assert(gClipmapTileHashBucketCount >= gClipmapMaxResidentTiles,
+        "gClipmapTileHashBucketCount should be at least gClipmapMaxResidentTiles");
 
-        glm::vec3 forward = gCameraOrientation * glm::vec3(0.0f, 0.0f, -1.0f);
-        gCameraPosition = gCameraTarget - forward * gCameraDistance;
+static void RemoveTileCacheEntry(ClipmapAttributeSource& source, uint64_t key);
+static void SpillTileCacheEntry(ClipmapAttributeSource& source, const ClipmapTileCacheEntry& entry);
+
+static inline size_t GetTileRawBytes(const ClipmapAttributeSource& source)
+{
+        return (size_t)source.tileSize * (size_t)source.tileSize * (size_t)source.bytesPerTexel;
 }
 
-void SetCameraFromLookAt(const glm::vec3& position, const glm::vec3& target)
+// Arena tiles are compressed streams when -compresstiles is set.
+static inline bool IsTileCompressed(const ClipmapAttributeSource& source)
 {
-        glm::vec3 forward = glm::normalize(target - position);
-        gCameraYawRadians = atan2f(forward.x, -forward.z);
-        gCameraPitchRadians = asinf(glm::clamp(forward.y, -1.0f, 1.0f));
-        gCameraTarget = target;
-        gCameraDistance = glm::length(target - position);
-        UpdateCameraOrbitTransform();
+        return gClipmapTileCompression && source.mappedView == NULL;
 }
 
-void MoveCameraAlongLocalAxis(const glm::vec3& localDirection)
+// Raw arena tiles larger than a block are chains and are copied through a flat
+// buffer rather than read in place.
+static inline bool IsRawTileChained(const ClipmapAttributeSource& source)
 {
-        glm::vec3 worldDirection = gCameraOrientation * localDirection;
-        gCameraPosition += worldDirection;
-        gCameraTarget += worldDirection;
-        gCameraDistance = glm::max(glm::length(gCameraPosition - gCameraTarget), 0.1f);
+        return !IsTileCompressed(source) && source.mappedView == NULL && GetTileRawBytes(source) > gClipmapTileArena.blockSize;
 }
 
-void RotateCamera(float angleRadians, const glm::vec3& axis)
+// Budget charged for one resident tile of source when it is claimed. A
+// compressed tile is charged for a raw tile until its stream is known.
+static inline size_t GetTileStorageBytes(const ClipmapAttributeSource& source)
 {
-        if (glm::length(axis) <= 0.0f)
+        if(source.mappedView != NULL)
         {
-                return;
-	}
+                return GetTileRawBytes(source);
+        }
 
-        gCameraOrientation = glm::normalize(glm::angleAxis(angleRadians, glm::normalize(axis)) * gCameraOrientation);
+        size_t streamBytes = GetTileRawBytes(source) + (IsTileCompressed(source) ? gClipmapTileStreamHeaderBytes : 0u);
+        size_t blockSize = gClipmapTileArena.blockSize;
+        return (blockSize != 0u) ? ((streamBytes + blockSize - 1u) / blockSize) * blockSize : 0u;
 }
 
-int ClampInt(int value, int minValue, int maxValue)
+// Mapped payloads are read only; the pointer is non-const only so it can sit in
+// ClipmapTileResident next to arena blocks.
+static inline uint8_t* GetMappedTilePayload(const ClipmapAttributeSource& source, uint32_t mipLevel, uint32_t tileX, uint32_t tileY)
 {
-        if(value < minValue)
-	{
-		return minValue;
-	}
-	if(value > maxValue)
-	{
-		return maxValue;
-	}
-	return value;
+        uint32_t tileCountX = source.mipImages[mipLevel].width / source.tileSize;
+        uint64_t offset = source.mappedTileIndex[mipLevel][(size_t)tileY * tileCountX + tileX];
+        return (uint8_t*)(source.mappedView + offset);
 }
 
-float ClampFloat(float value, float minValue, float maxValue)
+// Returns a tile's payload to the budget. Arena blocks go back on the free
+// stack; mapped pages are dropped from the working set (VirtualUnlock on pages
+// that are not locked trims them) so only the cached tiles stay resident.
+static void ReleaseTileStorage(ClipmapAttributeSource& source, uint8_t* data, size_t storageBytes)
 {
-	if(value < minValue)
-	{
-		return minValue;
-	}
-	if(value > maxValue)
-	{
-		return maxValue;
-	}
-	return value;
+        if(data == NULL)
+        {
+                return;
+        }
+
+        if(source.mappedView != NULL)
+        {
+                VirtualUnlock(data, storageBytes);
+        }
+        else
+        {
+                FreeClipmapTileBlocks(gClipmapTileArena, data, 0u);
+        }
+        source.residentBytes -= storageBytes;
 }
 
-float SampleHeightValue(const float* heightData, uint32_t width, uint32_t height, int x, int y)
+static inline uint64_t MixTileKey(uint64_t key)
 {
-	if(heightData == NULL || width == 0 || height == 0)
-	{
-		return 0.0f;
-	}
-
-	int clampedX = ClampInt(x, 0, (int)width - 1);
-	int clampedY = ClampInt(y, 0, (int)height - 1);
-	size_t index = ((size_t)clampedY * (size_t)width) + (size_t)clampedX;
-	return heightData[index];
+        // 64-bit finalizer from splitmix64; tile coordinates sit in the low bits of
+        // the packed key so they need to be spread before masking.
+        key ^= key >> 30;
+        key *= 0xBF58476D1CE4E5B9ull;
+        key ^= key >> 27;
+        key *= 0x94D049BB133111EBull;
+        key ^= key >> 31;
+        return key;
 }
 
-float WrapFloatCoordinate(float value, float maxValue)
+static inline uint32_t HashTileKey(uint64_t key)
 {
-	if(maxValue <= 0.0f)
-	{
-		return 0.0f;
-	}
-
-	float wrapped = fmodf(value, maxValue);
-	if(wrapped < 0.0f)
-	{
-		wrapped += maxValue;
-	}
-	return wrapped;
+        return (uint32_t)MixTileKey(key) & (gClipmapTileHashBucketCount - 1u);
 }
 
-static void SampleAttributeTexel(ClipmapAttributeType attribute, float sampleX, float sampleY, uint8_t* outValue)
+// Payloads of loaded arena tiles, shared between tiles whose stored bytes are
+// identical. A payload is looked up by attribute and a hash of the stored bytes
+// and confirmed byte for byte, and it is charged to the budget once however many
+// tiles refer to it. Tiles whose texels are all equal keep the texel instead and
+// hold no payload. Chain links, the free list and tile references are index + 1.
+static const uint32_t gClipmapTilePayloadBucketCount = 8192u;
+
+struct ClipmapTilePayload
+{
+        uint64_t contentHash;
+        uint8_t* data; // Arena chain.
+        uint32_t storageBytes;
+        uint32_t storedBytes; // Raw tile or compressed stream length.
+        uint32_t refCount;
+        uint32_t attribute;
+        uint32_t next; // Hash chain link while referenced, free-list link otherwise.
+};
+
+struct ClipmapTilePayloadTable
 {
-        const ClipmapAttributeSpec& spec = gClipmapAttributeSpecs[attribute];
-        ClipmapAttributeSource& source = gClipmapAttributeSources[attribute];
-        ClipmapAttributeSource& heightSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT];
+        ClipmapVector<ClipmapTilePayload> payloads;
+        uint32_t buckets[gClipmapTilePayloadBucketCount];
+        uint32_t freeHead;
+};
+
+ClipmapTilePayloadTable gClipmapTilePayloads;
 
-        if((source.width == 0) || (source.height == 0) || (heightSource.width == 0) || (heightSource.height == 0))
+static_assert((gClipmapTilePayloadBucketCount & (gClipmapTilePayloadBucketCount - 1u)) == 0u,
+        "gClipmapTilePayloadBucketCount must be a power of two");
+static_assert(gClipmapTilePayloadBucketCount >= gClipmapMaxResidentTiles * CLIPMAP_ATTRIBUTE_COUNT,
+        "gClipmapTilePayloadBucketCount should be at least the resident tiles of all attributes");
+
+// Word-at-a-time hash of a tile's stored bytes.
+static uint64_t HashClipmapTileBytes(const uint8_t* bytes, size_t byteCount, uint64_t hash)
+{
+        size_t offset = 0;
+        for(; offset + sizeof(uint64_t) <= byteCount; offset += sizeof(uint64_t))
         {
-                memset(outValue, 0, spec.bytesPerTexel);
-                return;
+                uint64_t word;
+                memcpy(&word, bytes + offset, sizeof(word));
+                hash = (hash ^ word) * 0x100000001B3ull;
+                hash ^= hash >> 29;
+        }
+        for(; offset < byteCount; offset++)
+        {
+                hash = (hash ^ bytes[offset]) * 0x100000001B3ull;
         }
+        return hash;
+}
 
-        float scaleX = (float)source.width / (float)heightSource.width;
-        float scaleY = (float)source.height / (float)heightSource.height;
+// Compares byteCount bytes of two block chains of the tile arena.
+static bool AreClipmapTileChainsEqual(const uint8_t* a, const uint8_t* b, size_t byteCount)
+{
+        size_t blockSize = gClipmapTileArena.blockSize;
+        for(size_t offset = 0; offset < byteCount; offset += blockSize)
+        {
+                if(a == NULL || b == NULL || memcmp(a, b, CLIPMAP_MIN(blockSize, byteCount - offset)) != 0)
+                {
+                        return false;
+                }
+                a = GetNextClipmapTileBlock(gClipmapTileArena, a);
+                b = GetNextClipmapTileBlock(gClipmapTileArena, b);
+        }
+        return true;
+}
 
-        float srcX = sampleX * scaleX;
-        float srcY = sampleY * scaleY;
+static void ResetClipmapTilePayloads(void)
+{
+        gClipmapTilePayloads.payloads.release();
+        memset(gClipmapTilePayloads.buckets, 0, sizeof(gClipmapTilePayloads.buckets));
+        gClipmapTilePayloads.freeHead = 0u;
+}
 
-        float wrappedX = WrapFloatCoordinate(srcX, (float)source.width);
-        float wrappedY = WrapFloatCoordinate(srcY, (float)source.height);
+// Unlinks a payload and frees its entry; its storage is left to the caller.
+static void RemoveTilePayload(uint32_t payloadLink)
+{
+        ClipmapTilePayload& payload = gClipmapTilePayloads.payloads[payloadLink - 1u];
+        uint32_t* link = &gClipmapTilePayloads.buckets[(uint32_t)MixTileKey(payload.contentHash) & (gClipmapTilePayloadBucketCount - 1u)];
+        while(*link != payloadLink)
+        {
+                link = &gClipmapTilePayloads.payloads[*link - 1u].next;
+        }
+        *link = payload.next;
 
-        uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
-        uint32_t tileCountX = (source.width + tileSize - 1u) / tileSize;
-        uint32_t tileCountY = (source.height + tileSize - 1u) / tileSize;
+        payload.data = NULL;
+        payload.refCount = 0u;
+        payload.next = gClipmapTilePayloads.freeHead;
+        gClipmapTilePayloads.freeHead = payloadLink;
+}
 
-        uint32_t wrappedSampleX = (uint32_t)floorf(wrappedX);
-        uint32_t wrappedSampleY = (uint32_t)floorf(wrappedY);
-        uint32_t tileX = WrapCoordForTile((int)(wrappedSampleX / tileSize), tileCountX);
-        uint32_t tileY = WrapCoordForTile((int)(wrappedSampleY / tileSize), tileCountY);
+// Drops one reference to a tile's payload, freeing the payload with the last.
+static void ReleaseTilePayload(ClipmapAttributeSource& source, uint32_t payloadLink)
+{
+        ClipmapTilePayload& payload = gClipmapTilePayloads.payloads[payloadLink - 1u];
+        if(--payload.refCount != 0u)
+        {
+                return;
+        }
 
-        ClipmapTileKey tileKey;
-        tileKey.attribute = attribute;
-        tileKey.level = 0u;
-        tileKey.tileX = tileX;
-        tileKey.tileY = tileY;
+        uint8_t* data = payload.data;
+        uint32_t storageBytes = payload.storageBytes;
+        RemoveTilePayload(payloadLink);
+        ReleaseTileStorage(source, data, storageBytes);
+}
 
-        ClipmapTileResident* resident = NULL;
-        VkResult status = EnsureTileResident(tileKey, &resident);
-        if((status != VK_SUCCESS) || (resident == NULL))
+// Frees whatever a cache entry's tile holds and clears its payload fields.
+static void ReleaseResidentTile(ClipmapAttributeSource& source, ClipmapTileResident& tile)
+{
+        if(tile.payload != 0u)
         {
-                memset(outValue, 0, spec.bytesPerTexel);
-                return;
+                ReleaseTilePayload(source, tile.payload);
         }
+        else
+        {
+                ReleaseTileStorage(source, tile.data, tile.storageBytes);
+        }
+        tile.data = NULL;
+        tile.storageBytes = 0;
+        tile.encodedBytes = 0;
+        tile.payload = 0;
+        tile.uniform = false;
+}
 
-        uint32_t localX = wrappedSampleX % tileSize;
-        uint32_t localY = wrappedSampleY % tileSize;
-        size_t baseIndex = ((size_t)localY * (size_t)tileSize + (size_t)localX) * (size_t)source.bytesPerTexel;
+// Hands a freshly loaded tile's storage to the payload table, or frees it when
+// an identical payload is already resident and refers the tile to that one.
+static void ShareTilePayload(ClipmapAttributeSource& source, uint32_t attribute, ClipmapTileResident& tile)
+{
+        uint32_t storedBytes = (tile.encodedBytes != 0u) ? tile.encodedBytes : (uint32_t)GetTileRawBytes(source);
+        uint32_t* bucket = &gClipmapTilePayloads.buckets[(uint32_t)MixTileKey(tile.contentHash) & (gClipmapTilePayloadBucketCount - 1u)];
+        for(uint32_t link = *bucket; link != 0u; link = gClipmapTilePayloads.payloads[link - 1u].next)
+        {
+                ClipmapTilePayload& payload = gClipmapTilePayloads.payloads[link - 1u];
+                if(payload.contentHash == tile.contentHash && payload.attribute == attribute && payload.storedBytes == storedBytes &&
+                   AreClipmapTileChainsEqual(payload.data, tile.data, storedBytes))
+                {
+                        ReleaseTileStorage(source, tile.data, tile.storageBytes);
+                        payload.refCount++;
+                        tile.data = payload.data;
+                        tile.storageBytes = 0;
+                        tile.payload = link;
+                        source.duplicateTiles++;
+                        return;
+                }
+        }
 
-        if(source.isFloat)
+        uint32_t link = gClipmapTilePayloads.freeHead;
+        if(link != 0u)
         {
-                float heightValue = 0.0f;
-                memcpy(&heightValue, resident->data.data() + baseIndex, sizeof(float));
-                memcpy(outValue, &heightValue, sizeof(float));
-                return;
+                gClipmapTilePayloads.freeHead = gClipmapTilePayloads.payloads[link - 1u].next;
+        }
+        else
+        {
+                ClipmapTilePayload empty = {};
+                if(!gClipmapTilePayloads.payloads.push_back(empty))
+                {
+                        // The tile keeps its storage to itself.
+                        return;
+                }
+                link = (uint32_t)gClipmapTilePayloads.payloads.size();
         }
 
-        const uint8_t* pixelData = resident->data.data();
-        memcpy(outValue, pixelData + baseIndex, spec.bytesPerTexel);
+        ClipmapTilePayload& payload = gClipmapTilePayloads.payloads[link - 1u];
+        payload.contentHash = tile.contentHash;
+        payload.data = tile.data;
+        payload.storageBytes = tile.storageBytes;
+        payload.storedBytes = storedBytes;
+        payload.refCount = 1u;
+        payload.attribute = attribute;
+        payload.next = *bucket;
+        *bucket = link;
+        tile.storageBytes = 0;
+        tile.payload = link;
 }
 
-uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+static inline uint32_t GetTileCacheSlot(const ClipmapAttributeSource& source, const ClipmapTileCacheEntry* entry)
 {
-	for(uint32_t i = 0; i < vkPhysicalDeviceMemoryProperties.memoryTypeCount; i++)
-	{
-		if((typeFilter & (1 << i)) && ((vkPhysicalDeviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
-		{
-			return i;
-		}
-	}
-	return UINT32_MAX;
+        return (uint32_t)(entry - source.tileCache) + 1u;
 }
 
-VkCommandBuffer BeginSingleTimeCommands(void)
+static inline bool IsTileCacheEntryPinned(const ClipmapAttributeSource& source, const ClipmapTileCacheEntry* entry)
 {
-	VkCommandBufferAllocateInfo vkCommandBufferAllocateInfo;
-	memset((void*)&vkCommandBufferAllocateInfo, 0, sizeof(VkCommandBufferAllocateInfo));
-	vkCommandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	vkCommandBufferAllocateInfo.commandPool = vkCommandPool;
-	vkCommandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	vkCommandBufferAllocateInfo.commandBufferCount = 1;
+        return (source.pinGeneration != 0u) && (entry->pinGeneration == source.pinGeneration);
+}
 
-	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-	VkResult vkResult = vkAllocateCommandBuffers(vkDevice, &vkCommandBufferAllocateInfo, &commandBuffer);
-	if(vkResult != VK_SUCCESS)
-	{
-		fprintf(gFILE, "BeginSingleTimeCommands(): vkAllocateCommandBuffers() failed with error code %d\n", vkResult);
-		return VK_NULL_HANDLE;
-	}
+static void UnlinkTileLru(ClipmapAttributeSource& source, uint32_t slot)
+{
+        ClipmapTileCacheEntry& entry = source.tileCache[slot - 1u];
+        if(entry.lruPrev != gClipmapTileSlotNone)
+        {
+                source.tileCache[entry.lruPrev - 1u].lruNext = entry.lruNext;
+        }
+        else
+        {
+                source.lruHead = entry.lruNext;
+        }
 
-	VkCommandBufferBeginInfo vkCommandBufferBeginInfo;
-	memset((void*)&vkCommandBufferBeginInfo, 0, sizeof(VkCommandBufferBeginInfo));
-	vkCommandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	vkCommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        if(entry.lruNext != gClipmapTileSlotNone)
+        {
+                source.tileCache[entry.lruNext - 1u].lruPrev = entry.lruPrev;
+        }
+        else
+        {
+                source.lruTail = entry.lruPrev;
+        }
 
-	vkResult = vkBeginCommandBuffer(commandBuffer, &vkCommandBufferBeginInfo);
-	if(vkResult != VK_SUCCESS)
-	{
-		fprintf(gFILE, "BeginSingleTimeCommands(): vkBeginCommandBuffer() failed with error code %d\n", vkResult);
-		return VK_NULL_HANDLE;
-	}
+        entry.lruPrev = gClipmapTileSlotNone;
+        entry.lruNext = gClipmapTileSlotNone;
+}
 
-	return commandBuffer;
+static void LinkTileLruFront(ClipmapAttributeSource& source, uint32_t slot)
+{
+        ClipmapTileCacheEntry& entry = source.tileCache[slot - 1u];
+        entry.lruPrev = gClipmapTileSlotNone;
+        entry.lruNext = source.lruHead;
+        if(source.lruHead != gClipmapTileSlotNone)
+        {
+                source.tileCache[source.lruHead - 1u].lruPrev = slot;
+        }
+        source.lruHead = slot;
+        if(source.lruTail == gClipmapTileSlotNone)
+        {
+                source.lruTail = slot;
+        }
 }
 
-void EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+// Returns the least recently used tile that is not pinned by the current job, or
+// NULL. Touched tiles move to the head, so a pinned tail means every resident
+// tile is pinned.
+static ClipmapTileCacheEntry* GetTileEvictionCandidate(ClipmapAttributeSource& source)
 {
-	if(commandBuffer == VK_NULL_HANDLE)
-	{
-		return;
-	}
+        if(source.lruTail == gClipmapTileSlotNone)
+        {
+                return NULL;
+        }
 
-	VkResult vkResult = vkEndCommandBuffer(commandBuffer);
-	if(vkResult != VK_SUCCESS)
-	{
-		fprintf(gFILE, "EndSingleTimeCommands(): vkEndCommandBuffer() failed with error code %d\n", vkResult);
-		return;
-	}
+        ClipmapTileCacheEntry* candidate = &source.tileCache[source.lruTail - 1u];
+        return IsTileCacheEntryPinned(source, candidate) ? NULL : candidate;
+}
 
-	VkSubmitInfo vkSubmitInfo;
-	memset((void*)&vkSubmitInfo, 0, sizeof(VkSubmitInfo));
-	vkSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	vkSubmitInfo.commandBufferCount = 1;
-	vkSubmitInfo.pCommandBuffers = &commandBuffer;
+static ClipmapTileCacheEntry* FindTileCacheEntry(ClipmapAttributeSource& source, uint64_t key)
+{
+        uint32_t link = source.tileHashBuckets[HashTileKey(key)];
+        while(link != gClipmapTileSlotNone)
+        {
+                ClipmapTileCacheEntry& entry = source.tileCache[link - 1u];
+                if(entry.key == key)
+                {
+                        return &entry;
+                }
+                link = entry.next;
+        }
+        return NULL;
+}
 
-	vkResult = vkQueueSubmit(vkQueue, 1, &vkSubmitInfo, VK_NULL_HANDLE);
-	if(vkResult != VK_SUCCESS)
-	{
-		fprintf(gFILE, "EndSingleTimeCommands(): vkQueueSubmit() failed with error code %d\n", vkResult);
-	}
+static ClipmapTileCacheEntry* AllocateTileCacheEntry(ClipmapAttributeSource& source, uint64_t key)
+{
+        if (source.tileCacheCount >= gClipmapMaxResidentTiles)
+        {
+                // Out of slots rather than bytes: evict this attribute's
+                // least-recently-used tile to make room instead of failing.
+                ClipmapTileCacheEntry* candidate = GetTileEvictionCandidate(source);
+                if (candidate != NULL)
+                {
+                        SpillTileCacheEntry(source, *candidate);
+                        RemoveTileCacheEntry(source, candidate->key);
+                }
+                else
+                {
+                        if (!source.cacheLimitReported)
+                        {
+                                source.cacheLimitReported = true;
+                                FILE* logFile = (gFILE != NULL) ? gFILE : stderr;
+                                fprintf(logFile,
+                                        "AllocateTileCacheEntry(): slot limit (%zu) reached for key %llu (all resident tiles pinned)\n",
+                                        gClipmapMaxResidentTiles,
+                                        (unsigned long long)key);
+                        }
+                        return NULL;
+                }
+        }
 
-	vkQueueWaitIdle(vkQueue);
-	vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &commandBuffer);
+        uint32_t slot = gClipmapTileSlotNone;
+        if(source.freeSlotHead != gClipmapTileSlotNone)
+        {
+                slot = source.freeSlotHead;
+                source.freeSlotHead = source.tileCache[slot - 1u].next;
+        }
+        else if(source.slotHighWater < gClipmapMaxResidentTiles)
+        {
+                source.slotHighWater++;
+                slot = source.slotHighWater;
+        }
+        else
+        {
+                return NULL;
+        }
+
+        uint32_t bucket = HashTileKey(key);
+        ClipmapTileCacheEntry& entry = source.tileCache[slot - 1u];
+        entry.occupied = true;
+        entry.key = key;
+        entry.next = source.tileHashBuckets[bucket];
+        entry.pinGeneration = 0;
+        entry.prefetched = false;
+        entry.loaded = false;
+        entry.tile.data = NULL;
+        entry.tile.storageBytes = 0;
+        entry.tile.encodedBytes = 0;
+        entry.tile.contentHash = 0;
+        entry.tile.payload = 0;
+        entry.tile.uniform = false;
+        entry.tile.lastUsedFrame = 0;
+        source.tileHashBuckets[bucket] = slot;
+        LinkTileLruFront(source, slot);
+        source.tileCacheCount++;
+        return &entry;
 }
 
-VkResult CreateBufferResource(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* bufferMemory, const char* debugName)
+static void RemoveTileCacheEntry(ClipmapAttributeSource& source, uint64_t key)
 {
-	VkResult vkResult = VK_SUCCESS;
+        uint32_t* link = &source.tileHashBuckets[HashTileKey(key)];
+        while(*link != gClipmapTileSlotNone)
+        {
+                uint32_t slot = *link;
+                ClipmapTileCacheEntry& entry = source.tileCache[slot - 1u];
+                if(entry.key != key)
+                {
+                        link = &entry.next;
+                        continue;
+                }
 
-	VkBufferCreateInfo vkBufferCreateInfo;
+                *link = entry.next;
+                UnlinkTileLru(source, slot);
+                if(entry.prefetched)
+                {
+                        source.prefetchWasted++;
+                        entry.prefetched = false;
+                }
+                ReleaseResidentTile(source, entry.tile);
+                entry.occupied = false;
+                entry.loaded = false;
+                entry.key = 0;
+                entry.pinGeneration = 0;
+                entry.tile.lastUsedFrame = 0;
+                entry.next = source.freeSlotHead;
+                source.freeSlotHead = slot;
+                if(source.tileCacheCount > 0)
+                {
+                        source.tileCacheCount--;
+                }
+                return;
+        }
+}
+
+static void ClearClipmapTileCache(ClipmapAttributeSource& source)
+{
+	for(size_t i = 0; i < gClipmapMaxResidentTiles; i++)
+        {
+                if(source.tileCache[i].occupied)
+                {
+                        ReleaseResidentTile(source, source.tileCache[i].tile);
+                        source.tileCache[i].occupied = false;
+                }
+                source.tileCache[i].key = 0;
+                source.tileCache[i].next = gClipmapTileSlotNone;
+                source.tileCache[i].lruPrev = gClipmapTileSlotNone;
+                source.tileCache[i].lruNext = gClipmapTileSlotNone;
+                source.tileCache[i].pinGeneration = 0;
+                source.tileCache[i].prefetched = false;
+                source.tileCache[i].loaded = false;
+                source.tileCache[i].tile.lastUsedFrame = 0;
+        }
+        for(uint32_t bucket = 0; bucket < gClipmapTileHashBucketCount; bucket++)
+        {
+                source.tileHashBuckets[bucket] = gClipmapTileSlotNone;
+        }
+        source.freeSlotHead = gClipmapTileSlotNone;
+        source.slotHighWater = 0;
+        source.tileCacheCount = 0;
+        source.tilesLoaded = 0;
+        source.demandMisses = 0;
+        source.prefetchLoads = 0;
+        source.prefetchHits = 0;
+        source.prefetchWasted = 0;
+        source.demandHits = 0;
+        source.spillHits = 0;
+        source.uniformTiles = 0;
+        source.duplicateTiles = 0;
+        source.residentBytes = 0;
+        source.residentBytesHighWater = 0;
+        source.reloadCostMicroseconds = 0.0;
+        source.tilesEncoded = 0;
+        source.encodedBytes = 0;
+        source.tilesDecoded = 0;
+        source.decodeTicks = 0;
+        source.lruHead = gClipmapTileSlotNone;
+        source.lruTail = gClipmapTileSlotNone;
+        source.pinGeneration = 0;
+        source.cacheLimitReported = false;
+}
+
+// One attribute of every level: layer L of the image is level L. The view
+// covers all layers and serves both the draw and the compute fill.
+struct ClipmapAttributeArray
+{
+        VkImage vkImage;
+        VkDeviceMemory vkDeviceMemory;
+        VkImageView vkImageView;
+};
+
+enum ClipmapPatchType
+{
+        CLIPMAP_PATCH_RING_BLOCK = 0,
+        CLIPMAP_PATCH_TRIM = 1,
+        CLIPMAP_PATCH_FILLER = 2,
+        CLIPMAP_PATCH_FIXUP_NORTH = 3,
+        CLIPMAP_PATCH_FIXUP_EAST = 4,
+        CLIPMAP_PATCH_FIXUP_SOUTH = 5,
+        CLIPMAP_PATCH_FIXUP_WEST = 6,
+        CLIPMAP_PATCH_SKIRT_OUTER = 7,
+        CLIPMAP_PATCH_SKIRT_INNER = 8
+};
+
+struct ClipmapMeshSection
+{
+	ClipmapPatchType patchType;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	glm::uvec2 blockCoord;
+};
+
+struct ClipmapLevelResource
+{
+	glm::ivec2 originInSamples;
+	glm::vec2 worldOrigin;
+	glm::ivec2 textureOffset;
+	bool initialized;
+	volatile LONG jobPending;
+	// The level was last filled from its tile window by an upload the GPU has
+	// not finished; jobPending stays set so the worker leaves the window alone.
+	bool windowInFlight;
+};
+
+struct ClipmapPushConstants
+{
+	uint32_t levelIndex;
+	uint32_t patchType;
+	uint32_t padding0;
+	uint32_t padding1;
+};
+
+ClipmapVector<ClipmapMeshSection> gClipmapMeshSections;
+ClipmapLevelResource gClipmapLevels[gClipmapLevelCount];
+ClipmapAttributeArray gClipmapAttributeArrays[CLIPMAP_ATTRIBUTE_COUNT];
+VkSampler gClipmapSampler = VK_NULL_HANDLE;
+ClipmapAttributeSource gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_COUNT];
+CRITICAL_SECTION gClipmapLevelMutexes[gClipmapLevelCount];
+VkPipeline gClipmapComputePipelines[CLIPMAP_ATTRIBUTE_COUNT] = { VK_NULL_HANDLE, VK_NULL_HANDLE, VK_NULL_HANDLE };
+VkPipelineLayout gClipmapComputePipelineLayout = VK_NULL_HANDLE;
+VkDescriptorSetLayout gClipmapComputeDescriptorSetLayout = VK_NULL_HANDLE;
+VkDescriptorPool gClipmapComputeDescriptorPool = VK_NULL_HANDLE;
+VkDescriptorSet gClipmapComputeDescriptorSets[gClipmapLevelCount][CLIPMAP_ATTRIBUTE_COUNT];
+uint64_t gClipmapTileFrameCounter = 0;
+
+// Matches FillPushConstants in Shader.comp.
+struct ClipmapComputePushConstants
+{
+        glm::ivec2 originSamples;
+        glm::ivec2 textureOffset;
+        uint32_t levelIndex;
+        uint32_t attributeIndex;
+        uint32_t mipLevel;
+        uint32_t windowTiles;
+        glm::ivec2 firstTile; // Tile holding the level's first texel.
+        glm::ivec2 firstSlot; // Window slot of firstTile.
+        glm::ivec2 slotModulus; // Slots used on each axis.
+};
+
+// Source tiles the fill shader reads. Each attribute keeps, for every level, a
+// windowTiles x windowTiles grid of tile slots in one host-visible storage
+// buffer. Tile t of a level lands in slot t mod windowTiles on each axis, or in
+// its wrapped index once the level covers the whole source, so a level that
+// moves only copies the tiles it newly covers. A level's slots are written by
+// the job that computes its update and read by the GPU only after that job has
+// been applied, so the two never overlap.
+struct ClipmapTileWindow
+{
+        VkBuffer vkBuffer;
+        VkDeviceMemory vkDeviceMemory;
+        uint8_t* mapped;
+        size_t tileBytes;
+        VkDeviceSize levelBytes; // All slots of one level.
+        ClipmapVector<uint64_t> slotKeys; // Packed tile key + 1 per slot, 0 when empty.
+        uint64_t tilesCopied;
+};
+
+uint32_t gClipmapTileWindowTiles = 0u;
+ClipmapTileWindow gClipmapTileWindows[CLIPMAP_ATTRIBUTE_COUNT];
+
+// Upload staging shared by every level: one persistently mapped buffer used as
+// a ring. Level jobs allocate at the head and write their update strips; the
+// render thread copies them into the clipmap images and releases them once the
+// frame that recorded the copies has retired. Levels are applied coarse first, so releases can come
+// out of order and the tail only advances past a released prefix.
+struct ClipmapStagingAllocation
+{
+        VkDeviceSize offset;
+        VkDeviceSize bytes; // Includes the padding skipped when the allocation wrapped.
+        bool released;
+};
+
+struct ClipmapStagingRing
+{
+        VkBuffer vkBuffer;
+        VkDeviceMemory vkDeviceMemory;
+        uint8_t* mapped;
+        VkDeviceSize capacity;
+        VkDeviceSize head;
+        VkDeviceSize usedBytes;
+        VkDeviceSize usedHighWater;
+        ClipmapVector<ClipmapStagingAllocation> allocations; // Oldest first.
+        CRITICAL_SECTION mutex;
+        uint64_t allocationCount;
+        uint64_t allocationFailures; // Uploads that fell back to the fill shader.
+        uint64_t bytesStaged;
+};
+
+// Two full refreshes of every level with float heights.
+static const VkDeviceSize gClipmapStagingRingBytes = 16ull * 1024ull * 1024ull;
+// Keeps every strip aligned for any clipmap texel size.
+static const VkDeviceSize gClipmapStagingAlignment = 16u;
+ClipmapStagingRing gClipmapStagingRing;
+
+// Clipmap uploads of one frame in flight. Every level applied during a frame
+// is recorded into the frame's command buffer, which is submitted to the
+// streaming queue once just before the frame's draw; the draw waits on
+// vkSemaphore at the stages that sample the clipmaps. vkFence retires the
+// frame's staging allocations and tile windows when its slot comes round again.
+// With a separate streaming queue family the images change owner around each
+// upload: the graphics queue releases them in vkReleaseCommandBuffer, ahead of
+// the upload, and acquires them back in vkAcquireCommandBuffer, at the start
+// of the draw's submission.
+struct ClipmapUploadFrame
+{
+        VkCommandBuffer vkCommandBuffer;
+        VkCommandBuffer vkReleaseCommandBuffer;
+        VkCommandBuffer vkAcquireCommandBuffer;
+        VkFence vkFence; // Signalled by the last submission of the frame's uploads.
+        VkSemaphore vkSemaphore;
+        VkSemaphore vkReleaseSemaphore;
+        bool recording;
+        bool releaseRecording;
+        bool acquireRecording;
+        bool submitted; // vkFence has not been waited on since.
+        uint32_t levelsRecorded;
+        ClipmapVector<VkDeviceSize> stagingAllocations;
+        ClipmapVector<uint32_t> windowLevels;
+};
+
+struct ClipmapUploadStats
+{
+        uint64_t submissions;
+        uint64_t levelsSubmitted;
+        uint64_t fenceWaits; // Retirements that found the fence unsignalled.
+        double totalStallMs;
+        double worstStallMs;
+        double frameStallMs; // Since the frame statistics last read it.
+};
+
+// Every stage of the draw that samples the clipmap images.
+static const VkPipelineStageFlags gClipmapSampleStages =
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_TESSELLATION_CONTROL_SHADER_BIT |
+        VK_PIPELINE_STAGE_TESSELLATION_EVALUATION_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+// Stages of the streaming queue that write the clipmap images.
+static const VkPipelineStageFlags gClipmapWriteStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+ClipmapUploadFrame gClipmapUploadFrames[gMaxFramesInFlight];
+VkCommandPool gClipmapStreamCommandPool = VK_NULL_HANDLE; // vkCommandPool when streaming shares the graphics family.
+uint32_t gClipmapUploadFrameIndex = 0u;
+ClipmapUploadStats gClipmapUploadStats;
+
+struct ClipmapStreamingJob
+{
+        uint32_t levelIndex;
+        glm::ivec2 desiredOrigin;
+        LONG prefetchGeneration; // Prefetch jobs only; stale once the context moves on.
+        bool tilesRead; // Level jobs only: the tile reader has paged the job's tiles in.
+};
+
+struct ClipmapUpdateRegion
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+// A toroidal update touches at most two row strips and two column strips.
+const uint32_t gClipmapMaxUpdateRegions = 4u;
+
+// Result of a streaming job: the level state the worker computed plus the
+// texture regions the render thread has to refresh when it applies it.
+struct ClipmapLevelUpdate
+{
+	uint32_t levelIndex;
+	VkResult status;
+	glm::ivec2 originInSamples;
+	glm::ivec2 textureOffset;
+	ClipmapUpdateRegion regions[gClipmapMaxUpdateRegions];
+	uint32_t regionCount;
+	// Set when the job wrote the regions' texels into the staging ring. The
+	// strip of attribute a and region r starts at stagingOffsets[a][r].
+	bool staged;
+	VkDeviceSize stagingAllocation;
+	VkDeviceSize stagingOffsets[CLIPMAP_ATTRIBUTE_COUNT][gClipmapMaxUpdateRegions];
+};
+
+using ClipmapTileKeyVector = ClipmapVector<ClipmapTileKey>;
+
+static void ShutdownClipmapStreaming(void);
+static VkResult PopulateClipmapLevelCpuData(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapLevelUpdate& outUpdate);
+static VkResult UploadClipmapLevelToGpu(uint32_t levelIndex, const ClipmapLevelUpdate& update);
+static inline uint32_t WrapCoordForTile(int value, uint32_t modulus);
+static uint64_t PackTileKey(const ClipmapTileKey& key);
+static VkResult EnsureTileResident(const ClipmapTileKey& key, ClipmapTileResident** outTile);
+static VkResult EnsureTileSetResident(const ClipmapTileKeyVector& keys, bool prefetch);
+static const uint8_t* GetClipmapTileTexels(ClipmapAttributeSource& source, const ClipmapTileResident& tile, uint8_t* scratch);
+static void CloseClipmapTerrainFile(void);
+static void CloseClipmapTileSpillEvent(void);
+static void CollectVisibleTilesForLevel(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileKeyVector (&outTiles)[CLIPMAP_ATTRIBUTE_COUNT]);
+static VkResult StageClipmapLevelUpdate(ClipmapLevelUpdate& update);
+static void DestroyClipmapTileWindows(void);
+static bool AllocateClipmapStagingBytes(VkDeviceSize bytes, VkDeviceSize* outOffset);
+static void ReleaseClipmapStagingBytes(VkDeviceSize offset);
+static void DestroyClipmapStagingRing(void);
+static void DestroyClipmapUploadFrames(void);
+static void DestroyClipmapComputePipelines(void);
+VkResult CreateShaderModuleFromSpv(const char* szFileName, VkShaderModule* shaderModule);
+glm::ivec2 ComputeClipmapOriginForLevel(uint32_t levelIndex, const glm::ivec2& cameraSample);
+#if CLIPMAP_BENCHMARKS
+// Defined in ClipmapBenchmarks.cpp.
+static void RunTileCacheBenchmark(void);
+static void RunVisibleTileBenchmark(void);
+static void RunTileLoadBenchmark(void);
+static void RunTileCompressionBenchmark(void);
+static void RunTileDedupBenchmark(void);
+static void RunHeightQuantizationBenchmark(void);
+static void RunTaskPoolScalingBenchmark(void);
+static void RunPrefetchFlightBenchmark(void);
+static void RunTileReaderBenchmark(void);
+static void RecordClipmapFrameStats(const LARGE_INTEGER& streamingStart);
+#endif
+
+// At most one request per level is waiting at any time. A newer origin
+// overwrites the queued one instead of queueing behind it. The finished update
+// stays here until the render thread's frame budget lets it be applied.
+struct ClipmapLevelRequest
+{
+        bool queued;
+        glm::ivec2 desiredOrigin;
+        glm::ivec2 inFlightOrigin; // Valid while the level's jobPending is set.
+        // The in-flight job is parked until the tile reader has paged its tiles
+        // in; the reader counts readsRemaining down and wakes the worker at zero.
+        bool parked;
+        volatile LONG readsRemaining;
+        bool completed;
+        ClipmapLevelUpdate completedUpdate;
+};
+
+// The worker thread owns the tile caches once streaming has started; the
+// render thread only hands it requests and applies the finished level updates.
+struct ClipmapStreamingContext
+{
+        HANDLE workerThread;
+        HANDLE workAvailableEvent;
+        CRITICAL_SECTION mutex;
+        ClipmapLevelRequest levelRequests[gClipmapLevelCount];
+        // Low priority: only run while no level request is runnable.
+        ClipmapQueue<ClipmapStreamingJob> prefetchJobs;
+        volatile LONG stopRequested;
+        volatile LONG prefetchGeneration;
+        uint64_t prefetchJobsRun;
+        uint64_t prefetchJobsSkipped;
+        uint64_t prefetchCancellations;
+        uint64_t requestsCoalesced;
+        uint64_t updatesApplied;
+        uint64_t texelsUpdated;
+        uint64_t budgetLimitedFrames;
+};
+
+// Prefetch looks ahead along the camera's ground-plane velocity and is cancelled
+// when the heading turns by more than gClipmapPrefetchTurnCosine or the camera stops.
+const float gClipmapPrefetchLookaheadSeconds = 0.25f;
+const float gClipmapPrefetchMinSpeed = 50.0f;
+const float gClipmapPrefetchTurnCosine = 0.866f;
+
+struct ClipmapPrefetchState
+{
+        bool active;
+        glm::vec2 direction;
+        bool originValid[gClipmapLevelCount];
+        glm::ivec2 origins[gClipmapLevelCount];
+};
+
+ClipmapPrefetchState gClipmapPrefetch;
+
+ClipmapStreamingContext gClipmapStreamingContext;
+
+static inline bool IsClipmapJobPending(ClipmapLevelResource* resource)
+{
+	return InterlockedCompareExchange(&resource->jobPending, 0, 0) != 0;
+}
+
+static inline void SetClipmapJobPending(ClipmapLevelResource* resource, bool isPending)
+{
+	InterlockedExchange(&resource->jobPending, isPending ? 1 : 0);
+}
+
+float gClipmapBaseWorldSpacing = 1.0f;
+const int gClipmapSampleUpdateThreshold = 2;
+
+// Render-thread cap on the level updates applied per frame, coarse levels
+// first. Either limit may be 0 to disable it; one update always goes through.
+const uint64_t gClipmapFrameUpdateTexelBudget = 2ull * gClipmapTextureSize * gClipmapTextureSize;
+const double gClipmapFrameUpdateBudgetMs = 2.0;
+
+// A level lagging its desired origin by more than this many of its own texels
+// is not drawn, together with every finer level; its parent covers the area.
+const int gClipmapMaxDrawLagTexels = 16;
+
+// Levels whose samples project to fewer than this many pixels at the nearest
+// point of their footprint are inactive: neither streamed nor drawn.
+const float gClipmapMinPixelsPerSample = 1.0f;
+
+uint32_t gClipmapFinestActiveLevel = 0;
+uint32_t gClipmapFinestDrawLevel = 0;
+ClipmapVector<uint32_t> gClipmapRecordedDrawLevels; // Per swapchain image.
+glm::ivec2 gClipmapCameraSample = glm::ivec2(0);
+bool gClipmapSynchronizationInitialized = false;
+
+//31-Ortho: Uniform Buffer (Uniform related declarations)
+//31.1
+struct ClipmapLevelUniform
+{
+        glm::vec4 worldOriginAndSpacing; // xyzw = (originX, originZ, sampleSpacingWorld, heightBias)
+        glm::vec4 textureInfo; // x = invTextureSize, y = heightScale, z = morphStart, w = morphEnd
+        glm::vec4 torusParams; // xy = texel offsets, z = gridSize, w = max tessellation factor
+};
+
+struct ClipmapCameraUniform
+{
+	glm::mat4 viewMatrix;
+	glm::mat4 projectionMatrix;
+	glm::mat4 viewProjectionMatrix;
+	glm::vec4 cameraWorldPosition;
+};
+
+struct ClipmapUniformData
+{
+	ClipmapCameraUniform camera;
+	ClipmapLevelUniform levels[gClipmapLevelCount];
+};
+
+//31.1
+struct UniformData
+{
+	VkBuffer vkBuffer; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkBuffer.html
+	VkDeviceMemory vkDeviceMemory; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkDeviceMemory.html
+};
+
+//31.1
+struct UniformData uniformData;
+
+glm::vec3 gCameraPosition = glm::vec3(0.0f, 600.0f, 800.0f);
+const float gCameraFieldOfViewY = glm::radians(45.0f);
+glm::quat gCameraOrientation = glm::quat(glm::vec3(0.0f));
+const float gCameraMoveSpeed = 1200.0f;
+const float gCameraRotationSpeed = glm::radians(120.0f);
+glm::vec3 gCameraTarget = glm::vec3(0.0f, 0.0f, 0.0f);
+glm::vec3 gCameraVelocity = glm::vec3(0.0f); // World units per second, from update().
+float gCameraDistance = 1000.0f;
+float gCameraYawRadians = glm::radians(-35.0f);
+float gCameraPitchRadians = glm::radians(-25.0f);
+bool gIsMouseDragging = false;
+POINT gLastMousePosition = {0};
+const float gMouseRotationSensitivity = 0.005f;
+const float gMouseZoomSpeed = 0.5f;
+
+float NormalizeAngleRadians(float angle)
+{
+        const float twoPi = glm::two_pi<float>();
+
+        angle = fmod(angle, twoPi);
+
+        if (angle > glm::pi<float>())
+        {
+                angle -= twoPi;
+        }
+        else if (angle < -glm::pi<float>())
+        {
+                angle += twoPi;
+        }
+
+        return angle;
+}
+
+void UpdateCameraOrbitTransform()
+{
+        gCameraYawRadians = NormalizeAngleRadians(gCameraYawRadians);
+        gCameraPitchRadians = NormalizeAngleRadians(gCameraPitchRadians);
+
+        // Prevent the orbit radius from collapsing to zero while still allowing zoom-in adjustments.
+        gCameraDistance = glm::max(gCameraDistance, 0.1f);
+
+        glm::quat yawQuat = glm::angleAxis(gCameraYawRadians, glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::vec3 rightAxis = yawQuat * glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::quat pitchQuat = glm::angleAxis(gCameraPitchRadians, glm::normalize(rightAxis));
+
+        gCameraOrientation = glm::normalize(pitchQuat * yawQuat);
+
+        glm::vec3 forward = gCameraOrientation * glm::vec3(0.0f, 0.0f, -1.0f);
+        gCameraPosition = gCameraTarget - forward * gCameraDistance;
+}
+
+void SetCameraFromLookAt(const glm::vec3& position, const glm::vec3& target)
+{
+        glm::vec3 forward = glm::normalize(target - position);
+        gCameraYawRadians = atan2f(forward.x, -forward.z);
+        gCameraPitchRadians = asinf(glm::clamp(forward.y, -1.0f, 1.0f));
+        gCameraTarget = target;
+        gCameraDistance = glm::length(target - position);
+        UpdateCameraOrbitTransform();
+}
+
+void MoveCameraAlongLocalAxis(const glm::vec3& localDirection)
+{
+        glm::vec3 worldDirection = gCameraOrientation * localDirection;
+        gCameraPosition += worldDirection;
+        gCameraTarget += worldDirection;
+        gCameraDistance = glm::max(glm::length(gCameraPosition - gCameraTarget), 0.1f);
+}
+
+void RotateCamera(float angleRadians, const glm::vec3& axis)
+{
+        if (glm::length(axis) <= 0.0f)
+        {
+                return;
+	}
+
+        gCameraOrientation = glm::normalize(glm::angleAxis(angleRadians, glm::normalize(axis)) * gCameraOrientation);
+}
+
+int ClampInt(int value, int minValue, int maxValue)
+{
+        if(value < minValue)
+	{
+		return minValue;
+	}
+	if(value > maxValue)
+	{
+		return maxValue;
+	}
+	return value;
+}
+
+float ClampFloat(float value, float minValue, float maxValue)
+{
+	if(value < minValue)
+	{
+		return minValue;
+	}
+	if(value > maxValue)
+	{
+		return maxValue;
+	}
+	return value;
+}
+
+float SampleHeightValue(const float* heightData, uint32_t width, uint32_t height, int x, int y)
+{
+	if(heightData == NULL || width == 0 || height == 0)
+	{
+		return 0.0f;
+	}
+
+	int clampedX = ClampInt(x, 0, (int)width - 1);
+	int clampedY = ClampInt(y, 0, (int)height - 1);
+	size_t index = ((size_t)clampedY * (size_t)width) + (size_t)clampedX;
+	return heightData[index];
+}
+
+uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	for(uint32_t i = 0; i < vkPhysicalDeviceMemoryProperties.memoryTypeCount; i++)
+	{
+		if((typeFilter & (1 << i)) && ((vkPhysicalDeviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties))
+		{
+			return i;
+		}
+	}
+	return UINT32_MAX;
+}
+
+VkCommandBuffer BeginSingleTimeCommands(void)
+{
+	VkCommandBufferAllocateInfo vkCommandBufferAllocateInfo;
+	memset((void*)&vkCommandBufferAllocateInfo, 0, sizeof(VkCommandBufferAllocateInfo));
+	vkCommandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	vkCommandBufferAllocateInfo.commandPool = vkCommandPool;
+	vkCommandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	vkCommandBufferAllocateInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkResult vkResult = vkAllocateCommandBuffers(vkDevice, &vkCommandBufferAllocateInfo, &commandBuffer);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "BeginSingleTimeCommands(): vkAllocateCommandBuffers() failed with error code %d\n", vkResult);
+		return VK_NULL_HANDLE;
+	}
+
+	VkCommandBufferBeginInfo vkCommandBufferBeginInfo;
+	memset((void*)&vkCommandBufferBeginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+	vkCommandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	vkCommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkResult = vkBeginCommandBuffer(commandBuffer, &vkCommandBufferBeginInfo);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "BeginSingleTimeCommands(): vkBeginCommandBuffer() failed with error code %d\n", vkResult);
+		return VK_NULL_HANDLE;
+	}
+
+	return commandBuffer;
+}
+
+void EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+{
+	if(commandBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	VkResult vkResult = vkEndCommandBuffer(commandBuffer);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "EndSingleTimeCommands(): vkEndCommandBuffer() failed with error code %d\n", vkResult);
+		return;
+	}
+
+	// Waits for this submission only, not for everything else on the queue.
+	VkFenceCreateInfo vkFenceCreateInfo;
+	memset((void*)&vkFenceCreateInfo, 0, sizeof(VkFenceCreateInfo));
+	vkFenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence vkFence = VK_NULL_HANDLE;
+	vkResult = vkCreateFence(vkDevice, &vkFenceCreateInfo, NULL, &vkFence);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "EndSingleTimeCommands(): vkCreateFence() failed with error code %d\n", vkResult);
+		vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &commandBuffer);
+		return;
+	}
+
+	VkSubmitInfo vkSubmitInfo;
+	memset((void*)&vkSubmitInfo, 0, sizeof(VkSubmitInfo));
+	vkSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	vkSubmitInfo.commandBufferCount = 1;
+	vkSubmitInfo.pCommandBuffers = &commandBuffer;
+
+	vkResult = vkQueueSubmit(vkQueue, 1, &vkSubmitInfo, vkFence);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "EndSingleTimeCommands(): vkQueueSubmit() failed with error code %d\n", vkResult);
+	}
+	else
+	{
+		vkWaitForFences(vkDevice, 1, &vkFence, VK_TRUE, UINT64_MAX);
+	}
+
+	vkDestroyFence(vkDevice, vkFence, NULL);
+	vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &commandBuffer);
+}
+
+VkResult CreateBufferResource(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer* buffer, VkDeviceMemory* bufferMemory, const char* debugName)
+{
+	VkResult vkResult = VK_SUCCESS;
+
+	VkBufferCreateInfo vkBufferCreateInfo;
 	memset((void*)&vkBufferCreateInfo, 0, sizeof(VkBufferCreateInfo));
 	vkBufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	vkBufferCreateInfo.size = size;
 	vkBufferCreateInfo.usage = usage;
 	vkBufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	vkResult = vkCreateBuffer(vkDevice, &vkBufferCreateInfo, NULL, buffer);
-	if(vkResult != VK_SUCCESS)
+	vkResult = vkCreateBuffer(vkDevice, &vkBufferCreateInfo, NULL, buffer);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateBufferResource(): vkCreateBuffer() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	VkMemoryRequirements vkMemoryRequirements;
+	memset((void*)&vkMemoryRequirements, 0, sizeof(VkMemoryRequirements));
+	vkGetBufferMemoryRequirements(vkDevice, *buffer, &vkMemoryRequirements);
+
+	VkMemoryAllocateInfo vkMemoryAllocateInfo;
+	memset((void*)&vkMemoryAllocateInfo, 0, sizeof(VkMemoryAllocateInfo));
+	vkMemoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	vkMemoryAllocateInfo.allocationSize = vkMemoryRequirements.size;
+	vkMemoryAllocateInfo.memoryTypeIndex = FindMemoryType(vkMemoryRequirements.memoryTypeBits, properties);
+
+	if(vkMemoryAllocateInfo.memoryTypeIndex == UINT32_MAX)
+	{
+		fprintf(gFILE, "CreateBufferResource(): suitable memory type not found for %s\n", debugName);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	vkResult = vkAllocateMemory(vkDevice, &vkMemoryAllocateInfo, NULL, bufferMemory);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateBufferResource(): vkAllocateMemory() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	vkResult = vkBindBufferMemory(vkDevice, *buffer, *bufferMemory, 0);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateBufferResource(): vkBindBufferMemory() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	return vkResult;
+}
+
+VkResult CreateImageResource(uint32_t width, uint32_t height, uint32_t arrayLayers, VkFormat format, VkImageUsageFlags usage, VkImage* image, VkDeviceMemory* vkDeviceMemory, const char* debugName)
+{
+	VkResult vkResult = VK_SUCCESS;
+
+	VkImageCreateInfo vkImageCreateInfo;
+	memset((void*)&vkImageCreateInfo, 0, sizeof(VkImageCreateInfo));
+	vkImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	vkImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	vkImageCreateInfo.extent.width = width;
+	vkImageCreateInfo.extent.height = height;
+	vkImageCreateInfo.extent.depth = 1;
+	vkImageCreateInfo.mipLevels = 1;
+	vkImageCreateInfo.arrayLayers = arrayLayers;
+	vkImageCreateInfo.format = format;
+	vkImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	vkImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	vkImageCreateInfo.usage = usage;
+	vkImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	vkImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	vkResult = vkCreateImage(vkDevice, &vkImageCreateInfo, NULL, image);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateImageResource(): vkCreateImage() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	VkMemoryRequirements vkMemoryRequirements;
+	memset((void*)&vkMemoryRequirements, 0, sizeof(VkMemoryRequirements));
+	vkGetImageMemoryRequirements(vkDevice, *image, &vkMemoryRequirements);
+
+	VkMemoryAllocateInfo vkMemoryAllocateInfo;
+	memset((void*)&vkMemoryAllocateInfo, 0, sizeof(VkMemoryAllocateInfo));
+	vkMemoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	vkMemoryAllocateInfo.allocationSize = vkMemoryRequirements.size;
+	vkMemoryAllocateInfo.memoryTypeIndex = FindMemoryType(vkMemoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if(vkMemoryAllocateInfo.memoryTypeIndex == UINT32_MAX)
+	{
+		fprintf(gFILE, "CreateImageResource(): suitable memory type not found for %s\n", debugName);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	vkResult = vkAllocateMemory(vkDevice, &vkMemoryAllocateInfo, NULL, vkDeviceMemory);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateImageResource(): vkAllocateMemory() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	vkResult = vkBindImageMemory(vkDevice, *image, *vkDeviceMemory, 0);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateImageResource(): vkBindImageMemory() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	return vkResult;
+}
+
+static void RecordImageLayoutTransition(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+	VkImageMemoryBarrier vkImageMemoryBarrier;
+	memset((void*)&vkImageMemoryBarrier, 0, sizeof(VkImageMemoryBarrier));
+	vkImageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	vkImageMemoryBarrier.oldLayout = oldLayout;
+	vkImageMemoryBarrier.newLayout = newLayout;
+	vkImageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	vkImageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	vkImageMemoryBarrier.image = image;
+	vkImageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	vkImageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+	vkImageMemoryBarrier.subresourceRange.levelCount = 1;
+	vkImageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
+	vkImageMemoryBarrier.subresourceRange.layerCount = 1;
+
+	VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	VkPipelineStageFlags destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	if((oldLayout == VK_IMAGE_LAYOUT_UNDEFINED) && (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL))
+	{
+		vkImageMemoryBarrier.srcAccessMask = 0;
+		vkImageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	else if((oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) && (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL))
+	{
+		vkImageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkImageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	else if((oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) && (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL))
+	{
+		vkImageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkImageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		sourceStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	else
+	{
+		fprintf(gFILE, "TransitionImageLayout(): unsupported layout transition requested\n");
+	}
+
+	vkCmdPipelineBarrier(commandBuffer,
+		sourceStage,
+		destinationStage,
+		0,
+		0, NULL,
+		0, NULL,
+		1, &vkImageMemoryBarrier);
+}
+
+void TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+	if(commandBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	RecordImageLayoutTransition(commandBuffer, image, oldLayout, newLayout);
+	EndSingleTimeCommands(commandBuffer);
+}
+
+static void RecordCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height)
+{
+	VkBufferImageCopy vkBufferImageCopy;
+	memset((void*)&vkBufferImageCopy, 0, sizeof(VkBufferImageCopy));
+	vkBufferImageCopy.bufferOffset = bufferOffset;
+	vkBufferImageCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	vkBufferImageCopy.imageSubresource.mipLevel = 0;
+	vkBufferImageCopy.imageSubresource.baseArrayLayer = 0;
+	vkBufferImageCopy.imageSubresource.layerCount = 1;
+	vkBufferImageCopy.imageOffset.x = 0;
+	vkBufferImageCopy.imageOffset.y = 0;
+	vkBufferImageCopy.imageOffset.z = 0;
+	vkBufferImageCopy.imageExtent.width = width;
+	vkBufferImageCopy.imageExtent.height = height;
+	vkBufferImageCopy.imageExtent.depth = 1;
+
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &vkBufferImageCopy);
+}
+
+void CopyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height)
+{
+	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+	if(commandBuffer == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	RecordCopyBufferToImage(commandBuffer, buffer, bufferOffset, image, width, height);
+	EndSingleTimeCommands(commandBuffer);
+}
+
+// Records the copies into commandBuffer so several images can share one submission.
+void CopyBufferToImageRegions(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, const VkBufferImageCopy* regions, uint32_t regionCount)
+{
+	if(regions == NULL || regionCount == 0)
+	{
+		return;
+	}
+
+	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
+}
+
+VkResult CreateTextureFromRgba(const uint8_t* pixelData, VkDeviceSize dataSize, uint32_t width, uint32_t height, TextureResource* textureResource, const char* debugName)
+{
+	if((pixelData == NULL) || (dataSize == 0))
+	{
+		fprintf(gFILE, "CreateTextureFromRgba(): pixelData empty for %s\n", debugName);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkResult vkResult = VK_SUCCESS;
+
+	// Textures that fit go through the clipmap staging ring; anything else gets
+	// a staging buffer of its own.
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	VkDeviceSize stagingOffset = 0;
+	// The ring belongs to the streaming queue's family when that is not this queue's.
+	bool ringStaged = (gClipmapStreamQueueFamilyIndex == graphicsQuequeFamilyIndex_selected) && AllocateClipmapStagingBytes(dataSize, &stagingOffset);
+	if(ringStaged)
+	{
+		memcpy(gClipmapStagingRing.mapped + stagingOffset, pixelData, (size_t)dataSize);
+		stagingBuffer = gClipmapStagingRing.vkBuffer;
+	}
+	else
+	{
+		vkResult = CreateBufferResource(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingMemory, "TextureStagingBuffer");
+		if(vkResult != VK_SUCCESS)
+		{
+			return vkResult;
+		}
+
+		void* data = NULL;
+		vkResult = vkMapMemory(vkDevice, stagingMemory, 0, dataSize, 0, &data);
+		if(vkResult != VK_SUCCESS)
+		{
+			fprintf(gFILE, "CreateTextureFromRgba(): vkMapMemory() failed for %s with error code %d\n", debugName, vkResult);
+			return vkResult;
+		}
+
+		memcpy(data, pixelData, (size_t)dataSize);
+		vkUnmapMemory(vkDevice, stagingMemory);
+	}
+
+	memset((void*)textureResource, 0, sizeof(TextureResource));
+	vkResult = CreateImageResource(width, height, 1, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, &textureResource->vkImage, &textureResource->vkDeviceMemory, debugName);
+	if(vkResult != VK_SUCCESS)
+	{
+		return vkResult;
+	}
+
+	// Both transitions and the copy share one submission.
+	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+	if(commandBuffer == VK_NULL_HANDLE)
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	RecordImageLayoutTransition(commandBuffer, textureResource->vkImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	RecordCopyBufferToImage(commandBuffer, stagingBuffer, stagingOffset, textureResource->vkImage, width, height);
+	RecordImageLayoutTransition(commandBuffer, textureResource->vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	EndSingleTimeCommands(commandBuffer);
+
+	VkImageViewCreateInfo vkImageViewCreateInfo;
+	memset((void*)&vkImageViewCreateInfo, 0, sizeof(VkImageViewCreateInfo));
+	vkImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	vkImageViewCreateInfo.image = textureResource->vkImage;
+	vkImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	vkImageViewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	vkImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	vkImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+	vkImageViewCreateInfo.subresourceRange.levelCount = 1;
+	vkImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	vkImageViewCreateInfo.subresourceRange.layerCount = 1;
+
+	vkResult = vkCreateImageView(vkDevice, &vkImageViewCreateInfo, NULL, &textureResource->vkImageView);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateTextureFromRgba(): vkCreateImageView() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	VkSamplerCreateInfo vkSamplerCreateInfo;
+	memset((void*)&vkSamplerCreateInfo, 0, sizeof(VkSamplerCreateInfo));
+	vkSamplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	vkSamplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	vkSamplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	vkSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	vkSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	vkSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	vkSamplerCreateInfo.anisotropyEnable = VK_FALSE;
+	vkSamplerCreateInfo.maxAnisotropy = 1.0f;
+	vkSamplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	vkSamplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+	vkSamplerCreateInfo.compareEnable = VK_FALSE;
+	vkSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+
+	vkResult = vkCreateSampler(vkDevice, &vkSamplerCreateInfo, NULL, &textureResource->vkSampler);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "CreateTextureFromRgba(): vkCreateSampler() failed for %s with error code %d\n", debugName, vkResult);
+		return vkResult;
+	}
+
+	textureResource->width = width;
+	textureResource->height = height;
+
+	if(ringStaged)
+	{
+		ReleaseClipmapStagingBytes(stagingOffset);
+	}
+	else
+	{
+		vkDestroyBuffer(vkDevice, stagingBuffer, NULL);
+		vkFreeMemory(vkDevice, stagingMemory, NULL);
+	}
+
+	return vkResult;
+}
+
+// Work-stealing task pool shared by clipmap streaming and procedural generation.
+// Work is submitted as batches of `count` calls to function(context, index). A
+// batch may depend on other batches and is only queued once they have finished.
+// Workers pop their own queue LIFO and steal FIFO from the others; a thread that
+// waits on a batch runs queued tasks, and only blocks once the batch's last
+// tasks are running elsewhere.
+typedef void (*ClipmapTaskFunction)(void* context, uint32_t index);
+
+const uint32_t gClipmapMaxTaskWorkers = 15u;
+const uint32_t gClipmapMaxTaskDependents = 4u;
+// Empty polls a waiter makes before it blocks on its event.
+const uint32_t gClipmapTaskWaitSpinCount = 64u;
+
+struct ClipmapTaskBatch
+{
+        ClipmapTaskFunction function;
+        void* context;
+        uint32_t count;
+        volatile LONG remaining;
+        volatile LONG blockers;
+        // NULL while running, then the event of a thread blocked on the batch,
+        // and gClipmapTaskBatchDone once it has finished.
+        volatile PVOID completion;
+        ClipmapTaskBatch* dependents[gClipmapMaxTaskDependents];
+        uint32_t dependentCount;
+};
+
+struct ClipmapTaskItem
+{
+        ClipmapTaskBatch* batch;
+        uint32_t index;
+};
+
+struct ClipmapTaskQueue
+{
+        CRITICAL_SECTION lock;
+        ClipmapVector<ClipmapTaskItem> items;
+        size_t head;
+};
+
+// Queue [workerCount] is shared by threads outside the pool (render thread,
+// streaming worker).
+struct ClipmapTaskPool
+{
+        HANDLE workers[gClipmapMaxTaskWorkers];
+        uint32_t workerCount;
+        HANDLE workSemaphore;
+        ClipmapTaskQueue queues[gClipmapMaxTaskWorkers + 1u];
+        volatile LONG stopRequested;
+        bool initialized;
+};
+
+ClipmapTaskPool gClipmapTaskPool;
+static thread_local uint32_t gClipmapTaskThreadIndex = UINT32_MAX;
+// Auto-reset event a thread blocks on while waiting for a batch; created on its
+// first wait.
+static thread_local HANDLE gClipmapTaskWaitEvent = NULL;
+static char gClipmapTaskBatchDoneMarker;
+static PVOID const gClipmapTaskBatchDone = (PVOID)&gClipmapTaskBatchDoneMarker;
+
+static inline uint32_t GetClipmapTaskQueueIndex(void)
+{
+        return (gClipmapTaskThreadIndex < gClipmapTaskPool.workerCount) ? gClipmapTaskThreadIndex : gClipmapTaskPool.workerCount;
+}
+
+static void PushClipmapTasks(ClipmapTaskBatch* batch)
+{
+        ClipmapTaskQueue& queue = gClipmapTaskPool.queues[GetClipmapTaskQueueIndex()];
+        EnterCriticalSection(&queue.lock);
+        for(uint32_t index = batch->count; index > 0u; index--)
+        {
+                ClipmapTaskItem item = { batch, index - 1u };
+                queue.items.push_back(item);
+        }
+        LeaveCriticalSection(&queue.lock);
+
+        if(gClipmapTaskPool.workSemaphore != NULL && gClipmapTaskPool.workerCount > 0u)
+        {
+                ReleaseSemaphore(gClipmapTaskPool.workSemaphore, (LONG)CLIPMAP_MIN(batch->count, gClipmapTaskPool.workerCount), NULL);
+        }
+}
+
+static bool PopClipmapTask(uint32_t queueIndex, bool steal, ClipmapTaskItem* outItem)
+{
+        ClipmapTaskQueue& queue = gClipmapTaskPool.queues[queueIndex];
+        bool found = false;
+
+        EnterCriticalSection(&queue.lock);
+        if(queue.head < queue.items.size())
+        {
+                if(steal)
+                {
+                        *outItem = queue.items[queue.head];
+                        queue.head++;
+                }
+                else
+                {
+                        *outItem = queue.items.back();
+                        queue.items.pop_back();
+                }
+
+                if(queue.head >= queue.items.size())
+                {
+                        queue.items.clear();
+                        queue.head = 0;
+                }
+                found = true;
+        }
+        LeaveCriticalSection(&queue.lock);
+
+        return found;
+}
+
+static void ReleaseClipmapTaskBatch(ClipmapTaskBatch* batch);
+
+// Dependents are released before the batch is marked done; once a waiter sees
+// that the batch is no longer touched and may go out of scope. Only the waiter's
+// event, which outlives the batch, is signalled afterwards.
+static void CompleteClipmapTaskBatch(ClipmapTaskBatch* batch)
+{
+        for(uint32_t i = 0; i < batch->dependentCount; i++)
+        {
+                ReleaseClipmapTaskBatch(batch->dependents[i]);
+        }
+
+        PVOID waiter = InterlockedExchangePointer(&batch->completion, gClipmapTaskBatchDone);
+        if(waiter != NULL)
+        {
+                SetEvent((HANDLE)waiter);
+        }
+}
+
+static void ReleaseClipmapTaskBatch(ClipmapTaskBatch* batch)
+{
+        if(InterlockedDecrement(&batch->blockers) != 0)
+        {
+                return;
+        }
+
+        if(batch->count == 0u)
+        {
+                CompleteClipmapTaskBatch(batch);
+                return;
+        }
+
+        PushClipmapTasks(batch);
+}
+
+static bool RunPendingClipmapTask(void)
+{
+        uint32_t queueCount = gClipmapTaskPool.workerCount + 1u;
+        uint32_t ownIndex = GetClipmapTaskQueueIndex();
+
+        ClipmapTaskItem item;
+        bool found = PopClipmapTask(ownIndex, false, &item);
+        for(uint32_t offset = 1u; !found && offset < queueCount; offset++)
+        {
+                found = PopClipmapTask((ownIndex + offset) % queueCount, true, &item);
+        }
+
+        if(!found)
+        {
+                return false;
+        }
+
+        item.batch->function(item.batch->context, item.index);
+        if(InterlockedDecrement(&item.batch->remaining) == 0)
+        {
+                CompleteClipmapTaskBatch(item.batch);
+        }
+        return true;
+}
+
+static void InitClipmapTaskBatch(ClipmapTaskBatch* batch, ClipmapTaskFunction function, void* context, uint32_t count)
+{
+        memset((void*)batch, 0, sizeof(ClipmapTaskBatch));
+        batch->function = function;
+        batch->context = context;
+        batch->count = count;
+        batch->remaining = (LONG)count;
+        // Held by the submitter until SubmitClipmapTaskBatch().
+        batch->blockers = 1;
+}
+
+// `after` is queued only once `before` has finished. Both must still be
+// unsubmitted. Returns false, leaving both untouched, when `before` already has
+// gClipmapMaxTaskDependents dependents.
+static bool AddClipmapTaskDependency(ClipmapTaskBatch* before, ClipmapTaskBatch* after)
+{
+        if(before->dependentCount >= gClipmapMaxTaskDependents)
+        {
+                fprintf(gFILE, "AddClipmapTaskDependency(): a batch takes at most %u dependents\n", gClipmapMaxTaskDependents);
+                return false;
+        }
+
+        before->dependents[before->dependentCount++] = after;
+        after->blockers++;
+        return true;
+}
+
+static void SubmitClipmapTaskBatch(ClipmapTaskBatch* batch)
+{
+        ReleaseClipmapTaskBatch(batch);
+}
+
+static inline bool IsClipmapTaskBatchDone(ClipmapTaskBatch* batch)
+{
+        return InterlockedCompareExchangePointer(&batch->completion, NULL, NULL) == gClipmapTaskBatchDone;
+}
+
+// Every submitted batch has to be waited on before its storage is released.
+static void WaitForClipmapTaskBatch(ClipmapTaskBatch* batch)
+{
+        uint32_t idlePolls = 0u;
+        while(!IsClipmapTaskBatchDone(batch))
+        {
+                if(RunPendingClipmapTask())
+                {
+                        idlePolls = 0u;
+                        continue;
+                }
+
+                if(++idlePolls < gClipmapTaskWaitSpinCount)
+                {
+                        YieldProcessor();
+                        continue;
+                }
+
+                if(gClipmapTaskWaitEvent == NULL)
+                {
+                        gClipmapTaskWaitEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+                        if(gClipmapTaskWaitEvent == NULL)
+                        {
+                                Sleep(0);
+                                continue;
+                        }
+                }
+
+                // Nothing left to steal: the remaining tasks run on other threads,
+                // and whichever finishes the batch signals the event.
+                if(InterlockedCompareExchangePointer(&batch->completion, (PVOID)gClipmapTaskWaitEvent, NULL) == NULL)
+                {
+                        WaitForSingleObject(gClipmapTaskWaitEvent, INFINITE);
+                        return;
+                }
+        }
+}
+
+// Called by threads that may have waited on a batch before they exit.
+static void CloseClipmapTaskWaitEvent(void)
+{
+        if(gClipmapTaskWaitEvent != NULL)
+        {
+                CloseHandle(gClipmapTaskWaitEvent);
+                gClipmapTaskWaitEvent = NULL;
+        }
+}
+
+static void RunClipmapTasks(ClipmapTaskFunction function, void* context, uint32_t count)
+{
+        ClipmapTaskBatch batch;
+        InitClipmapTaskBatch(&batch, function, context, count);
+        SubmitClipmapTaskBatch(&batch);
+        WaitForClipmapTaskBatch(&batch);
+}
+
+static DWORD WINAPI ClipmapTaskWorkerProc(LPVOID parameter)
+{
+        gClipmapTaskThreadIndex = (uint32_t)(uintptr_t)parameter;
+
+        for(;;)
+        {
+                WaitForSingleObject(gClipmapTaskPool.workSemaphore, INFINITE);
+                if(InterlockedCompareExchange(&gClipmapTaskPool.stopRequested, 0, 0) != 0)
+                {
+                        break;
+                }
+
+                while(RunPendingClipmapTask())
+                {
+                }
+        }
+
+        CloseClipmapTaskWaitEvent();
+        CloseClipmapTileSpillEvent();
+        return 0;
+}
+
+static uint32_t GetDefaultClipmapTaskWorkerCount(void)
+{
+        SYSTEM_INFO systemInfo;
+        memset((void*)&systemInfo, 0, sizeof(SYSTEM_INFO));
+        GetSystemInfo(&systemInfo);
+
+        uint32_t processorCount = (systemInfo.dwNumberOfProcessors > 0) ? (uint32_t)systemInfo.dwNumberOfProcessors : 1u;
+        return CLIPMAP_MIN(processorCount - 1u, gClipmapMaxTaskWorkers);
+}
+
+// Must not be called while tasks are in flight.
+static void InitializeClipmapTaskPool(uint32_t workerCount)
+{
+        if(gClipmapTaskPool.initialized)
+        {
+                return;
+        }
+
+        for(uint32_t queueIndex = 0; queueIndex <= gClipmapMaxTaskWorkers; queueIndex++)
+        {
+                InitializeCriticalSection(&gClipmapTaskPool.queues[queueIndex].lock);
+                gClipmapTaskPool.queues[queueIndex].items.clear();
+                gClipmapTaskPool.queues[queueIndex].head = 0;
+        }
+
+        gClipmapTaskPool.workerCount = 0;
+        gClipmapTaskPool.stopRequested = 0;
+        gClipmapTaskPool.initialized = true;
+
+        // Without workers every task runs on the thread that waits for it.
+        gClipmapTaskPool.workSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+        if(gClipmapTaskPool.workSemaphore == NULL)
+        {
+                fprintf(gFILE, "InitializeClipmapTaskPool(): CreateSemaphore failed (%lu), running tasks inline\n", (unsigned long)GetLastError());
+                return;
+        }
+
+        workerCount = CLIPMAP_MIN(workerCount, gClipmapMaxTaskWorkers);
+        for(uint32_t workerIndex = 0; workerIndex < workerCount; workerIndex++)
+        {
+                gClipmapTaskPool.workers[workerIndex] = CreateThread(NULL, 0, ClipmapTaskWorkerProc, (LPVOID)(uintptr_t)workerIndex, 0, NULL);
+                if(gClipmapTaskPool.workers[workerIndex] == NULL)
+                {
+                        fprintf(gFILE, "InitializeClipmapTaskPool(): CreateThread failed for worker %u (%lu)\n", workerIndex, (unsigned long)GetLastError());
+                        break;
+                }
+                gClipmapTaskPool.workerCount++;
+        }
+
+        fprintf(gFILE, "InitializeClipmapTaskPool(): %u worker threads\n", gClipmapTaskPool.workerCount);
+}
+
+static void ShutdownClipmapTaskPool(void)
+{
+        if(!gClipmapTaskPool.initialized)
+        {
+                return;
+        }
+
+        InterlockedExchange(&gClipmapTaskPool.stopRequested, 1);
+        if(gClipmapTaskPool.workerCount > 0u)
+        {
+                ReleaseSemaphore(gClipmapTaskPool.workSemaphore, (LONG)gClipmapTaskPool.workerCount, NULL);
+        }
+
+        for(uint32_t workerIndex = 0; workerIndex < gClipmapTaskPool.workerCount; workerIndex++)
+        {
+                WaitForSingleObject(gClipmapTaskPool.workers[workerIndex], INFINITE);
+                CloseHandle(gClipmapTaskPool.workers[workerIndex]);
+                gClipmapTaskPool.workers[workerIndex] = NULL;
+        }
+
+        if(gClipmapTaskPool.workSemaphore != NULL)
+        {
+                CloseHandle(gClipmapTaskPool.workSemaphore);
+                gClipmapTaskPool.workSemaphore = NULL;
+        }
+
+        for(uint32_t queueIndex = 0; queueIndex <= gClipmapMaxTaskWorkers; queueIndex++)
+        {
+                gClipmapTaskPool.queues[queueIndex].items.release();
+                gClipmapTaskPool.queues[queueIndex].head = 0;
+                DeleteCriticalSection(&gClipmapTaskPool.queues[queueIndex].lock);
+        }
+
+        gClipmapTaskPool.workerCount = 0;
+        gClipmapTaskPool.initialized = false;
+}
+
+static inline uint32_t HashCoords(int x, int y)
+{
+        uint32_t state = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+        state = (state ^ (state >> 13u)) * 1274126177u;
+        state ^= state >> 16u;
+        return state;
+}
+
+static float ValueNoise(int x, int y)
+{
+        return (float)HashCoords(x, y) / (float)UINT32_MAX;
+}
+
+static float SmoothNoise(float x, float y)
+{
+        int xi = (int)floorf(x);
+        int yi = (int)floorf(y);
+        float tx = x - (float)xi;
+        float ty = y - (float)yi;
+
+        float v00 = ValueNoise(xi, yi);
+        float v10 = ValueNoise(xi + 1, yi);
+        float v01 = ValueNoise(xi, yi + 1);
+        float v11 = ValueNoise(xi + 1, yi + 1);
+
+        float vx0 = v00 + (v10 - v00) * tx;
+        float vx1 = v01 + (v11 - v01) * tx;
+        return vx0 + (vx1 - vx0) * ty;
+}
+
+static float FractalNoise(float x, float y, int octaves, float lacunarity, float gain)
+{
+        float amplitude = 1.0f;
+        float frequency = 1.0f;
+        float sum = 0.0f;
+        for(int i = 0; i < octaves; i++)
+        {
+                sum += SmoothNoise(x * frequency, y * frequency) * amplitude;
+                frequency *= lacunarity;
+                amplitude *= gain;
+        }
+        return sum;
+}
+
+const uint32_t gProceduralRowsPerTask = 16u;
+
+struct ProceduralTerrainContext
+{
+        uint32_t size;
+        float* heightPixels;
+        uint8_t* diffusePixels;
+        uint8_t* normalPixels;
+};
+
+static glm::vec3 ProceduralHeightToColor(float h)
+{
+        if(h < 0.35f) return glm::mix(glm::vec3(0.05f, 0.2f, 0.05f), glm::vec3(0.25f, 0.35f, 0.18f), h / 0.35f);
+        if(h < 0.65f) return glm::mix(glm::vec3(0.25f, 0.35f, 0.18f), glm::vec3(0.35f, 0.3f, 0.22f), (h - 0.35f) / 0.3f);
+        return glm::mix(glm::vec3(0.35f, 0.3f, 0.22f), glm::vec3(0.75f, 0.75f, 0.78f), (h - 0.65f) / 0.35f);
+}
+
+// Normalized height of texel (x, y). Shared by the in-memory generator and the
+// terrain file writer so both produce the same terrain.
+static float ProceduralTerrainHeight(uint32_t x, uint32_t y)
+{
+        const float frequency = 1.0f / 180.0f;
+        float nx = (float)x * frequency;
+        float ny = (float)y * frequency;
+        float ridge = fabsf(FractalNoise(nx, ny, 5, 2.07f, 0.5f) * 2.0f - 1.0f);
+        float fbm = FractalNoise(nx * 0.6f, ny * 0.6f, 6, 2.0f, 0.55f);
+        return glm::clamp(0.6f * fbm + 0.7f * ridge, 0.0f, 1.0f);
+}
+
+static void EncodeProceduralDiffuse(float heightValue, uint8_t* outTexel)
+{
+        glm::vec3 color = ProceduralHeightToColor(heightValue);
+        outTexel[0] = (uint8_t)glm::clamp(color.r * 255.0f, 0.0f, 255.0f);
+        outTexel[1] = (uint8_t)glm::clamp(color.g * 255.0f, 0.0f, 255.0f);
+        outTexel[2] = (uint8_t)glm::clamp(color.b * 255.0f, 0.0f, 255.0f);
+        outTexel[3] = 255u;
+}
+
+// Normal from the heights of the four neighbouring texels.
+static void EncodeProceduralNormal(float hL, float hR, float hD, float hU, uint8_t* outTexel)
+{
+        float dx = (hR - hL);
+        float dy = (hU - hD);
+        glm::vec3 normal = glm::normalize(glm::vec3(-dx * gTerrainHeightScale, 2.0f, -dy * gTerrainHeightScale));
+
+        outTexel[0] = (uint8_t)glm::clamp((normal.x * 0.5f + 0.5f) * 255.0f, 0.0f, 255.0f);
+        outTexel[1] = (uint8_t)glm::clamp((normal.y * 0.5f + 0.5f) * 255.0f, 0.0f, 255.0f);
+        outTexel[2] = (uint8_t)glm::clamp((normal.z * 0.5f + 0.5f) * 255.0f, 0.0f, 255.0f);
+        outTexel[3] = 255u;
+}
+
+// Task: height and diffuse for one band of gProceduralRowsPerTask rows.
+static void GenerateProceduralTerrainRows(void* taskContext, uint32_t band)
+{
+        const ProceduralTerrainContext* context = (const ProceduralTerrainContext*)taskContext;
+        const uint32_t size = context->size;
+        const uint32_t firstRow = band * gProceduralRowsPerTask;
+        const uint32_t endRow = CLIPMAP_MIN(firstRow + gProceduralRowsPerTask, size);
+        float* heightPixels = context->heightPixels;
+        uint8_t* diffusePixels = context->diffusePixels;
+
+        for(uint32_t y = firstRow; y < endRow; y++)
+        {
+                for(uint32_t x = 0; x < size; x++)
+                {
+                        float heightValue = ProceduralTerrainHeight(x, y);
+                        size_t idx = (size_t)y * (size_t)size + (size_t)x;
+                        heightPixels[idx] = heightValue;
+                        EncodeProceduralDiffuse(heightValue, diffusePixels + idx * 4u);
+                }
+        }
+}
+
+// Task: normals for one band of rows; reads the finished height field.
+static void GenerateProceduralNormalRows(void* taskContext, uint32_t band)
+{
+        const ProceduralTerrainContext* context = (const ProceduralTerrainContext*)taskContext;
+        const uint32_t size = context->size;
+        const uint32_t firstRow = band * gProceduralRowsPerTask;
+        const uint32_t endRow = CLIPMAP_MIN(firstRow + gProceduralRowsPerTask, size);
+        const float* heightPixels = context->heightPixels;
+        uint8_t* normalPixels = context->normalPixels;
+
+        auto sampleHeight = [&](int x, int y) -> float
+        {
+                int sx = WrapCoordForTile(x, size);
+                int sy = WrapCoordForTile(y, size);
+                return heightPixels[(size_t)sy * (size_t)size + (size_t)sx];
+        };
+
+        for(uint32_t y = firstRow; y < endRow; y++)
+        {
+                for(uint32_t x = 0; x < size; x++)
+                {
+                        float hL = sampleHeight((int)x - 1, (int)y);
+                        float hR = sampleHeight((int)x + 1, (int)y);
+                        float hD = sampleHeight((int)x, (int)y - 1);
+                        float hU = sampleHeight((int)x, (int)y + 1);
+
+                        size_t idx = ((size_t)y * (size_t)size + (size_t)x) * 4u;
+                        EncodeProceduralNormal(hL, hR, hD, hU, normalPixels + idx);
+                }
+        }
+}
+
+static void GenerateProceduralTerrainImages(uint32_t size, ImageData* heightOut, ImageData* diffuseOut, ImageData* normalOut)
+{
+        DestroyImageData(heightOut);
+        DestroyImageData(diffuseOut);
+        DestroyImageData(normalOut);
+
+        const size_t pixelCount = (size_t)size * (size_t)size;
+        const size_t heightByteSize = pixelCount * sizeof(float);
+        const size_t rgbaByteSize = pixelCount * 4u;
+
+        float* heightPixels = (float*)malloc(heightByteSize);
+        uint8_t* diffusePixels = (uint8_t*)malloc(rgbaByteSize);
+        uint8_t* normalPixels = (uint8_t*)malloc(rgbaByteSize);
+        if(heightPixels == NULL || diffusePixels == NULL || normalPixels == NULL)
+        {
+                free(heightPixels);
+                free(diffusePixels);
+                free(normalPixels);
+                fprintf(gFILE, "GenerateProceduralTerrainImages(): allocation failed\n");
+                return;
+        }
+
+        ProceduralTerrainContext context;
+        context.size = size;
+        context.heightPixels = heightPixels;
+        context.diffusePixels = diffusePixels;
+        context.normalPixels = normalPixels;
+
+        uint32_t bandCount = (size + gProceduralRowsPerTask - 1u) / gProceduralRowsPerTask;
+        ClipmapTaskBatch terrainBatch;
+        ClipmapTaskBatch normalBatch;
+        InitClipmapTaskBatch(&terrainBatch, GenerateProceduralTerrainRows, &context, bandCount);
+        InitClipmapTaskBatch(&normalBatch, GenerateProceduralNormalRows, &context, bandCount);
+        // Normals difference the neighbouring rows, so they wait for the whole height pass.
+        if(AddClipmapTaskDependency(&terrainBatch, &normalBatch))
+        {
+                SubmitClipmapTaskBatch(&normalBatch);
+                SubmitClipmapTaskBatch(&terrainBatch);
+                WaitForClipmapTaskBatch(&terrainBatch);
+                WaitForClipmapTaskBatch(&normalBatch);
+        }
+        else
+        {
+                SubmitClipmapTaskBatch(&terrainBatch);
+                WaitForClipmapTaskBatch(&terrainBatch);
+                SubmitClipmapTaskBatch(&normalBatch);
+                WaitForClipmapTaskBatch(&normalBatch);
+        }
+
+        heightOut->width = size;
+        heightOut->height = size;
+        heightOut->size = (VkDeviceSize)heightByteSize;
+        heightOut->pixels = (uint8_t*)heightPixels;
+
+        diffuseOut->width = size;
+        diffuseOut->height = size;
+        diffuseOut->size = (VkDeviceSize)rgbaByteSize;
+        diffuseOut->pixels = diffusePixels;
+
+        normalOut->width = size;
+        normalOut->height = size;
+        normalOut->size = (VkDeviceSize)rgbaByteSize;
+        normalOut->pixels = normalPixels;
+
+        fprintf(gFILE, "GenerateProceduralTerrainImages(): generated %ux%u maps\n", size, size);
+}
+
+// Replaces a float height image by 16-bit unorm heights spanning its range and
+// sets the scale and bias that decode them.
+static bool QuantizeClipmapHeightImage(ImageData* image)
+{
+        const float* heights = (const float*)image->pixels;
+        const size_t texelCount = (size_t)image->width * (size_t)image->height;
+        uint16_t* quantized = (uint16_t*)malloc(texelCount * sizeof(uint16_t));
+        if(quantized == NULL || texelCount == 0u)
+        {
+                free(quantized);
+                fprintf(gFILE, "QuantizeClipmapHeightImage(): allocation failed for %ux%u\n", image->width, image->height);
+                return false;
+        }
+
+        float low = heights[0];
+        float high = heights[0];
+        for(size_t texel = 1; texel < texelCount; texel++)
+        {
+                low = CLIPMAP_MIN(low, heights[texel]);
+                high = CLIPMAP_MAX(high, heights[texel]);
+        }
+
+        gClipmapHeightScale = high - low;
+        gClipmapHeightBias = low;
+        for(size_t texel = 0; texel < texelCount; texel++)
+        {
+                quantized[texel] = QuantizeClipmapHeight(heights[texel], gClipmapHeightScale, gClipmapHeightBias);
+        }
+
+        free(image->pixels);
+        image->pixels = (uint8_t*)quantized;
+        image->size = (VkDeviceSize)(texelCount * sizeof(uint16_t));
+        return true;
+}
+
+static uint64_t PackTileKey(const ClipmapTileKey& key)
+{
+        uint64_t packed = ((uint64_t)key.attribute & 0xFFull) << 56;
+        packed |= ((uint64_t)key.mipLevel & 0xFFull) << 48;
+        packed |= ((uint64_t)key.tileX & 0xFFFFFFull) << 24;
+        packed |= ((uint64_t)key.tileY & 0xFFFFFFull);
+        return packed;
+}
+
+static inline uint32_t WrapCoordForTile(int value, uint32_t modulus)
+{
+        if(modulus == 0)
+        {
+                return 0u;
+        }
+
+        int wrapped = value % (int)modulus;
+        if(wrapped < 0)
+        {
+                wrapped += (int)modulus;
+        }
+        return (uint32_t)wrapped;
+}
+
+// Moves the entry to the most recently used end and pins it for the current job.
+static void TouchTileEntry(ClipmapAttributeSource& source, ClipmapTileCacheEntry* entry)
+{
+        uint32_t slot = GetTileCacheSlot(source, entry);
+        if(source.lruHead != slot)
+        {
+                UnlinkTileLru(source, slot);
+                LinkTileLruFront(source, slot);
+        }
+
+        entry->pinGeneration = source.pinGeneration;
+        entry->tile.lastUsedFrame = gClipmapTileFrameCounter;
+}
+
+// Starts a new pin scope; tiles pinned by the previous job become evictable.
+static void BeginTilePinScope(ClipmapAttributeSource& source)
+{
+        source.pinGeneration++;
+}
+
+// Unpinned tiles per attribute, counted from the LRU tail, that compete for
+// eviction when the shared budget is full. Tiles whose eviction frees no budget
+// are passed over and not counted, up to gClipmapEvictionScanLimit per attribute.
+static const uint32_t gClipmapEvictionCandidatesPerAttribute = 4u;
+static const uint32_t gClipmapEvictionScanLimit = 64u;
+
+// Budget returned by evicting a tile: none for uniform tiles or a payload other
+// tiles still refer to.
+static size_t GetTileEvictionBytes(const ClipmapTileResident& tile)
+{
+        if(tile.payload != 0u)
+        {
+                const ClipmapTilePayload& payload = gClipmapTilePayloads.payloads[tile.payload - 1u];
+                return (payload.refCount == 1u) ? payload.storageBytes : 0u;
+        }
+        return tile.storageBytes;
+}
+
+// Picks the resident tile across all attributes that is cheapest to lose: its
+// attribute's measured reload cost divided by the frames since it was last used
+// and by the bytes its eviction frees.
+static ClipmapTileCacheEntry* GetBudgetEvictionCandidate(ClipmapAttributeSource** outSource)
+{
+        ClipmapTileCacheEntry* bestEntry = NULL;
+        double bestScore = 0.0;
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                double reloadCost = CLIPMAP_MAX(source.reloadCostMicroseconds, 1.0);
+
+                uint32_t slot = source.lruTail;
+                uint32_t considered = 0;
+                for(uint32_t scanned = 0; slot != gClipmapTileSlotNone && considered < gClipmapEvictionCandidatesPerAttribute &&
+                    scanned < gClipmapEvictionScanLimit; scanned++)
+                {
+                        ClipmapTileCacheEntry* entry = &source.tileCache[slot - 1u];
+                        if(IsTileCacheEntryPinned(source, entry))
+                        {
+                                break;
+                        }
+
+                        slot = entry->lruPrev;
+                        size_t freedBytes = GetTileEvictionBytes(entry->tile);
+                        if(freedBytes == 0u)
+                        {
+                                continue;
+                        }
+                        considered++;
+
+                        uint64_t age = (gClipmapTileFrameCounter > entry->tile.lastUsedFrame) ? (gClipmapTileFrameCounter - entry->tile.lastUsedFrame) : 0u;
+                        double score = reloadCost / ((1.0 + (double)age) * (double)freedBytes);
+                        if(bestEntry == NULL || score < bestScore)
+                        {
+                                bestEntry = entry;
+                                bestScore = score;
+                                *outSource = &source;
+                        }
+                }
+        }
+
+        return bestEntry;
+}
+
+static size_t GetClipmapTileCacheResidentBytes(void)
+{
+        size_t residentBytes = 0;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                residentBytes += gClipmapAttributeSources[attributeIndex].residentBytes;
+        }
+        return residentBytes;
+}
+
+// Evicts until `bytes` more fit in the tile cache or every remaining tile is pinned.
+static void ReserveTileCacheBytes(size_t bytes)
+{
+        while(GetClipmapTileCacheResidentBytes() + bytes > gClipmapTileCacheCapacityBytes)
+        {
+                ClipmapAttributeSource* source = NULL;
+                ClipmapTileCacheEntry* candidate = GetBudgetEvictionCandidate(&source);
+                if(candidate == NULL)
+                {
+                        break;
+                }
+
+                SpillTileCacheEntry(*source, *candidate);
+                RemoveTileCacheEntry(*source, candidate->key);
+        }
+}
+
+// Charges one of source's tiles to the budget, evicting from any attribute when
+// it is used up; prefetch never evicts. Returns the tile's arena block, or its
+// payload in the mapped terrain file.
+static uint8_t* ClaimTileStorage(ClipmapAttributeSource& source, const ClipmapTileKey& key, bool allowEviction)
+{
+        size_t storageBytes = GetTileStorageBytes(source);
+        if(allowEviction)
+        {
+                ReserveTileCacheBytes(storageBytes);
+        }
+        if(GetClipmapTileCacheResidentBytes() + storageBytes > gClipmapTileCacheCapacityBytes)
+        {
+                return NULL;
+        }
+
+        uint8_t* data = NULL;
+        if(source.mappedView != NULL)
+        {
+                if(key.mipLevel < source.mipCount)
+                {
+                        data = GetMappedTilePayload(source, key.mipLevel, key.tileX, key.tileY);
+                }
+        }
+        else
+        {
+                uint32_t blockCount = (uint32_t)(storageBytes / gClipmapTileArena.blockSize);
+                data = AllocateClipmapTileBlocks(gClipmapTileArena, blockCount);
+        }
+
+        if(data != NULL)
+        {
+                source.residentBytes += storageBytes;
+                source.residentBytesHighWater = CLIPMAP_MAX(source.residentBytesHighWater, source.residentBytes);
+        }
+        return data;
+}
+
+// Copies a tileSize x tileSize block starting at texel (originX, originY) out of
+// a wrapping source image. Every row is at most two contiguous spans, split where
+// it crosses the right edge of the image.
+static void CopyTileFromImage(const ImageData& image, uint32_t bytesPerTexel, uint32_t tileSize, int originX, int originY, uint8_t* outData)
+{
+        size_t srcRowBytes = (size_t)image.width * (size_t)bytesPerTexel;
+        size_t dstRowBytes = (size_t)tileSize * (size_t)bytesPerTexel;
+        uint32_t firstSrcX = WrapCoordForTile(originX, image.width);
+        uint32_t srcY = WrapCoordForTile(originY, image.height);
+
+        for(uint32_t localY = 0; localY < tileSize; localY++)
+        {
+                const uint8_t* srcRow = image.pixels + (size_t)srcY * srcRowBytes;
+                uint8_t* dstRow = outData + (size_t)localY * dstRowBytes;
+
+                uint32_t copied = 0u;
+                uint32_t srcX = firstSrcX;
+                while(copied < tileSize)
+                {
+                        uint32_t span = CLIPMAP_MIN(tileSize - copied, image.width - srcX);
+                        memcpy(dstRow + (size_t)copied * bytesPerTexel, srcRow + (size_t)srcX * bytesPerTexel, (size_t)span * bytesPerTexel);
+                        copied += span;
+                        srcX = 0u;
+                }
+
+                srcY++;
+                if(srcY == image.height)
+                {
+                        srcY = 0u;
+                }
+        }
+}
+
+// Resident tile compression. Every channel of a texel is predicted from its
+// left, upper and upper-left neighbours with the LOCO-I median predictor and the
+// residuals are Rice coded, with one parameter per row. Heights are predicted as
+// the bit patterns of their floats, which order like the values for the
+// non-negative heights the terrain holds. A stream starts with its codec; a
+// tile that would not shrink is stored raw behind it.
+enum ClipmapTileCodec
+{
+        CLIPMAP_TILE_CODEC_RAW = 0,
+        CLIPMAP_TILE_CODEC_DELTA_RICE = 1
+};
+
+// Largest unary quotient; a residual whose quotient reaches it is written raw.
+static const uint32_t gClipmapTileRiceEscape = 16u;
+
+struct ClipmapBitWriter
+{
+        uint8_t* data;
+        size_t capacity;
+        size_t size;
+        uint64_t bits;
+        uint32_t bitCount;
+        bool overflow;
+};
+
+struct ClipmapBitReader
+{
+        const uint8_t* data;
+        size_t size;
+        size_t position;
+        uint64_t bits;
+        uint32_t bitCount;
+};
+
+// Appends the low count bits of value, least significant first; count <= 32.
+static inline void WriteClipmapBits(ClipmapBitWriter& writer, uint64_t value, uint32_t count)
+{
+        writer.bits |= (value & ((1ull << count) - 1u)) << writer.bitCount;
+        writer.bitCount += count;
+        while(writer.bitCount >= 8u)
+        {
+                if(writer.size == writer.capacity)
+                {
+                        writer.overflow = true;
+                        writer.bits = 0u;
+                        writer.bitCount = 0u;
+                        return;
+                }
+                writer.data[writer.size++] = (uint8_t)writer.bits;
+                writer.bits >>= 8u;
+                writer.bitCount -= 8u;
+        }
+}
+
+static inline void FlushClipmapBits(ClipmapBitWriter& writer)
+{
+        if(writer.bitCount != 0u)
+        {
+                WriteClipmapBits(writer, 0u, 8u - writer.bitCount);
+        }
+}
+
+// Keeps at least 57 bits buffered; past the end of the stream it reads zeros.
+static inline void RefillClipmapBits(ClipmapBitReader& reader)
+{
+        while(reader.bitCount <= 56u)
+        {
+                uint64_t byte = (reader.position < reader.size) ? reader.data[reader.position] : 0u;
+                reader.position++;
+                reader.bits |= byte << reader.bitCount;
+                reader.bitCount += 8u;
+        }
+}
+
+static inline uint32_t ReadClipmapBits(ClipmapBitReader& reader, uint32_t count)
+{
+        RefillClipmapBits(reader);
+        uint32_t value = (uint32_t)(reader.bits & ((1ull << count) - 1u));
+        reader.bits >>= count;
+        reader.bitCount -= count;
+        return value;
+}
+
+// Counts the ones before the next zero, stopping at the escape.
+static inline uint32_t ReadClipmapUnary(ClipmapBitReader& reader)
+{
+        RefillClipmapBits(reader);
+        unsigned long firstZero = 0;
+        _BitScanForward64(&firstZero, ~reader.bits);
+        if(firstZero >= gClipmapTileRiceEscape)
+        {
+                reader.bits >>= gClipmapTileRiceEscape;
+                reader.bitCount -= gClipmapTileRiceEscape;
+                return gClipmapTileRiceEscape;
+        }
+        reader.bits >>= firstZero + 1u;
+        reader.bitCount -= (uint32_t)firstZero + 1u;
+        return (uint32_t)firstZero;
+}
+
+static inline uint32_t GetClipmapTileChannel(const uint8_t* texels, size_t valueIndex, uint32_t channelBits)
+{
+        if(channelBits == 32u)
+        {
+                uint32_t value;
+                memcpy(&value, texels + valueIndex * 4u, sizeof(value));
+                return value;
+        }
+        if(channelBits == 16u)
+        {
+                uint16_t value;
+                memcpy(&value, texels + valueIndex * 2u, sizeof(value));
+                return value;
+        }
+        return texels[valueIndex];
+}
+
+static inline void SetClipmapTileChannel(uint8_t* texels, size_t valueIndex, uint32_t channelBits, uint32_t value)
+{
+        if(channelBits == 32u)
+        {
+                memcpy(texels + valueIndex * 4u, &value, sizeof(value));
+                return;
+        }
+        if(channelBits == 16u)
+        {
+                uint16_t narrow = (uint16_t)value;
+                memcpy(texels + valueIndex * 2u, &narrow, sizeof(narrow));
+                return;
+        }
+        texels[valueIndex] = (uint8_t)value;
+}
+
+static inline uint32_t PredictClipmapTileChannel(const uint8_t* texels, uint32_t tileSize, uint32_t channelCount, uint32_t channelBits, uint32_t x, uint32_t y, size_t valueIndex)
+{
+        size_t rowValues = (size_t)tileSize * channelCount;
+        if(y == 0u)
+        {
+                return (x == 0u) ? 0u : GetClipmapTileChannel(texels, valueIndex - channelCount, channelBits);
+        }
+        uint32_t up = GetClipmapTileChannel(texels, valueIndex - rowValues, channelBits);
+        if(x == 0u)
+        {
+                return up;
+        }
+
+        uint32_t left = GetClipmapTileChannel(texels, valueIndex - channelCount, channelBits);
+        uint32_t upLeft = GetClipmapTileChannel(texels, valueIndex - rowValues - channelCount, channelBits);
+        uint32_t low = CLIPMAP_MIN(left, up);
+        uint32_t high = CLIPMAP_MAX(left, up);
+        if(upLeft >= high)
+        {
+                return low;
+        }
+        if(upLeft <= low)
+        {
+                return high;
+        }
+        return left + up - upLeft;
+}
+
+// Channel layout of an attribute's texels: one 32-bit float or 16-bit unorm
+// height, or four 8-bit bytes.
+static inline void GetClipmapTileChannelLayout(const ClipmapAttributeSource& source, uint32_t* outChannelCount, uint32_t* outChannelBits)
+{
+        bool height16 = !source.isFloat && source.bytesPerTexel == sizeof(uint16_t);
+        *outChannelCount = (source.isFloat || height16) ? 1u : source.bytesPerTexel;
+        *outChannelBits = source.isFloat ? 32u : (height16 ? 16u : 8u);
+}
+
+// Writes the stream of a tile to out and returns its length in bytes, codec
+// included. capacity must hold the raw tile and its codec.
+static size_t EncodeClipmapTile(const uint8_t* texels, uint32_t tileSize, uint32_t channelCount, uint32_t channelBits, uint8_t* out, size_t capacity)
+{
+        size_t rowValues = (size_t)tileSize * channelCount;
+        size_t rawBytes = rowValues * tileSize * (channelBits / 8u);
+        uint32_t shift = 32u - channelBits;
+        uint32_t residuals[gClipmapTileSize * 4u];
+        assert(rowValues <= sizeof(residuals) / sizeof(residuals[0]));
+
+        ClipmapBitWriter writer = { out + gClipmapTileStreamHeaderBytes, CLIPMAP_MIN(capacity - gClipmapTileStreamHeaderBytes, rawBytes), 0u, 0u, 0u, false };
+        for(uint32_t y = 0; y < tileSize && !writer.overflow; y++)
+        {
+                uint64_t residualSum = 0u;
+                for(uint32_t x = 0; x < tileSize; x++)
+                {
+                        for(uint32_t channel = 0; channel < channelCount; channel++)
+                        {
+                                size_t valueIndex = (size_t)y * rowValues + (size_t)x * channelCount + channel;
+                                uint32_t predicted = PredictClipmapTileChannel(texels, tileSize, channelCount, channelBits, x, y, valueIndex);
+                                int32_t delta = (int32_t)((GetClipmapTileChannel(texels, valueIndex, channelBits) - predicted) << shift) >> shift;
+                                uint32_t zigzag = ((uint32_t)delta << 1u) ^ (uint32_t)(delta >> 31);
+                                residuals[(size_t)x * channelCount + channel] = zigzag;
+                                residualSum += zigzag;
+                        }
+                }
+
+                if(residualSum == 0u)
+                {
+                        WriteClipmapBits(writer, 0u, 1u);
+                        continue;
+                }
+
+                // Rice parameter near the mean residual of the row.
+                uint32_t k = 0u;
+                while(k < 31u && ((uint64_t)rowValues << k) < residualSum)
+                {
+                        k++;
+                }
+                WriteClipmapBits(writer, 1u, 1u);
+                WriteClipmapBits(writer, k, 5u);
+
+                for(size_t i = 0; i < rowValues; i++)
+                {
+                        uint32_t quotient = residuals[i] >> k;
+                        if(quotient >= gClipmapTileRiceEscape)
+                        {
+                                WriteClipmapBits(writer, (1u << gClipmapTileRiceEscape) - 1u, gClipmapTileRiceEscape);
+                                WriteClipmapBits(writer, residuals[i], channelBits);
+                                continue;
+                        }
+                        WriteClipmapBits(writer, (1u << quotient) - 1u, quotient + 1u);
+                        WriteClipmapBits(writer, residuals[i], k);
+                }
+        }
+        FlushClipmapBits(writer);
+
+        if(writer.overflow || writer.size >= rawBytes)
+        {
+                out[0] = CLIPMAP_TILE_CODEC_RAW;
+                memcpy(out + gClipmapTileStreamHeaderBytes, texels, rawBytes);
+                return rawBytes + gClipmapTileStreamHeaderBytes;
+        }
+
+        out[0] = CLIPMAP_TILE_CODEC_DELTA_RICE;
+        return writer.size + gClipmapTileStreamHeaderBytes;
+}
+
+static bool DecodeClipmapTile(const uint8_t* stream, size_t streamBytes, uint32_t tileSize, uint32_t channelCount, uint32_t channelBits, uint8_t* outTexels)
+{
+        size_t rowValues = (size_t)tileSize * channelCount;
+        size_t rawBytes = rowValues * tileSize * (channelBits / 8u);
+        if(streamBytes < gClipmapTileStreamHeaderBytes)
+        {
+                return false;
+        }
+
+        if(stream[0] == CLIPMAP_TILE_CODEC_RAW)
+        {
+                if(streamBytes < rawBytes + gClipmapTileStreamHeaderBytes)
+                {
+                        return false;
+                }
+                memcpy(outTexels, stream + gClipmapTileStreamHeaderBytes, rawBytes);
+                return true;
+        }
+        if(stream[0] != CLIPMAP_TILE_CODEC_DELTA_RICE)
+        {
+                return false;
+        }
+
+        uint32_t mask = (channelBits == 32u) ? 0xFFFFFFFFu : ((1u << channelBits) - 1u);
+        ClipmapBitReader reader = { stream + gClipmapTileStreamHeaderBytes, streamBytes - gClipmapTileStreamHeaderBytes, 0u, 0u, 0u };
+        for(uint32_t y = 0; y < tileSize; y++)
+        {
+                bool coded = ReadClipmapBits(reader, 1u) != 0u;
+                uint32_t k = coded ? ReadClipmapBits(reader, 5u) : 0u;
+                for(uint32_t x = 0; x < tileSize; x++)
+                {
+                        for(uint32_t channel = 0; channel < channelCount; channel++)
+                        {
+                                size_t valueIndex = (size_t)y * rowValues + (size_t)x * channelCount + channel;
+                                uint32_t zigzag = 0u;
+                                if(coded)
+                                {
+                                        uint32_t quotient = ReadClipmapUnary(reader);
+                                        zigzag = (quotient == gClipmapTileRiceEscape) ? ReadClipmapBits(reader, channelBits) :
+                                                ((quotient << k) | ReadClipmapBits(reader, k));
+                                }
+                                uint32_t delta = (zigzag >> 1u) ^ (0u - (zigzag & 1u));
+                                uint32_t predicted = PredictClipmapTileChannel(outTexels, tileSize, channelCount, channelBits, x, y, valueIndex);
+                                SetClipmapTileChannel(outTexels, valueIndex, channelBits, (predicted + delta) & mask);
+                        }
+                }
+        }
+
+        // Bits buffered but not consumed were read ahead, possibly past the end.
+        return reader.position - reader.bitCount / 8u <= reader.size;
+}
+
+static bool IsUniformTile(const uint8_t* texels, size_t texelCount, uint32_t bytesPerTexel)
+{
+        if(bytesPerTexel > sizeof(((ClipmapTileResident*)NULL)->uniformTexel))
+        {
+                return false;
+        }
+        for(size_t texel = 1; texel < texelCount; texel++)
+        {
+                if(memcmp(texels + texel * bytesPerTexel, texels, bytesPerTexel) != 0)
+                {
+                        return false;
+                }
+        }
+        return true;
+}
+
+// Copies bytes between a flat buffer and a chain of arena blocks.
+static void WriteClipmapTileChain(uint8_t* blockData, const uint8_t* bytes, size_t byteCount)
+{
+        size_t blockSize = gClipmapTileArena.blockSize;
+        for(size_t offset = 0; offset < byteCount && blockData != NULL; offset += blockSize)
+        {
+                memcpy(blockData, bytes + offset, CLIPMAP_MIN(blockSize, byteCount - offset));
+                blockData = GetNextClipmapTileBlock(gClipmapTileArena, blockData);
+        }
+}
+
+static void ReadClipmapTileChain(const uint8_t* blockData, uint8_t* bytes, size_t byteCount)
+{
+        size_t blockSize = gClipmapTileArena.blockSize;
+        for(size_t offset = 0; offset < byteCount && blockData != NULL; offset += blockSize)
+        {
+                memcpy(bytes + offset, blockData, CLIPMAP_MIN(blockSize, byteCount - offset));
+                blockData = GetNextClipmapTileBlock(gClipmapTileArena, blockData);
+        }
+}
+
+// Second tier of the tile cache: a bounded temporary file that tiles evicted
+// from memory spill to, so a later miss reads them back instead of rebuilding
+// them from the source. Tiles never change once built, so a tile already in the
+// file is not written again, and slots are reused oldest first. A read blocks
+// the task pool thread that loads the tile until it lands; the file is opened
+// for overlapped I/O only so that those threads can read their own offsets
+// through the one handle at the same time. Spills happen serially with
+// eviction. Mapped terrain is already on disk and never spills.
+static const size_t gClipmapTileSpillSlotBytes = (gClipmapTileMaxStreamBytes + gClipmapTerrainFilePageSize - 1u) & ~(size_t)(gClipmapTerrainFilePageSize - 1u);
+
+struct ClipmapTileSpill
+{
+        HANDLE file;
+        uint32_t slotCount;
+        uint32_t nextSlot; // Ring cursor over the slots.
+        ClipmapVector<uint64_t> slotKeys;
+        ClipmapVector<uint32_t> slotBytes; // Zero while a slot is empty.
+        ClipmapVector<uint32_t> slotNext; // Hash chain links, slot + 1.
+        ClipmapVector<uint32_t> buckets; // Slot + 1 of each chain head.
+        uint32_t bucketMask;
+        uint64_t tilesWritten;
+        uint64_t bytesWritten;
+        uint64_t tilesOverwritten;
+        volatile LONG64 ioFailures;
+};
+
+ClipmapTileSpill gClipmapTileSpill;
+
+static inline uint32_t HashSpilledTileKey(uint64_t key)
+{
+        return (uint32_t)MixTileKey(key) & gClipmapTileSpill.bucketMask;
+}
+
+// Completion event for this thread's spill transfers; created on its first
+// transfer. ReadFile and WriteFile reset it when they start.
+static thread_local HANDLE gClipmapTileSpillEvent = NULL;
+
+// Called by threads that may have loaded tiles before they exit.
+static void CloseClipmapTileSpillEvent(void)
+{
+        if(gClipmapTileSpillEvent != NULL)
+        {
+                CloseHandle(gClipmapTileSpillEvent);
+                gClipmapTileSpillEvent = NULL;
+        }
+}
+
+// Blocks until one positional read or write of the spill file completes.
+static bool TransferClipmapTileSpill(void* buffer, uint32_t byteCount, uint64_t offset, bool write)
+{
+        if(gClipmapTileSpillEvent == NULL)
+        {
+                gClipmapTileSpillEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+                if(gClipmapTileSpillEvent == NULL)
+                {
+                        InterlockedIncrement64(&gClipmapTileSpill.ioFailures);
+                        return false;
+                }
+        }
+
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+        overlapped.hEvent = gClipmapTileSpillEvent;
+
+        BOOL started = write ? WriteFile(gClipmapTileSpill.file, buffer, byteCount, NULL, &overlapped) :
+                ReadFile(gClipmapTileSpill.file, buffer, byteCount, NULL, &overlapped);
+        DWORD transferred = 0;
+        bool succeeded = (started || GetLastError() == ERROR_IO_PENDING) &&
+                GetOverlappedResult(gClipmapTileSpill.file, &overlapped, &transferred, TRUE) && transferred == byteCount;
+        if(!succeeded)
+        {
+                InterlockedIncrement64(&gClipmapTileSpill.ioFailures);
+        }
+        return succeeded;
+}
+
+// Slot + 1 holding key, or zero.
+static uint32_t FindSpilledTile(uint64_t key)
+{
+        if(gClipmapTileSpill.slotCount == 0u)
+        {
+                return 0u;
+        }
+
+        uint32_t link = gClipmapTileSpill.buckets[HashSpilledTileKey(key)];
+        while(link != 0u && gClipmapTileSpill.slotKeys[link - 1u] != key)
+        {
+                link = gClipmapTileSpill.slotNext[link - 1u];
+        }
+        return link;
+}
+
+static void UnlinkSpilledTile(uint32_t slot)
+{
+        uint32_t* link = &gClipmapTileSpill.buckets[HashSpilledTileKey(gClipmapTileSpill.slotKeys[slot])];
+        while(*link != 0u && *link != slot + 1u)
+        {
+                link = &gClipmapTileSpill.slotNext[*link - 1u];
+        }
+        if(*link != 0u)
+        {
+                *link = gClipmapTileSpill.slotNext[slot];
+        }
+        gClipmapTileSpill.slotNext[slot] = 0u;
+        gClipmapTileSpill.slotBytes[slot] = 0u;
+}
+
+// Opens an empty spill file of budgetBytes in the temp directory. It is deleted
+// when closed.
+static bool OpenClipmapTileSpill(size_t budgetBytes)
+{
+        char directory[MAX_PATH];
+        char path[MAX_PATH];
+        DWORD directoryLength = GetTempPathA(MAX_PATH, directory);
+        if(directoryLength == 0u || directoryLength > MAX_PATH || GetTempFileNameA(directory, "clt", 0u, path) == 0u)
+        {
+                fprintf(gFILE, "OpenClipmapTileSpill(): no temporary file name (error %lu)\n", GetLastError());
+                return false;
+        }
+
+        HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_RANDOM_ACCESS | FILE_FLAG_OVERLAPPED, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+        {
+                fprintf(gFILE, "OpenClipmapTileSpill(): failed to create %s (error %lu)\n", path, GetLastError());
+                return false;
+        }
+
+        uint32_t slotCount = (uint32_t)CLIPMAP_MIN(budgetBytes / gClipmapTileSpillSlotBytes, (size_t)UINT32_MAX / 2u);
+        uint32_t bucketCount = 1u;
+        while(bucketCount < slotCount)
+        {
+                bucketCount <<= 1u;
+        }
+
+        gClipmapTileSpill.file = file;
+        gClipmapTileSpill.slotCount = slotCount;
+        gClipmapTileSpill.nextSlot = 0u;
+        gClipmapTileSpill.slotKeys.resize(slotCount);
+        gClipmapTileSpill.slotBytes.resize(slotCount);
+        gClipmapTileSpill.slotNext.resize(slotCount);
+        gClipmapTileSpill.buckets.resize(bucketCount);
+        memset(gClipmapTileSpill.slotBytes.data(), 0, slotCount * sizeof(uint32_t));
+        memset(gClipmapTileSpill.slotNext.data(), 0, slotCount * sizeof(uint32_t));
+        memset(gClipmapTileSpill.buckets.data(), 0, bucketCount * sizeof(uint32_t));
+        gClipmapTileSpill.bucketMask = bucketCount - 1u;
+
+        fprintf(gFILE, "OpenClipmapTileSpill(): %u slots of %zu bytes in %s\n", slotCount, gClipmapTileSpillSlotBytes, path);
+        return true;
+}
+
+static void CloseClipmapTileSpill(void)
+{
+        if(gClipmapTileSpill.file == NULL)
+        {
+                return;
+        }
+
+        fprintf(gFILE, "CloseClipmapTileSpill(): spilled %llu tiles (%.1f MB), %llu overwritten, %lld I/O failures\n",
+                (unsigned long long)gClipmapTileSpill.tilesWritten,
+                (double)gClipmapTileSpill.bytesWritten / (1024.0 * 1024.0),
+                (unsigned long long)gClipmapTileSpill.tilesOverwritten,
+                (long long)gClipmapTileSpill.ioFailures);
+
+        CloseHandle(gClipmapTileSpill.file);
+        // The worker threads closed their own events when they exited.
+        CloseClipmapTileSpillEvent();
+        gClipmapTileSpill.slotKeys.release();
+        gClipmapTileSpill.slotBytes.release();
+        gClipmapTileSpill.slotNext.release();
+        gClipmapTileSpill.buckets.release();
+        memset(&gClipmapTileSpill, 0, sizeof(gClipmapTileSpill));
+}
+
+// Writes a loaded tile that is about to be evicted to the spill file, taking the
+// oldest slot.
+static void SpillTileCacheEntry(ClipmapAttributeSource& source, const ClipmapTileCacheEntry& entry)
+{
+        if(gClipmapTileSpill.slotCount == 0u || source.mappedView != NULL || !entry.loaded || entry.tile.data == NULL ||
+           FindSpilledTile(entry.key) != 0u)
+        {
+                return;
+        }
+
+        // Compressed tiles spill as their stream, raw tiles straight from their block
+        // unless they span several.
+        static thread_local uint8_t stream[gClipmapTileMaxStreamBytes];
+        uint8_t* bytes = entry.tile.data;
+        uint32_t byteCount = (uint32_t)GetTileRawBytes(source);
+        if(IsTileCompressed(source))
+        {
+                byteCount = entry.tile.encodedBytes;
+        }
+        if(IsTileCompressed(source) || IsRawTileChained(source))
+        {
+                ReadClipmapTileChain(entry.tile.data, stream, byteCount);
+                bytes = stream;
+        }
+
+        uint32_t slot = gClipmapTileSpill.nextSlot;
+        if(gClipmapTileSpill.slotBytes[slot] != 0u)
+        {
+                UnlinkSpilledTile(slot);
+                gClipmapTileSpill.tilesOverwritten++;
+        }
+        if(!TransferClipmapTileSpill(bytes, byteCount, (uint64_t)slot * gClipmapTileSpillSlotBytes, true))
+        {
+                return;
+        }
+
+        uint32_t bucket = HashSpilledTileKey(entry.key);
+        gClipmapTileSpill.slotKeys[slot] = entry.key;
+        gClipmapTileSpill.slotBytes[slot] = byteCount;
+        gClipmapTileSpill.slotNext[slot] = gClipmapTileSpill.buckets[bucket];
+        gClipmapTileSpill.buckets[bucket] = slot + 1u;
+        gClipmapTileSpill.nextSlot = (slot + 1u == gClipmapTileSpill.slotCount) ? 0u : slot + 1u;
+        gClipmapTileSpill.tilesWritten++;
+        gClipmapTileSpill.bytesWritten += byteCount;
+}
+
+// Reads a tile's stored bytes (raw texels or compressed stream) back from the
+// spill file into outBytes. Returns false when the tile was never spilled, or
+// its slot has been reused, so it has to be rebuilt.
+static bool ReadSpilledTile(ClipmapAttributeSource& source, const ClipmapTileKey& key, uint8_t* outBytes, uint32_t* outByteCount)
+{
+        uint32_t link = FindSpilledTile(PackTileKey(key));
+        if(link == 0u)
+        {
+                return false;
+        }
+
+        uint32_t slot = link - 1u;
+        uint32_t byteCount = gClipmapTileSpill.slotBytes[slot];
+        if(!TransferClipmapTileSpill(outBytes, byteCount, (uint64_t)slot * gClipmapTileSpillSlotBytes, false))
+        {
+                return false;
+        }
+
+        *outByteCount = byteCount;
+        InterlockedIncrement64(&source.spillHits);
+        return true;
+}
+
+static void FillUniformTile(const ClipmapAttributeSource& source, const ClipmapTileResident& tile, uint8_t* outTexels)
+{
+        size_t texelCount = GetTileRawBytes(source) / source.bytesPerTexel;
+        for(size_t texel = 0; texel < texelCount; texel++)
+        {
+                memcpy(outTexels + texel * source.bytesPerTexel, tile.uniformTexel, source.bytesPerTexel);
+        }
+}
+
+// Texels of a resident tile: its own storage, or the tile expanded into scratch
+// (gClipmapTileMaxRawBytes) when it is uniform, compressed or a chain of blocks.
+// Safe on any streaming thread.
+static const uint8_t* GetClipmapTileTexels(ClipmapAttributeSource& source, const ClipmapTileResident& tile, uint8_t* scratch)
+{
+        if(tile.uniform)
+        {
+                FillUniformTile(source, tile, scratch);
+                return scratch;
+        }
+        if(IsRawTileChained(source))
+        {
+                ReadClipmapTileChain(tile.data, scratch, GetTileRawBytes(source));
+                return scratch;
+        }
+        if(!IsTileCompressed(source) || tile.encodedBytes == 0u)
+        {
+                return tile.data;
+        }
+
+        static thread_local uint8_t stream[gClipmapTileMaxStreamBytes];
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        ReadClipmapTileChain(tile.data, stream, tile.encodedBytes);
+
+        uint32_t channelCount, channelBits;
+        GetClipmapTileChannelLayout(source, &channelCount, &channelBits);
+        if(!DecodeClipmapTile(stream, tile.encodedBytes, (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize, channelCount, channelBits, scratch))
+        {
+                fprintf(gFILE, "GetClipmapTileTexels(): corrupt tile stream for attribute %u mip %u tile (%u, %u)\n",
+                        tile.key.attribute, tile.key.mipLevel, tile.key.tileX, tile.key.tileY);
+                memset(scratch, 0, GetTileRawBytes(source));
+        }
+        QueryPerformanceCounter(&end);
+
+        InterlockedIncrement64(&source.tilesDecoded);
+        InterlockedAdd64(&source.decodeTicks, end.QuadPart - start.QuadPart);
+        return scratch;
+}
+
+// Hands the blocks a compressed tile's stream does not need back to the arena.
+static void TrimTileStorage(ClipmapAttributeSource& source, ClipmapTileResident& tile)
+{
+        if(tile.encodedBytes == 0u)
+        {
+                return;
+        }
+
+        size_t blockSize = gClipmapTileArena.blockSize;
+        uint32_t keepCount = (uint32_t)((tile.encodedBytes + blockSize - 1u) / blockSize);
+        size_t freedBytes = (size_t)FreeClipmapTileBlocks(gClipmapTileArena, tile.data, keepCount) * blockSize;
+        tile.storageBytes -= (uint32_t)freedBytes;
+        source.residentBytes -= freedBytes;
+}
+
+// Once a compressed tile is loaded, hands the blocks its stream does not need
+// back to the arena. Runs serially after the loads.
+static void ShrinkCompressedTile(ClipmapAttributeSource& source, ClipmapTileResident& tile)
+{
+        if(!IsTileCompressed(source) || tile.encodedBytes == 0u)
+        {
+                return;
+        }
+
+        TrimTileStorage(source, tile);
+        source.tilesEncoded++;
+        source.encodedBytes += tile.encodedBytes;
+}
+
+// Serial half of a tile load. Uniform tiles give all their storage back, and
+// the rest share their payload with an identical resident tile when there is
+// one.
+static void FinishLoadedTile(ClipmapAttributeSource& source, ClipmapTileCacheEntry& entry)
+{
+        entry.loaded = true;
+        ClipmapTileResident& tile = entry.tile;
+        if(source.mappedView != NULL)
+        {
+                return;
+        }
+
+        if(tile.uniform)
+        {
+                ReleaseTileStorage(source, tile.data, tile.storageBytes);
+                tile.data = NULL;
+                tile.storageBytes = 0;
+                tile.encodedBytes = 0;
+                source.uniformTiles++;
+                return;
+        }
+
+        ShrinkCompressedTile(source, tile);
+        ShareTilePayload(source, tile.key.attribute, tile);
+}
+
+static VkResult LoadTileDataForKey(const ClipmapTileKey& key, ClipmapTileResident& outTile)
+{
+        if(key.attribute >= CLIPMAP_ATTRIBUTE_COUNT)
+        {
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
+        if(key.mipLevel >= source.mipCount || (source.mappedView == NULL && source.mipImages[key.mipLevel].pixels == NULL))
+        {
+                fprintf(gFILE, "LoadTileDataForKey(): missing image data for attribute %u mip %u\n", key.attribute, key.mipLevel);
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        const ImageData& image = source.mipImages[key.mipLevel];
+
+        uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
+        if(outTile.data == NULL)
+        {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        outTile.key = key;
+        outTile.lastUsedFrame = gClipmapTileFrameCounter;
+
+        if(source.mappedView != NULL)
+        {
+                // Mapped tiles are read in place. Touching every page here takes the
+                // page faults on the loading thread rather than on whoever samples first.
+                size_t tileBytes = GetTileStorageBytes(source);
+                uint32_t pageSum = 0u;
+                for(size_t offset = 0; offset < tileBytes; offset += gClipmapTerrainFilePageSize)
+                {
+                        pageSum += ((volatile const uint8_t*)outTile.data)[offset];
+                }
+                (void)pageSum;
+                return VK_SUCCESS;
+        }
+
+        // Arena tiles come back from the spill file or are cut from the source mip.
+        // Fresh tiles whose texels are all equal keep just the texel; the others
+        // are hashed over their stored bytes, raw or compressed, for sharing.
+        static thread_local uint8_t texels[gClipmapTileMaxRawBytes];
+        static thread_local uint8_t stream[gClipmapTileMaxStreamBytes];
+        bool compressed = IsTileCompressed(source);
+        bool chained = IsRawTileChained(source);
+        uint8_t* storedData = compressed ? stream : (chained ? texels : outTile.data);
+        uint32_t storedBytes = 0u;
+        if(!ReadSpilledTile(source, key, storedData, &storedBytes))
+        {
+                uint8_t* rawData = (compressed || chained) ? texels : outTile.data;
+                CopyTileFromImage(image, source.bytesPerTexel, tileSize, (int)(key.tileX * tileSize), (int)(key.tileY * tileSize), rawData);
+                if(IsUniformTile(rawData, (size_t)tileSize * (size_t)tileSize, source.bytesPerTexel))
+                {
+                        outTile.uniform = true;
+                        memcpy(outTile.uniformTexel, rawData, source.bytesPerTexel);
+                        return VK_SUCCESS;
+                }
+
+                storedBytes = (uint32_t)GetTileRawBytes(source);
+                if(compressed)
+                {
+                        uint32_t channelCount, channelBits;
+                        GetClipmapTileChannelLayout(source, &channelCount, &channelBits);
+                        storedBytes = (uint32_t)EncodeClipmapTile(texels, tileSize, channelCount, channelBits, stream, sizeof(stream));
+                }
+        }
+
+        if(compressed)
+        {
+                WriteClipmapTileChain(outTile.data, stream, storedBytes);
+                outTile.encodedBytes = storedBytes;
+        }
+        else if(chained)
+        {
+                WriteClipmapTileChain(outTile.data, texels, storedBytes);
+        }
+        outTile.contentHash = HashClipmapTileBytes(storedData, storedBytes, 0xCBF29CE484222325ull ^ key.attribute);
+        return VK_SUCCESS;
+}
+
+static VkResult EnsureTileResident(const ClipmapTileKey& key, ClipmapTileResident** outTile)
+{
+	if(key.attribute >= CLIPMAP_ATTRIBUTE_COUNT)
+	{
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
+	uint64_t packedKey = PackTileKey(key);
+	ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, packedKey);
+	if(entry != NULL)
+	{
+		source.demandHits++;
+		TouchTileEntry(source, entry);
+		if(outTile)
+		{
+			*outTile = &entry->tile;
+		}
+		return VK_SUCCESS;
+	}
+
+	// Storage is claimed first so that making room for it cannot evict the new entry.
+	uint8_t* tileData = ClaimTileStorage(source, key, true);
+	if(tileData == NULL)
+	{
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
+
+	ClipmapTileCacheEntry* newEntry = AllocateTileCacheEntry(source, packedKey);
+	if(newEntry == NULL)
+	{
+		ReleaseTileStorage(source, tileData, GetTileStorageBytes(source));
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
+
+	newEntry->tile.data = tileData;
+	newEntry->tile.storageBytes = (uint32_t)GetTileStorageBytes(source);
+	VkResult vkResult = LoadTileDataForKey(key, newEntry->tile);
+	if(vkResult != VK_SUCCESS)
+	{
+		RemoveTileCacheEntry(source, packedKey);
+		return vkResult;
+	}
+	FinishLoadedTile(source, *newEntry);
+	source.tilesLoaded++;
+
+	TouchTileEntry(source, newEntry);
+
+	if(outTile)
+	{
+		*outTile = &newEntry->tile;
+	}
+
+	return VK_SUCCESS;
+}
+
+struct ClipmapTileLoadRequest
+{
+	ClipmapTileKey key;
+	ClipmapTileCacheEntry* entry;
+	VkResult status;
+	int64_t loadTicks;
+};
+
+// Weight of the newest sample in an attribute's running reload cost.
+static const double gClipmapReloadCostSmoothing = 0.05;
+
+// Task: copies one claimed tile out of its source mip into its arena block, or
+// faults in its pages when the source is mapped.
+static void LoadClipmapTileTask(void* context, uint32_t index)
+{
+	ClipmapTileLoadRequest* request = &((ClipmapTileLoadRequest*)context)[index];
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	request->status = LoadTileDataForKey(request->key, request->entry->tile);
+	QueryPerformanceCounter(&end);
+	request->loadTicks = end.QuadPart - start.QuadPart;
+}
+
+// Demand requests pin their tiles and evict from any attribute to make room.
+// Prefetch requests are best effort: they only use budget that is still free and
+// leave pins and LRU order alone.
+static VkResult EnsureTileSetResident(const ClipmapTileKeyVector& keys, bool prefetch)
+{
+	size_t missingBytes = 0;
+
+	for(const ClipmapTileKey& key : keys)
+	{
+		if(key.attribute >= CLIPMAP_ATTRIBUTE_COUNT)
+		{
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+	}
+
+	if(!prefetch)
+	{
+		for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+		{
+			BeginTilePinScope(gClipmapAttributeSources[attributeIndex]);
+		}
+
+		// Pin the tiles this job already has so making room below cannot evict them.
+		for(const ClipmapTileKey& key : keys)
+		{
+			ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
+			ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, PackTileKey(key));
+			if(entry != NULL)
+			{
+				source.demandHits++;
+				if(entry->prefetched)
+				{
+					source.prefetchHits++;
+					entry->prefetched = false;
+				}
+				TouchTileEntry(source, entry);
+			}
+			else
+			{
+				missingBytes += GetTileStorageBytes(source);
+			}
+		}
+
+		ReserveTileCacheBytes(missingBytes);
+	}
+
+	// Claim tile storage and cache slots serially, then fill them on the task pool.
+	// Claimed demand entries are pinned, so later claims in this batch cannot evict them.
+	VkResult status = VK_SUCCESS;
+	ClipmapVector<ClipmapTileLoadRequest> loads;
+	for(const ClipmapTileKey& key : keys)
+	{
+		ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
+		uint64_t packedKey = PackTileKey(key);
+		ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, packedKey);
+		if(entry != NULL)
+		{
+			if(!prefetch)
+			{
+				TouchTileEntry(source, entry);
+			}
+			continue;
+		}
+
+		uint8_t* tileData = ClaimTileStorage(source, key, !prefetch);
+		if(tileData == NULL)
+		{
+			if(!prefetch)
+			{
+				status = VK_ERROR_OUT_OF_HOST_MEMORY;
+			}
+			break;
+		}
+
+		entry = AllocateTileCacheEntry(source, packedKey);
+		if(entry == NULL)
+		{
+			ReleaseTileStorage(source, tileData, GetTileStorageBytes(source));
+			status = VK_ERROR_OUT_OF_HOST_MEMORY;
+			break;
+		}
+
+		entry->tile.data = tileData;
+		entry->tile.storageBytes = (uint32_t)GetTileStorageBytes(source);
+		entry->prefetched = prefetch;
+		if(!prefetch)
+		{
+			TouchTileEntry(source, entry);
+		}
+
+		ClipmapTileLoadRequest request = { key, entry, VK_SUCCESS, 0 };
+		loads.push_back(request);
+	}
+
+	if(!loads.empty())
+	{
+		RunClipmapTasks(LoadClipmapTileTask, loads.data(), (uint32_t)loads.size());
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	for(const ClipmapTileLoadRequest& request : loads)
+	{
+		ClipmapAttributeSource& source = gClipmapAttributeSources[request.key.attribute];
+		if(request.status != VK_SUCCESS)
+		{
+			request.entry->prefetched = false;
+			RemoveTileCacheEntry(source, PackTileKey(request.key));
+			status = request.status;
+			continue;
+		}
+
+		FinishLoadedTile(source, *request.entry);
+
+		double loadMicroseconds = (double)request.loadTicks * 1.0e6 / (double)frequency.QuadPart;
+		source.reloadCostMicroseconds = (source.tilesLoaded == 0u) ? loadMicroseconds :
+			source.reloadCostMicroseconds + (loadMicroseconds - source.reloadCostMicroseconds) * gClipmapReloadCostSmoothing;
+
+		source.tilesLoaded++;
+		if(prefetch)
+		{
+			source.prefetchLoads++;
+		}
+		else
+		{
+			source.demandMisses++;
+		}
+	}
+
+	return status;
+}
+
+// Tile reader: a small pool of threads that page tiles of the mapped terrain
+// file in, so the streaming worker never blocks on disk. Level jobs submit the
+// tiles they miss and are parked until the reads land; prefetch jobs submit
+// read-ahead along the camera's heading, which only runs while no level read is
+// queued. Tiles that follow each other in the file are merged into one read.
+const uint32_t gClipmapTileReaderCount = 2u;
+const size_t gClipmapTileReadMaxBytes = 256u * 1024u;
+// Read latencies are binned by powers of two microseconds.
+const uint32_t gClipmapTileReadLatencyBuckets = 32u;
+
+struct ClipmapTileRead
+{
+        const uint8_t* address;
+        size_t size;
+        uint32_t tileCount;
+        volatile LONG* remaining; // Level reads only; NULL for read-ahead.
+        int64_t submitTicks;
+};
+
+struct ClipmapTileReader
+{
+        HANDLE threads[gClipmapTileReaderCount];
+        uint32_t threadCount;
+        HANDLE readSemaphore;
+        CRITICAL_SECTION lock;
+        ClipmapQueue<ClipmapTileRead> levelReads;
+        ClipmapQueue<ClipmapTileRead> readAheadReads;
+        volatile LONG stopRequested;
+        bool initialized;
+        double ticksPerMicrosecond;
+        uint64_t readsCompleted;
+        uint64_t tilesRead;
+        uint64_t readAheadTiles;
+        uint64_t readAheadDropped;
+        uint64_t bytesRead;
+        uint64_t latencyHistogram[gClipmapTileReadLatencyBuckets]; // Per tile.
+};
+
+ClipmapTileReader gClipmapTileReader;
+
+static void RecordClipmapTileReadLatency(uint64_t (&histogram)[gClipmapTileReadLatencyBuckets], double microseconds, uint32_t tileCount)
+{
+        uint32_t bucket = 0u;
+        while(bucket + 1u < gClipmapTileReadLatencyBuckets && microseconds >= (double)(1ull << (bucket + 1u)))
+        {
+                bucket++;
+        }
+        histogram[bucket] += tileCount;
+}
+
+// Upper bound in microseconds of the bucket holding the given percentile.
+static double GetClipmapTileReadLatencyPercentile(const uint64_t (&histogram)[gClipmapTileReadLatencyBuckets], double percentile)
+{
+        uint64_t total = 0;
+        for(uint32_t bucket = 0; bucket < gClipmapTileReadLatencyBuckets; bucket++)
+        {
+                total += histogram[bucket];
+        }
+        if(total == 0)
+        {
+                return 0.0;
+        }
+
+        uint64_t rank = (uint64_t)ceil(percentile * (double)total);
+        uint64_t seen = 0;
+        for(uint32_t bucket = 0; bucket < gClipmapTileReadLatencyBuckets; bucket++)
+        {
+                seen += histogram[bucket];
+                if(seen >= rank)
+                {
+                        return (double)(1ull << (bucket + 1u));
+                }
+        }
+        return (double)(1ull << gClipmapTileReadLatencyBuckets);
+}
+
+// Asks the memory manager for the whole range in one go, then touches every
+// page so the range is resident when the read is reported complete.
+static void ReadClipmapTileRange(const uint8_t* address, size_t size)
+{
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = (PVOID)address;
+        range.NumberOfBytes = size;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+
+        uint32_t pageSum = 0u;
+        for(size_t offset = 0; offset < size; offset += gClipmapTerrainFilePageSize)
+        {
+                pageSum += ((volatile const uint8_t*)address)[offset];
+        }
+        (void)pageSum;
+}
+
+static DWORD WINAPI ClipmapTileReaderProc(LPVOID parameter)
+{
+        (void)parameter;
+
+        for(;;)
+        {
+                WaitForSingleObject(gClipmapTileReader.readSemaphore, INFINITE);
+                if(InterlockedCompareExchange(&gClipmapTileReader.stopRequested, 0, 0) != 0)
+                {
+                        break;
+                }
+
+                ClipmapTileRead read;
+                bool hasRead = false;
+                EnterCriticalSection(&gClipmapTileReader.lock);
+                if(!gClipmapTileReader.levelReads.empty())
+                {
+                        read = gClipmapTileReader.levelReads.front();
+                        gClipmapTileReader.levelReads.pop();
+                        hasRead = true;
+                }
+                else if(!gClipmapTileReader.readAheadReads.empty())
+                {
+                        read = gClipmapTileReader.readAheadReads.front();
+                        gClipmapTileReader.readAheadReads.pop();
+                        hasRead = true;
+                }
+                LeaveCriticalSection(&gClipmapTileReader.lock);
+
+                // Cancelled read-ahead leaves its semaphore counts behind.
+                if(!hasRead)
+                {
+                        continue;
+                }
+
+                ReadClipmapTileRange(read.address, read.size);
+
+                LARGE_INTEGER now;
+                QueryPerformanceCounter(&now);
+                double latencyMicroseconds = (double)(now.QuadPart - read.submitTicks) / gClipmapTileReader.ticksPerMicrosecond;
+
+                EnterCriticalSection(&gClipmapTileReader.lock);
+                gClipmapTileReader.readsCompleted++;
+                gClipmapTileReader.tilesRead += read.tileCount;
+                gClipmapTileReader.bytesRead += read.size;
+                if(read.remaining != NULL)
+                {
+                        RecordClipmapTileReadLatency(gClipmapTileReader.latencyHistogram, latencyMicroseconds, read.tileCount);
+                }
+                else
+                {
+                        gClipmapTileReader.readAheadTiles += read.tileCount;
+                }
+                LeaveCriticalSection(&gClipmapTileReader.lock);
+
+                if(read.remaining != NULL && InterlockedDecrement(read.remaining) == 0 &&
+                   gClipmapStreamingContext.workAvailableEvent != NULL)
+                {
+                        SetEvent(gClipmapStreamingContext.workAvailableEvent);
+                }
+        }
+
+        return 0;
+}
+
+// Only starts when the terrain comes from a mapped file; in-memory sources have
+// nothing to read.
+static void InitializeClipmapTileReader(void)
+{
+        if(gClipmapTileReader.initialized || gClipmapTerrainFile.view == NULL)
+        {
+                return;
+        }
+
+        InitializeCriticalSection(&gClipmapTileReader.lock);
+        gClipmapTileReader.levelReads.clear();
+        gClipmapTileReader.readAheadReads.clear();
+        gClipmapTileReader.threadCount = 0;
+        gClipmapTileReader.stopRequested = 0;
+        gClipmapTileReader.readsCompleted = 0;
+        gClipmapTileReader.tilesRead = 0;
+        gClipmapTileReader.readAheadTiles = 0;
+        gClipmapTileReader.readAheadDropped = 0;
+        gClipmapTileReader.bytesRead = 0;
+        memset((void*)gClipmapTileReader.latencyHistogram, 0, sizeof(gClipmapTileReader.latencyHistogram));
+        gClipmapTileReader.initialized = true;
+
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        gClipmapTileReader.ticksPerMicrosecond = (double)frequency.QuadPart / 1.0e6;
+
+        // Without reader threads every tile is paged in by the job that needs it.
+        gClipmapTileReader.readSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+        if(gClipmapTileReader.readSemaphore == NULL)
+        {
+                fprintf(gFILE, "InitializeClipmapTileReader(): CreateSemaphore failed (%lu), reading tiles inline\n", (unsigned long)GetLastError());
+                return;
+        }
+
+        for(uint32_t threadIndex = 0; threadIndex < gClipmapTileReaderCount; threadIndex++)
+        {
+                gClipmapTileReader.threads[threadIndex] = CreateThread(NULL, 0, ClipmapTileReaderProc, NULL, 0, NULL);
+                if(gClipmapTileReader.threads[threadIndex] == NULL)
+                {
+                        fprintf(gFILE, "InitializeClipmapTileReader(): CreateThread failed for reader %u (%lu)\n", threadIndex, (unsigned long)GetLastError());
+                        break;
+                }
+                gClipmapTileReader.threadCount++;
+        }
+
+        fprintf(gFILE, "InitializeClipmapTileReader(): %u reader threads\n", gClipmapTileReader.threadCount);
+}
+
+// Queued reads are dropped; a level parked on them is never resumed, so this
+// only runs once the streaming worker is stopping.
+static void ShutdownClipmapTileReader(void)
+{
+        if(!gClipmapTileReader.initialized)
+        {
+                return;
+        }
+
+        InterlockedExchange(&gClipmapTileReader.stopRequested, 1);
+        if(gClipmapTileReader.threadCount > 0u)
+        {
+                ReleaseSemaphore(gClipmapTileReader.readSemaphore, (LONG)gClipmapTileReader.threadCount, NULL);
+        }
+
+        for(uint32_t threadIndex = 0; threadIndex < gClipmapTileReader.threadCount; threadIndex++)
+        {
+                WaitForSingleObject(gClipmapTileReader.threads[threadIndex], INFINITE);
+                CloseHandle(gClipmapTileReader.threads[threadIndex]);
+                gClipmapTileReader.threads[threadIndex] = NULL;
+        }
+
+        if(gClipmapTileReader.readSemaphore != NULL)
+        {
+                CloseHandle(gClipmapTileReader.readSemaphore);
+                gClipmapTileReader.readSemaphore = NULL;
+        }
+
+        if(gClipmapTileReader.readsCompleted != 0)
+        {
+                fprintf(gFILE, "ShutdownClipmapTileReader(): %llu reads, %llu tiles (%.2f per read, %llu read ahead, %llu dropped), %.1f MB, level tile latency p50 <= %.0f us, p99 <= %.0f us\n",
+                        (unsigned long long)gClipmapTileReader.readsCompleted,
+                        (unsigned long long)gClipmapTileReader.tilesRead,
+                        (double)gClipmapTileReader.tilesRead / (double)gClipmapTileReader.readsCompleted,
+                        (unsigned long long)gClipmapTileReader.readAheadTiles,
+                        (unsigned long long)gClipmapTileReader.readAheadDropped,
+                        (double)gClipmapTileReader.bytesRead / (1024.0 * 1024.0),
+                        GetClipmapTileReadLatencyPercentile(gClipmapTileReader.latencyHistogram, 0.5),
+                        GetClipmapTileReadLatencyPercentile(gClipmapTileReader.latencyHistogram, 0.99));
+        }
+
+        gClipmapTileReader.levelReads.clear();
+        gClipmapTileReader.readAheadReads.clear();
+        gClipmapTileReader.threadCount = 0;
+        DeleteCriticalSection(&gClipmapTileReader.lock);
+        gClipmapTileReader.initialized = false;
+}
+
+static inline bool IsClipmapTileReaderRunning(void)
+{
+        return gClipmapTileReader.initialized && gClipmapTileReader.threadCount > 0u &&
+                InterlockedCompareExchange(&gClipmapTileReader.stopRequested, 0, 0) == 0;
+}
+
+struct ClipmapTilePayloadRange
+{
+        uint64_t offset;
+        uint64_t size;
+};
+
+static int CompareClipmapTilePayloadRanges(const void* left, const void* right)
+{
+        uint64_t a = ((const ClipmapTilePayloadRange*)left)->offset;
+        uint64_t b = ((const ClipmapTilePayloadRange*)right)->offset;
+        return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+// Turns the keys that are not in the tile cache into reads of the mapped file.
+// Payloads are sorted by file offset, and a payload that starts where the
+// previous one ends joins its read up to gClipmapTileReadMaxBytes. Returns the
+// number of reads appended.
+static uint32_t BuildClipmapTileReads(const ClipmapTileKeyVector& keys, volatile LONG* remaining, ClipmapVector<ClipmapTileRead>& outReads)
+{
+        ClipmapVector<ClipmapTilePayloadRange> ranges;
+        for(const ClipmapTileKey& key : keys)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
+                if(source.mappedView == NULL || key.mipLevel >= source.mipCount ||
+                   FindTileCacheEntry(source, PackTileKey(key)) != NULL)
+                {
+                        continue;
+                }
+
+                uint64_t tileBytes = GetTileStorageBytes(source);
+                uint64_t pageMask = gClipmapTerrainFilePageSize - 1u;
+                ClipmapTilePayloadRange range;
+                range.offset = (uint64_t)(GetMappedTilePayload(source, key.mipLevel, key.tileX, key.tileY) - source.mappedView);
+                range.size = (tileBytes + pageMask) & ~pageMask;
+                ranges.push_back(range);
+        }
+
+        if(ranges.empty())
+        {
+                return 0u;
+        }
+        qsort(ranges.data(), ranges.size(), sizeof(ClipmapTilePayloadRange), CompareClipmapTilePayloadRanges);
+
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+
+        uint32_t readCount = 0u;
+        ClipmapTileRead read;
+        memset((void*)&read, 0, sizeof(ClipmapTileRead));
+        uint64_t readOffset = 0;
+        for(size_t rangeIndex = 0; rangeIndex < ranges.size(); rangeIndex++)
+        {
+                const ClipmapTilePayloadRange& range = ranges[rangeIndex];
+                if(read.tileCount != 0u)
+                {
+                        uint64_t readEnd = readOffset + read.size;
+                        if(range.offset < readEnd)
+                        {
+                                continue; // Requested twice.
+                        }
+                        if(range.offset == readEnd && read.size + range.size <= gClipmapTileReadMaxBytes)
+                        {
+                                read.size += (size_t)range.size;
+                                read.tileCount++;
+                                continue;
+                        }
+
+                        outReads.push_back(read);
+                        readCount++;
+                }
+
+                read.address = gClipmapTerrainFile.view + range.offset;
+                read.size = (size_t)range.size;
+                read.tileCount = 1u;
+                read.remaining = remaining;
+                read.submitTicks = now.QuadPart;
+                readOffset = range.offset;
+        }
+        outReads.push_back(read);
+        readCount++;
+
+        return readCount;
+}
+
+static void QueueClipmapTileReads(const ClipmapVector<ClipmapTileRead>& reads, bool readAhead)
+{
+        EnterCriticalSection(&gClipmapTileReader.lock);
+        for(const ClipmapTileRead& read : reads)
+        {
+                if(readAhead)
+                {
+                        gClipmapTileReader.readAheadReads.push(read);
+                }
+                else
+                {
+                        gClipmapTileReader.levelReads.push(read);
+                }
+        }
+        LeaveCriticalSection(&gClipmapTileReader.lock);
+
+        ReleaseSemaphore(gClipmapTileReader.readSemaphore, (LONG)reads.size(), NULL);
+}
+
+// Read-ahead for tiles a prefetch job predicted. Returns false if the reader is
+// not running and the caller has to load the tiles itself.
+static bool SubmitClipmapTileReadAhead(const ClipmapTileKeyVector& keys)
+{
+        if(!IsClipmapTileReaderRunning())
+        {
+                return false;
+        }
+
+        ClipmapVector<ClipmapTileRead> reads;
+        if(BuildClipmapTileReads(keys, NULL, reads) != 0u)
+        {
+                QueueClipmapTileReads(reads, true);
+        }
+        return true;
+}
+
+// Drops read-ahead that has not started; the camera has turned away from it.
+static void CancelClipmapTileReadAhead(void)
+{
+        if(!gClipmapTileReader.initialized)
+        {
+                return;
+        }
+
+        EnterCriticalSection(&gClipmapTileReader.lock);
+        size_t dropped = 0;
+        while(!gClipmapTileReader.readAheadReads.empty())
+        {
+                dropped += gClipmapTileReader.readAheadReads.front().tileCount;
+                gClipmapTileReader.readAheadReads.pop();
+        }
+        gClipmapTileReader.readAheadDropped += dropped;
+        LeaveCriticalSection(&gClipmapTileReader.lock);
+}
+
+void DestroyTexture(TextureResource* textureResource)
+{
+	if(textureResource == NULL)
+	{
+		return;
+	}
+
+	if(textureResource->vkSampler)
+	{
+		vkDestroySampler(vkDevice, textureResource->vkSampler, NULL);
+		textureResource->vkSampler = VK_NULL_HANDLE;
+	}
+
+	if(textureResource->vkImageView)
+	{
+		vkDestroyImageView(vkDevice, textureResource->vkImageView, NULL);
+		textureResource->vkImageView = VK_NULL_HANDLE;
+	}
+
+	if(textureResource->vkImage)
+	{
+		vkDestroyImage(vkDevice, textureResource->vkImage, NULL);
+		textureResource->vkImage = VK_NULL_HANDLE;
+	}
+
+	if(textureResource->vkDeviceMemory)
+	{
+		vkFreeMemory(vkDevice, textureResource->vkDeviceMemory, NULL);
+		textureResource->vkDeviceMemory = VK_NULL_HANDLE;
+	}
+
+	textureResource->width = 0;
+	textureResource->height = 0;
+}
+
+void DestroyImageData(ImageData* imageData)
+{
+	if(imageData == NULL)
+	{
+		return;
+	}
+
+	if(imageData->pixels)
+	{
+		free(imageData->pixels);
+		imageData->pixels = NULL;
+	}
+
+	imageData->width = 0;
+	imageData->height = 0;
+	imageData->size = 0;
+}
+
+void DestroyClipmapLevelResource(ClipmapLevelResource* levelResource)
+{
+	if(levelResource == NULL)
+	{
+		return;
+	}
+
+	levelResource->originInSamples = glm::ivec2(0);
+	levelResource->worldOrigin = glm::vec2(0.0f);
+	levelResource->textureOffset = glm::ivec2(0);
+	levelResource->initialized = false;
+	levelResource->windowInFlight = false;
+	SetClipmapJobPending(levelResource, false);
+}
+
+static void DestroyClipmapAttributeSources(void)
+{
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                if(source.tilesLoaded != 0)
+                {
+                        fprintf(gFILE, "DestroyClipmapAttributeSources(): %s demand misses %llu, prefetched %llu, prefetch hits %llu (%.1f%%), wasted %llu\n",
+                                gClipmapAttributeSpecs[attributeIndex].debugName,
+                                (unsigned long long)source.demandMisses,
+                                (unsigned long long)source.prefetchLoads,
+                                (unsigned long long)source.prefetchHits,
+                                (source.prefetchLoads != 0) ? (100.0 * (double)source.prefetchHits / (double)source.prefetchLoads) : 0.0,
+                                (unsigned long long)source.prefetchWasted);
+                }
+                if(gClipmapTileCacheCapacityBytes != 0)
+                {
+                        fprintf(gFILE, "DestroyClipmapAttributeSources(): %s tile cache high-water %.2f MB, reload cost %.1f us/tile\n",
+                                gClipmapAttributeSpecs[attributeIndex].debugName,
+                                (double)source.residentBytesHighWater / (1024.0 * 1024.0),
+                                source.reloadCostMicroseconds);
+                }
+                if(source.tilesLoaded != 0)
+                {
+                        uint64_t demandRequests = source.demandHits + source.demandMisses;
+                        fprintf(gFILE, "DestroyClipmapAttributeSources(): %s L1 (memory) hit rate %.1f%%, L2 (spill file) hit rate %.1f%% of %llu loads\n",
+                                gClipmapAttributeSpecs[attributeIndex].debugName,
+                                (demandRequests != 0) ? (100.0 * (double)source.demandHits / (double)demandRequests) : 0.0,
+                                100.0 * (double)source.spillHits / (double)source.tilesLoaded,
+                                (unsigned long long)source.tilesLoaded);
+                        fprintf(gFILE, "DestroyClipmapAttributeSources(): %s %llu uniform tiles kept as one texel, %llu duplicates shared\n",
+                                gClipmapAttributeSpecs[attributeIndex].debugName,
+                                (unsigned long long)source.uniformTiles,
+                                (unsigned long long)source.duplicateTiles);
+                }
+                if(source.tilesEncoded != 0)
+                {
+                        LARGE_INTEGER frequency;
+                        QueryPerformanceFrequency(&frequency);
+                        double decodeSeconds = (double)source.decodeTicks / (double)frequency.QuadPart;
+                        double decodedMegabytes = (double)source.tilesDecoded * (double)GetTileRawBytes(source) / (1024.0 * 1024.0);
+                        fprintf(gFILE, "DestroyClipmapAttributeSources(): %s tiles compressed %.2f:1, %llu decodes at %.1f MB/s\n",
+                                gClipmapAttributeSpecs[attributeIndex].debugName,
+                                (double)source.tilesEncoded * (double)GetTileRawBytes(source) / (double)source.encodedBytes,
+                                (unsigned long long)source.tilesDecoded,
+                                (decodeSeconds > 0.0) ? decodedMegabytes / decodeSeconds : 0.0);
+                }
+		ClearClipmapTileCache(source);
+                for(uint32_t mipLevel = 0; mipLevel < gClipmapMaxSourceMips; mipLevel++)
+                {
+                        DestroyImageData(&source.mipImages[mipLevel]);
+                        source.mappedTileIndex[mipLevel] = NULL;
+                }
+                source.mappedView = NULL;
+                source.mipCount = 0;
+                source.width = 0;
+                source.height = 0;
+                source.bytesPerTexel = 0;
+                source.isFloat = false;
+                source.tileSize = 0;
+        }
+
+        if(gClipmapTileArena.memory != NULL)
+        {
+                fprintf(gFILE, "DestroyClipmapAttributeSources(): tile arena high-water %u/%u blocks, %llu failed allocations\n",
+                        gClipmapTileArena.highWaterBlocks,
+                        gClipmapTileArena.blockCount,
+                        (unsigned long long)gClipmapTileArena.failedAllocations);
+        }
+        ResetClipmapTilePayloads();
+        DestroyClipmapTileArena(gClipmapTileArena);
+        CloseClipmapTileSpill();
+        CloseClipmapTerrainFile();
+}
+
+static void ShutdownClipmapSynchronization(void);
+
+void DestroyClipmapResources(void)
+{
+        ShutdownClipmapStreaming();
+        ShutdownClipmapTaskPool();
+
+        DestroyClipmapUploadFrames();
+        DestroyClipmapComputePipelines();
+        DestroyClipmapTileWindows();
+        DestroyClipmapStagingRing();
+
+        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+	{
+		DestroyClipmapLevelResource(&gClipmapLevels[levelIndex]);
+	}
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeArray& attributeArray = gClipmapAttributeArrays[attributeIndex];
+
+		if(attributeArray.vkImageView)
+		{
+			vkDestroyImageView(vkDevice, attributeArray.vkImageView, NULL);
+			attributeArray.vkImageView = VK_NULL_HANDLE;
+		}
+
+		if(attributeArray.vkImage)
+		{
+			vkDestroyImage(vkDevice, attributeArray.vkImage, NULL);
+			attributeArray.vkImage = VK_NULL_HANDLE;
+		}
+
+                if(attributeArray.vkDeviceMemory)
+                {
+                        vkFreeMemory(vkDevice, attributeArray.vkDeviceMemory, NULL);
+                        attributeArray.vkDeviceMemory = VK_NULL_HANDLE;
+                }
+        }
+
+        if(gClipmapSampler)
+        {
+                vkDestroySampler(vkDevice, gClipmapSampler, NULL);
+                gClipmapSampler = VK_NULL_HANDLE;
+        }
+
+	if(gClipmapVertexBuffer.vkBuffer)
+	{
+		vkDestroyBuffer(vkDevice, gClipmapVertexBuffer.vkBuffer, NULL);
+		gClipmapVertexBuffer.vkBuffer = VK_NULL_HANDLE;
+	}
+
+	if(gClipmapVertexBuffer.vkDeviceMemory)
+	{
+		vkFreeMemory(vkDevice, gClipmapVertexBuffer.vkDeviceMemory, NULL);
+		gClipmapVertexBuffer.vkDeviceMemory = VK_NULL_HANDLE;
+	}
+
+	if(gClipmapIndexBuffer.vkBuffer)
+	{
+		vkDestroyBuffer(vkDevice, gClipmapIndexBuffer.vkBuffer, NULL);
+		gClipmapIndexBuffer.vkBuffer = VK_NULL_HANDLE;
+	}
+
+        if(gClipmapIndexBuffer.vkDeviceMemory)
+        {
+                vkFreeMemory(vkDevice, gClipmapIndexBuffer.vkDeviceMemory, NULL);
+                gClipmapIndexBuffer.vkDeviceMemory = VK_NULL_HANDLE;
+        }
+
+        DestroyClipmapAttributeSources();
+
+        ShutdownClipmapSynchronization();
+}
+
+static void DestroyClipmapSourceMips(ClipmapAttributeSource& source)
+{
+        for(uint32_t mipLevel = 0; mipLevel < gClipmapMaxSourceMips; mipLevel++)
+        {
+                DestroyImageData(&source.mipImages[mipLevel]);
+        }
+        source.mipCount = 0;
+}
+
+static inline glm::vec3 DecodeClipmapNormal(const uint8_t* texel)
+{
+        return glm::vec3(texel[0], texel[1], texel[2]) * (2.0f / 255.0f) - glm::vec3(1.0f);
+}
+
+// 2x2 box filter. Heights and colors are averaged; normals are averaged as
+// vectors and renormalized so coarse levels keep unit-length normals.
+static void DownsampleClipmapTexel(ClipmapAttributeType attribute, const uint8_t* t00, const uint8_t* t10, const uint8_t* t01, const uint8_t* t11, uint8_t* out)
+{
+        if(attribute == CLIPMAP_ATTRIBUTE_HEIGHT && gClipmapHeight16)
+        {
+                uint16_t h00, h10, h01, h11;
+                memcpy(&h00, t00, sizeof(uint16_t));
+                memcpy(&h10, t10, sizeof(uint16_t));
+                memcpy(&h01, t01, sizeof(uint16_t));
+                memcpy(&h11, t11, sizeof(uint16_t));
+                uint16_t average = (uint16_t)(((uint32_t)h00 + h10 + h01 + h11 + 2u) / 4u);
+                memcpy(out, &average, sizeof(uint16_t));
+        }
+        else if(attribute == CLIPMAP_ATTRIBUTE_HEIGHT)
+        {
+                float h00, h10, h01, h11;
+                memcpy(&h00, t00, sizeof(float));
+                memcpy(&h10, t10, sizeof(float));
+                memcpy(&h01, t01, sizeof(float));
+                memcpy(&h11, t11, sizeof(float));
+                float average = 0.25f * (h00 + h10 + h01 + h11);
+                memcpy(out, &average, sizeof(float));
+        }
+        else if(attribute == CLIPMAP_ATTRIBUTE_NORMAL)
+        {
+                glm::vec3 sum = DecodeClipmapNormal(t00) + DecodeClipmapNormal(t10) + DecodeClipmapNormal(t01) + DecodeClipmapNormal(t11);
+                float length = glm::length(sum);
+                glm::vec3 normal = (length > 1.0e-6f) ? (sum / length) : glm::vec3(0.0f, 1.0f, 0.0f);
+                out[0] = (uint8_t)glm::clamp((normal.x * 0.5f + 0.5f) * 255.0f + 0.5f, 0.0f, 255.0f);
+                out[1] = (uint8_t)glm::clamp((normal.y * 0.5f + 0.5f) * 255.0f + 0.5f, 0.0f, 255.0f);
+                out[2] = (uint8_t)glm::clamp((normal.z * 0.5f + 0.5f) * 255.0f + 0.5f, 0.0f, 255.0f);
+                out[3] = 255u;
+        }
+        else
+        {
+                for(uint32_t channel = 0; channel < 4u; channel++)
+                {
+                        uint32_t sum = (uint32_t)t00[channel] + t10[channel] + t01[channel] + t11[channel];
+                        out[channel] = (uint8_t)((sum + 2u) / 4u);
+                }
+        }
+}
+
+static bool DownsampleClipmapSourceMip(const ImageData& src, ImageData* dst, ClipmapAttributeType attribute)
+{
+        uint32_t width = src.width / 2u;
+        uint32_t height = src.height / 2u;
+        size_t texelBytes = gClipmapAttributeSpecs[attribute].bytesPerTexel;
+        size_t byteSize = (size_t)width * (size_t)height * texelBytes;
+        uint8_t* pixels = (uint8_t*)malloc(byteSize);
+        if(pixels == NULL)
+        {
+                fprintf(gFILE, "DownsampleClipmapSourceMip(): allocation failed for %ux%u\n", width, height);
+                return false;
+        }
+
+        size_t srcRowBytes = (size_t)src.width * texelBytes;
+        for(uint32_t y = 0; y < height; y++)
+        {
+                const uint8_t* row0 = src.pixels + (size_t)(y * 2u) * srcRowBytes;
+                const uint8_t* row1 = row0 + srcRowBytes;
+                uint8_t* dstRow = pixels + (size_t)y * (size_t)width * texelBytes;
+                for(uint32_t x = 0; x < width; x++)
+                {
+                        size_t srcOffset = (size_t)(x * 2u) * texelBytes;
+                        const uint8_t* t00 = row0 + srcOffset;
+                        const uint8_t* t10 = row0 + srcOffset + texelBytes;
+                        const uint8_t* t01 = row1 + srcOffset;
+                        const uint8_t* t11 = row1 + srcOffset + texelBytes;
+                        DownsampleClipmapTexel(attribute, t00, t10, t01, t11, dstRow + (size_t)x * texelBytes);
+                }
+        }
+
+        dst->width = width;
+        dst->height = height;
+        dst->size = (VkDeviceSize)byteSize;
+        dst->pixels = pixels;
+        return true;
+}
+
+static void BuildClipmapSourceMips(ClipmapAttributeSource& source, ClipmapAttributeType attribute)
+{
+        uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
+        while(source.mipCount < gClipmapMaxSourceMips)
+        {
+                const ImageData& previous = source.mipImages[source.mipCount - 1u];
+                if((previous.width / 2u) < tileSize || (previous.height / 2u) < tileSize ||
+                   (previous.width % 2u) != 0u || (previous.height % 2u) != 0u)
+                {
+                        break;
+                }
+
+                if(!DownsampleClipmapSourceMip(previous, &source.mipImages[source.mipCount], attribute))
+                {
+                        break;
+                }
+                source.mipCount++;
+        }
+}
+
+// Task: builds the mip pyramid of one attribute source; `context` is the source array.
+static void BuildClipmapSourceMipsTask(void* context, uint32_t attributeIndex)
+{
+        ClipmapAttributeSource* sources = (ClipmapAttributeSource*)context;
+        BuildClipmapSourceMips(sources[attributeIndex], (ClipmapAttributeType)attributeIndex);
+}
+
+// Clipmap level L samples the source every 2^L texels; it reads mip L directly
+// while the pyramid is deep enough and strides through the last mip beyond that.
+static inline uint32_t GetClipmapSourceMipForLevel(const ClipmapAttributeSource& source, uint32_t levelIndex)
+{
+        if(source.mipCount == 0u)
+        {
+                return 0u;
+        }
+        return CLIPMAP_MIN(levelIndex, source.mipCount - 1u);
+}
+
+static void CloseClipmapTerrainFile(void)
+{
+        if(gClipmapTerrainFile.view != NULL)
+        {
+                UnmapViewOfFile(gClipmapTerrainFile.view);
+        }
+        if(gClipmapTerrainFile.mapping != NULL)
+        {
+                CloseHandle(gClipmapTerrainFile.mapping);
+        }
+        if(gClipmapTerrainFile.file != NULL && gClipmapTerrainFile.file != INVALID_HANDLE_VALUE)
+        {
+                CloseHandle(gClipmapTerrainFile.file);
+        }
+        memset((void*)&gClipmapTerrainFile, 0, sizeof(ClipmapTerrainFile));
+}
+
+// Checks the header against this build and every index entry against the file
+// size, so a truncated or foreign file is rejected before any tile is read.
+static bool ValidateClipmapTerrainFile(void)
+{
+        const ClipmapTerrainFileHeader* header = (const ClipmapTerrainFileHeader*)gClipmapTerrainFile.view;
+        if(header->magic != gClipmapTerrainFileMagic || header->version != gClipmapTerrainFileVersion)
+        {
+                fprintf(gFILE, "ValidateClipmapTerrainFile(): not a terrain file or unsupported version\n");
+                return false;
+        }
+
+        if(header->tileSize != gClipmapTileSize || header->attributeCount != CLIPMAP_ATTRIBUTE_COUNT || header->fileSize != gClipmapTerrainFile.size)
+        {
+                fprintf(gFILE, "ValidateClipmapTerrainFile(): tile size %u, %u attributes, %llu bytes do not match this build or the file\n",
+                        header->tileSize,
+                        header->attributeCount,
+                        (unsigned long long)header->fileSize);
+                return false;
+        }
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                const ClipmapTerrainFileAttribute& attribute = header->attributes[attributeIndex];
+                bool formatMatches = (attributeIndex == CLIPMAP_ATTRIBUTE_HEIGHT) ?
+                        ((attribute.bytesPerTexel == sizeof(float) && attribute.isFloat != 0u) || (attribute.bytesPerTexel == sizeof(uint16_t) && attribute.isFloat == 0u)) :
+                        (attribute.bytesPerTexel == gClipmapAttributeSpecs[attributeIndex].bytesPerTexel);
+                if(!formatMatches || attribute.mipCount == 0u || attribute.mipCount > gClipmapMaxSourceMips)
+                {
+                        fprintf(gFILE, "ValidateClipmapTerrainFile(): %s has an unexpected format\n", gClipmapAttributeSpecs[attributeIndex].debugName);
+                        return false;
+                }
+
+                uint64_t tileBytes = (uint64_t)header->tileSize * header->tileSize * attribute.bytesPerTexel;
+                for(uint32_t mipLevel = 0; mipLevel < attribute.mipCount; mipLevel++)
+                {
+                        const ClipmapTerrainFileMip& mip = attribute.mips[mipLevel];
+                        uint64_t tileCount = (uint64_t)mip.tileCountX * mip.tileCountY;
+                        if(mip.width == 0u || mip.height == 0u ||
+                           mip.tileCountX != mip.width / header->tileSize || mip.tileCountY != mip.height / header->tileSize ||
+                           (mip.width % header->tileSize) != 0u || (mip.height % header->tileSize) != 0u ||
+                           (mip.indexOffset % sizeof(uint64_t)) != 0u || mip.indexOffset + tileCount * sizeof(uint64_t) > gClipmapTerrainFile.size)
+                        {
+                                fprintf(gFILE, "ValidateClipmapTerrainFile(): %s mip %u has a bad layout\n", gClipmapAttributeSpecs[attributeIndex].debugName, mipLevel);
+                                return false;
+                        }
+
+                        const uint64_t* index = (const uint64_t*)(gClipmapTerrainFile.view + mip.indexOffset);
+                        for(uint64_t tile = 0; tile < tileCount; tile++)
+                        {
+                                if((index[tile] % gClipmapTerrainFilePageSize) != 0u || index[tile] + tileBytes > gClipmapTerrainFile.size)
+                                {
+                                        fprintf(gFILE, "ValidateClipmapTerrainFile(): %s mip %u tile %llu is out of range\n",
+                                                gClipmapAttributeSpecs[attributeIndex].debugName,
+                                                mipLevel,
+                                                (unsigned long long)tile);
+                                        return false;
+                                }
+                        }
+                }
+        }
+
+        return true;
+}
+
+// Maps the whole file read only. Pages are only read in when a tile is loaded,
+// so the terrain may be far larger than RAM (but not than the address space).
+static VkResult OpenClipmapTerrainFile(const char* path)
+{
+        CloseClipmapTerrainFile();
+
+        gClipmapTerrainFile.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+        if(gClipmapTerrainFile.file == INVALID_HANDLE_VALUE)
+        {
+                fprintf(gFILE, "OpenClipmapTerrainFile(): cannot open %s (%lu)\n", path, (unsigned long)GetLastError());
+                CloseClipmapTerrainFile();
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        LARGE_INTEGER fileSize;
+        if(!GetFileSizeEx(gClipmapTerrainFile.file, &fileSize) || fileSize.QuadPart < (long long)gClipmapTerrainFilePageSize)
+        {
+                fprintf(gFILE, "OpenClipmapTerrainFile(): %s is too small to be a terrain file\n", path);
+                CloseClipmapTerrainFile();
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        gClipmapTerrainFile.size = (uint64_t)fileSize.QuadPart;
+
+        gClipmapTerrainFile.mapping = CreateFileMapping(gClipmapTerrainFile.file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(gClipmapTerrainFile.mapping != NULL)
+        {
+                gClipmapTerrainFile.view = (const uint8_t*)MapViewOfFile(gClipmapTerrainFile.mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        if(gClipmapTerrainFile.view == NULL)
+        {
+                fprintf(gFILE, "OpenClipmapTerrainFile(): cannot map %llu bytes of %s (%lu)\n", (unsigned long long)gClipmapTerrainFile.size, path, (unsigned long)GetLastError());
+                CloseClipmapTerrainFile();
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        if(!ValidateClipmapTerrainFile())
+        {
+                CloseClipmapTerrainFile();
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        return VK_SUCCESS;
+}
+
+// Points every attribute source at its tiles in the mapped file. Nothing is
+// copied; the sources only keep the mip sizes and tile indices.
+static VkResult LoadClipmapTerrainFileSources(const char* path)
+{
+        VkResult vkResult = OpenClipmapTerrainFile(path);
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+
+        // The file's height format wins over -height16.
+        const ClipmapTerrainFileHeader* header = (const ClipmapTerrainFileHeader*)gClipmapTerrainFile.view;
+        bool height16 = header->attributes[CLIPMAP_ATTRIBUTE_HEIGHT].isFloat == 0u;
+        if(height16 && !IsClipmapHeight16Supported())
+        {
+                fprintf(gFILE, "LoadClipmapTerrainFileSources(): %s has 16-bit heights, which this device cannot sample\n", path);
+                CloseClipmapTerrainFile();
+                return VK_ERROR_FORMAT_NOT_SUPPORTED;
+        }
+        SetClipmapHeightFormat(height16);
+        gClipmapHeightScale = height16 ? header->heightScale : 1.0f;
+        gClipmapHeightBias = height16 ? header->heightBias : 0.0f;
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                const ClipmapTerrainFileAttribute& attribute = header->attributes[attributeIndex];
+                ClearClipmapTileCache(source);
+                DestroyClipmapSourceMips(source);
+
+                source.width = attribute.mips[0].width;
+                source.height = attribute.mips[0].height;
+                source.bytesPerTexel = attribute.bytesPerTexel;
+                source.isFloat = (attribute.isFloat != 0u);
+                source.tileSize = header->tileSize;
+                for(uint32_t mipLevel = 0; mipLevel < attribute.mipCount; mipLevel++)
+                {
+                        source.mipImages[mipLevel].width = attribute.mips[mipLevel].width;
+                        source.mipImages[mipLevel].height = attribute.mips[mipLevel].height;
+                        source.mappedTileIndex[mipLevel] = (const uint64_t*)(gClipmapTerrainFile.view + attribute.mips[mipLevel].indexOffset);
+                }
+                source.mipCount = attribute.mipCount;
+                source.mappedView = gClipmapTerrainFile.view;
+        }
+
+        fprintf(gFILE, "LoadClipmapTerrainFileSources(): mapped %s (%.1f MB)\n", path, (double)gClipmapTerrainFile.size / (1024.0 * 1024.0));
+        return VK_SUCCESS;
+}
+
+struct ClipmapTerrainWriteContext
+{
+        uint8_t* view;
+        const ClipmapTerrainFileHeader* header;
+        uint32_t size;
+        uint32_t mipLevel;
+};
+
+static inline uint8_t* GetClipmapTerrainWriteTile(const ClipmapTerrainWriteContext* context, uint32_t attributeIndex, uint32_t mipLevel, uint32_t tileX, uint32_t tileY)
+{
+        const ClipmapTerrainFileMip& mip = context->header->attributes[attributeIndex].mips[mipLevel];
+        const uint64_t* index = (const uint64_t*)(context->view + mip.indexOffset);
+        return context->view + index[(size_t)tileY * mip.tileCountX + tileX];
+}
+
+// Task: mip 0 of every attribute for one tile. Heights are evaluated with a
+// one-texel border so the normals need no neighbouring tiles.
+static void WriteProceduralTerrainTileTask(void* taskContext, uint32_t tileIndex)
+{
+        const ClipmapTerrainWriteContext* context = (const ClipmapTerrainWriteContext*)taskContext;
+        const uint32_t tileSize = gClipmapTileSize;
+        const uint32_t borderedSize = gClipmapTileSize + 2u;
+        const uint32_t tileCountX = context->header->attributes[CLIPMAP_ATTRIBUTE_HEIGHT].mips[0].tileCountX;
+        const uint32_t tileX = tileIndex % tileCountX;
+        const uint32_t tileY = tileIndex / tileCountX;
+        const int originX = (int)(tileX * tileSize);
+        const int originY = (int)(tileY * tileSize);
+
+        float heights[(gClipmapTileSize + 2u) * (gClipmapTileSize + 2u)];
+        for(uint32_t y = 0; y < borderedSize; y++)
+        {
+                uint32_t sampleY = WrapCoordForTile(originY + (int)y - 1, context->size);
+                for(uint32_t x = 0; x < borderedSize; x++)
+                {
+                        heights[y * borderedSize + x] = ProceduralTerrainHeight(WrapCoordForTile(originX + (int)x - 1, context->size), sampleY);
+                }
+        }
+
+        uint8_t* heightTile = GetClipmapTerrainWriteTile(context, CLIPMAP_ATTRIBUTE_HEIGHT, 0u, tileX, tileY);
+        uint8_t* diffuseTile = GetClipmapTerrainWriteTile(context, CLIPMAP_ATTRIBUTE_DIFFUSE, 0u, tileX, tileY);
+        uint8_t* normalTile = GetClipmapTerrainWriteTile(context, CLIPMAP_ATTRIBUTE_NORMAL, 0u, tileX, tileY);
+        for(uint32_t y = 0; y < tileSize; y++)
+        {
+                for(uint32_t x = 0; x < tileSize; x++)
+                {
+                        const float* center = &heights[(y + 1u) * borderedSize + (x + 1u)];
+                        size_t idx = (size_t)y * tileSize + x;
+                        if(gClipmapHeight16)
+                        {
+                                ((uint16_t*)heightTile)[idx] = QuantizeClipmapHeight(*center, context->header->heightScale, context->header->heightBias);
+                        }
+                        else
+                        {
+                                ((float*)heightTile)[idx] = *center;
+                        }
+                        EncodeProceduralDiffuse(*center, diffuseTile + idx * 4u);
+                        EncodeProceduralNormal(center[-1], center[1], center[-(int)borderedSize], center[borderedSize], normalTile + idx * 4u);
+                }
+        }
+}
+
+// Task: one tile of mip context->mipLevel for every attribute, box filtered
+// from the four tiles below it, which each fill one quadrant.
+static void WriteDownsampledTerrainTileTask(void* taskContext, uint32_t tileIndex)
+{
+        const ClipmapTerrainWriteContext* context = (const ClipmapTerrainWriteContext*)taskContext;
+        const uint32_t tileSize = gClipmapTileSize;
+        const uint32_t halfTile = tileSize / 2u;
+        const uint32_t mipLevel = context->mipLevel;
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                const uint32_t tileCountX = context->header->attributes[attributeIndex].mips[mipLevel].tileCountX;
+                const uint32_t tileX = tileIndex % tileCountX;
+                const uint32_t tileY = tileIndex / tileCountX;
+                const size_t texelBytes = context->header->attributes[attributeIndex].bytesPerTexel;
+                const size_t rowBytes = (size_t)tileSize * texelBytes;
+                uint8_t* outTile = GetClipmapTerrainWriteTile(context, attributeIndex, mipLevel, tileX, tileY);
+
+                for(uint32_t quadrant = 0; quadrant < 4u; quadrant++)
+                {
+                        uint32_t quadrantX = quadrant & 1u;
+                        uint32_t quadrantY = quadrant >> 1u;
+                        const uint8_t* child = GetClipmapTerrainWriteTile(context, attributeIndex, mipLevel - 1u, tileX * 2u + quadrantX, tileY * 2u + quadrantY);
+                        for(uint32_t y = 0; y < halfTile; y++)
+                        {
+                                const uint8_t* row0 = child + (size_t)(y * 2u) * rowBytes;
+                                const uint8_t* row1 = row0 + rowBytes;
+                                uint8_t* outRow = outTile + (size_t)(quadrantY * halfTile + y) * rowBytes + (size_t)(quadrantX * halfTile) * texelBytes;
+                                for(uint32_t x = 0; x < halfTile; x++)
+                                {
+                                        size_t srcOffset = (size_t)(x * 2u) * texelBytes;
+                                        DownsampleClipmapTexel((ClipmapAttributeType)attributeIndex,
+                                                row0 + srcOffset, row0 + srcOffset + texelBytes,
+                                                row1 + srcOffset, row1 + srcOffset + texelBytes,
+                                                outRow + (size_t)x * texelBytes);
+                                }
+                        }
+                }
+        }
+}
+
+// Converter (-writeterrain): writes the procedural terrain at size x size texels
+// as a tiled terrain file. Tiles are generated straight into the mapped file and
+// each mip is filtered from the tiles of the one below, so the whole terrain is
+// never held in memory and terrains larger than RAM can be written.
+static VkResult WriteClipmapTerrainFile(const char* path, uint32_t size)
+{
+        if(size < gClipmapTileSize || (size & (size - 1u)) != 0u)
+        {
+                fprintf(gFILE, "WriteClipmapTerrainFile(): terrain size %u must be a power of two of at least %u\n", size, gClipmapTileSize);
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        ClipmapTerrainFileHeader header;
+        memset((void*)&header, 0, sizeof(ClipmapTerrainFileHeader));
+        header.magic = gClipmapTerrainFileMagic;
+        header.version = gClipmapTerrainFileVersion;
+        header.tileSize = gClipmapTileSize;
+        header.attributeCount = CLIPMAP_ATTRIBUTE_COUNT;
+        // Procedural heights span [0, 1].
+        header.heightScale = 1.0f;
+        header.heightBias = 0.0f;
+
+        // Same pyramid as BuildClipmapSourceMips(): halve while a mip still holds a tile.
+        uint64_t offset = gClipmapTerrainFilePageSize;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapTerrainFileAttribute& attribute = header.attributes[attributeIndex];
+                attribute.bytesPerTexel = gClipmapAttributeSpecs[attributeIndex].bytesPerTexel;
+                attribute.isFloat = (attributeIndex == CLIPMAP_ATTRIBUTE_HEIGHT && !gClipmapHeight16) ? 1u : 0u;
+                for(uint32_t mipSize = size; mipSize >= gClipmapTileSize && attribute.mipCount < gClipmapMaxSourceMips; mipSize /= 2u)
+                {
+                        ClipmapTerrainFileMip& mip = attribute.mips[attribute.mipCount++];
+                        mip.width = mipSize;
+                        mip.height = mipSize;
+                        mip.tileCountX = mipSize / gClipmapTileSize;
+                        mip.tileCountY = mipSize / gClipmapTileSize;
+                        mip.indexOffset = offset;
+                        offset += (uint64_t)mip.tileCountX * mip.tileCountY * sizeof(uint64_t);
+                }
+        }
+
+        const uint64_t pageMask = gClipmapTerrainFilePageSize - 1u;
+        const uint64_t payloadStart = (offset + pageMask) & ~pageMask;
+        header.fileSize = payloadStart;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                const ClipmapTerrainFileAttribute& attribute = header.attributes[attributeIndex];
+                uint64_t tileBytes = (uint64_t)gClipmapTileSize * gClipmapTileSize * attribute.bytesPerTexel;
+                for(uint32_t mipLevel = 0; mipLevel < attribute.mipCount; mipLevel++)
+                {
+                        header.fileSize += (uint64_t)attribute.mips[mipLevel].tileCountX * attribute.mips[mipLevel].tileCountY * ((tileBytes + pageMask) & ~pageMask);
+                }
+        }
+
+        HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file == INVALID_HANDLE_VALUE)
+        {
+                fprintf(gFILE, "WriteClipmapTerrainFile(): cannot create %s (%lu)\n", path, (unsigned long)GetLastError());
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        LARGE_INTEGER fileEnd;
+        fileEnd.QuadPart = (long long)header.fileSize;
+        HANDLE mapping = NULL;
+        uint8_t* view = NULL;
+        if(SetFilePointerEx(file, fileEnd, NULL, FILE_BEGIN) && SetEndOfFile(file))
+        {
+                mapping = CreateFileMapping(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+        }
+        if(mapping != NULL)
+        {
+                view = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+        }
+        if(view == NULL)
+        {
+                fprintf(gFILE, "WriteClipmapTerrainFile(): cannot size or map %llu bytes of %s (%lu)\n", (unsigned long long)header.fileSize, path, (unsigned long)GetLastError());
+                if(mapping != NULL)
+                {
+                        CloseHandle(mapping);
+                }
+                CloseHandle(file);
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        memcpy(view, &header, sizeof(ClipmapTerrainFileHeader));
+        uint64_t payloadOffset = payloadStart;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                const ClipmapTerrainFileAttribute& attribute = header.attributes[attributeIndex];
+                uint64_t tileBytes = (uint64_t)gClipmapTileSize * gClipmapTileSize * attribute.bytesPerTexel;
+                for(uint32_t mipLevel = 0; mipLevel < attribute.mipCount; mipLevel++)
+                {
+                        const ClipmapTerrainFileMip& mip = attribute.mips[mipLevel];
+                        uint64_t* index = (uint64_t*)(view + mip.indexOffset);
+                        for(uint64_t tile = 0; tile < (uint64_t)mip.tileCountX * mip.tileCountY; tile++)
+                        {
+                                index[tile] = payloadOffset;
+                                payloadOffset += (tileBytes + pageMask) & ~pageMask;
+                        }
+                }
+        }
+
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&start);
+
+        ClipmapTerrainWriteContext context;
+        context.view = view;
+        context.header = &header;
+        context.size = size;
+        context.mipLevel = 0u;
+        const ClipmapTerrainFileAttribute& heightAttribute = header.attributes[CLIPMAP_ATTRIBUTE_HEIGHT];
+        RunClipmapTasks(WriteProceduralTerrainTileTask, &context, heightAttribute.mips[0].tileCountX * heightAttribute.mips[0].tileCountY);
+        for(uint32_t mipLevel = 1u; mipLevel < heightAttribute.mipCount; mipLevel++)
+        {
+                context.mipLevel = mipLevel;
+                RunClipmapTasks(WriteDownsampledTerrainTileTask, &context, heightAttribute.mips[mipLevel].tileCountX * heightAttribute.mips[mipLevel].tileCountY);
+        }
+
+        BOOL flushed = FlushViewOfFile(view, 0);
+        QueryPerformanceCounter(&end);
+        UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        CloseHandle(file);
+
+        if(!flushed)
+        {
+                fprintf(gFILE, "WriteClipmapTerrainFile(): flushing %s failed (%lu)\n", path, (unsigned long)GetLastError());
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        fprintf(gFILE, "WriteClipmapTerrainFile(): wrote %s, %ux%u texels, %u mips, %.1f MB in %.2f s\n",
+                path,
+                size,
+                size,
+                heightAttribute.mipCount,
+                (double)header.fileSize / (1024.0 * 1024.0),
+                (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart);
+        return VK_SUCCESS;
+}
+
+// Procedural terrain generated in memory; used when no terrain file is given.
+static VkResult LoadProceduralClipmapSources(void)
+{
+        ImageData heightImage;
+        memset((void*)&heightImage, 0, sizeof(ImageData));
+        ImageData diffuseImage;
+        memset((void*)&diffuseImage, 0, sizeof(ImageData));
+        ImageData normalImage;
+        memset((void*)&normalImage, 0, sizeof(ImageData));
+
+        const uint32_t proceduralSize = 1024u;
+        GenerateProceduralTerrainImages(proceduralSize, &heightImage, &diffuseImage, &normalImage);
+
+        if(heightImage.pixels == NULL || diffuseImage.pixels == NULL || normalImage.pixels == NULL)
+        {
+                DestroyImageData(&heightImage);
+                DestroyImageData(&diffuseImage);
+                DestroyImageData(&normalImage);
+                fprintf(gFILE, "LoadClipmapAttributeSources(): failed to generate procedural terrain data\n");
+                return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        gClipmapHeightScale = 1.0f;
+        gClipmapHeightBias = 0.0f;
+        if(gClipmapHeight16 && !QuantizeClipmapHeightImage(&heightImage))
+        {
+                SetClipmapHeightFormat(false);
+        }
+
+        ClipmapAttributeSource& heightSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT];
+        DestroyClipmapSourceMips(heightSource);
+        heightSource.width = heightImage.width;
+        heightSource.height = heightImage.height;
+        heightSource.bytesPerTexel = gClipmapAttributeSpecs[CLIPMAP_ATTRIBUTE_HEIGHT].bytesPerTexel;
+        heightSource.isFloat = !gClipmapHeight16;
+        heightSource.tileSize = gClipmapTileSize;
+        heightSource.mipImages[0] = heightImage;
+        heightSource.mipCount = 1;
+	ClearClipmapTileCache(heightSource);
+
+        ClipmapAttributeSource& diffuseSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_DIFFUSE];
+        DestroyClipmapSourceMips(diffuseSource);
+        diffuseSource.width = diffuseImage.width;
+        diffuseSource.height = diffuseImage.height;
+        diffuseSource.bytesPerTexel = 4;
+        diffuseSource.isFloat = false;
+        diffuseSource.tileSize = gClipmapTileSize;
+        diffuseSource.mipImages[0] = diffuseImage;
+        diffuseSource.mipCount = 1;
+	ClearClipmapTileCache(diffuseSource);
+
+        ClipmapAttributeSource& normalSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_NORMAL];
+        DestroyClipmapSourceMips(normalSource);
+        normalSource.width = normalImage.width;
+        normalSource.height = normalImage.height;
+        normalSource.bytesPerTexel = 4;
+        normalSource.isFloat = false;
+        normalSource.tileSize = gClipmapTileSize;
+        normalSource.mipImages[0] = normalImage;
+        normalSource.mipCount = 1;
+	ClearClipmapTileCache(normalSource);
+
+        RunClipmapTasks(BuildClipmapSourceMipsTask, gClipmapAttributeSources, CLIPMAP_ATTRIBUTE_COUNT);
+        return VK_SUCCESS;
+}
+
+VkResult LoadClipmapAttributeSources(void)
+{
+        if((gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].mipCount != 0) &&
+           (gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_DIFFUSE].mipCount != 0) &&
+           (gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_NORMAL].mipCount != 0))
+        {
+                return VK_SUCCESS;
+        }
+
+        if(gClipmapHeight16 && !IsClipmapHeight16Supported())
+        {
+                fprintf(gFILE, "LoadClipmapAttributeSources(): R16_UNORM cannot be sampled with filtering here, heights stay float\n");
+                SetClipmapHeightFormat(false);
+        }
+
+        VkResult vkResult = VK_ERROR_INITIALIZATION_FAILED;
+        if(gClipmapTerrainFilePath[0] != '\0')
+        {
+                vkResult = LoadClipmapTerrainFileSources(gClipmapTerrainFilePath);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "LoadClipmapAttributeSources(): falling back to the procedural terrain\n");
+                }
+        }
+        if(vkResult != VK_SUCCESS)
+        {
+                vkResult = LoadProceduralClipmapSources();
+                if(vkResult != VK_SUCCESS)
+                {
+                        return vkResult;
+                }
+        }
+
+        ClipmapAttributeSource& heightSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT];
+
+        // The budget is never allowed below what a single level update pins at
+        // once. Mapped tiles are read in place and need no arena; otherwise a
+        // block is the smallest raw tile of any attribute, so a 16-bit height tile
+        // is charged its own size and wider tiles take a chain of blocks.
+        // Compressed tiles are chains of small blocks, so the budget is sized for
+        // the worst case of a tile that stays raw but holds as many tiles as
+        // compress into it.
+        size_t tileBytes = 0;
+        size_t smallestTileBytes = 0;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                size_t rawBytes = GetTileRawBytes(gClipmapAttributeSources[attributeIndex]);
+                tileBytes = CLIPMAP_MAX(tileBytes, rawBytes);
+                smallestTileBytes = (smallestTileBytes == 0u) ? rawBytes : CLIPMAP_MIN(smallestTileBytes, rawBytes);
+        }
+        if(gClipmapTileCompression && heightSource.mappedView != NULL)
+        {
+                fprintf(gFILE, "LoadClipmapAttributeSources(): mapped terrain tiles are read in place and stay uncompressed\n");
+        }
+        bool compressed = gClipmapTileCompression && heightSource.mappedView == NULL;
+        size_t blockBytes = compressed ? gClipmapTileChunkBytes : smallestTileBytes;
+        size_t worstStreamBytes = tileBytes + (compressed ? gClipmapTileStreamHeaderBytes : 0u);
+        size_t worstTileBytes = ((worstStreamBytes + blockBytes - 1u) / blockBytes) * blockBytes;
+
+        uint32_t tilesPerLevelAxis = gClipmapTextureSize / gClipmapTileSize + 1u;
+        size_t minimumTiles = (size_t)tilesPerLevelAxis * (size_t)tilesPerLevelAxis * CLIPMAP_ATTRIBUTE_COUNT;
+        size_t capacityBytes = CLIPMAP_MAX(gClipmapTileCacheBudgetBytes, minimumTiles * worstTileBytes);
+        capacityBytes = CLIPMAP_MIN(capacityBytes, (size_t)gClipmapMaxResidentTiles * CLIPMAP_ATTRIBUTE_COUNT * worstTileBytes);
+        size_t blockCount = capacityBytes / blockBytes;
+        gClipmapTileCacheCapacityBytes = blockCount * blockBytes;
+
+        if(heightSource.mappedView != NULL)
+        {
+                DestroyClipmapTileArena(gClipmapTileArena);
+        }
+        else if(!CreateClipmapTileArena(gClipmapTileArena, blockBytes, (uint32_t)blockCount))
+        {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        else if(gClipmapTileSpillBudgetBytes != 0u && !OpenClipmapTileSpill(gClipmapTileSpillBudgetBytes))
+        {
+                fprintf(gFILE, "LoadClipmapAttributeSources(): evicted tiles will be rebuilt from the source\n");
+        }
+        fprintf(gFILE, "LoadClipmapAttributeSources(): tile cache budget %.1f MB (%zu blocks of %zu bytes%s) shared by all attributes\n",
+                (double)gClipmapTileCacheCapacityBytes / (1024.0 * 1024.0),
+                blockCount,
+                blockBytes,
+                (heightSource.mappedView != NULL) ? ", mapped" : (compressed ? ", compressed" : ""));
+
+        gClipmapBaseWorldSpacing = gTerrainWorldExtent / (float)heightSource.width;
+
+        fprintf(gFILE, "LoadClipmapAttributeSources(): loaded height field %ux%u (%u mips, %s), base world spacing %.3f\n",
+                heightSource.width,
+                heightSource.height,
+                heightSource.mipCount,
+                gClipmapHeight16 ? "16-bit unorm" : "float",
+                gClipmapBaseWorldSpacing);
+
+#if CLIPMAP_BENCHMARKS
+        RunTileCacheBenchmark();
+        RunVisibleTileBenchmark();
+        RunTileLoadBenchmark();
+        RunTileCompressionBenchmark();
+        RunTileDedupBenchmark();
+        RunHeightQuantizationBenchmark();
+#endif
+
+        return VK_SUCCESS;
+}
+
+VkResult CreateClipmapAttributeResources(void)
+{
+	for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+	{
+		ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
+		levelResource->originInSamples = glm::ivec2(0);
+		levelResource->worldOrigin = glm::vec2(0.0f);
+		levelResource->textureOffset = glm::ivec2(0);
+		levelResource->initialized = false;
+		levelResource->windowInFlight = false;
+		SetClipmapJobPending(levelResource, false);
+	}
+
+	for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+	{
+                const ClipmapAttributeSpec& spec = gClipmapAttributeSpecs[attributeIndex];
+                ClipmapAttributeArray& attributeArray = gClipmapAttributeArrays[attributeIndex];
+
+                // Storage writes to R16_UNORM need an optional device feature.
+                VkFormatProperties vkFormatProperties;
+                memset((void*)&vkFormatProperties, 0, sizeof(vkFormatProperties));
+                vkGetPhysicalDeviceFormatProperties(vkPhysicalDevice_selected, spec.format, &vkFormatProperties);
+                VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+                if(vkFormatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)
+                {
+                        usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+                }
+
+                char imageName[128];
+                sprintf(imageName, "%s_ImageArray", spec.debugName);
+                VkResult vkResult = CreateImageResource(
+                        gClipmapTextureSize,
+                        gClipmapTextureSize,
+                        gClipmapLevelCount,
+                        spec.format,
+                        usage,
+                        &attributeArray.vkImage,
+                        &attributeArray.vkDeviceMemory,
+                        imageName);
+		if(vkResult != VK_SUCCESS)
+		{
+			return vkResult;
+		}
+
+		VkImageViewCreateInfo vkImageViewCreateInfo;
+		memset((void*)&vkImageViewCreateInfo, 0, sizeof(VkImageViewCreateInfo));
+		vkImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		vkImageViewCreateInfo.image = attributeArray.vkImage;
+		vkImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		vkImageViewCreateInfo.format = spec.format;
+		vkImageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+		vkImageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+		vkImageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+		vkImageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+		vkImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		vkImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+		vkImageViewCreateInfo.subresourceRange.levelCount = 1;
+		vkImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+		vkImageViewCreateInfo.subresourceRange.layerCount = gClipmapLevelCount;
+
+		vkResult = vkCreateImageView(vkDevice, &vkImageViewCreateInfo, NULL, &attributeArray.vkImageView);
+		if(vkResult != VK_SUCCESS)
+		{
+			fprintf(gFILE, "CreateClipmapAttributeResources(): vkCreateImageView failed for %s with error %d\n", spec.debugName, vkResult);
+			return vkResult;
+		}
+	}
+
+	// Every level of every attribute is sampled the same way; the layer
+	// coordinate is never filtered or wrapped.
+	VkSamplerCreateInfo vkSamplerCreateInfo;
+	memset((void*)&vkSamplerCreateInfo, 0, sizeof(VkSamplerCreateInfo));
+	vkSamplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	vkSamplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	vkSamplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	vkSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	vkSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	vkSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	vkSamplerCreateInfo.anisotropyEnable = VK_FALSE;
+	vkSamplerCreateInfo.maxAnisotropy = 1.0f;
+	vkSamplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	vkSamplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+	vkSamplerCreateInfo.compareEnable = VK_FALSE;
+	vkSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+
+        VkResult vkResult = vkCreateSampler(vkDevice, &vkSamplerCreateInfo, NULL, &gClipmapSampler);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "CreateClipmapAttributeResources(): vkCreateSampler failed with error %d\n", vkResult);
+                return vkResult;
+        }
+
+        return VK_SUCCESS;
+}
+
+static void InitializeClipmapSynchronization(void)
+{
+        if(!gClipmapSynchronizationInitialized)
+        {
+                for(CRITICAL_SECTION& section : gClipmapLevelMutexes)
+                {
+                        InitializeCriticalSection(&section);
+                }
+
+                InitializeCriticalSection(&gClipmapStreamingContext.mutex);
+                gClipmapStreamingContext.workerThread = NULL;
+                gClipmapStreamingContext.workAvailableEvent = NULL;
+                gClipmapSynchronizationInitialized = true;
+        }
+}
+
+static void ShutdownClipmapSynchronization(void)
+{
+        if(gClipmapSynchronizationInitialized)
+        {
+                DeleteCriticalSection(&gClipmapStreamingContext.mutex);
+                for(CRITICAL_SECTION& section : gClipmapLevelMutexes)
+                {
+                        DeleteCriticalSection(&section);
+                }
+
+                gClipmapSynchronizationInitialized = false;
+        }
+}
+
+static void ApplyClipmapLevelUpdate(const ClipmapLevelUpdate& update)
+{
+        ClipmapLevelResource* levelResource = &gClipmapLevels[update.levelIndex];
+        levelResource->originInSamples = update.originInSamples;
+        levelResource->textureOffset = update.textureOffset;
+        levelResource->worldOrigin = glm::vec2((float)update.originInSamples.x, (float)update.originInSamples.y) * gClipmapBaseWorldSpacing;
+}
+
+// Every attribute's tiles of one level origin, in a single batch.
+static void CollectClipmapLevelTileBatch(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileKeyVector& outBatch)
+{
+        ClipmapTileKeyVector requestedTiles[CLIPMAP_ATTRIBUTE_COUNT];
+        CollectVisibleTilesForLevel(levelIndex, originSamples, requestedTiles);
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                outBatch.append(requestedTiles[attributeIndex]);
+        }
+}
+
+// Makes the job's tiles resident and computes the level update without
+// touching the level state, so it can run off the render thread.
+static void RunClipmapStreamingJob(const ClipmapStreamingJob& job, ClipmapLevelUpdate& outUpdate)
+{
+        memset((void*)&outUpdate, 0, sizeof(ClipmapLevelUpdate));
+        outUpdate.levelIndex = job.levelIndex;
+
+        ClipmapTileKeyVector tileBatch;
+        CollectClipmapLevelTileBatch(job.levelIndex, job.desiredOrigin, tileBatch);
+
+        outUpdate.status = EnsureTileSetResident(tileBatch, false);
+        if(outUpdate.status != VK_SUCCESS)
+        {
+                return;
+        }
+
+        CRITICAL_SECTION* levelSection = &gClipmapLevelMutexes[job.levelIndex];
+        EnterCriticalSection(levelSection);
+        outUpdate.status = PopulateClipmapLevelCpuData(job.levelIndex, job.desiredOrigin, outUpdate);
+        LeaveCriticalSection(levelSection);
+
+        if(outUpdate.status == VK_SUCCESS)
+        {
+                outUpdate.status = StageClipmapLevelUpdate(outUpdate);
+        }
+}
+
+// Parks a level job on reads of the tiles it misses from the mapped terrain
+// file. Returns false when there is nothing to read or no reader is running;
+// the job then runs straight away.
+static bool ParkClipmapLevelJobOnTileReads(const ClipmapStreamingJob& job)
+{
+        if(!IsClipmapTileReaderRunning())
+        {
+                return false;
+        }
+
+        ClipmapTileKeyVector tileBatch;
+        CollectClipmapLevelTileBatch(job.levelIndex, job.desiredOrigin, tileBatch);
+
+        ClipmapLevelRequest* request = &gClipmapStreamingContext.levelRequests[job.levelIndex];
+        ClipmapVector<ClipmapTileRead> reads;
+        uint32_t readCount = BuildClipmapTileReads(tileBatch, &request->readsRemaining, reads);
+        if(readCount == 0u)
+        {
+                return false;
+        }
+
+        InterlockedExchange(&request->readsRemaining, (LONG)readCount);
+        EnterCriticalSection(&gClipmapStreamingContext.mutex);
+        request->parked = true;
+        LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+
+        QueueClipmapTileReads(reads, false);
+        return true;
+}
+
+// Loads whatever tiles of a predicted level origin fit in free cache slots,
+// unless the prefetch was cancelled after the job was queued. A mapped terrain
+// is only read ahead, so the worker does not wait on it.
+static void RunClipmapPrefetchJob(const ClipmapStreamingJob& job)
+{
+        if(job.prefetchGeneration != InterlockedCompareExchange(&gClipmapStreamingContext.prefetchGeneration, 0, 0))
+        {
+                gClipmapStreamingContext.prefetchJobsSkipped++;
+                return;
+        }
+
+        ClipmapTileKeyVector tileBatch;
+        CollectClipmapLevelTileBatch(job.levelIndex, job.desiredOrigin, tileBatch);
+
+        if(!SubmitClipmapTileReadAhead(tileBatch))
+        {
+                EnsureTileSetResident(tileBatch, true);
+        }
+        gClipmapStreamingContext.prefetchJobsRun++;
+}
+
+// Makes the tiles of every level around cameraSample resident in one batch.
+static VkResult PopulateAllClipmapLevelTiles(const glm::ivec2& cameraSample)
+{
+        ClipmapTileKeyVector tileBatch;
+        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+        {
+                ClipmapTileKeyVector requestedTiles[CLIPMAP_ATTRIBUTE_COUNT];
+                CollectVisibleTilesForLevel(levelIndex, ComputeClipmapOriginForLevel(levelIndex, cameraSample), requestedTiles);
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        tileBatch.append(requestedTiles[attributeIndex]);
+                }
+        }
+
+        return EnsureTileSetResident(tileBatch, false);
+}
+
+// Hands out the finest level with a queued request whose previous update has
+// been applied; a level's next job is computed against its applied state. A
+// parked job whose tile reads have landed is resumed in the same order.
+// Must be called with the streaming mutex held.
+static bool TakeClipmapLevelRequest(ClipmapStreamingJob* outJob)
+{
+        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+        {
+                ClipmapLevelRequest* request = &gClipmapStreamingContext.levelRequests[levelIndex];
+                if(request->parked)
+                {
+                        if(InterlockedCompareExchange(&request->readsRemaining, 0, 0) != 0)
+                        {
+                                continue;
+                        }
+
+                        request->parked = false;
+                        outJob->levelIndex = levelIndex;
+                        outJob->desiredOrigin = request->inFlightOrigin;
+                        outJob->prefetchGeneration = 0;
+                        outJob->tilesRead = true;
+                        return true;
+                }
+
+                if(!request->queued || IsClipmapJobPending(&gClipmapLevels[levelIndex]))
+                {
+                        continue;
+                }
+
+                request->queued = false;
+                request->inFlightOrigin = request->desiredOrigin;
+                SetClipmapJobPending(&gClipmapLevels[levelIndex], true);
+
+                outJob->levelIndex = levelIndex;
+                outJob->desiredOrigin = request->desiredOrigin;
+                outJob->prefetchGeneration = 0;
+                outJob->tilesRead = false;
+                return true;
+        }
+
+        return false;
+}
+
+static void DrainClipmapStreamingJobs(void)
+{
+        for(;;)
+        {
+                ClipmapStreamingJob job;
+                bool hasJob = false;
+
+                bool isPrefetch = false;
+
+                EnterCriticalSection(&gClipmapStreamingContext.mutex);
+                if(InterlockedCompareExchange(&gClipmapStreamingContext.stopRequested, 0, 0) == 0)
+                {
+                        if(TakeClipmapLevelRequest(&job))
+                        {
+                                hasJob = true;
+                        }
+                        else if(!gClipmapStreamingContext.prefetchJobs.empty())
+                        {
+                                job = gClipmapStreamingContext.prefetchJobs.front();
+                                gClipmapStreamingContext.prefetchJobs.pop();
+                                hasJob = true;
+                                isPrefetch = true;
+                        }
+                }
+                LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+
+                if(!hasJob)
+                {
+                        break;
+                }
+
+                if(isPrefetch)
+                {
+                        RunClipmapPrefetchJob(job);
+                        continue;
+                }
+
+                if(!job.tilesRead && ParkClipmapLevelJobOnTileReads(job))
+                {
+                        continue;
+                }
+
+                ClipmapLevelUpdate update;
+                RunClipmapStreamingJob(job, update);
+
+                EnterCriticalSection(&gClipmapStreamingContext.mutex);
+                gClipmapStreamingContext.levelRequests[job.levelIndex].completed = true;
+                gClipmapStreamingContext.levelRequests[job.levelIndex].completedUpdate = update;
+                LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+        }
+}
+
+static DWORD WINAPI ClipmapStreamingThreadProc(LPVOID parameter)
+{
+        (void)parameter;
+
+        while(InterlockedCompareExchange(&gClipmapStreamingContext.stopRequested, 0, 0) == 0)
+        {
+                WaitForSingleObject(gClipmapStreamingContext.workAvailableEvent, INFINITE);
+                DrainClipmapStreamingJobs();
+        }
+
+        CloseClipmapTaskWaitEvent();
+        CloseClipmapTileSpillEvent();
+        return 0;
+}
+
+static VkResult InitializeClipmapStreaming(void)
+{
+        gClipmapStreamingContext.stopRequested = 0;
+        memset((void*)gClipmapStreamingContext.levelRequests, 0, sizeof(gClipmapStreamingContext.levelRequests));
+        gClipmapStreamingContext.prefetchJobs.clear();
+        gClipmapStreamingContext.prefetchGeneration = 0;
+        gClipmapStreamingContext.prefetchJobsRun = 0;
+        gClipmapStreamingContext.prefetchJobsSkipped = 0;
+        gClipmapStreamingContext.prefetchCancellations = 0;
+        gClipmapStreamingContext.requestsCoalesced = 0;
+        gClipmapStreamingContext.updatesApplied = 0;
+        gClipmapStreamingContext.texelsUpdated = 0;
+        gClipmapStreamingContext.budgetLimitedFrames = 0;
+        memset((void*)&gClipmapPrefetch, 0, sizeof(ClipmapPrefetchState));
+
+#if CLIPMAP_STREAMING_THREAD
+        // Auto-reset: the worker drains the whole queue after every wake-up, so a
+        // signal raised while it is busy is picked up on its next wait.
+        gClipmapStreamingContext.workAvailableEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if(gClipmapStreamingContext.workAvailableEvent == NULL)
+        {
+                fprintf(gFILE, "InitializeClipmapStreaming(): CreateEvent failed (%lu), streaming on the render thread\n", (unsigned long)GetLastError());
+                return VK_SUCCESS;
+        }
+
+        gClipmapStreamingContext.workerThread = CreateThread(NULL, 0, ClipmapStreamingThreadProc, NULL, 0, NULL);
+        if(gClipmapStreamingContext.workerThread == NULL)
+        {
+                fprintf(gFILE, "InitializeClipmapStreaming(): CreateThread failed (%lu), streaming on the render thread\n", (unsigned long)GetLastError());
+                CloseHandle(gClipmapStreamingContext.workAvailableEvent);
+                gClipmapStreamingContext.workAvailableEvent = NULL;
+        }
+#endif
+
+        InitializeClipmapTileReader();
+        return VK_SUCCESS;
+}
+
+static void ShutdownClipmapStreaming(void)
+{
+        if(gClipmapStreamingContext.workerThread != NULL)
+        {
+                InterlockedExchange(&gClipmapStreamingContext.stopRequested, 1);
+                SetEvent(gClipmapStreamingContext.workAvailableEvent);
+                WaitForSingleObject(gClipmapStreamingContext.workerThread, INFINITE);
+                CloseHandle(gClipmapStreamingContext.workerThread);
+                gClipmapStreamingContext.workerThread = NULL;
+        }
+
+        // Readers signal workAvailableEvent, so they stop before it is closed.
+        ShutdownClipmapTileReader();
+
+        if(gClipmapStreamingContext.workAvailableEvent != NULL)
+        {
+                CloseHandle(gClipmapStreamingContext.workAvailableEvent);
+                gClipmapStreamingContext.workAvailableEvent = NULL;
+        }
+
+        if(gClipmapStreamingContext.prefetchJobsRun != 0 || gClipmapStreamingContext.prefetchCancellations != 0)
+        {
+                fprintf(gFILE, "ShutdownClipmapStreaming(): %llu prefetch jobs run, %llu skipped, %llu cancellations\n",
+                        (unsigned long long)gClipmapStreamingContext.prefetchJobsRun,
+                        (unsigned long long)gClipmapStreamingContext.prefetchJobsSkipped,
+                        (unsigned long long)gClipmapStreamingContext.prefetchCancellations);
+        }
+
+        if(gClipmapStreamingContext.updatesApplied != 0)
+        {
+                fprintf(gFILE, "ShutdownClipmapStreaming(): %llu level updates applied, %llu requests coalesced, %llu texels updated, %llu frames at the update budget\n",
+                        (unsigned long long)gClipmapStreamingContext.updatesApplied,
+                        (unsigned long long)gClipmapStreamingContext.requestsCoalesced,
+                        (unsigned long long)gClipmapStreamingContext.texelsUpdated,
+                        (unsigned long long)gClipmapStreamingContext.budgetLimitedFrames);
+        }
+
+        memset((void*)gClipmapStreamingContext.levelRequests, 0, sizeof(gClipmapStreamingContext.levelRequests));
+        gClipmapStreamingContext.prefetchJobs.clear();
+}
+
+// Points the level's request at desiredOrigin. A request that is still queued
+// is overwritten, and one that the level already has or is about to get is dropped.
+static void RequestClipmapLevelOrigin(uint32_t levelIndex, const glm::ivec2& desiredOrigin)
+{
+	ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
+	bool wakeWorker = false;
+
+	EnterCriticalSection(&gClipmapStreamingContext.mutex);
+	ClipmapLevelRequest* request = &gClipmapStreamingContext.levelRequests[levelIndex];
+
+	bool pending = IsClipmapJobPending(levelResource);
+	bool settled = pending || levelResource->initialized;
+	glm::ivec2 settledOrigin = pending ? request->inFlightOrigin : levelResource->originInSamples;
+
+	if(settled && settledOrigin == desiredOrigin)
 	{
-		fprintf(gFILE, "CreateBufferResource(): vkCreateBuffer() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		if(request->queued)
+		{
+			request->queued = false;
+			gClipmapStreamingContext.requestsCoalesced++;
+		}
+	}
+	else if(!request->queued || request->desiredOrigin != desiredOrigin)
+	{
+		if(request->queued)
+		{
+			gClipmapStreamingContext.requestsCoalesced++;
+		}
+		request->queued = true;
+		request->desiredOrigin = desiredOrigin;
+		wakeWorker = true;
 	}
+	LeaveCriticalSection(&gClipmapStreamingContext.mutex);
 
-	VkMemoryRequirements vkMemoryRequirements;
-	memset((void*)&vkMemoryRequirements, 0, sizeof(VkMemoryRequirements));
-	vkGetBufferMemoryRequirements(vkDevice, *buffer, &vkMemoryRequirements);
+	if(wakeWorker && gClipmapStreamingContext.workAvailableEvent != NULL)
+	{
+		SetEvent(gClipmapStreamingContext.workAvailableEvent);
+	}
+}
 
-	VkMemoryAllocateInfo vkMemoryAllocateInfo;
-	memset((void*)&vkMemoryAllocateInfo, 0, sizeof(VkMemoryAllocateInfo));
-	vkMemoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	vkMemoryAllocateInfo.allocationSize = vkMemoryRequirements.size;
-	vkMemoryAllocateInfo.memoryTypeIndex = FindMemoryType(vkMemoryRequirements.memoryTypeBits, properties);
+// Drops a queued request of a level that just became inactive. A job already
+// in flight still completes and is applied.
+static void CancelClipmapLevelRequest(uint32_t levelIndex)
+{
+	EnterCriticalSection(&gClipmapStreamingContext.mutex);
+	gClipmapStreamingContext.levelRequests[levelIndex].queued = false;
+	LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+}
 
-	if(vkMemoryAllocateInfo.memoryTypeIndex == UINT32_MAX)
+static void CancelClipmapPrefetch(void)
+{
+	if(gClipmapPrefetch.active)
 	{
-		fprintf(gFILE, "CreateBufferResource(): suitable memory type not found for %s\n", debugName);
-		return VK_ERROR_INITIALIZATION_FAILED;
+		gClipmapStreamingContext.prefetchCancellations++;
 	}
 
-	vkResult = vkAllocateMemory(vkDevice, &vkMemoryAllocateInfo, NULL, bufferMemory);
-	if(vkResult != VK_SUCCESS)
+	InterlockedIncrement(&gClipmapStreamingContext.prefetchGeneration);
+	EnterCriticalSection(&gClipmapStreamingContext.mutex);
+	gClipmapStreamingContext.prefetchJobs.clear();
+	LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+	CancelClipmapTileReadAhead();
+
+	memset((void*)&gClipmapPrefetch, 0, sizeof(ClipmapPrefetchState));
+}
+
+// Queues prefetch jobs for the levels whose origin will have moved by the time
+// the camera reaches its predicted position.
+static void ScheduleClipmapPrefetch(const glm::vec2& cameraSample, const glm::vec3& velocity)
+{
+	glm::vec2 planarVelocity = glm::vec2(velocity.x, velocity.z);
+	float speed = glm::length(planarVelocity);
+	if(speed < gClipmapPrefetchMinSpeed)
 	{
-		fprintf(gFILE, "CreateBufferResource(): vkAllocateMemory() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		if(gClipmapPrefetch.active)
+		{
+			CancelClipmapPrefetch();
+		}
+		return;
 	}
 
-	vkResult = vkBindBufferMemory(vkDevice, *buffer, *bufferMemory, 0);
-	if(vkResult != VK_SUCCESS)
+	glm::vec2 direction = planarVelocity / speed;
+	if(gClipmapPrefetch.active && glm::dot(direction, gClipmapPrefetch.direction) < gClipmapPrefetchTurnCosine)
 	{
-		fprintf(gFILE, "CreateBufferResource(): vkBindBufferMemory() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		CancelClipmapPrefetch();
 	}
+	gClipmapPrefetch.active = true;
+	gClipmapPrefetch.direction = direction;
 
-	return vkResult;
+	glm::vec2 predicted = cameraSample + planarVelocity * (gClipmapPrefetchLookaheadSeconds / gClipmapBaseWorldSpacing);
+	glm::ivec2 predictedSample = glm::ivec2((int)floorf(predicted.x), (int)floorf(predicted.y));
+
+	ClipmapStreamingJob job;
+	job.prefetchGeneration = InterlockedCompareExchange(&gClipmapStreamingContext.prefetchGeneration, 0, 0);
+	job.tilesRead = false;
+	bool queued = false;
+	for(uint32_t levelIndex = gClipmapFinestActiveLevel; levelIndex < gClipmapLevelCount; levelIndex++)
+	{
+		glm::ivec2 predictedOrigin = ComputeClipmapOriginForLevel(levelIndex, predictedSample);
+		if(predictedOrigin == ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample))
+		{
+			continue;
+		}
+
+		if(gClipmapPrefetch.originValid[levelIndex] && gClipmapPrefetch.origins[levelIndex] == predictedOrigin)
+		{
+			continue;
+		}
+
+		gClipmapPrefetch.originValid[levelIndex] = true;
+		gClipmapPrefetch.origins[levelIndex] = predictedOrigin;
+
+		job.levelIndex = levelIndex;
+		job.desiredOrigin = predictedOrigin;
+		EnterCriticalSection(&gClipmapStreamingContext.mutex);
+		gClipmapStreamingContext.prefetchJobs.push(job);
+		LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+		queued = true;
+	}
+
+	if(queued && gClipmapStreamingContext.workAvailableEvent != NULL)
+	{
+		SetEvent(gClipmapStreamingContext.workAvailableEvent);
+	}
 }
 
-VkResult CreateImageResource(uint32_t width, uint32_t height, VkFormat format, VkImageUsageFlags usage, VkImage* image, VkDeviceMemory* vkDeviceMemory, const char* debugName)
+static uint64_t CountClipmapUpdateTexels(const ClipmapLevelUpdate& update)
 {
-	VkResult vkResult = VK_SUCCESS;
-
-	VkImageCreateInfo vkImageCreateInfo;
-	memset((void*)&vkImageCreateInfo, 0, sizeof(VkImageCreateInfo));
-	vkImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-	vkImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-	vkImageCreateInfo.extent.width = width;
-	vkImageCreateInfo.extent.height = height;
-	vkImageCreateInfo.extent.depth = 1;
-	vkImageCreateInfo.mipLevels = 1;
-	vkImageCreateInfo.arrayLayers = 1;
-	vkImageCreateInfo.format = format;
-	vkImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-	vkImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	vkImageCreateInfo.usage = usage;
-	vkImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-	vkImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	uint64_t texelCount = 0;
+	for(uint32_t regionIndex = 0; regionIndex < update.regionCount; regionIndex++)
+	{
+		texelCount += (uint64_t)update.regions[regionIndex].width * update.regions[regionIndex].height;
+	}
+	return texelCount;
+}
 
-	vkResult = vkCreateImage(vkDevice, &vkImageCreateInfo, NULL, image);
-	if(vkResult != VK_SUCCESS)
+// Applies the level updates finished by the worker and records their uploads,
+// coarse levels first and within the per-frame update budget. Updates left
+// over stay with their level for the next frame. Without a worker thread the
+// pending jobs are run inline first.
+static VkResult ProcessCompletedClipmapJobs(void)
+{
+	if(gClipmapStreamingContext.workerThread == NULL)
 	{
-		fprintf(gFILE, "CreateImageResource(): vkCreateImage() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		DrainClipmapStreamingJobs();
 	}
 
-	VkMemoryRequirements vkMemoryRequirements;
-	memset((void*)&vkMemoryRequirements, 0, sizeof(VkMemoryRequirements));
-	vkGetImageMemoryRequirements(vkDevice, *image, &vkMemoryRequirements);
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER startCounter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&startCounter);
 
-	VkMemoryAllocateInfo vkMemoryAllocateInfo;
-	memset((void*)&vkMemoryAllocateInfo, 0, sizeof(VkMemoryAllocateInfo));
-	vkMemoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	vkMemoryAllocateInfo.allocationSize = vkMemoryRequirements.size;
-	vkMemoryAllocateInfo.memoryTypeIndex = FindMemoryType(vkMemoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	uint64_t texelsApplied = 0;
+	bool levelReleased = false;
+	VkResult result = VK_SUCCESS;
+	for(uint32_t step = 0; step < gClipmapLevelCount; step++)
+	{
+		uint32_t levelIndex = gClipmapLevelCount - 1u - step;
+		ClipmapLevelRequest* request = &gClipmapStreamingContext.levelRequests[levelIndex];
+		ClipmapLevelUpdate update;
+		bool hasUpdate = false;
+
+		EnterCriticalSection(&gClipmapStreamingContext.mutex);
+		if(request->completed)
+		{
+			update = request->completedUpdate;
+			hasUpdate = true;
+		}
+		LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+
+		if(!hasUpdate)
+		{
+			continue;
+		}
+
+		uint64_t updateTexels = CountClipmapUpdateTexels(update);
+		if(levelReleased)
+		{
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			double elapsedMs = (double)(now.QuadPart - startCounter.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+			bool overTexelBudget = (gClipmapFrameUpdateTexelBudget != 0) && (texelsApplied + updateTexels > gClipmapFrameUpdateTexelBudget);
+			bool overTimeBudget = (gClipmapFrameUpdateBudgetMs > 0.0) && (elapsedMs >= gClipmapFrameUpdateBudgetMs);
+			if(overTexelBudget || overTimeBudget)
+			{
+				gClipmapStreamingContext.budgetLimitedFrames++;
+				break;
+			}
+		}
+
+		// Only the render thread clears completed, so the copy above is still current.
+		EnterCriticalSection(&gClipmapStreamingContext.mutex);
+		request->completed = false;
+		LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+
+		CRITICAL_SECTION* levelSection = &gClipmapLevelMutexes[levelIndex];
+		EnterCriticalSection(levelSection);
+		ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
+		VkResult status = update.status;
+		// No regions on an initialized level means the origin did not move.
+		if(status == VK_SUCCESS && (update.regionCount > 0u || !levelResource->initialized))
+		{
+			ApplyClipmapLevelUpdate(update);
+			status = UploadClipmapLevelToGpu(levelIndex, update);
+
+			gClipmapStreamingContext.updatesApplied++;
+			gClipmapStreamingContext.texelsUpdated += updateTexels;
+			texelsApplied += updateTexels;
+		}
 
-	if(vkMemoryAllocateInfo.memoryTypeIndex == UINT32_MAX)
-	{
-		fprintf(gFILE, "CreateImageResource(): suitable memory type not found for %s\n", debugName);
-		return VK_ERROR_INITIALIZATION_FAILED;
-	}
+		// A level filled from its tile window stays pending until the GPU has read it.
+		if(!levelResource->windowInFlight)
+		{
+			SetClipmapJobPending(levelResource, false);
+		}
+		LeaveCriticalSection(levelSection);
+		levelReleased = true;
 
-	vkResult = vkAllocateMemory(vkDevice, &vkMemoryAllocateInfo, NULL, vkDeviceMemory);
-	if(vkResult != VK_SUCCESS)
-	{
-		fprintf(gFILE, "CreateImageResource(): vkAllocateMemory() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		if(status != VK_SUCCESS)
+		{
+			result = status;
+			break;
+		}
 	}
 
-	vkResult = vkBindImageMemory(vkDevice, *image, *vkDeviceMemory, 0);
-	if(vkResult != VK_SUCCESS)
+	// A request that arrived while its level was in flight is runnable now.
+	if(levelReleased && gClipmapStreamingContext.workAvailableEvent != NULL)
 	{
-		fprintf(gFILE, "CreateImageResource(): vkBindImageMemory() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		SetEvent(gClipmapStreamingContext.workAvailableEvent);
 	}
 
-	return vkResult;
+	return result;
 }
 
-void TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
+// Terrain height in world units below worldXZ, from the finest source mip.
+static float SampleClipmapTerrainHeight(const glm::vec2& worldXZ)
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-	if(commandBuffer == VK_NULL_HANDLE)
+	const ClipmapAttributeSource& source = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT];
+	const ImageData& image = source.mipImages[0];
+	if(source.mappedView == NULL && image.pixels == NULL)
 	{
-		return;
+		return 0.0f;
 	}
 
-	VkImageMemoryBarrier vkImageMemoryBarrier;
-	memset((void*)&vkImageMemoryBarrier, 0, sizeof(VkImageMemoryBarrier));
-	vkImageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	vkImageMemoryBarrier.oldLayout = oldLayout;
-	vkImageMemoryBarrier.newLayout = newLayout;
-	vkImageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	vkImageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	vkImageMemoryBarrier.image = image;
-	vkImageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	vkImageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-	vkImageMemoryBarrier.subresourceRange.levelCount = 1;
-	vkImageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-	vkImageMemoryBarrier.subresourceRange.layerCount = 1;
-
-	VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-	VkPipelineStageFlags destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-
-	if((oldLayout == VK_IMAGE_LAYOUT_UNDEFINED) && (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL))
-	{
-		vkImageMemoryBarrier.srcAccessMask = 0;
-		vkImageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if((oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) && (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL))
+	uint32_t x = WrapCoordForTile((int)floorf(worldXZ.x / gClipmapBaseWorldSpacing), image.width);
+	uint32_t y = WrapCoordForTile((int)floorf(worldXZ.y / gClipmapBaseWorldSpacing), image.height);
+	if(source.mappedView != NULL)
 	{
-		vkImageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		vkImageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		const uint8_t* tile = GetMappedTilePayload(source, 0u, x / source.tileSize, y / source.tileSize);
+		return DecodeClipmapHeight(tile + ((size_t)(y % source.tileSize) * source.tileSize + (x % source.tileSize)) * source.bytesPerTexel) * gTerrainHeightScale;
 	}
-	else if((oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) && (newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL))
+	return DecodeClipmapHeight(image.pixels + ((size_t)y * image.width + x) * source.bytesPerTexel) * gTerrainHeightScale;
+}
+
+// Finest level worth streaming and drawing from the current camera. Each level's
+// footprint is centred on the camera target; its nearest point is seen from the
+// camera's height above the terrain and horizontal distance, and the level stays
+// active while one of its samples covers gClipmapMinPixelsPerSample there.
+static uint32_t ComputeClipmapFinestActiveLevel(void)
+{
+	if(winHeight <= 0)
 	{
-		vkImageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkImageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		sourceStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		return 0u;
 	}
-	else
+
+	glm::vec2 cameraXZ = glm::vec2(gCameraPosition.x, gCameraPosition.z);
+	float heightAboveTerrain = glm::max(gCameraPosition.y - SampleClipmapTerrainHeight(cameraXZ), 0.0f);
+	float pixelsPerRadian = (float)winHeight / (2.0f * tanf(gCameraFieldOfViewY * 0.5f));
+	glm::vec2 centreXZ = glm::vec2(gCameraTarget.x, gCameraTarget.z);
+
+	uint32_t finestLevel = 0u;
+	while(finestLevel < gClipmapLevelCount - 1u)
 	{
-		fprintf(gFILE, "TransitionImageLayout(): unsupported layout transition requested\n");
+		float sampleSpacingWorld = gClipmapBaseWorldSpacing * (float)(1u << finestLevel);
+		float halfExtent = 0.5f * (float)gClipmapGridSize * sampleSpacingWorld;
+		glm::vec2 outside = glm::max(glm::abs(cameraXZ - centreXZ) - glm::vec2(halfExtent), glm::vec2(0.0f));
+		float nearestDistance = glm::max(sqrtf(glm::dot(outside, outside) + heightAboveTerrain * heightAboveTerrain), 1.0f);
+		if(sampleSpacingWorld * pixelsPerRadian / nearestDistance >= gClipmapMinPixelsPerSample)
+		{
+			break;
+		}
+		finestLevel++;
 	}
 
-	vkCmdPipelineBarrier(commandBuffer,
-		sourceStage,
-		destinationStage,
-		0,
-		0, NULL,
-		0, NULL,
-		1, &vkImageMemoryBarrier);
-
-	EndSingleTimeCommands(commandBuffer);
+	return finestLevel;
 }
 
-void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+// Finest level that can be drawn this frame: it and every coarser level must be
+// active, initialized and close enough to their desired origin. The coarsest
+// level is always drawn.
+static uint32_t ComputeClipmapFinestDrawLevel(void)
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-	if(commandBuffer == VK_NULL_HANDLE)
+	uint32_t finestLevel = gClipmapLevelCount - 1u;
+	while(finestLevel > gClipmapFinestActiveLevel)
 	{
-		return;
-	}
+		uint32_t levelIndex = finestLevel - 1u;
+		const ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
+		if(!levelResource->initialized)
+		{
+			break;
+		}
 
-	VkBufferImageCopy vkBufferImageCopy;
-	memset((void*)&vkBufferImageCopy, 0, sizeof(VkBufferImageCopy));
-	vkBufferImageCopy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	vkBufferImageCopy.imageSubresource.mipLevel = 0;
-	vkBufferImageCopy.imageSubresource.baseArrayLayer = 0;
-	vkBufferImageCopy.imageSubresource.layerCount = 1;
-	vkBufferImageCopy.imageOffset.x = 0;
-	vkBufferImageCopy.imageOffset.y = 0;
-	vkBufferImageCopy.imageOffset.z = 0;
-	vkBufferImageCopy.imageExtent.width = width;
-	vkBufferImageCopy.imageExtent.height = height;
-	vkBufferImageCopy.imageExtent.depth = 1;
+		int spacing = 1 << levelIndex;
+		glm::ivec2 lag = glm::abs(ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample) - levelResource->originInSamples) / spacing;
+		if(CLIPMAP_MAX(lag.x, lag.y) > gClipmapMaxDrawLagTexels)
+		{
+			break;
+		}
 
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &vkBufferImageCopy);
+		finestLevel = levelIndex;
+	}
 
-	EndSingleTimeCommands(commandBuffer);
+	return finestLevel;
 }
 
-void CopyBufferToImageRegions(VkBuffer buffer, VkImage image, const VkBufferImageCopy* regions, uint32_t regionCount)
+static inline uint32_t WrapCoordinate(int value, uint32_t modulus)
 {
-	if(regions == NULL || regionCount == 0)
+	int result = value % (int)modulus;
+	if(result < 0)
 	{
-		return;
+		result += (int)modulus;
 	}
+	return (uint32_t)result;
+}
 
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
-	if(commandBuffer == VK_NULL_HANDLE)
+static void AppendRowRegions(uint32_t startRow, uint32_t count, ClipmapLevelUpdate& update)
+{
+	if(count == 0)
 	{
 		return;
 	}
 
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions);
+	uint32_t remaining = count;
+	uint32_t current = startRow;
+	while(remaining > 0)
+	{
+		uint32_t span = CLIPMAP_MIN(remaining, gClipmapTextureSize - current);
+		ClipmapUpdateRegion region;
+		region.x = 0;
+		region.y = current;
+		region.width = gClipmapTextureSize;
+		region.height = span;
+		update.regions[update.regionCount++] = region;
 
-	EndSingleTimeCommands(commandBuffer);
+		remaining -= span;
+		current = 0;
+	}
 }
 
-VkResult CreateTextureFromRgba(const uint8_t* pixelData, VkDeviceSize dataSize, uint32_t width, uint32_t height, TextureResource* textureResource, const char* debugName)
+static void AppendColumnRegions(uint32_t startColumn, uint32_t count, ClipmapLevelUpdate& update)
 {
-	if((pixelData == NULL) || (dataSize == 0))
-	{
-		fprintf(gFILE, "CreateTextureFromRgba(): pixelData empty for %s\n", debugName);
-		return VK_ERROR_INITIALIZATION_FAILED;
-	}
-
-	VkResult vkResult = VK_SUCCESS;
-
-	VkBuffer stagingBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
-	vkResult = CreateBufferResource(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingMemory, "TextureStagingBuffer");
-	if(vkResult != VK_SUCCESS)
-	{
-		return vkResult;
-	}
+        if(count == 0)
+        {
+                return;
+        }
 
-	void* data = NULL;
-	vkResult = vkMapMemory(vkDevice, stagingMemory, 0, dataSize, 0, &data);
-	if(vkResult != VK_SUCCESS)
+	uint32_t remaining = count;
+	uint32_t current = startColumn;
+	while(remaining > 0)
 	{
-		fprintf(gFILE, "CreateTextureFromRgba(): vkMapMemory() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
-	}
+		uint32_t span = CLIPMAP_MIN(remaining, gClipmapTextureSize - current);
+		ClipmapUpdateRegion region;
+		region.x = current;
+		region.y = 0;
+		region.width = span;
+		region.height = gClipmapTextureSize;
+		update.regions[update.regionCount++] = region;
 
-	memcpy(data, pixelData, (size_t)dataSize);
-	vkUnmapMemory(vkDevice, stagingMemory);
+                remaining -= span;
+                current = 0;
+        }
+}
 
-	memset((void*)textureResource, 0, sizeof(TextureResource));
-	vkResult = CreateImageResource(width, height, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, &textureResource->vkImage, &textureResource->vkDeviceMemory, debugName);
-	if(vkResult != VK_SUCCESS)
-	{
-		return vkResult;
-	}
+static inline int FloorDivide(int value, int divisor)
+{
+        int quotient = value / divisor;
+        if((value % divisor != 0) && ((value < 0) != (divisor < 0)))
+        {
+                quotient--;
+        }
+        return quotient;
+}
 
-	TransitionImageLayout(textureResource->vkImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	CopyBufferToImage(stagingBuffer, textureResource->vkImage, width, height);
-	TransitionImageLayout(textureResource->vkImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+// Returns the first wrapped tile index and the number of unique tiles covered
+// by [firstTile, lastTile] on an axis that repeats every tileCount tiles.
+static void ComputeWrappedTileSpan(int firstTile, int lastTile, uint32_t tileCount, uint32_t* outStart, uint32_t* outCount)
+{
+        uint32_t span = (uint32_t)(lastTile - firstTile + 1);
+        if(span >= tileCount)
+        {
+                *outStart = 0u;
+                *outCount = tileCount;
+                return;
+        }
 
-	VkImageViewCreateInfo vkImageViewCreateInfo;
-	memset((void*)&vkImageViewCreateInfo, 0, sizeof(VkImageViewCreateInfo));
-	vkImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-	vkImageViewCreateInfo.image = textureResource->vkImage;
-	vkImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-	vkImageViewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-	vkImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	vkImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-	vkImageViewCreateInfo.subresourceRange.levelCount = 1;
-	vkImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-	vkImageViewCreateInfo.subresourceRange.layerCount = 1;
+        *outStart = WrapCoordForTile(firstTile, tileCount);
+        *outCount = span;
+}
 
-	vkResult = vkCreateImageView(vkDevice, &vkImageViewCreateInfo, NULL, &textureResource->vkImageView);
-	if(vkResult != VK_SUCCESS)
+static void CollectVisibleTilesForLevel(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileKeyVector (&outTiles)[CLIPMAP_ATTRIBUTE_COUNT])
+{
+	for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
 	{
-		fprintf(gFILE, "CreateTextureFromRgba(): vkCreateImageView() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
+		outTiles[attributeIndex].clear();
 	}
 
-	VkSamplerCreateInfo vkSamplerCreateInfo;
-	memset((void*)&vkSamplerCreateInfo, 0, sizeof(VkSamplerCreateInfo));
-	vkSamplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	vkSamplerCreateInfo.magFilter = VK_FILTER_LINEAR;
-	vkSamplerCreateInfo.minFilter = VK_FILTER_LINEAR;
-	vkSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	vkSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	vkSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	vkSamplerCreateInfo.anisotropyEnable = VK_FALSE;
-	vkSamplerCreateInfo.maxAnisotropy = 1.0f;
-	vkSamplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	vkSamplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-	vkSamplerCreateInfo.compareEnable = VK_FALSE;
-	vkSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        // The level's image holds gClipmapTextureSize samples, one past the last grid vertex.
+        int sampleSpacing = 1 << levelIndex;
+        int coverageSamples = (int)gClipmapTextureSize * sampleSpacing;
+        int startX = originSamples.x;
+        int startY = originSamples.y;
+        int endX = startX + coverageSamples;
+        int endY = startY + coverageSamples;
 
-	vkResult = vkCreateSampler(vkDevice, &vkSamplerCreateInfo, NULL, &textureResource->vkSampler);
-	if(vkResult != VK_SUCCESS)
-	{
-		fprintf(gFILE, "CreateTextureFromRgba(): vkCreateSampler() failed for %s with error code %d\n", debugName, vkResult);
-		return vkResult;
-	}
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                if(source.width == 0 || source.height == 0)
+                {
+                        continue;
+                }
 
-	textureResource->width = width;
-	textureResource->height = height;
+                uint32_t mipLevel = GetClipmapSourceMipForLevel(source, levelIndex);
+                const ImageData& image = source.mipImages[mipLevel];
+                int mipStride = 1 << mipLevel;
+                uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
+                uint32_t tileCountX = (image.width + tileSize - 1u) / tileSize;
+                uint32_t tileCountY = (image.height + tileSize - 1u) / tileSize;
+
+                // The source wraps, so once the covered range spans the whole source
+                // every tile is visible exactly once; otherwise the range is a single
+                // contiguous run modulo the tile count. Either way no dedup is needed.
+                uint32_t firstTileX = 0u;
+                uint32_t tileSpanX = 0u;
+                uint32_t firstTileY = 0u;
+                uint32_t tileSpanY = 0u;
+                int mipTileSize = mipStride * (int)tileSize;
+                ComputeWrappedTileSpan(FloorDivide(startX, mipTileSize), FloorDivide(endX - 1, mipTileSize), tileCountX, &firstTileX, &tileSpanX);
+                ComputeWrappedTileSpan(FloorDivide(startY, mipTileSize), FloorDivide(endY - 1, mipTileSize), tileCountY, &firstTileY, &tileSpanY);
+
+                ClipmapTileKeyVector& tiles = outTiles[attributeIndex];
+                tiles.reserve((size_t)tileSpanX * (size_t)tileSpanY);
+                for(uint32_t offsetY = 0; offsetY < tileSpanY; offsetY++)
+                {
+                        uint32_t tileY = (firstTileY + offsetY) % tileCountY;
+                        for(uint32_t offsetX = 0; offsetX < tileSpanX; offsetX++)
+                        {
+                                ClipmapTileKey key;
+                                key.attribute = (ClipmapAttributeType)attributeIndex;
+                                key.mipLevel = mipLevel;
+                                key.tileX = (firstTileX + offsetX) % tileCountX;
+                                key.tileY = tileY;
+                                tiles.push_back(key);
+                        }
+                }
+        }
+}
 
-	vkDestroyBuffer(vkDevice, stagingBuffer, NULL);
-	vkFreeMemory(vkDevice, stagingMemory, NULL);
+// One barrier over a level's layer of every attribute image; a release or
+// acquire when the queue families differ. The release and the acquire must
+// repeat the same layouts.
+static void InsertClipmapOwnershipBarrier(VkCommandBuffer commandBuffer, uint32_t levelIndex, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex)
+{
+        VkImageMemoryBarrier vkImageMemoryBarrier_array[CLIPMAP_ATTRIBUTE_COUNT];
+        memset((void*)vkImageMemoryBarrier_array, 0, sizeof(vkImageMemoryBarrier_array));
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                VkImageMemoryBarrier& vkImageMemoryBarrier = vkImageMemoryBarrier_array[attributeIndex];
+                vkImageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                vkImageMemoryBarrier.oldLayout = oldLayout;
+                vkImageMemoryBarrier.newLayout = newLayout;
+                vkImageMemoryBarrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+                vkImageMemoryBarrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+                vkImageMemoryBarrier.image = gClipmapAttributeArrays[attributeIndex].vkImage;
+                vkImageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                vkImageMemoryBarrier.subresourceRange.baseMipLevel = 0;
+                vkImageMemoryBarrier.subresourceRange.levelCount = 1;
+                vkImageMemoryBarrier.subresourceRange.baseArrayLayer = levelIndex;
+                vkImageMemoryBarrier.subresourceRange.layerCount = 1;
+                vkImageMemoryBarrier.srcAccessMask = srcAccessMask;
+                vkImageMemoryBarrier.dstAccessMask = dstAccessMask;
+        }
 
-	return vkResult;
+        vkCmdPipelineBarrier(
+                commandBuffer,
+                srcStage,
+                dstStage,
+                0,
+                0, NULL,
+                0, NULL,
+                CLIPMAP_ATTRIBUTE_COUNT, vkImageMemoryBarrier_array);
 }
 
-static inline uint32_t HashCoords(int x, int y)
+static void InsertClipmapImageBarrier(VkCommandBuffer commandBuffer, uint32_t levelIndex, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
 {
-        uint32_t state = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
-        state = (state ^ (state >> 13u)) * 1274126177u;
-        state ^= state >> 16u;
-        return state;
+        InsertClipmapOwnershipBarrier(commandBuffer, levelIndex, oldLayout, newLayout, srcAccessMask, dstAccessMask, srcStage, dstStage, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED);
 }
 
-static float ValueNoise(int x, int y)
+struct ClipmapTileWindowPlacement
 {
-        return (float)HashCoords(x, y) / (float)UINT32_MAX;
-}
+        uint32_t mipLevel;
+        glm::ivec2 firstTile;
+        glm::ivec2 tileSpan; // Distinct tiles to stage on each axis.
+        glm::ivec2 tileCount;
+        glm::ivec2 firstSlot;
+        glm::ivec2 slotModulus;
+};
 
-static float SmoothNoise(float x, float y)
+// Where the tiles of one attribute covered by a level origin sit in the level's
+// tile window. The level's image spans gClipmapTextureSize samples, one more
+// than the grid, so the last grid vertex has a tile to read from.
+static void ComputeClipmapTileWindowPlacement(const ClipmapAttributeSource& source, uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileWindowPlacement* outPlacement)
 {
-        int xi = (int)floorf(x);
-        int yi = (int)floorf(y);
-        float tx = x - (float)xi;
-        float ty = y - (float)yi;
-
-        float v00 = ValueNoise(xi, yi);
-        float v10 = ValueNoise(xi + 1, yi);
-        float v01 = ValueNoise(xi, yi + 1);
-        float v11 = ValueNoise(xi + 1, yi + 1);
+        uint32_t mipLevel = GetClipmapSourceMipForLevel(source, levelIndex);
+        const ImageData& image = source.mipImages[mipLevel];
+        int tileSize = (int)((source.tileSize == 0u) ? gClipmapTileSize : source.tileSize);
+        int mipTileSize = (1 << mipLevel) * tileSize;
+        int coverageSamples = (int)gClipmapTextureSize << levelIndex;
 
-        float vx0 = v00 + (v10 - v00) * tx;
-        float vx1 = v01 + (v11 - v01) * tx;
-        return vx0 + (vx1 - vx0) * ty;
+        outPlacement->mipLevel = mipLevel;
+        outPlacement->tileCount = glm::ivec2(((int)image.width + tileSize - 1) / tileSize, ((int)image.height + tileSize - 1) / tileSize);
+        for(int axis = 0; axis < 2; axis++)
+        {
+                int firstTile = FloorDivide(originSamples[axis], mipTileSize);
+                int lastTile = FloorDivide(originSamples[axis] + coverageSamples - 1, mipTileSize);
+                int tileCount = outPlacement->tileCount[axis];
+                bool wholeSource = (lastTile - firstTile + 1) >= tileCount;
+
+                outPlacement->firstTile[axis] = firstTile;
+                outPlacement->tileSpan[axis] = wholeSource ? tileCount : (lastTile - firstTile + 1);
+                outPlacement->slotModulus[axis] = wholeSource ? tileCount : (int)gClipmapTileWindowTiles;
+                outPlacement->firstSlot[axis] = (int)WrapCoordForTile(firstTile, (uint32_t)outPlacement->slotModulus[axis]);
+        }
 }
 
-static float FractalNoise(float x, float y, int octaves, float lacunarity, float gain)
+// Slots per axis that every level's window needs: enough for the widest
+// span any level can cover, capped by the source's own tile count.
+static uint32_t ComputeClipmapTileWindowTiles(void)
 {
-        float amplitude = 1.0f;
-        float frequency = 1.0f;
-        float sum = 0.0f;
-        for(int i = 0; i < octaves; i++)
+        uint32_t windowTiles = 0u;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-                sum += SmoothNoise(x * frequency, y * frequency) * amplitude;
-                frequency *= lacunarity;
-                amplitude *= gain;
+                const ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                if(source.width == 0 || source.height == 0)
+                {
+                        continue;
+                }
+
+                uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
+                for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+                {
+                        uint32_t mipLevel = GetClipmapSourceMipForLevel(source, levelIndex);
+                        const ImageData& image = source.mipImages[mipLevel];
+                        // An unaligned origin straddles one extra tile.
+                        uint32_t spanTiles = ((gClipmapTextureSize << (levelIndex - mipLevel)) / tileSize) + 1u;
+                        uint32_t tileCountX = (image.width + tileSize - 1u) / tileSize;
+                        uint32_t tileCountY = (image.height + tileSize - 1u) / tileSize;
+                        windowTiles = CLIPMAP_MAX(windowTiles, CLIPMAP_MIN(spanTiles, CLIPMAP_MAX(tileCountX, tileCountY)));
+                }
         }
-        return sum;
+        return windowTiles;
 }
 
-static void GenerateProceduralTerrainImages(uint32_t size, ImageData* heightOut, ImageData* diffuseOut, ImageData* normalOut)
+static VkResult CreateClipmapTileWindows(void)
 {
-        DestroyImageData(heightOut);
-        DestroyImageData(diffuseOut);
-        DestroyImageData(normalOut);
-
-        const size_t pixelCount = (size_t)size * (size_t)size;
-        const size_t heightByteSize = pixelCount * sizeof(float);
-        const size_t rgbaByteSize = pixelCount * 4u;
-
-        float* heightPixels = (float*)malloc(heightByteSize);
-        uint8_t* diffusePixels = (uint8_t*)malloc(rgbaByteSize);
-        uint8_t* normalPixels = (uint8_t*)malloc(rgbaByteSize);
-        if(heightPixels == NULL || diffusePixels == NULL || normalPixels == NULL)
+        gClipmapTileWindowTiles = ComputeClipmapTileWindowTiles();
+        if(gClipmapTileWindowTiles == 0u)
         {
-                free(heightPixels);
-                free(diffusePixels);
-                free(normalPixels);
-                fprintf(gFILE, "GenerateProceduralTerrainImages(): allocation failed\n");
-                return;
+                return VK_ERROR_INITIALIZATION_FAILED;
         }
 
-        auto heightToColor = [](float h) -> glm::vec3
-        {
-                if(h < 0.35f) return glm::mix(glm::vec3(0.05f, 0.2f, 0.05f), glm::vec3(0.25f, 0.35f, 0.18f), h / 0.35f);
-                if(h < 0.65f) return glm::mix(glm::vec3(0.25f, 0.35f, 0.18f), glm::vec3(0.35f, 0.3f, 0.22f), (h - 0.35f) / 0.3f);
-                return glm::mix(glm::vec3(0.35f, 0.3f, 0.22f), glm::vec3(0.75f, 0.75f, 0.78f), (h - 0.65f) / 0.35f);
-        };
-
-        const float frequency = 1.0f / 180.0f;
-        for(uint32_t y = 0; y < size; y++)
+        size_t levelSlots = (size_t)gClipmapTileWindowTiles * gClipmapTileWindowTiles;
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-                for(uint32_t x = 0; x < size; x++)
+                ClipmapTileWindow& window = gClipmapTileWindows[attributeIndex];
+                window.tileBytes = GetTileRawBytes(gClipmapAttributeSources[attributeIndex]);
+                window.levelBytes = (VkDeviceSize)(levelSlots * window.tileBytes);
+                window.tilesCopied = 0;
+                if(!window.slotKeys.resize(levelSlots * gClipmapLevelCount))
                 {
-                        float nx = (float)x * frequency;
-                        float ny = (float)y * frequency;
-                        float ridge = fabsf(FractalNoise(nx, ny, 5, 2.07f, 0.5f) * 2.0f - 1.0f);
-                        float fbm = FractalNoise(nx * 0.6f, ny * 0.6f, 6, 2.0f, 0.55f);
-                        float heightValue = glm::clamp(0.6f * fbm + 0.7f * ridge, 0.0f, 1.0f);
-                        size_t idx = (size_t)y * (size_t)size + (size_t)x;
-                        heightPixels[idx] = heightValue;
+                        return VK_ERROR_OUT_OF_HOST_MEMORY;
+                }
+                memset(window.slotKeys.data(), 0, window.slotKeys.size() * sizeof(uint64_t));
+
+                char bufferName[128];
+                sprintf(bufferName, "%s_TileWindow", gClipmapAttributeSpecs[attributeIndex].debugName);
+                VkResult vkResult = CreateBufferResource(
+                        window.levelBytes * gClipmapLevelCount,
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                        &window.vkBuffer,
+                        &window.vkDeviceMemory,
+                        bufferName);
+                if(vkResult != VK_SUCCESS)
+                {
+                        return vkResult;
+                }
 
-                        glm::vec3 color = heightToColor(heightValue);
-                        diffusePixels[idx * 4u + 0u] = (uint8_t)glm::clamp(color.r * 255.0f, 0.0f, 255.0f);
-                        diffusePixels[idx * 4u + 1u] = (uint8_t)glm::clamp(color.g * 255.0f, 0.0f, 255.0f);
-                        diffusePixels[idx * 4u + 2u] = (uint8_t)glm::clamp(color.b * 255.0f, 0.0f, 255.0f);
-                        diffusePixels[idx * 4u + 3u] = 255u;
+                vkResult = vkMapMemory(vkDevice, window.vkDeviceMemory, 0, VK_WHOLE_SIZE, 0, (void**)&window.mapped);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "CreateClipmapTileWindows(): vkMapMemory() failed for %s with error code %d\n", bufferName, vkResult);
+                        return vkResult;
                 }
+
+                fprintf(gFILE, "CreateClipmapTileWindows(): %s %ux%u tiles per level (%.2f MB)\n",
+                        gClipmapAttributeSpecs[attributeIndex].debugName,
+                        gClipmapTileWindowTiles,
+                        gClipmapTileWindowTiles,
+                        (double)(window.levelBytes * gClipmapLevelCount) / (1024.0 * 1024.0));
         }
 
-        auto sampleHeight = [&](int x, int y) -> float
-        {
-                int sx = WrapCoordForTile(x, size);
-                int sy = WrapCoordForTile(y, size);
-                return heightPixels[(size_t)sy * (size_t)size + (size_t)sx];
-        };
+        return VK_SUCCESS;
+}
 
-        for(uint32_t y = 0; y < size; y++)
+static void DestroyClipmapTileWindows(void)
+{
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-                for(uint32_t x = 0; x < size; x++)
+                ClipmapTileWindow& window = gClipmapTileWindows[attributeIndex];
+                if(window.mapped)
                 {
-                        float hL = sampleHeight((int)x - 1, (int)y);
-                        float hR = sampleHeight((int)x + 1, (int)y);
-                        float hD = sampleHeight((int)x, (int)y - 1);
-                        float hU = sampleHeight((int)x, (int)y + 1);
+                        vkUnmapMemory(vkDevice, window.vkDeviceMemory);
+                        window.mapped = NULL;
+                }
 
-                        float dx = (hR - hL);
-                        float dy = (hU - hD);
-                        glm::vec3 normal = glm::normalize(glm::vec3(-dx * gTerrainHeightScale, 2.0f, -dy * gTerrainHeightScale));
+                if(window.vkBuffer)
+                {
+                        vkDestroyBuffer(vkDevice, window.vkBuffer, NULL);
+                        window.vkBuffer = VK_NULL_HANDLE;
+                }
 
-                        size_t idx = ((size_t)y * (size_t)size + (size_t)x) * 4u;
-                        normalPixels[idx + 0u] = (uint8_t)glm::clamp((normal.x * 0.5f + 0.5f) * 255.0f, 0.0f, 255.0f);
-                        normalPixels[idx + 1u] = (uint8_t)glm::clamp((normal.y * 0.5f + 0.5f) * 255.0f, 0.0f, 255.0f);
-                        normalPixels[idx + 2u] = (uint8_t)glm::clamp((normal.z * 0.5f + 0.5f) * 255.0f, 0.0f, 255.0f);
-                        normalPixels[idx + 3u] = 255u;
+                if(window.vkDeviceMemory)
+                {
+                        vkFreeMemory(vkDevice, window.vkDeviceMemory, NULL);
+                        window.vkDeviceMemory = VK_NULL_HANDLE;
                 }
+
+                window.slotKeys = ClipmapVector<uint64_t>();
         }
+        gClipmapTileWindowTiles = 0u;
+}
 
-        heightOut->width = size;
-        heightOut->height = size;
-        heightOut->size = (VkDeviceSize)heightByteSize;
-        heightOut->pixels = (uint8_t*)heightPixels;
+// Copies the tiles a level origin covers into the level's window slots, skipping
+// slots that already hold the right tile. Runs in the job that made the tiles
+// resident, so they are still pinned; anything missing is loaded again.
+static VkResult StageClipmapLevelTiles(uint32_t levelIndex, const glm::ivec2& originSamples)
+{
+        // The benchmarks run level jobs before the windows exist.
+        if(gClipmapTileWindowTiles == 0u)
+        {
+                return VK_SUCCESS;
+        }
 
-        diffuseOut->width = size;
-        diffuseOut->height = size;
-        diffuseOut->size = (VkDeviceSize)rgbaByteSize;
-        diffuseOut->pixels = diffusePixels;
+        static thread_local uint8_t scratch[gClipmapTileMaxRawBytes];
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                ClipmapTileWindow& window = gClipmapTileWindows[attributeIndex];
+                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                if(window.mapped == NULL || source.width == 0 || source.height == 0)
+                {
+                        continue;
+                }
 
-        normalOut->width = size;
-        normalOut->height = size;
-        normalOut->size = (VkDeviceSize)rgbaByteSize;
-        normalOut->pixels = normalPixels;
+                ClipmapTileWindowPlacement placement;
+                ComputeClipmapTileWindowPlacement(source, levelIndex, originSamples, &placement);
+                size_t levelSlotBase = (size_t)levelIndex * gClipmapTileWindowTiles * gClipmapTileWindowTiles;
+                for(int offsetY = 0; offsetY < placement.tileSpan.y; offsetY++)
+                {
+                        for(int offsetX = 0; offsetX < placement.tileSpan.x; offsetX++)
+                        {
+                                ClipmapTileKey key;
+                                key.attribute = (ClipmapAttributeType)attributeIndex;
+                                key.mipLevel = placement.mipLevel;
+                                key.tileX = WrapCoordForTile(placement.firstTile.x + offsetX, (uint32_t)placement.tileCount.x);
+                                key.tileY = WrapCoordForTile(placement.firstTile.y + offsetY, (uint32_t)placement.tileCount.y);
+                                uint64_t packedKey = PackTileKey(key);
+
+                                uint32_t slotX = (uint32_t)((placement.firstSlot.x + offsetX) % placement.slotModulus.x);
+                                uint32_t slotY = (uint32_t)((placement.firstSlot.y + offsetY) % placement.slotModulus.y);
+                                size_t slotIndex = levelSlotBase + (size_t)slotY * gClipmapTileWindowTiles + slotX;
+                                if(window.slotKeys[slotIndex] == packedKey + 1u)
+                                {
+                                        continue;
+                                }
 
-        fprintf(gFILE, "GenerateProceduralTerrainImages(): generated %ux%u maps\n", size, size);
-}
+                                ClipmapTileResident* tile = NULL;
+                                ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, packedKey);
+                                if(entry != NULL)
+                                {
+                                        tile = &entry->tile;
+                                }
+                                else
+                                {
+                                        VkResult vkResult = EnsureTileResident(key, &tile);
+                                        if(vkResult != VK_SUCCESS)
+                                        {
+                                                return vkResult;
+                                        }
+                                }
 
-static uint64_t PackTileKey(const ClipmapTileKey& key)
-{
-        uint64_t packed = ((uint64_t)key.attribute & 0xFFull) << 56;
-        packed |= ((uint64_t)key.level & 0xFFull) << 48;
-        packed |= ((uint64_t)key.tileX & 0xFFFFFFull) << 24;
-        packed |= ((uint64_t)key.tileY & 0xFFFFFFull);
-        return packed;
+                                const uint8_t* texels = GetClipmapTileTexels(source, *tile, scratch);
+                                memcpy(window.mapped + slotIndex * window.tileBytes, texels, window.tileBytes);
+                                window.slotKeys[slotIndex] = packedKey + 1u;
+                                window.tilesCopied++;
+                        }
+                }
+        }
+
+        return VK_SUCCESS;
 }
 
-static inline uint32_t WrapCoordForTile(int value, uint32_t modulus)
+static VkResult CreateClipmapStagingRing(void)
 {
-        if(modulus == 0)
+        ClipmapStagingRing& ring = gClipmapStagingRing;
+        VkResult vkResult = CreateBufferResource(
+                gClipmapStagingRingBytes,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &ring.vkBuffer,
+                &ring.vkDeviceMemory,
+                "ClipmapStagingRing");
+        if(vkResult != VK_SUCCESS)
         {
-                return 0u;
+                return vkResult;
         }
 
-        int wrapped = value % (int)modulus;
-        if(wrapped < 0)
+        vkResult = vkMapMemory(vkDevice, ring.vkDeviceMemory, 0, VK_WHOLE_SIZE, 0, (void**)&ring.mapped);
+        if(vkResult != VK_SUCCESS)
         {
-                wrapped += (int)modulus;
+                fprintf(gFILE, "CreateClipmapStagingRing(): vkMapMemory() failed with error code %d\n", vkResult);
+                return vkResult;
         }
-        return (uint32_t)wrapped;
-}
 
-static void TouchTileEntry(ClipmapAttributeSource& source, uint64_t packedKey)
-{
-	source.lruOrder.remove_first(packedKey);
-	source.lruOrder.push_front(packedKey);
+        InitializeCriticalSection(&ring.mutex);
 
-	ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, packedKey);
-	if(entry != NULL)
-	{
-		entry->tile.lastUsedFrame = gClipmapTileFrameCounter;
-	}
-}
+        // Every level and the odd texture can hold an allocation at once.
+        if(!ring.allocations.reserve(gClipmapLevelCount * 2u))
+        {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
 
-static bool ClipmapContainsKey(const ClipmapVector<uint64_t>& list, uint64_t value)
-{
-	for(const uint64_t entry : list)
-	{
-		if(entry == value)
-		{
-			return true;
-		}
-	}
-	return false;
+        ring.capacity = gClipmapStagingRingBytes;
+        ring.head = 0;
+        ring.usedBytes = 0;
+        ring.usedHighWater = 0;
+        ring.allocationCount = 0;
+        ring.allocationFailures = 0;
+        ring.bytesStaged = 0;
+        return VK_SUCCESS;
 }
 
-static void TrimTileCache(ClipmapAttributeSource& source, const ClipmapVector<uint64_t>& required)
+static void DestroyClipmapStagingRing(void)
 {
-        if(source.maxResidentTiles == 0)
+        ClipmapStagingRing& ring = gClipmapStagingRing;
+        if(ring.mapped)
         {
-                return;
+                fprintf(gFILE, "DestroyClipmapStagingRing(): %llu uploads staged (%.2f MB), high-water %.2f of %.2f MB, %llu did not fit\n",
+                        (unsigned long long)ring.allocationCount,
+                        (double)ring.bytesStaged / (1024.0 * 1024.0),
+                        (double)ring.usedHighWater / (1024.0 * 1024.0),
+                        (double)ring.capacity / (1024.0 * 1024.0),
+                        (unsigned long long)ring.allocationFailures);
+
+                vkUnmapMemory(vkDevice, ring.vkDeviceMemory);
+                ring.mapped = NULL;
+                DeleteCriticalSection(&ring.mutex);
         }
 
-        while(source.tileCacheCount > source.maxResidentTiles && source.lruOrder.empty() == false)
+        if(ring.vkBuffer)
         {
-                uint64_t candidate = source.lruOrder.back();
-                if(ClipmapContainsKey(required, candidate))
-                {
-                        source.lruOrder.pop_back();
-                        continue;
-                }
+                vkDestroyBuffer(vkDevice, ring.vkBuffer, NULL);
+                ring.vkBuffer = VK_NULL_HANDLE;
+        }
 
-                RemoveTileCacheEntry(source, candidate);
-                source.lruOrder.pop_back();
+        if(ring.vkDeviceMemory)
+        {
+                vkFreeMemory(vkDevice, ring.vkDeviceMemory, NULL);
+                ring.vkDeviceMemory = VK_NULL_HANDLE;
         }
+
+        ring.allocations = ClipmapVector<ClipmapStagingAllocation>();
+        ring.capacity = 0;
 }
 
-static void EnsureTileCacheSpace(ClipmapAttributeSource& source, const ClipmapVector<uint64_t>& required,
-        size_t incomingMissing)
+// Claims bytes at the ring's head, wrapping to the start when they do not fit
+// before the end. Fails without waiting when the ring is full.
+static bool AllocateClipmapStagingBytes(VkDeviceSize bytes, VkDeviceSize* outOffset)
 {
-        if(source.maxResidentTiles == 0 || incomingMissing == 0)
+        ClipmapStagingRing& ring = gClipmapStagingRing;
+        if(ring.mapped == NULL)
         {
-                return;
+                return false;
+        }
+
+        bytes = (bytes + gClipmapStagingAlignment - 1u) & ~(gClipmapStagingAlignment - 1u);
+        EnterCriticalSection(&ring.mutex);
+        VkDeviceSize offset = ring.head;
+        VkDeviceSize padding = 0;
+        if(offset + bytes > ring.capacity)
+        {
+                padding = ring.capacity - offset;
+                offset = 0;
         }
 
-        while((source.tileCacheCount + incomingMissing) > source.maxResidentTiles && source.lruOrder.empty() == false)
+        ClipmapStagingAllocation allocation = {offset, padding + bytes, false};
+        bool allocated = (ring.usedBytes + allocation.bytes <= ring.capacity) && ring.allocations.push_back(allocation);
+        if(allocated)
+        {
+                ring.head = offset + bytes;
+                ring.usedBytes += allocation.bytes;
+                ring.usedHighWater = CLIPMAP_MAX(ring.usedHighWater, ring.usedBytes);
+                ring.allocationCount++;
+                ring.bytesStaged += bytes;
+                *outOffset = offset;
+        }
+        else
         {
-                uint64_t candidate = source.lruOrder.back();
-                source.lruOrder.pop_back();
+                ring.allocationFailures++;
+        }
+        LeaveCriticalSection(&ring.mutex);
+        return allocated;
+}
 
-                if(ClipmapContainsKey(required, candidate))
+// Hands an allocation back once the GPU has finished reading it.
+static void ReleaseClipmapStagingBytes(VkDeviceSize offset)
+{
+        ClipmapStagingRing& ring = gClipmapStagingRing;
+        EnterCriticalSection(&ring.mutex);
+        for(ClipmapStagingAllocation& allocation : ring.allocations)
+        {
+                if(allocation.offset == offset && !allocation.released)
                 {
-                        continue;
+                        allocation.released = true;
+                        break;
                 }
+        }
 
-                RemoveTileCacheEntry(source, candidate);
+        while(!ring.allocations.empty() && ring.allocations[0].released)
+        {
+                ring.usedBytes -= ring.allocations[0].bytes;
+                ring.allocations.erase(0);
         }
-}
 
-static VkResult LoadTileDataForKey(const ClipmapTileKey& key, ClipmapTileResident& outTile)
-{
-        if(key.attribute >= CLIPMAP_ATTRIBUTE_COUNT)
+        // An empty ring starts over so the next allocation need not wrap.
+        if(ring.allocations.empty())
         {
-                return VK_ERROR_INITIALIZATION_FAILED;
+                ring.head = 0;
         }
+        LeaveCriticalSection(&ring.mutex);
+}
 
-        ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
-        if(source.imageData.pixels == NULL)
+// A run of texels along one axis of an update region that reads a single
+// source tile, every stride-th texel of it.
+struct ClipmapStripSegment
+{
+        uint32_t first; // Offset into the region.
+        uint32_t count;
+        uint32_t tile; // Wrapped tile index.
+        uint32_t local; // Tile texel read by the first entry.
+};
+
+// Splits region texels [regionStart, regionStart + regionSize) of one axis
+// into segments. The grid index is contiguous until it wraps at the texture
+// edge and the source texel until it leaves its tile, which also covers the
+// source wrapping since mip sizes are whole tiles.
+static uint32_t BuildClipmapStripSegments(uint32_t regionStart, uint32_t regionSize, int textureOffset, int mipOrigin, uint32_t stride, uint32_t mipSize, uint32_t tileSize, ClipmapStripSegment* outSegments)
+{
+        uint32_t segmentCount = 0u;
+        uint32_t position = 0u;
+        while(position < regionSize)
         {
-                fprintf(gFILE, "LoadTileDataForKey(): missing image data for attribute %u\n", key.attribute);
-                return VK_ERROR_INITIALIZATION_FAILED;
+                uint32_t grid = WrapCoordForTile((int)(regionStart + position) - textureOffset, gClipmapTextureSize);
+                uint32_t mipTexel = WrapCoordForTile(mipOrigin + (int)(grid * stride), mipSize);
+                uint32_t local = mipTexel % tileSize;
+                uint32_t gridRun = gClipmapTextureSize - grid;
+                uint32_t tileRun = (tileSize - local + stride - 1u) / stride;
+                uint32_t count = CLIPMAP_MIN(regionSize - position, CLIPMAP_MIN(gridRun, tileRun));
+
+                ClipmapStripSegment& segment = outSegments[segmentCount++];
+                segment.first = position;
+                segment.count = count;
+                segment.tile = mipTexel / tileSize;
+                segment.local = local;
+                position += count;
         }
+        return segmentCount;
+}
 
+// Writes one attribute's texels of one update region, tightly packed in image
+// row order, reading each source tile once.
+static VkResult WriteClipmapUpdateStrip(uint32_t attributeIndex, const ClipmapLevelUpdate& update, const ClipmapUpdateRegion& region, uint8_t* destination)
+{
+        ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+        uint32_t mipLevel = GetClipmapSourceMipForLevel(source, update.levelIndex);
+        const ImageData& image = source.mipImages[mipLevel];
         uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
-        outTile.key = key;
-        outTile.lastUsedFrame = gClipmapTileFrameCounter;
-        outTile.data.resize((size_t)tileSize * (size_t)tileSize * (size_t)source.bytesPerTexel);
-
-        for(uint32_t localY = 0; localY < tileSize; localY++)
+        uint32_t stride = 1u << (update.levelIndex - mipLevel);
+        size_t texelBytes = source.bytesPerTexel;
+        size_t destinationPitch = (size_t)region.width * texelBytes;
+
+        ClipmapStripSegment columns[gClipmapTextureSize];
+        ClipmapStripSegment rows[gClipmapTextureSize];
+        uint32_t columnCount = BuildClipmapStripSegments(region.x, region.width, update.textureOffset.x,
+                FloorDivide(update.originInSamples.x, 1 << mipLevel), stride, image.width, tileSize, columns);
+        uint32_t rowCount = BuildClipmapStripSegments(region.y, region.height, update.textureOffset.y,
+                FloorDivide(update.originInSamples.y, 1 << mipLevel), stride, image.height, tileSize, rows);
+
+        static thread_local uint8_t scratch[gClipmapTileMaxRawBytes];
+        for(uint32_t rowIndex = 0; rowIndex < rowCount; rowIndex++)
         {
-                uint32_t srcY = WrapCoordForTile((int)(key.tileY * tileSize + localY), source.height);
-                for(uint32_t localX = 0; localX < tileSize; localX++)
+                const ClipmapStripSegment& row = rows[rowIndex];
+                for(uint32_t columnIndex = 0; columnIndex < columnCount; columnIndex++)
                 {
-                        uint32_t srcX = WrapCoordForTile((int)(key.tileX * tileSize + localX), source.width);
-                        size_t dstIndex = ((size_t)localY * (size_t)tileSize + (size_t)localX) * (size_t)source.bytesPerTexel;
-
-                        if(source.isFloat)
+                        const ClipmapStripSegment& column = columns[columnIndex];
+                        ClipmapTileKey key;
+                        key.attribute = (ClipmapAttributeType)attributeIndex;
+                        key.mipLevel = mipLevel;
+                        key.tileX = column.tile;
+                        key.tileY = row.tile;
+
+                        ClipmapTileResident* tile = NULL;
+                        ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, PackTileKey(key));
+                        if(entry != NULL)
                         {
-                                size_t srcIndex = ((size_t)srcY * (size_t)source.width + (size_t)srcX) * sizeof(float);
-                                memcpy(outTile.data.data() + dstIndex, source.imageData.pixels + srcIndex, sizeof(float));
+                                tile = &entry->tile;
                         }
                         else
                         {
-                                size_t srcIndex = ((size_t)srcY * (size_t)source.width + (size_t)srcX) * 4u;
-                                memcpy(outTile.data.data() + dstIndex, source.imageData.pixels + srcIndex, source.bytesPerTexel);
+                                VkResult vkResult = EnsureTileResident(key, &tile);
+                                if(vkResult != VK_SUCCESS)
+                                {
+                                        return vkResult;
+                                }
+                        }
+
+                        const uint8_t* texels = GetClipmapTileTexels(source, *tile, scratch);
+                        for(uint32_t y = 0; y < row.count; y++)
+                        {
+                                const uint8_t* sourceRow = texels + ((size_t)(row.local + y * stride) * tileSize + column.local) * texelBytes;
+                                uint8_t* destinationRow = destination + (size_t)(row.first + y) * destinationPitch + (size_t)column.first * texelBytes;
+                                if(stride == 1u)
+                                {
+                                        memcpy(destinationRow, sourceRow, column.count * texelBytes);
+                                        continue;
+                                }
+
+                                for(uint32_t x = 0; x < column.count; x++)
+                                {
+                                        memcpy(destinationRow + x * texelBytes, sourceRow + (size_t)x * stride * texelBytes, texelBytes);
+                                }
                         }
                 }
         }
+
         return VK_SUCCESS;
 }
 
-static VkResult EnsureTileResident(const ClipmapTileKey& key, ClipmapTileResident** outTile)
+// Stages the texels of a computed level update. The strips go into the staging
+// ring when it has room; otherwise the level's tile windows are brought up to
+// date for the fill shader. Runs in the job that made the tiles resident.
+static VkResult StageClipmapLevelUpdate(ClipmapLevelUpdate& update)
 {
-        if(key.attribute >= CLIPMAP_ATTRIBUTE_COUNT)
+        update.staged = false;
+        if(update.regionCount == 0u)
         {
-                return VK_ERROR_INITIALIZATION_FAILED;
+                return VK_SUCCESS;
         }
 
-        ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
-        uint64_t packedKey = PackTileKey(key);
-	ClipmapTileCacheEntry* entry = FindTileCacheEntry(source, packedKey);
-	if(entry != NULL)
-	{
-		TouchTileEntry(source, packedKey);
-		if(outTile)
-		{
-			*outTile = &entry->tile;
-		}
-		return VK_SUCCESS;
-	}
-
-        ClipmapTileResident resident;
-        VkResult vkResult = LoadTileDataForKey(key, resident);
-        if(vkResult != VK_SUCCESS)
+        VkDeviceSize bytes = 0;
+        VkDeviceSize stripOffsets[CLIPMAP_ATTRIBUTE_COUNT][gClipmapMaxUpdateRegions];
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-                return vkResult;
+                for(uint32_t regionIndex = 0; regionIndex < update.regionCount; regionIndex++)
+                {
+                        const ClipmapUpdateRegion& region = update.regions[regionIndex];
+                        stripOffsets[attributeIndex][regionIndex] = bytes;
+                        bytes += (VkDeviceSize)region.width * region.height * gClipmapAttributeSources[attributeIndex].bytesPerTexel;
+                        bytes = (bytes + gClipmapStagingAlignment - 1u) & ~(gClipmapStagingAlignment - 1u);
+                }
         }
 
-	ClipmapTileCacheEntry* newEntry = AllocateTileCacheEntry(source, packedKey);
-	if(newEntry == NULL)
-	{
-		resident.data.release();
-		return VK_ERROR_OUT_OF_HOST_MEMORY;
-	}
-
-	newEntry->tile = ClipmapMove(resident);
-	newEntry->tile.key = key;
-	newEntry->tile.lastUsedFrame = gClipmapTileFrameCounter;
-
-        TouchTileEntry(source, packedKey);
+        VkDeviceSize allocation = 0;
+        if(!AllocateClipmapStagingBytes(bytes, &allocation))
+        {
+                return StageClipmapLevelTiles(update.levelIndex, update.originInSamples);
+        }
 
-        if(outTile)
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-		*outTile = &newEntry->tile;
+                for(uint32_t regionIndex = 0; regionIndex < update.regionCount; regionIndex++)
+                {
+                        VkDeviceSize offset = allocation + stripOffsets[attributeIndex][regionIndex];
+                        VkResult vkResult = WriteClipmapUpdateStrip(attributeIndex, update, update.regions[regionIndex], gClipmapStagingRing.mapped + offset);
+                        if(vkResult != VK_SUCCESS)
+                        {
+                                ReleaseClipmapStagingBytes(allocation);
+                                return vkResult;
+                        }
+                        update.stagingOffsets[attributeIndex][regionIndex] = offset;
+                }
         }
 
+        update.staged = true;
+        update.stagingAllocation = allocation;
         return VK_SUCCESS;
 }
 
-static VkResult EnsureTileSetResident(const ClipmapTileKeyVector& keys)
+// Fill shader binary for an attribute; the height variant follows the height format.
+static const char* GetClipmapFillShaderFile(uint32_t attributeIndex)
 {
-	ClipmapVector<uint64_t> requiredPacked[CLIPMAP_ATTRIBUTE_COUNT];
-	size_t missingCounts[CLIPMAP_ATTRIBUTE_COUNT] = { 0 };
-
-	for(const ClipmapTileKey& key : keys)
-	{
-		if(key.attribute >= CLIPMAP_ATTRIBUTE_COUNT)
-		{
-			return VK_ERROR_INITIALIZATION_FAILED;
-		}
-
-		uint64_t packedKey = PackTileKey(key);
-		requiredPacked[key.attribute].push_back(packedKey);
-
-		ClipmapAttributeSource& source = gClipmapAttributeSources[key.attribute];
-		if(FindTileCacheEntry(source, packedKey) == NULL)
-		{
-			missingCounts[key.attribute]++;
-		}
-	}
-
-	for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
-	{
-		ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
-		EnsureTileCacheSpace(source, requiredPacked[attributeIndex], missingCounts[attributeIndex]);
-	}
-
-        for(const ClipmapTileKey& key : keys)
+        if(attributeIndex == CLIPMAP_ATTRIBUTE_HEIGHT)
         {
-                VkResult status = EnsureTileResident(key, NULL);
-                if(status != VK_SUCCESS)
-                {
-			return status;
-		}
-	}
-	return VK_SUCCESS;
+                return gClipmapHeight16 ? "ShaderHeight16.comp.spv" : "ShaderHeight.comp.spv";
+        }
+        return "ShaderColor.comp.spv";
 }
 
-static void EnforceTileBudgets(ClipmapTileKeyVector (&requiredTiles)[CLIPMAP_ATTRIBUTE_COUNT])
-{
-        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+// One descriptor set per level and attribute: binding 0 is the level's slice of
+// the attribute's tile window, binding 1 the level's image.
+static VkResult CreateClipmapComputeDescriptorSets(void)
+{
+        VkDescriptorSetLayoutBinding vkDescriptorSetLayoutBinding_array[2];
+        memset((void*)vkDescriptorSetLayoutBinding_array, 0, sizeof(VkDescriptorSetLayoutBinding) * _ARRAYSIZE(vkDescriptorSetLayoutBinding_array));
+        vkDescriptorSetLayoutBinding_array[0].binding = 0;
+        vkDescriptorSetLayoutBinding_array[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        vkDescriptorSetLayoutBinding_array[0].descriptorCount = 1;
+        vkDescriptorSetLayoutBinding_array[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        vkDescriptorSetLayoutBinding_array[1].binding = 1;
+        vkDescriptorSetLayoutBinding_array[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        vkDescriptorSetLayoutBinding_array[1].descriptorCount = 1;
+        vkDescriptorSetLayoutBinding_array[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo vkDescriptorSetLayoutCreateInfo;
+        memset((void*)&vkDescriptorSetLayoutCreateInfo, 0, sizeof(VkDescriptorSetLayoutCreateInfo));
+        vkDescriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        vkDescriptorSetLayoutCreateInfo.bindingCount = _ARRAYSIZE(vkDescriptorSetLayoutBinding_array);
+        vkDescriptorSetLayoutCreateInfo.pBindings = vkDescriptorSetLayoutBinding_array;
+
+        VkResult vkResult = vkCreateDescriptorSetLayout(vkDevice, &vkDescriptorSetLayoutCreateInfo, NULL, &gClipmapComputeDescriptorSetLayout);
+        if(vkResult != VK_SUCCESS)
         {
-                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
-		ClipmapVector<uint64_t> required;
-		for(const ClipmapTileKey& key : requiredTiles[attributeIndex])
-		{
-			required.push_back(PackTileKey(key));
-		}
-
-		TrimTileCache(source, required);
+                fprintf(gFILE, "CreateClipmapComputeDescriptorSets(): vkCreateDescriptorSetLayout() failed with error code %d\n", vkResult);
+                return vkResult;
         }
-}
 
-void DestroyTexture(TextureResource* textureResource)
-{
-	if(textureResource == NULL)
-	{
-		return;
-	}
+        const uint32_t setCount = gClipmapLevelCount * CLIPMAP_ATTRIBUTE_COUNT;
+        VkDescriptorPoolSize vkDescriptorPoolSize_array[2];
+        memset((void*)vkDescriptorPoolSize_array, 0, sizeof(VkDescriptorPoolSize) * _ARRAYSIZE(vkDescriptorPoolSize_array));
+        vkDescriptorPoolSize_array[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        vkDescriptorPoolSize_array[0].descriptorCount = setCount;
+        vkDescriptorPoolSize_array[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        vkDescriptorPoolSize_array[1].descriptorCount = setCount;
+
+        VkDescriptorPoolCreateInfo vkDescriptorPoolCreateInfo;
+        memset((void*)&vkDescriptorPoolCreateInfo, 0, sizeof(VkDescriptorPoolCreateInfo));
+        vkDescriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        vkDescriptorPoolCreateInfo.maxSets = setCount;
+        vkDescriptorPoolCreateInfo.poolSizeCount = _ARRAYSIZE(vkDescriptorPoolSize_array);
+        vkDescriptorPoolCreateInfo.pPoolSizes = vkDescriptorPoolSize_array;
+
+        vkResult = vkCreateDescriptorPool(vkDevice, &vkDescriptorPoolCreateInfo, NULL, &gClipmapComputeDescriptorPool);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "CreateClipmapComputeDescriptorSets(): vkCreateDescriptorPool() failed with error code %d\n", vkResult);
+                return vkResult;
+        }
 
-	if(textureResource->vkSampler)
-	{
-		vkDestroySampler(vkDevice, textureResource->vkSampler, NULL);
-		textureResource->vkSampler = VK_NULL_HANDLE;
-	}
+        VkDescriptorSetLayout setLayouts[setCount];
+        for(uint32_t setIndex = 0; setIndex < setCount; setIndex++)
+        {
+                setLayouts[setIndex] = gClipmapComputeDescriptorSetLayout;
+        }
 
-	if(textureResource->vkImageView)
-	{
-		vkDestroyImageView(vkDevice, textureResource->vkImageView, NULL);
-		textureResource->vkImageView = VK_NULL_HANDLE;
-	}
+        VkDescriptorSetAllocateInfo vkDescriptorSetAllocateInfo;
+        memset((void*)&vkDescriptorSetAllocateInfo, 0, sizeof(VkDescriptorSetAllocateInfo));
+        vkDescriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        vkDescriptorSetAllocateInfo.descriptorPool = gClipmapComputeDescriptorPool;
+        vkDescriptorSetAllocateInfo.descriptorSetCount = setCount;
+        vkDescriptorSetAllocateInfo.pSetLayouts = setLayouts;
 
-	if(textureResource->vkImage)
-	{
-		vkDestroyImage(vkDevice, textureResource->vkImage, NULL);
-		textureResource->vkImage = VK_NULL_HANDLE;
-	}
+        vkResult = vkAllocateDescriptorSets(vkDevice, &vkDescriptorSetAllocateInfo, &gClipmapComputeDescriptorSets[0][0]);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "CreateClipmapComputeDescriptorSets(): vkAllocateDescriptorSets() failed with error code %d\n", vkResult);
+                return vkResult;
+        }
 
-	if(textureResource->vkDeviceMemory)
-	{
-		vkFreeMemory(vkDevice, textureResource->vkDeviceMemory, NULL);
-		textureResource->vkDeviceMemory = VK_NULL_HANDLE;
-	}
+        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+        {
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        const ClipmapTileWindow& window = gClipmapTileWindows[attributeIndex];
+                        VkDescriptorBufferInfo vkDescriptorBufferInfo;
+                        memset((void*)&vkDescriptorBufferInfo, 0, sizeof(VkDescriptorBufferInfo));
+                        vkDescriptorBufferInfo.buffer = window.vkBuffer;
+                        vkDescriptorBufferInfo.offset = window.levelBytes * levelIndex;
+                        vkDescriptorBufferInfo.range = window.levelBytes;
+
+                        VkDescriptorImageInfo vkDescriptorImageInfo;
+                        memset((void*)&vkDescriptorImageInfo, 0, sizeof(VkDescriptorImageInfo));
+                        vkDescriptorImageInfo.imageView = gClipmapAttributeArrays[attributeIndex].vkImageView;
+                        vkDescriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+                        VkWriteDescriptorSet vkWriteDescriptorSet_array[2];
+                        memset((void*)vkWriteDescriptorSet_array, 0, sizeof(VkWriteDescriptorSet) * _ARRAYSIZE(vkWriteDescriptorSet_array));
+                        vkWriteDescriptorSet_array[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                        vkWriteDescriptorSet_array[0].dstSet = gClipmapComputeDescriptorSets[levelIndex][attributeIndex];
+                        vkWriteDescriptorSet_array[0].dstBinding = 0;
+                        vkWriteDescriptorSet_array[0].descriptorCount = 1;
+                        vkWriteDescriptorSet_array[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                        vkWriteDescriptorSet_array[0].pBufferInfo = &vkDescriptorBufferInfo;
+                        vkWriteDescriptorSet_array[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                        vkWriteDescriptorSet_array[1].dstSet = gClipmapComputeDescriptorSets[levelIndex][attributeIndex];
+                        vkWriteDescriptorSet_array[1].dstBinding = 1;
+                        vkWriteDescriptorSet_array[1].descriptorCount = 1;
+                        vkWriteDescriptorSet_array[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+                        vkWriteDescriptorSet_array[1].pImageInfo = &vkDescriptorImageInfo;
+                        vkUpdateDescriptorSets(vkDevice, _ARRAYSIZE(vkWriteDescriptorSet_array), vkWriteDescriptorSet_array, 0, NULL);
+                }
+        }
 
-	textureResource->width = 0;
-	textureResource->height = 0;
+        return VK_SUCCESS;
 }
 
-void DestroyImageData(ImageData* imageData)
+// The fill pipelines UploadClipmapLevelToGpu dispatches, one per attribute. A
+// missing fill shader binary fails this, and so initialization.
+static VkResult CreateClipmapComputePipelines(void)
 {
-	if(imageData == NULL)
-	{
-		return;
-	}
-
-	if(imageData->pixels)
-	{
-		free(imageData->pixels);
-		imageData->pixels = NULL;
-	}
-
-	imageData->width = 0;
-	imageData->height = 0;
-	imageData->size = 0;
-}
+        VkResult vkResult = CreateClipmapComputeDescriptorSets();
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
 
-void DestroyClipmapLevelResource(ClipmapLevelResource* levelResource)
-{
-	if(levelResource == NULL)
-	{
-		return;
-	}
+        VkPushConstantRange vkPushConstantRange;
+        memset((void*)&vkPushConstantRange, 0, sizeof(VkPushConstantRange));
+        vkPushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        vkPushConstantRange.offset = 0;
+        vkPushConstantRange.size = sizeof(ClipmapComputePushConstants);
+
+        VkPipelineLayoutCreateInfo vkPipelineLayoutCreateInfo;
+        memset((void*)&vkPipelineLayoutCreateInfo, 0, sizeof(VkPipelineLayoutCreateInfo));
+        vkPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        vkPipelineLayoutCreateInfo.setLayoutCount = 1;
+        vkPipelineLayoutCreateInfo.pSetLayouts = &gClipmapComputeDescriptorSetLayout;
+        vkPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+        vkPipelineLayoutCreateInfo.pPushConstantRanges = &vkPushConstantRange;
+
+        vkResult = vkCreatePipelineLayout(vkDevice, &vkPipelineLayoutCreateInfo, NULL, &gClipmapComputePipelineLayout);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "CreateClipmapComputePipelines(): vkCreatePipelineLayout() failed with error code %d\n", vkResult);
+                return vkResult;
+        }
 
         for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-                ClipmapAttributeResource& attributeResource = levelResource->attributes[attributeIndex];
-
-                if(attributeResource.vkSampler)
+                const char* shaderFile = GetClipmapFillShaderFile(attributeIndex);
+                VkShaderModule shaderModule = VK_NULL_HANDLE;
+                vkResult = CreateShaderModuleFromSpv(shaderFile, &shaderModule);
+                if(vkResult != VK_SUCCESS)
                 {
-                        vkDestroySampler(vkDevice, attributeResource.vkSampler, NULL);
-			attributeResource.vkSampler = VK_NULL_HANDLE;
-		}
-
-		if(attributeResource.vkImageView)
-		{
-			vkDestroyImageView(vkDevice, attributeResource.vkImageView, NULL);
-			attributeResource.vkImageView = VK_NULL_HANDLE;
-		}
-
-		if(attributeResource.vkImage)
-		{
-			vkDestroyImage(vkDevice, attributeResource.vkImage, NULL);
-			attributeResource.vkImage = VK_NULL_HANDLE;
-		}
+                        fprintf(gFILE, "CreateClipmapComputePipelines(): %s is unavailable, %s images cannot be filled\n",
+                                shaderFile, gClipmapAttributeSpecs[attributeIndex].debugName);
+                        return vkResult;
+                }
 
-                if(attributeResource.vkDeviceMemory)
+                VkComputePipelineCreateInfo vkComputePipelineCreateInfo;
+                memset((void*)&vkComputePipelineCreateInfo, 0, sizeof(VkComputePipelineCreateInfo));
+                vkComputePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+                // Update regions are dispatched with a non-zero base workgroup.
+                vkComputePipelineCreateInfo.flags = VK_PIPELINE_CREATE_DISPATCH_BASE_BIT;
+                vkComputePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+                vkComputePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+                vkComputePipelineCreateInfo.stage.module = shaderModule;
+                vkComputePipelineCreateInfo.stage.pName = "main";
+                vkComputePipelineCreateInfo.layout = gClipmapComputePipelineLayout;
+
+                vkResult = vkCreateComputePipelines(vkDevice, VK_NULL_HANDLE, 1, &vkComputePipelineCreateInfo, NULL, &gClipmapComputePipelines[attributeIndex]);
+                vkDestroyShaderModule(vkDevice, shaderModule, NULL);
+                if(vkResult != VK_SUCCESS)
                 {
-                        vkFreeMemory(vkDevice, attributeResource.vkDeviceMemory, NULL);
-                        attributeResource.vkDeviceMemory = VK_NULL_HANDLE;
+                        fprintf(gFILE, "CreateClipmapComputePipelines(): vkCreateComputePipelines() failed for %s with error code %d\n", shaderFile, vkResult);
+                        return vkResult;
                 }
-                attributeResource.initialized = false;
         }
 
-	levelResource->originInSamples = glm::ivec2(0);
-	levelResource->worldOrigin = glm::vec2(0.0f);
-	levelResource->textureOffset = glm::ivec2(0);
-	levelResource->initialized = false;
-	SetClipmapJobPending(levelResource, false);
+        return VK_SUCCESS;
 }
 
-static void DestroyClipmapAttributeSources(void)
+static void DestroyClipmapComputePipelines(void)
 {
         for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
         {
-                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
-		ClearClipmapTileCache(source);
-                DestroyImageData(&source.imageData);
-                source.width = 0;
-                source.height = 0;
-                source.bytesPerTexel = 0;
-                source.isFloat = false;
-                source.tileSize = 0;
-                source.maxResidentTiles = 0;
+                if(gClipmapComputePipelines[attributeIndex])
+                {
+                        vkDestroyPipeline(vkDevice, gClipmapComputePipelines[attributeIndex], NULL);
+                        gClipmapComputePipelines[attributeIndex] = VK_NULL_HANDLE;
+                }
         }
-}
-
-static void ShutdownClipmapSynchronization(void);
-
-void DestroyClipmapResources(void)
-{
-        ShutdownClipmapStreaming();
-
-        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
-	{
-		DestroyClipmapLevelResource(&gClipmapLevels[levelIndex]);
-	}
-
-	if(gClipmapVertexBuffer.vkBuffer)
-	{
-		vkDestroyBuffer(vkDevice, gClipmapVertexBuffer.vkBuffer, NULL);
-		gClipmapVertexBuffer.vkBuffer = VK_NULL_HANDLE;
-	}
-
-	if(gClipmapVertexBuffer.vkDeviceMemory)
-	{
-		vkFreeMemory(vkDevice, gClipmapVertexBuffer.vkDeviceMemory, NULL);
-		gClipmapVertexBuffer.vkDeviceMemory = VK_NULL_HANDLE;
-	}
-
-	if(gClipmapIndexBuffer.vkBuffer)
-	{
-		vkDestroyBuffer(vkDevice, gClipmapIndexBuffer.vkBuffer, NULL);
-		gClipmapIndexBuffer.vkBuffer = VK_NULL_HANDLE;
-	}
 
-        if(gClipmapIndexBuffer.vkDeviceMemory)
+        if(gClipmapComputePipelineLayout)
         {
-                vkFreeMemory(vkDevice, gClipmapIndexBuffer.vkDeviceMemory, NULL);
-                gClipmapIndexBuffer.vkDeviceMemory = VK_NULL_HANDLE;
+                vkDestroyPipelineLayout(vkDevice, gClipmapComputePipelineLayout, NULL);
+                gClipmapComputePipelineLayout = VK_NULL_HANDLE;
         }
 
-        DestroyClipmapAttributeSources();
+        // Destroying the pool frees its sets.
+        if(gClipmapComputeDescriptorPool)
+        {
+                vkDestroyDescriptorPool(vkDevice, gClipmapComputeDescriptorPool, NULL);
+                gClipmapComputeDescriptorPool = VK_NULL_HANDLE;
+        }
+        memset((void*)gClipmapComputeDescriptorSets, 0, sizeof(gClipmapComputeDescriptorSets));
 
-        ShutdownClipmapSynchronization();
+        if(gClipmapComputeDescriptorSetLayout)
+        {
+                vkDestroyDescriptorSetLayout(vkDevice, gClipmapComputeDescriptorSetLayout, NULL);
+                gClipmapComputeDescriptorSetLayout = VK_NULL_HANDLE;
+        }
 }
 
-VkResult LoadClipmapAttributeSources(void)
+// Computes the level's new origin, toroidal offset and dirty regions into
+// outUpdate. The level itself is left untouched until the update is applied.
+VkResult PopulateClipmapLevelCpuData(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapLevelUpdate& outUpdate)
 {
-        if((gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].imageData.pixels != NULL) &&
-           (gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_DIFFUSE].imageData.pixels != NULL) &&
-           (gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_NORMAL].imageData.pixels != NULL))
+        outUpdate.levelIndex = levelIndex;
+        outUpdate.regionCount = 0u;
+
+        if(gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].width == 0)
         {
-                return VK_SUCCESS;
+                return VK_ERROR_INITIALIZATION_FAILED;
         }
 
-        ImageData heightImage;
-        memset((void*)&heightImage, 0, sizeof(ImageData));
-        ImageData diffuseImage;
-        memset((void*)&diffuseImage, 0, sizeof(ImageData));
-        ImageData normalImage;
-        memset((void*)&normalImage, 0, sizeof(ImageData));
-
-        const uint32_t proceduralSize = 1024u;
-        GenerateProceduralTerrainImages(proceduralSize, &heightImage, &diffuseImage, &normalImage);
+        const ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
+        uint32_t textureSize = gClipmapTextureSize;
+        uint32_t sampleSpacing = 1u << levelIndex;
+        outUpdate.originInSamples = originSamples;
+        outUpdate.textureOffset = levelResource->textureOffset;
 
-        if(heightImage.pixels == NULL || diffuseImage.pixels == NULL || normalImage.pixels == NULL)
+        auto fullUpdate = [&]() -> VkResult
         {
-                DestroyImageData(&heightImage);
-                DestroyImageData(&diffuseImage);
-                DestroyImageData(&normalImage);
-                fprintf(gFILE, "LoadClipmapAttributeSources(): failed to generate procedural terrain data\n");
-                return VK_ERROR_INITIALIZATION_FAILED;
-        }
+                outUpdate.textureOffset = glm::ivec2(0);
+                ClipmapUpdateRegion region = {0u, 0u, textureSize, textureSize};
+                outUpdate.regions[0] = region;
+                outUpdate.regionCount = 1u;
+                return VK_SUCCESS;
+	};
 
-        ClipmapAttributeSource& heightSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT];
-        DestroyImageData(&heightSource.imageData);
-        heightSource.width = heightImage.width;
-        heightSource.height = heightImage.height;
-        heightSource.bytesPerTexel = sizeof(float);
-        heightSource.isFloat = true;
-        heightSource.tileSize = gClipmapTileSize;
-        heightSource.maxResidentTiles = gClipmapMaxResidentTiles;
-        heightSource.imageData = heightImage;
-	ClearClipmapTileCache(heightSource);
+	if(levelResource->initialized == false)
+	{
+		return fullUpdate();
+	}
 
-        ClipmapAttributeSource& diffuseSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_DIFFUSE];
-        DestroyImageData(&diffuseSource.imageData);
-        diffuseSource.width = diffuseImage.width;
-        diffuseSource.height = diffuseImage.height;
-        diffuseSource.bytesPerTexel = 4;
-        diffuseSource.isFloat = false;
-        diffuseSource.tileSize = gClipmapTileSize;
-        diffuseSource.maxResidentTiles = gClipmapMaxResidentTiles;
-        diffuseSource.imageData = diffuseImage;
-	ClearClipmapTileCache(diffuseSource);
+	glm::ivec2 deltaSamples = originSamples - levelResource->originInSamples;
+	if(deltaSamples.x == 0 && deltaSamples.y == 0)
+	{
+		return VK_SUCCESS;
+	}
 
-        ClipmapAttributeSource& normalSource = gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_NORMAL];
-        DestroyImageData(&normalSource.imageData);
-        normalSource.width = normalImage.width;
-        normalSource.height = normalImage.height;
-        normalSource.bytesPerTexel = 4;
-        normalSource.isFloat = false;
-        normalSource.tileSize = gClipmapTileSize;
-        normalSource.maxResidentTiles = gClipmapMaxResidentTiles;
-        normalSource.imageData = normalImage;
-	ClearClipmapTileCache(normalSource);
+	if((deltaSamples.x % (int)sampleSpacing) != 0 || (deltaSamples.y % (int)sampleSpacing) != 0)
+	{
+		return fullUpdate();
+	}
 
-        gClipmapBaseWorldSpacing = gTerrainWorldExtent / (float)heightSource.width;
+	int shiftX = deltaSamples.x / (int)sampleSpacing;
+	int shiftY = deltaSamples.y / (int)sampleSpacing;
+
+	if(abs(shiftX) >= (int)textureSize || abs(shiftY) >= (int)textureSize)
+	{
+		return fullUpdate();
+	}
+
+	if(shiftY != 0)
+	{
+		outUpdate.textureOffset.y = (int)WrapCoordinate(outUpdate.textureOffset.y + shiftY, textureSize);
+		uint32_t rowCount = (uint32_t)abs(shiftY);
+		int startRowValue = (shiftY > 0)
+			? (outUpdate.textureOffset.y + (int)textureSize - (int)rowCount)
+			: outUpdate.textureOffset.y;
+		uint32_t startRow = WrapCoordinate(startRowValue, textureSize);
+		AppendRowRegions(startRow, rowCount, outUpdate);
+	}
 
-        fprintf(gFILE, "LoadClipmapAttributeSources(): loaded height field %ux%u, base world spacing %.3f\n",
-                heightSource.width,
-                heightSource.height,
-                gClipmapBaseWorldSpacing);
+	if(shiftX != 0)
+	{
+		outUpdate.textureOffset.x = (int)WrapCoordinate(outUpdate.textureOffset.x + shiftX, textureSize);
+		uint32_t columnCount = (uint32_t)abs(shiftX);
+		int startColumnValue = (shiftX > 0)
+			? (outUpdate.textureOffset.x + (int)textureSize - (int)columnCount)
+			: outUpdate.textureOffset.x;
+		uint32_t startColumn = WrapCoordinate(startColumnValue, textureSize);
+                AppendColumnRegions(startColumn, columnCount, outUpdate);
+        }
 
         return VK_SUCCESS;
 }
 
-VkResult CreateClipmapAttributeResources(void)
+static inline bool UsesClipmapStreamQueueFamily(void)
 {
-	for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
-	{
-		ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
-		levelResource->originInSamples = glm::ivec2(0);
-		levelResource->worldOrigin = glm::vec2(0.0f);
-		levelResource->textureOffset = glm::ivec2(0);
-		levelResource->initialized = false;
-		SetClipmapJobPending(levelResource, false);
+        return gClipmapStreamQueueFamilyIndex != graphicsQuequeFamilyIndex_selected;
+}
 
-		for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
-		{
-                        const ClipmapAttributeSpec& spec = gClipmapAttributeSpecs[attributeIndex];
-                        ClipmapAttributeResource& attributeResource = levelResource->attributes[attributeIndex];
-                        attributeResource.initialized = false;
-
-                        char imageName[128];
-                        sprintf(imageName, "%s_Image_L%u", spec.debugName, levelIndex);
-                        VkResult vkResult = CreateImageResource(
-                                gClipmapTextureSize,
-                                gClipmapTextureSize,
-                                spec.format,
-                                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-                                &attributeResource.vkImage,
-                                &attributeResource.vkDeviceMemory,
-                                imageName);
-			if(vkResult != VK_SUCCESS)
-			{
-				return vkResult;
-			}
+static VkResult CreateClipmapUploadFrames(void)
+{
+        bool transferOwnership = UsesClipmapStreamQueueFamily();
+        gClipmapStreamCommandPool = vkCommandPool;
+        if(transferOwnership)
+        {
+                VkCommandPoolCreateInfo vkCommandPoolCreateInfo;
+                memset((void*)&vkCommandPoolCreateInfo, 0, sizeof(VkCommandPoolCreateInfo));
+                vkCommandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                vkCommandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+                vkCommandPoolCreateInfo.queueFamilyIndex = gClipmapStreamQueueFamilyIndex;
 
-			VkImageViewCreateInfo vkImageViewCreateInfo;
-			memset((void*)&vkImageViewCreateInfo, 0, sizeof(VkImageViewCreateInfo));
-			vkImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-			vkImageViewCreateInfo.image = attributeResource.vkImage;
-			vkImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-			vkImageViewCreateInfo.format = spec.format;
-			vkImageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-			vkImageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-			vkImageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-			vkImageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-			vkImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			vkImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-			vkImageViewCreateInfo.subresourceRange.levelCount = 1;
-			vkImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-			vkImageViewCreateInfo.subresourceRange.layerCount = 1;
-
-			vkResult = vkCreateImageView(vkDevice, &vkImageViewCreateInfo, NULL, &attributeResource.vkImageView);
-			if(vkResult != VK_SUCCESS)
-			{
-				fprintf(gFILE, "CreateClipmapAttributeResources(): vkCreateImageView failed for %s level %u with error %d\n", spec.debugName, levelIndex, vkResult);
-				return vkResult;
-			}
+                VkResult vkResult = vkCreateCommandPool(vkDevice, &vkCommandPoolCreateInfo, NULL, &gClipmapStreamCommandPool);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "CreateClipmapUploadFrames(): vkCreateCommandPool() failed for queue family %u with error code %d\n", gClipmapStreamQueueFamilyIndex, vkResult);
+                        gClipmapStreamCommandPool = VK_NULL_HANDLE;
+                        return vkResult;
+                }
+        }
+
+        VkCommandBufferAllocateInfo vkCommandBufferAllocateInfo;
+        memset((void*)&vkCommandBufferAllocateInfo, 0, sizeof(VkCommandBufferAllocateInfo));
+        vkCommandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        vkCommandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        vkCommandBufferAllocateInfo.commandBufferCount = 1;
+
+        // Unsignalled: a frame's fence is only waited on after a submission.
+        VkFenceCreateInfo vkFenceCreateInfo;
+        memset((void*)&vkFenceCreateInfo, 0, sizeof(VkFenceCreateInfo));
+        vkFenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        VkSemaphoreCreateInfo vkSemaphoreCreateInfo;
+        memset((void*)&vkSemaphoreCreateInfo, 0, sizeof(VkSemaphoreCreateInfo));
+        vkSemaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        for(uint32_t frameIndex = 0; frameIndex < gMaxFramesInFlight; frameIndex++)
+        {
+                ClipmapUploadFrame& frame = gClipmapUploadFrames[frameIndex];
+                frame.recording = false;
+                frame.releaseRecording = false;
+                frame.acquireRecording = false;
+                frame.submitted = false;
+                frame.levelsRecorded = 0u;
+
+                vkCommandBufferAllocateInfo.commandPool = gClipmapStreamCommandPool;
+                VkResult vkResult = vkAllocateCommandBuffers(vkDevice, &vkCommandBufferAllocateInfo, &frame.vkCommandBuffer);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "CreateClipmapUploadFrames(): vkAllocateCommandBuffers() failed for frame %u with error code %d\n", frameIndex, vkResult);
+                        return vkResult;
+                }
+
+                vkResult = vkCreateFence(vkDevice, &vkFenceCreateInfo, NULL, &frame.vkFence);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "CreateClipmapUploadFrames(): vkCreateFence() failed for frame %u with error code %d\n", frameIndex, vkResult);
+                        return vkResult;
+                }
 
-			VkSamplerCreateInfo vkSamplerCreateInfo;
-			memset((void*)&vkSamplerCreateInfo, 0, sizeof(VkSamplerCreateInfo));
-			vkSamplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-			vkSamplerCreateInfo.magFilter = VK_FILTER_LINEAR;
-			vkSamplerCreateInfo.minFilter = VK_FILTER_LINEAR;
-			vkSamplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-			vkSamplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-			vkSamplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-			vkSamplerCreateInfo.anisotropyEnable = VK_FALSE;
-			vkSamplerCreateInfo.maxAnisotropy = 1.0f;
-			vkSamplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-			vkSamplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-			vkSamplerCreateInfo.compareEnable = VK_FALSE;
-			vkSamplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-
-                        vkResult = vkCreateSampler(vkDevice, &vkSamplerCreateInfo, NULL, &attributeResource.vkSampler);
+                vkResult = vkCreateSemaphore(vkDevice, &vkSemaphoreCreateInfo, NULL, &frame.vkSemaphore);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "CreateClipmapUploadFrames(): vkCreateSemaphore() failed for frame %u with error code %d\n", frameIndex, vkResult);
+                        return vkResult;
+                }
+
+                if(transferOwnership)
+                {
+                        vkCommandBufferAllocateInfo.commandPool = vkCommandPool;
+                        vkResult = vkAllocateCommandBuffers(vkDevice, &vkCommandBufferAllocateInfo, &frame.vkReleaseCommandBuffer);
+                        if(vkResult == VK_SUCCESS)
+                        {
+                                vkResult = vkAllocateCommandBuffers(vkDevice, &vkCommandBufferAllocateInfo, &frame.vkAcquireCommandBuffer);
+                        }
                         if(vkResult != VK_SUCCESS)
                         {
-                                fprintf(gFILE, "CreateClipmapAttributeResources(): vkCreateSampler failed for %s level %u with error %d\n", spec.debugName, levelIndex, vkResult);
+                                fprintf(gFILE, "CreateClipmapUploadFrames(): vkAllocateCommandBuffers() failed for the ownership transfers of frame %u with error code %d\n", frameIndex, vkResult);
                                 return vkResult;
                         }
+
+                        vkResult = vkCreateSemaphore(vkDevice, &vkSemaphoreCreateInfo, NULL, &frame.vkReleaseSemaphore);
+                        if(vkResult != VK_SUCCESS)
+                        {
+                                fprintf(gFILE, "CreateClipmapUploadFrames(): vkCreateSemaphore() failed for the release of frame %u with error code %d\n", frameIndex, vkResult);
+                                return vkResult;
+                        }
+                }
+
+                if(!frame.stagingAllocations.reserve(gClipmapLevelCount) || !frame.windowLevels.reserve(gClipmapLevelCount))
+                {
+                        return VK_ERROR_OUT_OF_HOST_MEMORY;
                 }
         }
 
+        gClipmapUploadFrameIndex = 0u;
+        memset((void*)&gClipmapUploadStats, 0, sizeof(ClipmapUploadStats));
         return VK_SUCCESS;
 }
 
-static void InitializeClipmapSynchronization(void)
+// Waits for the frame's last submission and hands back what it read: its
+// staging ring allocations, and the jobs of the levels it filled from their
+// tile windows. A frame still recording keeps everything.
+static VkResult RetireClipmapUploadFrame(ClipmapUploadFrame& frame)
 {
-        if(!gClipmapSynchronizationInitialized)
+        if(frame.recording)
         {
-                for(CRITICAL_SECTION& section : gClipmapLevelMutexes)
+                return VK_SUCCESS;
+        }
+
+        if(frame.submitted)
+        {
+                VkResult vkResult = vkGetFenceStatus(vkDevice, frame.vkFence);
+                if(vkResult == VK_NOT_READY)
                 {
-                        InitializeCriticalSection(&section);
+                        LARGE_INTEGER frequency;
+                        LARGE_INTEGER startCounter;
+                        LARGE_INTEGER endCounter;
+                        QueryPerformanceFrequency(&frequency);
+                        QueryPerformanceCounter(&startCounter);
+                        vkResult = vkWaitForFences(vkDevice, 1, &frame.vkFence, VK_TRUE, UINT64_MAX);
+                        QueryPerformanceCounter(&endCounter);
+
+                        double stallMs = (double)(endCounter.QuadPart - startCounter.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+                        gClipmapUploadStats.fenceWaits++;
+                        gClipmapUploadStats.totalStallMs += stallMs;
+                        gClipmapUploadStats.worstStallMs = CLIPMAP_MAX(gClipmapUploadStats.worstStallMs, stallMs);
+                        gClipmapUploadStats.frameStallMs += stallMs;
+                }
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "RetireClipmapUploadFrame(): waiting for the upload fence failed with error code %d\n", vkResult);
+                        return vkResult;
                 }
 
-                InitializeCriticalSection(&gClipmapStreamingContext.mutex);
-                gClipmapStreamingContext.workerThread = NULL;
-                gClipmapSynchronizationInitialized = true;
+                vkResult = vkResetFences(vkDevice, 1, &frame.vkFence);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "RetireClipmapUploadFrame(): vkResetFences() failed with error code %d\n", vkResult);
+                        return vkResult;
+                }
+                frame.submitted = false;
         }
-}
 
-static void ShutdownClipmapSynchronization(void)
-{
-        if(gClipmapSynchronizationInitialized)
+        for(VkDeviceSize allocation : frame.stagingAllocations)
         {
-                DeleteCriticalSection(&gClipmapStreamingContext.mutex);
-                for(CRITICAL_SECTION& section : gClipmapLevelMutexes)
+                ReleaseClipmapStagingBytes(allocation);
+        }
+        frame.stagingAllocations.clear();
+
+        if(!frame.windowLevels.empty())
+        {
+                for(uint32_t levelIndex : frame.windowLevels)
                 {
-                        DeleteCriticalSection(&section);
+                        gClipmapLevels[levelIndex].windowInFlight = false;
+                        SetClipmapJobPending(&gClipmapLevels[levelIndex], false);
                 }
+                frame.windowLevels.clear();
 
-                gClipmapSynchronizationInitialized = false;
+                // Requests that arrived for those levels are runnable now.
+                if(gClipmapStreamingContext.workAvailableEvent != NULL)
+                {
+                        SetEvent(gClipmapStreamingContext.workAvailableEvent);
+                }
         }
-}
 
-static VkResult InitializeClipmapStreaming(void)
-{
-        gClipmapStreamingContext.stopRequested = false;
-        gClipmapStreamingContext.pendingJobs.clear();
         return VK_SUCCESS;
 }
 
-static void ShutdownClipmapStreaming(void)
-{
-        gClipmapStreamingContext.pendingJobs.clear();
-}
-
-static void EnqueueClipmapStreamingJob(uint32_t levelIndex, const glm::ivec2& desiredOrigin)
-{
-	ClipmapStreamingJob job;
-	job.levelIndex = levelIndex;
-	job.desiredOrigin = desiredOrigin;
-
-	{
-		EnterCriticalSection(&gClipmapStreamingContext.mutex);
-		gClipmapStreamingContext.pendingJobs.push(job);
-		LeaveCriticalSection(&gClipmapStreamingContext.mutex);
-	}
-}
-
-static VkResult ProcessCompletedClipmapJobs(void)
+static void DestroyClipmapUploadFrames(void)
 {
-	for(;;)
-	{
-		ClipmapStreamingJob job;
-		bool hasJob = false;
-
-		EnterCriticalSection(&gClipmapStreamingContext.mutex);
-		if(!gClipmapStreamingContext.pendingJobs.empty())
-		{
-			job = gClipmapStreamingContext.pendingJobs.front();
-			gClipmapStreamingContext.pendingJobs.pop();
-			hasJob = true;
-		}
-		LeaveCriticalSection(&gClipmapStreamingContext.mutex);
+        if(gClipmapUploadStats.submissions != 0)
+        {
+                fprintf(gFILE, "DestroyClipmapUploadFrames(): %llu upload submissions (%s queue), %.2f levels each, %llu fence waits, stall total %.3f ms worst %.3f ms\n",
+                        (unsigned long long)gClipmapUploadStats.submissions,
+                        UsesClipmapStreamQueueFamily() ? "async compute" : "graphics",
+                        (double)gClipmapUploadStats.levelsSubmitted / (double)gClipmapUploadStats.submissions,
+                        (unsigned long long)gClipmapUploadStats.fenceWaits,
+                        gClipmapUploadStats.totalStallMs,
+                        gClipmapUploadStats.worstStallMs);
+        }
 
-		if(!hasJob)
-		{
-			break;
-		}
+        for(uint32_t frameIndex = 0; frameIndex < gMaxFramesInFlight; frameIndex++)
+        {
+                ClipmapUploadFrame& frame = gClipmapUploadFrames[frameIndex];
 
-		ClipmapVector<ClipmapTileKey> requestedTiles[CLIPMAP_ATTRIBUTE_COUNT];
-		CollectVisibleTilesForLevel(job.levelIndex, job.desiredOrigin, requestedTiles);
+                // Uploads recorded but never submitted are dropped with the command buffers.
+                frame.recording = false;
+                frame.releaseRecording = false;
+                frame.acquireRecording = false;
+                RetireClipmapUploadFrame(frame);
 
-		CRITICAL_SECTION* levelSection = &gClipmapLevelMutexes[job.levelIndex];
-		EnterCriticalSection(levelSection);
-		ClipmapVector<ClipmapTileKey> tileBatch;
-		for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
-		{
-			tileBatch.append(requestedTiles[attributeIndex]);
-		}
+                if(frame.vkCommandBuffer)
+                {
+                        vkFreeCommandBuffers(vkDevice, gClipmapStreamCommandPool, 1, &frame.vkCommandBuffer);
+                        frame.vkCommandBuffer = VK_NULL_HANDLE;
+                }
 
-		VkResult tileStatus = EnsureTileSetResident(tileBatch);
-		if(tileStatus != VK_SUCCESS)
-		{
-			SetClipmapJobPending(&gClipmapLevels[job.levelIndex], false);
-			LeaveCriticalSection(levelSection);
-			return tileStatus;
-		}
+                if(frame.vkReleaseCommandBuffer)
+                {
+                        vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &frame.vkReleaseCommandBuffer);
+                        frame.vkReleaseCommandBuffer = VK_NULL_HANDLE;
+                }
 
-		EnforceTileBudgets(requestedTiles);
+                if(frame.vkAcquireCommandBuffer)
+                {
+                        vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &frame.vkAcquireCommandBuffer);
+                        frame.vkAcquireCommandBuffer = VK_NULL_HANDLE;
+                }
 
-		ClipmapVector<ClipmapUpdateRegion> regions;
-		VkResult status = PopulateClipmapLevelCpuData(job.levelIndex, job.desiredOrigin, regions);
-		if(status != VK_SUCCESS)
-		{
-			SetClipmapJobPending(&gClipmapLevels[job.levelIndex], false);
-			LeaveCriticalSection(levelSection);
-			return status;
-		}
+                if(frame.vkFence)
+                {
+                        vkDestroyFence(vkDevice, frame.vkFence, NULL);
+                        frame.vkFence = VK_NULL_HANDLE;
+                }
 
-		VkResult uploadResult = UploadClipmapLevelToGpu(job.levelIndex, regions);
-		if(uploadResult != VK_SUCCESS)
-		{
-			SetClipmapJobPending(&gClipmapLevels[job.levelIndex], false);
-			LeaveCriticalSection(levelSection);
-			return uploadResult;
-		}
+                if(frame.vkSemaphore)
+                {
+                        vkDestroySemaphore(vkDevice, frame.vkSemaphore, NULL);
+                        frame.vkSemaphore = VK_NULL_HANDLE;
+                }
 
-		SetClipmapJobPending(&gClipmapLevels[job.levelIndex], false);
-		LeaveCriticalSection(levelSection);
-	}
+                if(frame.vkReleaseSemaphore)
+                {
+                        vkDestroySemaphore(vkDevice, frame.vkReleaseSemaphore, NULL);
+                        frame.vkReleaseSemaphore = VK_NULL_HANDLE;
+                }
 
-	return VK_SUCCESS;
-}
+                frame.stagingAllocations = ClipmapVector<VkDeviceSize>();
+                frame.windowLevels = ClipmapVector<uint32_t>();
+        }
 
-static inline uint32_t WrapCoordinate(int value, uint32_t modulus)
-{
-	int result = value % (int)modulus;
-	if(result < 0)
-	{
-		result += (int)modulus;
-	}
-	return (uint32_t)result;
+        if(gClipmapStreamCommandPool != VK_NULL_HANDLE && gClipmapStreamCommandPool != vkCommandPool)
+        {
+                vkDestroyCommandPool(vkDevice, gClipmapStreamCommandPool, NULL);
+        }
+        gClipmapStreamCommandPool = VK_NULL_HANDLE;
 }
 
-static void AppendRowRegions(uint32_t startRow, uint32_t count, ClipmapUpdateRegionVector& regions)
+// Makes frameIndex the frame that clipmap uploads are recorded into. The draw
+// of the same slot waited on its previous submission, so retiring it does not
+// normally block.
+static VkResult BeginClipmapUploadFrame(uint32_t frameIndex)
 {
-	if(count == 0)
-	{
-		return;
-	}
-
-	uint32_t remaining = count;
-	uint32_t current = startRow;
-	while(remaining > 0)
-	{
-		uint32_t span = CLIPMAP_MIN(remaining, gClipmapTextureSize - current);
-		ClipmapUpdateRegion region;
-		region.x = 0;
-		region.y = current;
-		region.width = gClipmapTextureSize;
-		region.height = span;
-		regions.push_back(region);
-
-		remaining -= span;
-		current = 0;
-	}
+        gClipmapUploadFrameIndex = frameIndex;
+        return RetireClipmapUploadFrame(gClipmapUploadFrames[frameIndex]);
 }
 
-static void AppendColumnRegions(uint32_t startColumn, uint32_t count, ClipmapUpdateRegionVector& regions)
+static bool BeginClipmapFrameCommandBuffer(VkCommandBuffer commandBuffer, bool* recording)
 {
-        if(count == 0)
+        if(*recording)
         {
-                return;
+                return true;
         }
 
-	uint32_t remaining = count;
-	uint32_t current = startColumn;
-	while(remaining > 0)
-	{
-		uint32_t span = CLIPMAP_MIN(remaining, gClipmapTextureSize - current);
-		ClipmapUpdateRegion region;
-		region.x = current;
-		region.y = 0;
-		region.width = span;
-		region.height = gClipmapTextureSize;
-		regions.push_back(region);
+        VkCommandBufferBeginInfo vkCommandBufferBeginInfo;
+        memset((void*)&vkCommandBufferBeginInfo, 0, sizeof(VkCommandBufferBeginInfo));
+        vkCommandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        vkCommandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-                remaining -= span;
-                current = 0;
+        VkResult vkResult = vkBeginCommandBuffer(commandBuffer, &vkCommandBufferBeginInfo);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "BeginClipmapFrameCommandBuffer(): vkBeginCommandBuffer() failed with error code %d\n", vkResult);
+                return false;
         }
+
+        *recording = true;
+        return true;
 }
 
-static void CollectVisibleTilesForLevel(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapTileKeyVector (&outTiles)[CLIPMAP_ATTRIBUTE_COUNT])
+// The current frame's upload command buffer, begun on first use together
+// with the frame's release and acquire command buffers.
+static VkCommandBuffer GetClipmapUploadCommandBuffer(void)
 {
-	for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
-	{
-		outTiles[attributeIndex].clear();
-	}
+        ClipmapUploadFrame& frame = gClipmapUploadFrames[gClipmapUploadFrameIndex];
+        if(frame.recording)
+        {
+                return frame.vkCommandBuffer;
+        }
 
-        int sampleSpacing = 1 << levelIndex;
-        int coverageSamples = (int)gClipmapGridSize * sampleSpacing;
-        int startX = originSamples.x;
-        int startY = originSamples.y;
-        int endX = startX + coverageSamples;
-        int endY = startY + coverageSamples;
+        if(frame.vkCommandBuffer == VK_NULL_HANDLE || RetireClipmapUploadFrame(frame) != VK_SUCCESS)
+        {
+                return VK_NULL_HANDLE;
+        }
 
-        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        if(UsesClipmapStreamQueueFamily())
         {
-                ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
-                if(source.width == 0 || source.height == 0)
+                if(!BeginClipmapFrameCommandBuffer(frame.vkReleaseCommandBuffer, &frame.releaseRecording) ||
+                   !BeginClipmapFrameCommandBuffer(frame.vkAcquireCommandBuffer, &frame.acquireRecording))
                 {
-                        continue;
+                        return VK_NULL_HANDLE;
                 }
+        }
 
-                uint32_t tileSize = (source.tileSize == 0u) ? gClipmapTileSize : source.tileSize;
-                uint32_t tileCountX = (source.width + tileSize - 1u) / tileSize;
-                uint32_t tileCountY = (source.height + tileSize - 1u) / tileSize;
-
-                int minTileX = (int)floorf((float)startX / (float)tileSize);
-                int maxTileX = (int)floorf((float)(endX - 1) / (float)tileSize);
-                int minTileY = (int)floorf((float)startY / (float)tileSize);
-                int maxTileY = (int)floorf((float)(endY - 1) / (float)tileSize);
+        if(!BeginClipmapFrameCommandBuffer(frame.vkCommandBuffer, &frame.recording))
+        {
+                return VK_NULL_HANDLE;
+        }
 
-		ClipmapVector<uint64_t> seen;
-                for(int tileY = minTileY; tileY <= maxTileY; tileY++)
-                {
-                        for(int tileX = minTileX; tileX <= maxTileX; tileX++)
-                        {
-                                ClipmapTileKey key;
-                                key.attribute = (ClipmapAttributeType)attributeIndex;
-                                key.level = levelIndex;
-                                key.tileX = WrapCoordForTile(tileX, tileCountX);
-                                key.tileY = WrapCoordForTile(tileY, tileCountY);
+        frame.levelsRecorded = 0u;
+        return frame.vkCommandBuffer;
+}
 
-				uint64_t packed = PackTileKey(key);
-				bool alreadySeen = false;
-				for(const uint64_t value : seen)
-				{
-					if(value == packed)
-					{
-						alreadySeen = true;
-						break;
-					}
-				}
+// Makes a level's layers writable in writeLayout on the streaming queue.
+// Layers that hold nothing yet have no owner to take them from.
+static void BeginClipmapImageWrite(ClipmapUploadFrame& frame, uint32_t levelIndex, bool initialized, VkImageLayout writeLayout, VkAccessFlags writeAccess, VkPipelineStageFlags writeStage)
+{
+        if(!initialized)
+        {
+                InsertClipmapImageBarrier(frame.vkCommandBuffer, levelIndex, VK_IMAGE_LAYOUT_UNDEFINED, writeLayout, 0, writeAccess, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, writeStage);
+                return;
+        }
 
-				if(!alreadySeen)
-				{
-					seen.push_back(packed);
-					outTiles[attributeIndex].push_back(key);
-				}
-                        }
-                }
+        if(!UsesClipmapStreamQueueFamily())
+        {
+                // Earlier frames may still be drawing from the layers.
+                InsertClipmapImageBarrier(frame.vkCommandBuffer, levelIndex, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, writeLayout, VK_ACCESS_SHADER_READ_BIT, writeAccess, gClipmapSampleStages | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, writeStage);
+                return;
         }
+
+        // The graphics queue lets go once earlier draws are done with it; the
+        // layout change is carried by both halves and runs once.
+        InsertClipmapOwnershipBarrier(frame.vkReleaseCommandBuffer, levelIndex, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, writeLayout, 0, 0, gClipmapSampleStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, graphicsQuequeFamilyIndex_selected, gClipmapStreamQueueFamilyIndex);
+        InsertClipmapOwnershipBarrier(frame.vkCommandBuffer, levelIndex, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, writeLayout, 0, writeAccess, gClipmapWriteStages, writeStage, graphicsQuequeFamilyIndex_selected, gClipmapStreamQueueFamilyIndex);
 }
 
-static void InsertClipmapImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+// Hands a level's written layers back to the draw for sampling.
+static void EndClipmapImageWrite(ClipmapUploadFrame& frame, uint32_t levelIndex, VkImageLayout writeLayout, VkAccessFlags writeAccess, VkPipelineStageFlags writeStage)
 {
-        VkImageMemoryBarrier vkImageMemoryBarrier;
-        memset((void*)&vkImageMemoryBarrier, 0, sizeof(VkImageMemoryBarrier));
-        vkImageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        vkImageMemoryBarrier.oldLayout = oldLayout;
-        vkImageMemoryBarrier.newLayout = newLayout;
-        vkImageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        vkImageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        vkImageMemoryBarrier.image = image;
-        vkImageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        vkImageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-        vkImageMemoryBarrier.subresourceRange.levelCount = 1;
-        vkImageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-        vkImageMemoryBarrier.subresourceRange.layerCount = 1;
-        vkImageMemoryBarrier.srcAccessMask = srcAccessMask;
-        vkImageMemoryBarrier.dstAccessMask = dstAccessMask;
+        if(!UsesClipmapStreamQueueFamily())
+        {
+                InsertClipmapImageBarrier(frame.vkCommandBuffer, levelIndex, writeLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, writeAccess, VK_ACCESS_SHADER_READ_BIT, writeStage, gClipmapSampleStages | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+                return;
+        }
 
-        vkCmdPipelineBarrier(
-                commandBuffer,
-                srcStage,
-                dstStage,
-                0,
-                0, NULL,
-                0, NULL,
-                1, &vkImageMemoryBarrier);
+        InsertClipmapOwnershipBarrier(frame.vkCommandBuffer, levelIndex, writeLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, writeAccess, 0, writeStage, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, gClipmapStreamQueueFamilyIndex, graphicsQuequeFamilyIndex_selected);
+        InsertClipmapOwnershipBarrier(frame.vkAcquireCommandBuffer, levelIndex, writeLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, VK_ACCESS_SHADER_READ_BIT, gClipmapSampleStages, gClipmapSampleStages, gClipmapStreamQueueFamilyIndex, graphicsQuequeFamilyIndex_selected);
 }
 
-VkResult PopulateClipmapLevelCpuData(uint32_t levelIndex, const glm::ivec2& originSamples, ClipmapUpdateRegionVector& outRegions)
-{
-        outRegions.clear();
-
-        if(gClipmapAttributeSources[CLIPMAP_ATTRIBUTE_HEIGHT].width == 0)
+// Submits the uploads recorded this frame, if there are any: the graphics
+// queue's release first, then the uploads on the streaming queue. For the draw
+// (forDraw) the uploads signal the frame's semaphore, returned in
+// *outWaitSemaphore, and the acquire command buffer is returned for the draw's
+// submission to run first. Otherwise the acquire is submitted here and the
+// fence covers it. Both outputs are VK_NULL_HANDLE when there is nothing to
+// wait for.
+static VkResult SubmitClipmapUploadFrame(bool forDraw, VkSemaphore* outWaitSemaphore, VkCommandBuffer* outAcquireCommandBuffer)
+{
+        ClipmapUploadFrame& frame = gClipmapUploadFrames[gClipmapUploadFrameIndex];
+        if(outWaitSemaphore != NULL)
+        {
+                *outWaitSemaphore = VK_NULL_HANDLE;
+        }
+        if(outAcquireCommandBuffer != NULL)
         {
-                return VK_ERROR_INITIALIZATION_FAILED;
+                *outAcquireCommandBuffer = VK_NULL_HANDLE;
         }
 
-        ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
-        uint32_t textureSize = gClipmapTextureSize;
-        uint32_t sampleSpacing = 1u << levelIndex;
-
-        auto fullUpdate = [&]() -> VkResult
+        if(!frame.recording)
         {
-                levelResource->textureOffset = glm::ivec2(0);
-                ClipmapUpdateRegion region = {0u, 0u, textureSize, textureSize};
-                outRegions.clear();
-                outRegions.push_back(region);
-                levelResource->originInSamples = originSamples;
-                levelResource->worldOrigin = glm::vec2((float)originSamples.x, (float)originSamples.y) * gClipmapBaseWorldSpacing;
                 return VK_SUCCESS;
-	};
-
-	if(levelResource->initialized == false)
-	{
-		return fullUpdate();
-	}
-
-	glm::ivec2 deltaSamples = originSamples - levelResource->originInSamples;
-	if(deltaSamples.x == 0 && deltaSamples.y == 0)
-	{
-		levelResource->worldOrigin = glm::vec2((float)originSamples.x, (float)originSamples.y) * gClipmapBaseWorldSpacing;
-		return VK_SUCCESS;
-	}
+        }
 
-	if((deltaSamples.x % (int)sampleSpacing) != 0 || (deltaSamples.y % (int)sampleSpacing) != 0)
-	{
-		return fullUpdate();
-	}
+        bool transferOwnership = UsesClipmapStreamQueueFamily();
+        frame.recording = false;
+        frame.releaseRecording = false;
+        frame.acquireRecording = false;
+        VkResult vkResult = vkEndCommandBuffer(frame.vkCommandBuffer);
+        if(vkResult == VK_SUCCESS && transferOwnership)
+        {
+                vkResult = vkEndCommandBuffer(frame.vkReleaseCommandBuffer);
+                if(vkResult == VK_SUCCESS)
+                {
+                        vkResult = vkEndCommandBuffer(frame.vkAcquireCommandBuffer);
+                }
+        }
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "SubmitClipmapUploadFrame(): vkEndCommandBuffer() failed with error code %d\n", vkResult);
+                return vkResult;
+        }
 
-	int shiftX = deltaSamples.x / (int)sampleSpacing;
-	int shiftY = deltaSamples.y / (int)sampleSpacing;
+        if(transferOwnership)
+        {
+                VkSubmitInfo releaseSubmitInfo;
+                memset((void*)&releaseSubmitInfo, 0, sizeof(VkSubmitInfo));
+                releaseSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                releaseSubmitInfo.commandBufferCount = 1;
+                releaseSubmitInfo.pCommandBuffers = &frame.vkReleaseCommandBuffer;
+                releaseSubmitInfo.signalSemaphoreCount = 1;
+                releaseSubmitInfo.pSignalSemaphores = &frame.vkReleaseSemaphore;
+
+                vkResult = vkQueueSubmit(vkQueue, 1, &releaseSubmitInfo, VK_NULL_HANDLE);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "SubmitClipmapUploadFrame(): vkQueueSubmit() failed for the release with error code %d\n", vkResult);
+                        return vkResult;
+                }
+        }
 
-	if(abs(shiftX) >= (int)textureSize || abs(shiftY) >= (int)textureSize)
-	{
-		return fullUpdate();
-	}
+        const VkPipelineStageFlags releaseWaitStages = gClipmapWriteStages;
+        VkSubmitInfo vkSubmitInfo;
+        memset((void*)&vkSubmitInfo, 0, sizeof(VkSubmitInfo));
+        vkSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        vkSubmitInfo.commandBufferCount = 1;
+        vkSubmitInfo.pCommandBuffers = &frame.vkCommandBuffer;
+        if(transferOwnership)
+        {
+                vkSubmitInfo.waitSemaphoreCount = 1;
+                vkSubmitInfo.pWaitSemaphores = &frame.vkReleaseSemaphore;
+                vkSubmitInfo.pWaitDstStageMask = &releaseWaitStages;
+        }
+        if(forDraw || transferOwnership)
+        {
+                vkSubmitInfo.signalSemaphoreCount = 1;
+                vkSubmitInfo.pSignalSemaphores = &frame.vkSemaphore;
+        }
 
-	if(shiftY != 0)
-	{
-		levelResource->textureOffset.y = (int)WrapCoordinate(levelResource->textureOffset.y + shiftY, textureSize);
-		uint32_t rowCount = (uint32_t)abs(shiftY);
-		int startRowValue = (shiftY > 0)
-			? (levelResource->textureOffset.y + (int)textureSize - (int)rowCount)
-			: levelResource->textureOffset.y;
-		uint32_t startRow = WrapCoordinate(startRowValue, textureSize);
-		AppendRowRegions(startRow, rowCount, outRegions);
-	}
+        // The fence goes on the last submission made here.
+        bool acquireHere = transferOwnership && !forDraw;
+        vkResult = vkQueueSubmit(gClipmapStreamQueue, 1, &vkSubmitInfo, acquireHere ? VK_NULL_HANDLE : frame.vkFence);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "SubmitClipmapUploadFrame(): vkQueueSubmit() failed with error code %d\n", vkResult);
+                return vkResult;
+        }
 
-	if(shiftX != 0)
-	{
-		levelResource->textureOffset.x = (int)WrapCoordinate(levelResource->textureOffset.x + shiftX, textureSize);
-		uint32_t columnCount = (uint32_t)abs(shiftX);
-		int startColumnValue = (shiftX > 0)
-			? (levelResource->textureOffset.x + (int)textureSize - (int)columnCount)
-			: levelResource->textureOffset.x;
-		uint32_t startColumn = WrapCoordinate(startColumnValue, textureSize);
-                AppendColumnRegions(startColumn, columnCount, outRegions);
+        if(acquireHere)
+        {
+                const VkPipelineStageFlags acquireWaitStages = gClipmapSampleStages;
+                VkSubmitInfo acquireSubmitInfo;
+                memset((void*)&acquireSubmitInfo, 0, sizeof(VkSubmitInfo));
+                acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+                acquireSubmitInfo.waitSemaphoreCount = 1;
+                acquireSubmitInfo.pWaitSemaphores = &frame.vkSemaphore;
+                acquireSubmitInfo.pWaitDstStageMask = &acquireWaitStages;
+                acquireSubmitInfo.commandBufferCount = 1;
+                acquireSubmitInfo.pCommandBuffers = &frame.vkAcquireCommandBuffer;
+
+                vkResult = vkQueueSubmit(vkQueue, 1, &acquireSubmitInfo, frame.vkFence);
+                if(vkResult != VK_SUCCESS)
+                {
+                        fprintf(gFILE, "SubmitClipmapUploadFrame(): vkQueueSubmit() failed for the acquire with error code %d\n", vkResult);
+                        return vkResult;
+                }
         }
 
-        levelResource->originInSamples = originSamples;
-        levelResource->worldOrigin = glm::vec2((float)originSamples.x, (float)originSamples.y) * gClipmapBaseWorldSpacing;
+        frame.submitted = true;
+        gClipmapUploadStats.submissions++;
+        gClipmapUploadStats.levelsSubmitted += frame.levelsRecorded;
+        if(forDraw)
+        {
+                if(outWaitSemaphore != NULL)
+                {
+                        *outWaitSemaphore = frame.vkSemaphore;
+                }
+                if(transferOwnership && outAcquireCommandBuffer != NULL)
+                {
+                        *outAcquireCommandBuffer = frame.vkAcquireCommandBuffer;
+                }
+        }
         return VK_SUCCESS;
 }
 
-VkResult UploadClipmapLevelToGpu(uint32_t levelIndex, const ClipmapUpdateRegionVector& regions)
+// Submits whatever the current frame has recorded and waits for it, for
+// uploads made outside the frame loop.
+static VkResult FlushClipmapUploads(void)
+{
+        VkResult vkResult = SubmitClipmapUploadFrame(false, NULL, NULL);
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+        return RetireClipmapUploadFrame(gClipmapUploadFrames[gClipmapUploadFrameIndex]);
+}
+
+// Records copies of the update's strips out of the staging ring into the
+// level's layer of every attribute image, one copy region per strip, into the
+// current frame's uploads. Updates that did not fit in the ring are filled from
+// the level's tile windows instead, one dispatch per region. One barrier before
+// and one after cover the level's layer of all attributes.
+VkResult UploadClipmapLevelToGpu(uint32_t levelIndex, const ClipmapLevelUpdate& update)
 {
         ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
-        VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+        if(update.regionCount == 0u && levelResource->initialized)
+        {
+                return VK_SUCCESS;
+        }
+
+        ClipmapUploadFrame& frame = gClipmapUploadFrames[gClipmapUploadFrameIndex];
+        VkCommandBuffer commandBuffer = GetClipmapUploadCommandBuffer();
         if(commandBuffer == VK_NULL_HANDLE)
         {
+                if(update.staged)
+                {
+                        ReleaseClipmapStagingBytes(update.stagingAllocation);
+                }
                 return VK_ERROR_INITIALIZATION_FAILED;
         }
 
-	uint32_t updateWidth = gClipmapTextureSize;
-	uint32_t updateHeight = gClipmapTextureSize;
-	uint32_t dispatchOffsetX = 0u;
-	uint32_t dispatchOffsetY = 0u;
-	if(regions.empty() == false)
-	{
-		ClipmapUpdateRegion bounds = {gClipmapTextureSize, gClipmapTextureSize, 0u, 0u};
-		for(const ClipmapUpdateRegion& region : regions)
-		{
-			bounds.x = CLIPMAP_MIN(bounds.x, region.x);
-			bounds.y = CLIPMAP_MIN(bounds.y, region.y);
-			bounds.width = CLIPMAP_MAX(bounds.width, region.x + region.width);
-			bounds.height = CLIPMAP_MAX(bounds.height, region.y + region.height);
-		}
-
-		updateWidth = bounds.width - bounds.x;
-		updateHeight = bounds.height - bounds.y;
-		dispatchOffsetX = bounds.x;
-		dispatchOffsetY = bounds.y;
-	}
+        // A level that has never been filled is filled whole.
+        ClipmapUpdateRegion fullRegion = {0u, 0u, gClipmapTextureSize, gClipmapTextureSize};
+        const ClipmapUpdateRegion* regions = (update.regionCount > 0u) ? update.regions : &fullRegion;
+        uint32_t regionCount = (update.regionCount > 0u) ? update.regionCount : 1u;
+        const uint32_t groupSize = 8u;
+        bool windowRead = false;
 
-        if(updateWidth == 0 || updateHeight == 0)
+        if(update.staged)
         {
-                EndSingleTimeCommands(commandBuffer);
-                return VK_SUCCESS;
-        }
+                BeginClipmapImageWrite(frame, levelIndex, levelResource->initialized, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-	uint32_t groupSize = 8u;
-	uint32_t firstGroupX = dispatchOffsetX / groupSize;
-	uint32_t firstGroupY = dispatchOffsetY / groupSize;
-	uint32_t endGroupX = (dispatchOffsetX + updateWidth + groupSize - 1u) / groupSize;
-	uint32_t endGroupY = (dispatchOffsetY + updateHeight + groupSize - 1u) / groupSize;
-	uint32_t groupCountX = endGroupX - firstGroupX;
-	uint32_t groupCountY = endGroupY - firstGroupY;
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        VkBufferImageCopy vkBufferImageCopy_array[gClipmapMaxUpdateRegions];
+                        memset((void*)vkBufferImageCopy_array, 0, sizeof(vkBufferImageCopy_array));
+                        for(uint32_t regionIndex = 0; regionIndex < update.regionCount; regionIndex++)
+                        {
+                                const ClipmapUpdateRegion& region = update.regions[regionIndex];
+                                VkBufferImageCopy& copy = vkBufferImageCopy_array[regionIndex];
+                                copy.bufferOffset = update.stagingOffsets[attributeIndex][regionIndex];
+                                copy.bufferRowLength = region.width;
+                                copy.bufferImageHeight = region.height;
+                                copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                                copy.imageSubresource.mipLevel = 0;
+                                copy.imageSubresource.baseArrayLayer = levelIndex;
+                                copy.imageSubresource.layerCount = 1;
+                                copy.imageOffset.x = (int32_t)region.x;
+                                copy.imageOffset.y = (int32_t)region.y;
+                                copy.imageExtent.width = region.width;
+                                copy.imageExtent.height = region.height;
+                                copy.imageExtent.depth = 1;
+                        }
+                        CopyBufferToImageRegions(commandBuffer, gClipmapStagingRing.vkBuffer, gClipmapAttributeArrays[attributeIndex].vkImage, vkBufferImageCopy_array, update.regionCount);
+                }
 
-        struct ClipmapComputePushConstants
+                EndClipmapImageWrite(frame, levelIndex, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+        }
+        else
         {
-                glm::ivec2 originSamples;
-                glm::ivec2 textureOffset;
-                uint32_t levelIndex;
-                uint32_t attributeIndex;
-        };
+                BeginClipmapImageWrite(frame, levelIndex, levelResource->initialized, VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
-        {
-		ClipmapAttributeResource* attributeResource = &levelResource->attributes[attributeIndex];
+                for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+                {
+                        const ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                        if(source.width == 0)
+                        {
+                                continue;
+                        }
 
-		VkImageLayout currentLayout = attributeResource->initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
-		VkPipelineStageFlags srcStage = attributeResource->initialized ? (VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT) : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		VkAccessFlags srcAccess = attributeResource->initialized ? VK_ACCESS_SHADER_READ_BIT : 0;
-		InsertClipmapImageBarrier(commandBuffer, attributeResource->vkImage, currentLayout, VK_IMAGE_LAYOUT_GENERAL, srcAccess, VK_ACCESS_SHADER_WRITE_BIT, srcStage, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+                        ClipmapTileWindowPlacement placement;
+                        ComputeClipmapTileWindowPlacement(source, levelIndex, levelResource->originInSamples, &placement);
 
-                if((gClipmapComputePipelineLayout != VK_NULL_HANDLE) && (gClipmapComputePipelines[attributeIndex] != VK_NULL_HANDLE))
-                {
                         ClipmapComputePushConstants pushConstants;
                         pushConstants.originSamples = levelResource->originInSamples;
                         pushConstants.textureOffset = levelResource->textureOffset;
                         pushConstants.levelIndex = levelIndex;
                         pushConstants.attributeIndex = attributeIndex;
+                        pushConstants.mipLevel = placement.mipLevel;
+                        pushConstants.windowTiles = gClipmapTileWindowTiles;
+                        pushConstants.firstTile = placement.firstTile;
+                        pushConstants.firstSlot = placement.firstSlot;
+                        pushConstants.slotModulus = placement.slotModulus;
+
+                        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, gClipmapComputePipelines[attributeIndex]);
+                        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, gClipmapComputePipelineLayout, 0, 1, &gClipmapComputeDescriptorSets[levelIndex][attributeIndex], 0, NULL);
+                        vkCmdPushConstants(commandBuffer, gClipmapComputePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClipmapComputePushConstants), &pushConstants);
+
+                        // Groups that stick out of a region rewrite texels that are
+                        // already current with the same values.
+                        for(uint32_t regionIndex = 0; regionIndex < regionCount; regionIndex++)
+                        {
+                                const ClipmapUpdateRegion& region = regions[regionIndex];
+                                uint32_t firstGroupX = region.x / groupSize;
+                                uint32_t firstGroupY = region.y / groupSize;
+                                uint32_t endGroupX = (region.x + region.width + groupSize - 1u) / groupSize;
+                                uint32_t endGroupY = (region.y + region.height + groupSize - 1u) / groupSize;
+                                vkCmdDispatchBase(commandBuffer, firstGroupX, firstGroupY, 0, endGroupX - firstGroupX, endGroupY - firstGroupY, 1);
+                        }
+                        windowRead = true;
+                }
 
-			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, gClipmapComputePipelines[attributeIndex]);
-			vkCmdPushConstants(commandBuffer, gClipmapComputePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClipmapComputePushConstants), &pushConstants);
-			vkCmdDispatchBase(commandBuffer, firstGroupX, firstGroupY, 0, groupCountX, groupCountY, 1);
-		}
+                EndClipmapImageWrite(frame, levelIndex, VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        }
 
-		InsertClipmapImageBarrier(commandBuffer, attributeResource->vkImage, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        levelResource->initialized = true;
+        frame.levelsRecorded++;
 
-		attributeResource->initialized = true;
+        // The ring bytes and the tile window are read when the frame executes;
+        // both are handed back when it retires.
+        if(update.staged && !frame.stagingAllocations.push_back(update.stagingAllocation))
+        {
+                return VK_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        if(windowRead)
+        {
+                if(!frame.windowLevels.push_back(levelIndex))
+                {
+                        return VK_ERROR_OUT_OF_HOST_MEMORY;
+                }
+                levelResource->windowInFlight = true;
         }
 
-        levelResource->initialized = true;
-        EndSingleTimeCommands(commandBuffer);
+#if CLIPMAP_BLOCKING_UPLOADS
+        return FlushClipmapUploads();
+#else
         return VK_SUCCESS;
+#endif
 }
 
 glm::ivec2 ComputeClipmapOriginForLevel(uint32_t levelIndex, const glm::ivec2& cameraSample)
@@ -2644,47 +8081,38 @@ VkResult UpdateClipmapLevels(const glm::vec3& cameraTarget)
         desiredCameraSample.x = (int)floorf(cameraSample.x);
         desiredCameraSample.y = (int)floorf(cameraSample.y);
 
-        glm::ivec2 sampleDelta = desiredCameraSample - gClipmapCameraSample;
-        if(glm::all(glm::lessThan(glm::abs(sampleDelta), glm::ivec2(gClipmapSampleUpdateThreshold))))
+        // Prefetching on the render thread would only move the stall, so it needs the worker.
+        if(gClipmapStreamingContext.workerThread != NULL)
         {
-                return VK_SUCCESS;
+                ScheduleClipmapPrefetch(cameraSample, gCameraVelocity);
         }
 
-        gClipmapCameraSample = desiredCameraSample;
-        gClipmapTileFrameCounter++;
-
-        for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+        uint32_t finestActiveLevel = ComputeClipmapFinestActiveLevel();
+        bool levelsActivated = finestActiveLevel < gClipmapFinestActiveLevel;
+        for(uint32_t levelIndex = gClipmapFinestActiveLevel; levelIndex < finestActiveLevel; levelIndex++)
         {
-                glm::ivec2 desiredOrigin = ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample);
-		ClipmapTileKeyVector requestedTiles[CLIPMAP_ATTRIBUTE_COUNT];
-		CollectVisibleTilesForLevel(levelIndex, desiredOrigin, requestedTiles);
-ClipmapLevelResource* levelResource = &gClipmapLevels[levelIndex];
-bool enqueueJob = false;
-{
-CRITICAL_SECTION* levelSection = &gClipmapLevelMutexes[levelIndex];
-EnterCriticalSection(levelSection);
-
-if(levelResource->initialized && (levelResource->originInSamples == desiredOrigin))
-{
-LeaveCriticalSection(levelSection);
-continue;
-}
+                CancelClipmapLevelRequest(levelIndex);
+        }
+        gClipmapFinestActiveLevel = finestActiveLevel;
 
-if(IsClipmapJobPending(levelResource))
-{
-LeaveCriticalSection(levelSection);
-continue;
-}
+        // Updates finished by the worker are applied even when the camera has not
+        // crossed the threshold this frame.
+        glm::ivec2 sampleDelta = desiredCameraSample - gClipmapCameraSample;
+        bool crossedThreshold = !glm::all(glm::lessThan(glm::abs(sampleDelta), glm::ivec2(gClipmapSampleUpdateThreshold)));
+        if(!crossedThreshold && !levelsActivated)
+        {
+                return ProcessCompletedClipmapJobs();
+        }
 
-SetClipmapJobPending(levelResource, true);
-enqueueJob = true;
-LeaveCriticalSection(levelSection);
-}
+        if(crossedThreshold)
+        {
+                gClipmapCameraSample = desiredCameraSample;
+                gClipmapTileFrameCounter++;
+        }
 
-		if(enqueueJob)
-		{
-			EnqueueClipmapStreamingJob(levelIndex, desiredOrigin);
-		}
+        for(uint32_t levelIndex = gClipmapFinestActiveLevel; levelIndex < gClipmapLevelCount; levelIndex++)
+        {
+                RequestClipmapLevelOrigin(levelIndex, ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample));
         }
 
         return ProcessCompletedClipmapJobs();
@@ -3128,6 +8556,7 @@ VkResult CreateClipmapMesh(void)
 VkResult InitializeClipmapResources(void)
 {
         InitializeClipmapSynchronization();
+        InitializeClipmapTaskPool(GetDefaultClipmapTaskWorkerCount());
 
         VkResult vkResult = LoadClipmapAttributeSources();
         if(vkResult != VK_SUCCESS)
@@ -3135,12 +8564,44 @@ VkResult InitializeClipmapResources(void)
                 return vkResult;
         }
 
+#if CLIPMAP_BENCHMARKS
+        // First, while the terrain file's pages are untouched by this process:
+        // the other two make tiles around the camera resident.
+        RunTileReaderBenchmark();
+        RunTaskPoolScalingBenchmark();
+        RunPrefetchFlightBenchmark();
+#endif
+
 	vkResult = CreateClipmapAttributeResources();
 	if(vkResult != VK_SUCCESS)
 	{
 		return vkResult;
 	}
 
+        vkResult = CreateClipmapTileWindows();
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+
+        vkResult = CreateClipmapComputePipelines();
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+
+        vkResult = CreateClipmapStagingRing();
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+
+        vkResult = CreateClipmapUploadFrames();
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+
 	vkResult = CreateClipmapMesh();
 	if(vkResult != VK_SUCCESS)
 	{
@@ -3152,48 +8613,69 @@ VkResult InitializeClipmapResources(void)
         gClipmapCameraSample.y = (int)floorf(cameraSample.y);
 
         gClipmapTileFrameCounter = 1u;
-        ClipmapUpdateRegionVector updateRegions;
-        updateRegions.reserve(8);
+        // The first population runs synchronously, before the worker owns the caches.
+        // Every level's tiles go through one residency pass so the task pool can
+        // load them all in parallel.
+        vkResult = PopulateAllClipmapLevelTiles(gClipmapCameraSample);
+        if(vkResult == VK_ERROR_OUT_OF_HOST_MEMORY)
+        {
+                // A budget below the initial working set is not fatal; the levels
+                // below load their own tiles one at a time.
+                fprintf(gFILE, "InitializeClipmapResources(): tile cache budget is below the initial working set, populating levels on demand\n");
+        }
+        else if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
 
         for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
         {
-		glm::ivec2 desiredOrigin = ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample);
-		ClipmapTileKeyVector requestedTiles[CLIPMAP_ATTRIBUTE_COUNT];
-		CollectVisibleTilesForLevel(levelIndex, desiredOrigin, requestedTiles);
+                glm::ivec2 desiredOrigin = ComputeClipmapOriginForLevel(levelIndex, gClipmapCameraSample);
                 CRITICAL_SECTION* levelSection = &gClipmapLevelMutexes[levelIndex];
                 EnterCriticalSection(levelSection);
-		updateRegions.clear();
-		ClipmapTileKeyVector tileBatch;
-		for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
-		{
-			tileBatch.append(requestedTiles[attributeIndex]);
-		}
-
-                vkResult = EnsureTileSetResident(tileBatch);
-                if(vkResult != VK_SUCCESS)
+                ClipmapLevelUpdate update;
+                memset((void*)&update, 0, sizeof(ClipmapLevelUpdate));
+                vkResult = PopulateClipmapLevelCpuData(levelIndex, desiredOrigin, update);
+                if(vkResult == VK_SUCCESS)
                 {
-                        LeaveCriticalSection(levelSection);
-                        return vkResult;
+                        vkResult = StageClipmapLevelUpdate(update);
                 }
-
-                EnforceTileBudgets(requestedTiles);
-                vkResult = PopulateClipmapLevelCpuData(levelIndex, desiredOrigin, updateRegions);
-                if(vkResult != VK_SUCCESS)
+                if(vkResult == VK_SUCCESS)
                 {
-                        LeaveCriticalSection(levelSection);
-                        return vkResult;
+                        ApplyClipmapLevelUpdate(update);
+                        vkResult = UploadClipmapLevelToGpu(levelIndex, update);
                 }
-
-                vkResult = UploadClipmapLevelToGpu(levelIndex, updateRegions);
+                if(!gClipmapLevels[levelIndex].windowInFlight)
+                {
+                        SetClipmapJobPending(&gClipmapLevels[levelIndex], false);
+                }
+                LeaveCriticalSection(levelSection);
                 if(vkResult != VK_SUCCESS)
                 {
-                        LeaveCriticalSection(levelSection);
                         return vkResult;
                 }
+        }
 
-                SetClipmapJobPending(&gClipmapLevels[levelIndex], false);
-                LeaveCriticalSection(levelSection);
-	}
+        // Every level goes up in one submission, finished before the first frame.
+        vkResult = FlushClipmapUploads();
+        if(vkResult != VK_SUCCESS)
+        {
+                return vkResult;
+        }
+
+        for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
+        {
+                const ClipmapAttributeSource& source = gClipmapAttributeSources[attributeIndex];
+                fprintf(gFILE, "InitializeClipmapResources(): %s loaded %llu tiles, %zu resident (%.2f MB)\n",
+                        gClipmapAttributeSpecs[attributeIndex].debugName,
+                        (unsigned long long)source.tilesLoaded,
+                        source.tileCacheCount,
+                        (double)source.residentBytes / (1024.0 * 1024.0));
+        }
+        fprintf(gFILE, "InitializeClipmapResources(): tile arena %u/%u blocks (high-water %u)\n",
+                gClipmapTileArena.usedBlocks,
+                gClipmapTileArena.blockCount,
+                gClipmapTileArena.highWaterBlocks);
 
 	return InitializeClipmapStreaming();
 }
@@ -3311,6 +8793,20 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpszCmdLi
         }
 
         InitializeCrashHandler();
+        ParseClipmapCommandLine(lpszCmdLine);
+
+        // Converter mode: write the terrain file and exit without opening a window.
+        if(gClipmapTerrainWritePath[0] != '\0')
+        {
+                InitializeClipmapTaskPool(GetDefaultClipmapTaskWorkerCount());
+                vkResult = WriteClipmapTerrainFile(gClipmapTerrainWritePath, gClipmapTerrainWriteSize);
+                ShutdownClipmapTaskPool();
+
+                fprintf(gFILE, "WinMain(): terrain file conversion %s\n", (vkResult == VK_SUCCESS) ? "succeeded" : "failed");
+                fclose(gFILE);
+                gFILE = NULL;
+                return (vkResult == VK_SUCCESS) ? 0 : 1;
+        }
 	
 	wsprintf(szAppName, TEXT("%s"), gpszAppName);
 
@@ -4293,7 +9789,7 @@ VkResult UpdateUniformBuffer(void)
 	glm::mat4 rotationMatrix = glm::toMat4(glm::conjugate(gCameraOrientation));
 	glm::mat4 translationMatrix = glm::translate(glm::mat4(1.0f), -gCameraPosition);
 	glm::mat4 viewMatrix = rotationMatrix * translationMatrix;
-	glm::mat4 projectionMatrix = glm::perspective(glm::radians(45.0f), (float)winWidth/(float)winHeight, 0.1f, 10000.0f);
+	glm::mat4 projectionMatrix = glm::perspective(gCameraFieldOfViewY, (float)winWidth/(float)winHeight, 0.1f, 10000.0f);
 	projectionMatrix[1][1] = projectionMatrix[1][1] * (-1.0f);
 	glm::mat4 viewProjectionMatrix = projectionMatrix * viewMatrix;
 
@@ -4311,7 +9807,7 @@ VkResult UpdateUniformBuffer(void)
                 float sampleSpacingWorld = gClipmapBaseWorldSpacing * (float)(1u << levelIndex);
                 glm::vec2 worldOrigin = glm::vec2((float)levelResource->originInSamples.x, (float)levelResource->originInSamples.y) * gClipmapBaseWorldSpacing;
 
-                clipmapUniformData.levels[levelIndex].worldOriginAndSpacing = glm::vec4(worldOrigin.x, worldOrigin.y, sampleSpacingWorld, 0.0f);
+                clipmapUniformData.levels[levelIndex].worldOriginAndSpacing = glm::vec4(worldOrigin.x, worldOrigin.y, sampleSpacingWorld, gClipmapHeightBias * gTerrainHeightScale);
 
                 float morphBand = gClipmapMorphBandThickness * sampleSpacingWorld;
                 float ringRadius = (float)gClipmapGridSize * 0.5f * sampleSpacingWorld;
@@ -4319,7 +9815,7 @@ VkResult UpdateUniformBuffer(void)
                 float morphStart = glm::max(ringRadius - morphBand, 0.0f);
                 float morphEnd = ringRadius;
 
-                clipmapUniformData.levels[levelIndex].textureInfo = glm::vec4(invTextureSize, gTerrainHeightScale, morphStart, morphEnd);
+                clipmapUniformData.levels[levelIndex].textureInfo = glm::vec4(invTextureSize, gClipmapHeightScale * gTerrainHeightScale, morphStart, morphEnd);
                 clipmapUniformData.levels[levelIndex].torusParams = glm::vec4(
                         (float)levelResource->textureOffset.x,
                         (float)levelResource->textureOffset.y,
@@ -4423,6 +9919,7 @@ VkResult display(void)
 	VkResult resize(int, int);
 	//31.6
 	VkResult UpdateUniformBuffer(void);
+	VkResult buildCommandBuffersForImages(uint32_t, uint32_t);
 	
 	//Variable declarations
 	VkResult vkResult = VK_SUCCESS;
@@ -4512,6 +10009,17 @@ VkResult display(void)
 		return vkResult;
 	}
 
+#if CLIPMAP_BENCHMARKS
+        LARGE_INTEGER streamingStart;
+        QueryPerformanceCounter(&streamingStart);
+#endif
+        vkResult = BeginClipmapUploadFrame(frameIndex);
+        if(vkResult != VK_SUCCESS)
+        {
+                fprintf(gFILE, "display(): BeginClipmapUploadFrame() failed with error code %d\n", vkResult);
+                return vkResult;
+        }
+
         vkResult = UpdateClipmapLevels(gCameraTarget);
 	if(vkResult != VK_SUCCESS)
 	{
@@ -4519,6 +10027,22 @@ VkResult display(void)
 		return vkResult;
 	}
 
+	// The fence wait above means this image's command buffer is idle and can
+	// be re-recorded when the set of drawable levels has changed.
+	gClipmapFinestDrawLevel = ComputeClipmapFinestDrawLevel();
+	if(gClipmapRecordedDrawLevels[currentImageIndex] != gClipmapFinestDrawLevel)
+	{
+		vkResult = buildCommandBuffersForImages(currentImageIndex, 1);
+		if(vkResult != VK_SUCCESS)
+		{
+			fprintf(gFILE, "display(): buildCommandBuffersForImages() failed with error code %d\n", vkResult);
+			return vkResult;
+		}
+	}
+#if CLIPMAP_BENCHMARKS
+        RecordClipmapFrameStats(streamingStart);
+#endif
+
 	vkResult = UpdateUniformBuffer();
 	if(vkResult != VK_SUCCESS)
 	{
@@ -4526,12 +10050,27 @@ VkResult display(void)
 		return vkResult;
 	}
 	
-	//One of the memebers of VkSubmitInfo structure requires array of pipeline stages. We have only one of completion of color attachment output.
-	//Still we need 1 member array.
+	//One of the memebers of VkSubmitInfo structure requires array of pipeline stages, one per wait semaphore:
+	//color attachment output for the swapchain image, and the clipmap sampling stages for this frame's uploads.
 	
 	//https://registry.khronos.org/vulkan/specs/latest/man/html/VkPipelineStageFlags.html
 	//https://registry.khronos.org/vulkan/specs/latest/man/html/VkPipelineStageFlagBits.html
-	const VkPipelineStageFlags waitDstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	// The clipmap uploads of this frame go in one submission ahead of the draw,
+	// which only waits for them where it samples the clipmaps.
+	VkSemaphore uploadSemaphore = VK_NULL_HANDLE;
+	VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+	vkResult = SubmitClipmapUploadFrame(true, &uploadSemaphore, &acquireCommandBuffer);
+	if(vkResult != VK_SUCCESS)
+	{
+		fprintf(gFILE, "display(): SubmitClipmapUploadFrame() failed with error code %d\n", vkResult);
+		return vkResult;
+	}
+
+	VkSemaphore submitWaitSemaphores[2] = { waitSemaphores[0], uploadSemaphore };
+	const VkPipelineStageFlags waitDstStageMask[2] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, gClipmapSampleStages };
+	// With a separate streaming queue the clipmap images are acquired back ahead of the draw.
+	VkCommandBuffer submitCommandBuffers[2] = { acquireCommandBuffer, vkCommandBuffer_array[currentImageIndex] };
+	uint32_t firstSubmitCommandBuffer = (acquireCommandBuffer != VK_NULL_HANDLE) ? 0u : 1u;
 		
 	// https://registry.khronos.org/vulkan/specs/latest/man/html/VkSubmitInfo.html
 	// Declare, memset and initialize VkSubmitInfo structure
@@ -4539,11 +10078,11 @@ VkResult display(void)
 	memset((void*)&vkSubmitInfo, 0, sizeof(VkSubmitInfo));
 	vkSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	vkSubmitInfo.pNext = NULL;
-	vkSubmitInfo.pWaitDstStageMask = &waitDstStageMask;
-	vkSubmitInfo.waitSemaphoreCount = 1;
-	vkSubmitInfo.pWaitSemaphores = waitSemaphores;
-	vkSubmitInfo.commandBufferCount = 1;
-	vkSubmitInfo.pCommandBuffers = &vkCommandBuffer_array[currentImageIndex];
+	vkSubmitInfo.pWaitDstStageMask = waitDstStageMask;
+	vkSubmitInfo.waitSemaphoreCount = (uploadSemaphore != VK_NULL_HANDLE) ? 2 : 1;
+	vkSubmitInfo.pWaitSemaphores = submitWaitSemaphores;
+	vkSubmitInfo.commandBufferCount = 2u - firstSubmitCommandBuffer;
+	vkSubmitInfo.pCommandBuffers = &submitCommandBuffers[firstSubmitCommandBuffer];
 	vkSubmitInfo.signalSemaphoreCount = 1;
 	vkSubmitInfo.pSignalSemaphores = signalSemaphores;
 	
@@ -4671,10 +10210,13 @@ void update(void)
                 UpdateCameraOrbitTransform();
         }
 
+        glm::vec3 previousTarget = gCameraTarget;
         if (glm::length(movement) > 0.0f)
         {
                 MoveCameraAlongLocalAxis(movement);
         }
+
+        gCameraVelocity = (deltaSeconds > 0.0f) ? (gCameraTarget - previousTarget) / deltaSeconds : glm::vec3(0.0f);
 }
 
 /*
@@ -6248,6 +11790,42 @@ VkResult FillDeviceExtensionNames(void)
 	return vkResult;
 }
 
+// A queue family with compute but no graphics: it runs both the strip copies
+// and the fill shader next to the graphics queue. Transfer-only families are
+// passed over since they cannot run the fill shader and may not copy
+// arbitrary strips (minImageTransferGranularity). Falls back to the graphics
+// family.
+static uint32_t SelectClipmapStreamQueueFamily(void)
+{
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(vkPhysicalDevice_selected, &queueFamilyCount, NULL);
+	if (queueFamilyCount == 0)
+	{
+		return graphicsQuequeFamilyIndex_selected;
+	}
+
+	VkQueueFamilyProperties* vkQueueFamilyProperties_array = (VkQueueFamilyProperties*)malloc(sizeof(VkQueueFamilyProperties) * queueFamilyCount);
+	if (vkQueueFamilyProperties_array == NULL)
+	{
+		return graphicsQuequeFamilyIndex_selected;
+	}
+	vkGetPhysicalDeviceQueueFamilyProperties(vkPhysicalDevice_selected, &queueFamilyCount, vkQueueFamilyProperties_array);
+
+	uint32_t selected = graphicsQuequeFamilyIndex_selected;
+	for (uint32_t i = 0; i < queueFamilyCount; i++)
+	{
+		VkQueueFlags flags = vkQueueFamilyProperties_array[i].queueFlags;
+		if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) && vkQueueFamilyProperties_array[i].queueCount > 0)
+		{
+			selected = i;
+			break;
+		}
+	}
+
+	free(vkQueueFamilyProperties_array);
+	return selected;
+}
+
 VkResult CreateVulKanDevice(void)
 {
 	//function declaration
@@ -6277,15 +11855,30 @@ VkResult CreateVulKanDevice(void)
 	//float queuePriorities[1]  = {1.0};
 	float queuePriorities[1];
 	queuePriorities[0] = 1.0f;
-	VkDeviceQueueCreateInfo vkDeviceQueueCreateInfo; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkDeviceQueueCreateInfo.html
-	memset(&vkDeviceQueueCreateInfo, 0, sizeof(VkDeviceQueueCreateInfo));
-	
-	vkDeviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	vkDeviceQueueCreateInfo.pNext = NULL;
-	vkDeviceQueueCreateInfo.flags = 0;
-	vkDeviceQueueCreateInfo.queueFamilyIndex = graphicsQuequeFamilyIndex_selected;
-	vkDeviceQueueCreateInfo.queueCount = 1;
-	vkDeviceQueueCreateInfo.pQueuePriorities = queuePriorities;
+	VkDeviceQueueCreateInfo vkDeviceQueueCreateInfo_array[2]; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkDeviceQueueCreateInfo.html
+	memset((void*)vkDeviceQueueCreateInfo_array, 0, sizeof(vkDeviceQueueCreateInfo_array));
+	
+	vkDeviceQueueCreateInfo_array[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	vkDeviceQueueCreateInfo_array[0].pNext = NULL;
+	vkDeviceQueueCreateInfo_array[0].flags = 0;
+	vkDeviceQueueCreateInfo_array[0].queueFamilyIndex = graphicsQuequeFamilyIndex_selected;
+	vkDeviceQueueCreateInfo_array[0].queueCount = 1;
+	vkDeviceQueueCreateInfo_array[0].pQueuePriorities = queuePriorities;
+	uint32_t queueCreateInfoCount = 1;
+
+	// Clipmap streaming gets a queue of its own family when there is one.
+	gClipmapStreamQueueFamilyIndex = SelectClipmapStreamQueueFamily();
+	if (gClipmapStreamQueueFamilyIndex != graphicsQuequeFamilyIndex_selected)
+	{
+		vkDeviceQueueCreateInfo_array[1] = vkDeviceQueueCreateInfo_array[0];
+		vkDeviceQueueCreateInfo_array[1].queueFamilyIndex = gClipmapStreamQueueFamilyIndex;
+		queueCreateInfoCount = 2;
+		fprintf(gFILE, "CreateVulKanDevice(): clipmap streaming uses async compute queue family %u\n", gClipmapStreamQueueFamilyIndex);
+	}
+	else
+	{
+		fprintf(gFILE, "CreateVulKanDevice(): no async compute queue family, clipmap streaming uses the graphics queue\n");
+	}
 	
 	/*
 	3. Declare and initialize VkDeviceCreateInfo structure (https://registry.khronos.org/vulkan/specs/latest/man/html/VkDeviceCreateInfo.html).
@@ -6314,6 +11907,13 @@ VkResult CreateVulKanDevice(void)
                 fprintf(gFILE, "CreateVulKanDevice(): tessellationShader feature is not supported; terrain pipeline requires it.\n");
         }
 
+        // The clipmap fill shader writes R16_UNORM heights, which is not a core storage format.
+        if (vkPhysicalDeviceFeatures_supported.shaderStorageImageExtendedFormats)
+        {
+                vkPhysicalDeviceFeatures_enabled.shaderStorageImageExtendedFormats = VK_TRUE;
+                gClipmapStorageImageExtendedFormats = true;
+        }
+
         VkDeviceCreateInfo vkDeviceCreateInfo;
         memset(&vkDeviceCreateInfo, 0, sizeof(VkDeviceCreateInfo));
 	
@@ -6328,8 +11928,8 @@ VkResult CreateVulKanDevice(void)
 	vkDeviceCreateInfo.enabledLayerCount = 0;
 	vkDeviceCreateInfo.ppEnabledLayerNames = NULL;
         vkDeviceCreateInfo.pEnabledFeatures = &vkPhysicalDeviceFeatures_enabled;
-	vkDeviceCreateInfo.queueCreateInfoCount = 1;
-	vkDeviceCreateInfo.pQueueCreateInfos = &vkDeviceQueueCreateInfo;
+	vkDeviceCreateInfo.queueCreateInfoCount = queueCreateInfoCount;
+	vkDeviceCreateInfo.pQueueCreateInfos = vkDeviceQueueCreateInfo_array;
 	
 	/*
 	5. Now call vkCreateDevice to create actual Vulkan device and do error checking.
@@ -6361,6 +11961,18 @@ void GetDeviceQueque(void)
 	{
 		fprintf(gFILE, "GetDeviceQueque(): vkGetDeviceQueue() succedded\n");
 	}
+
+	gClipmapStreamQueue = vkQueue;
+	if(gClipmapStreamQueueFamilyIndex != graphicsQuequeFamilyIndex_selected)
+	{
+		vkGetDeviceQueue(vkDevice, gClipmapStreamQueueFamilyIndex, 0, &gClipmapStreamQueue);
+		if(gClipmapStreamQueue == VK_NULL_HANDLE)
+		{
+			fprintf(gFILE, "GetDeviceQueque(): vkGetDeviceQueue() returned NULL for the clipmap streaming queue, streaming on the graphics queue\n");
+			gClipmapStreamQueueFamilyIndex = graphicsQuequeFamilyIndex_selected;
+			gClipmapStreamQueue = vkQueue;
+		}
+	}
 }
 
 VkResult getPhysicalDeviceSurfaceFormatAndColorSpace(void)
@@ -7629,7 +13241,7 @@ VkResult CreateDescriptorSetLayout()
 
 	vkDescriptorSetLayoutBinding_array[1].binding = 1;
 	vkDescriptorSetLayoutBinding_array[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	vkDescriptorSetLayoutBinding_array[1].descriptorCount = gClipmapLevelCount;
+	vkDescriptorSetLayoutBinding_array[1].descriptorCount = 1;
     vkDescriptorSetLayoutBinding_array[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
             VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT |
             VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT |
@@ -7638,13 +13250,13 @@ VkResult CreateDescriptorSetLayout()
 
 	vkDescriptorSetLayoutBinding_array[2].binding = 2;
 	vkDescriptorSetLayoutBinding_array[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	vkDescriptorSetLayoutBinding_array[2].descriptorCount = gClipmapLevelCount;
+	vkDescriptorSetLayoutBinding_array[2].descriptorCount = 1;
 	vkDescriptorSetLayoutBinding_array[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	vkDescriptorSetLayoutBinding_array[2].pImmutableSamplers = NULL;
 
 	vkDescriptorSetLayoutBinding_array[3].binding = 3;
 	vkDescriptorSetLayoutBinding_array[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	vkDescriptorSetLayoutBinding_array[3].descriptorCount = gClipmapLevelCount;
+	vkDescriptorSetLayoutBinding_array[3].descriptorCount = 1;
 	vkDescriptorSetLayoutBinding_array[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	vkDescriptorSetLayoutBinding_array[3].pImmutableSamplers = NULL;
 	
@@ -7803,7 +13415,7 @@ VkResult CreateDescriptorPool(void)
 	vkDescriptorPoolSize_array[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER; //https://registry.khronos.org/vulkan/specs/latest/man/html/VkDescriptorType.html
 	vkDescriptorPoolSize_array[0].descriptorCount = 1;
 	vkDescriptorPoolSize_array[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	vkDescriptorPoolSize_array[1].descriptorCount = gClipmapLevelCount * 3;
+	vkDescriptorPoolSize_array[1].descriptorCount = CLIPMAP_ATTRIBUTE_COUNT;
 	
 	/*
 	//Create the pool
@@ -7927,31 +13539,14 @@ VkResult CreateDescriptorSet(void)
 	vkDescriptorBufferInfo.offset = 0;
 	vkDescriptorBufferInfo.range = sizeof(struct ClipmapUniformData);
 
-	ClipmapVector<VkDescriptorImageInfo> heightImageInfos;
-	ClipmapVector<VkDescriptorImageInfo> diffuseImageInfos;
-	ClipmapVector<VkDescriptorImageInfo> normalImageInfos;
-	if(!heightImageInfos.resize(gClipmapLevelCount) ||
-	   !diffuseImageInfos.resize(gClipmapLevelCount) ||
-	   !normalImageInfos.resize(gClipmapLevelCount))
-	{
-		return VK_ERROR_OUT_OF_HOST_MEMORY;
-	}
-	for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+	// One array view per attribute; the shaders pick the level by layer.
+	VkDescriptorImageInfo vkDescriptorImageInfo_array[CLIPMAP_ATTRIBUTE_COUNT];
+	memset((void*)vkDescriptorImageInfo_array, 0, sizeof(vkDescriptorImageInfo_array));
+	for(uint32_t attributeIndex = 0; attributeIndex < CLIPMAP_ATTRIBUTE_COUNT; attributeIndex++)
 	{
-		const ClipmapAttributeResource& heightAttr = gClipmapLevels[levelIndex].attributes[CLIPMAP_ATTRIBUTE_HEIGHT];
-		heightImageInfos[levelIndex].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		heightImageInfos[levelIndex].imageView = heightAttr.vkImageView;
-		heightImageInfos[levelIndex].sampler = heightAttr.vkSampler;
-
-		const ClipmapAttributeResource& diffuseAttr = gClipmapLevels[levelIndex].attributes[CLIPMAP_ATTRIBUTE_DIFFUSE];
-		diffuseImageInfos[levelIndex].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		diffuseImageInfos[levelIndex].imageView = diffuseAttr.vkImageView;
-		diffuseImageInfos[levelIndex].sampler = diffuseAttr.vkSampler;
-
-		const ClipmapAttributeResource& normalAttr = gClipmapLevels[levelIndex].attributes[CLIPMAP_ATTRIBUTE_NORMAL];
-		normalImageInfos[levelIndex].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		normalImageInfos[levelIndex].imageView = normalAttr.vkImageView;
-		normalImageInfos[levelIndex].sampler = normalAttr.vkSampler;
+		vkDescriptorImageInfo_array[attributeIndex].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		vkDescriptorImageInfo_array[attributeIndex].imageView = gClipmapAttributeArrays[attributeIndex].vkImageView;
+		vkDescriptorImageInfo_array[attributeIndex].sampler = gClipmapSampler;
 	}
 	
 	/*
@@ -7989,25 +13584,25 @@ VkResult CreateDescriptorSet(void)
 	vkWriteDescriptorSet_array[1].dstSet = vkDescriptorSet;
 	vkWriteDescriptorSet_array[1].dstBinding = 1;
 	vkWriteDescriptorSet_array[1].dstArrayElement = 0;
-	vkWriteDescriptorSet_array[1].descriptorCount = gClipmapLevelCount;
+	vkWriteDescriptorSet_array[1].descriptorCount = 1;
 	vkWriteDescriptorSet_array[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	vkWriteDescriptorSet_array[1].pImageInfo = heightImageInfos.data();
+	vkWriteDescriptorSet_array[1].pImageInfo = &vkDescriptorImageInfo_array[CLIPMAP_ATTRIBUTE_HEIGHT];
 
 	vkWriteDescriptorSet_array[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	vkWriteDescriptorSet_array[2].dstSet = vkDescriptorSet;
 	vkWriteDescriptorSet_array[2].dstBinding = 2;
 	vkWriteDescriptorSet_array[2].dstArrayElement = 0;
-	vkWriteDescriptorSet_array[2].descriptorCount = gClipmapLevelCount;
+	vkWriteDescriptorSet_array[2].descriptorCount = 1;
 	vkWriteDescriptorSet_array[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        vkWriteDescriptorSet_array[2].pImageInfo = diffuseImageInfos.data();
+        vkWriteDescriptorSet_array[2].pImageInfo = &vkDescriptorImageInfo_array[CLIPMAP_ATTRIBUTE_DIFFUSE];
 
 	vkWriteDescriptorSet_array[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	vkWriteDescriptorSet_array[3].dstSet = vkDescriptorSet;
 	vkWriteDescriptorSet_array[3].dstBinding = 3;
 	vkWriteDescriptorSet_array[3].dstArrayElement = 0;
-	vkWriteDescriptorSet_array[3].descriptorCount = gClipmapLevelCount;
+	vkWriteDescriptorSet_array[3].descriptorCount = 1;
 	vkWriteDescriptorSet_array[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        vkWriteDescriptorSet_array[3].pImageInfo = normalImageInfos.data();
+        vkWriteDescriptorSet_array[3].pImageInfo = &vkDescriptorImageInfo_array[CLIPMAP_ATTRIBUTE_NORMAL];
 	
 	/*
 	//https://registry.khronos.org/vulkan/specs/latest/man/html/vkUpdateDescriptorSets.html
@@ -9119,6 +14714,15 @@ VkResult CreateFences(void)
 }
 
 VkResult buildCommandBuffers(void)
+{
+	VkResult buildCommandBuffersForImages(uint32_t, uint32_t);
+
+	return buildCommandBuffersForImages(0, swapchainImageCount);
+}
+
+// Records the command buffers of swapchain images [firstImageIndex, firstImageIndex + imageCount).
+// The caller makes sure none of them is still in flight.
+VkResult buildCommandBuffersForImages(uint32_t firstImageIndex, uint32_t imageCount)
 {
 	//Variable declarations	
 	VkResult vkResult = VK_SUCCESS;
@@ -9126,12 +14730,17 @@ VkResult buildCommandBuffers(void)
 	/*
 	Code
 	*/
+	if(gClipmapRecordedDrawLevels.size() != swapchainImageCount && !gClipmapRecordedDrawLevels.resize(swapchainImageCount))
+	{
+		fprintf(gFILE, "buildCommandBuffers(): failed to allocate recorded draw levels\n");
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
 	
 	/*
 	1. Start a loop with swapchainImageCount as counter.
 	   loop per swapchainImage
 	*/
-	for(uint32_t i =0; i< swapchainImageCount; i++)
+	for(uint32_t i = firstImageIndex; i < firstImageIndex + imageCount; i++)
 	{
 		/*
 		2. Inside loop, call vkResetCommandBuffer to reset contents of command buffers.
@@ -9290,7 +14899,10 @@ VkResult buildCommandBuffers(void)
 		Here we should call Vulkan drawing functions.
 		*/
 		
-		for(uint32_t levelIndex = 0; levelIndex < gClipmapLevelCount; levelIndex++)
+		// Levels finer than gClipmapFinestDrawLevel are left out and the finest
+		// drawn level fills the centre hole itself.
+		gClipmapRecordedDrawLevels[i] = gClipmapFinestDrawLevel;
+		for(uint32_t levelIndex = gClipmapFinestDrawLevel; levelIndex < gClipmapLevelCount; levelIndex++)
 		{
 			for(const ClipmapMeshSection& section : gClipmapMeshSections)
 			{
@@ -9299,7 +14911,7 @@ VkResult buildCommandBuffers(void)
 					continue;
 				}
 
-				if(section.patchType == CLIPMAP_PATCH_FILLER && levelIndex != 0)
+				if(section.patchType == CLIPMAP_PATCH_FILLER && levelIndex != gClipmapFinestDrawLevel)
 				{
 					continue;
 				}